@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __M2D_ASSET_H__
+#define __M2D_ASSET_H__
+/**
+ * @file
+ * @brief Microchip 2D API: pre-converted asset packs
+ *
+ * An asset pack is a file holding surfaces already in their GPU pixel
+ * format, stride and premultiplied alpha, small images being packed into atlas
+ * pages, along with an index of image names. Packs are built offline, by the
+ * m2d-pack tool for instance, and loaded at runtime without any decoding:
+ * surface pixels are read straight into the GPU buffers.
+ *
+ * Packs are stored in little-endian byte order, whatever the host byte order.
+ */
+
+#include <m2d/atlas.h>
+#include <m2d/image.h>
+#include <m2d/m2d.h>
+
+#ifdef __cplusplus
+extern "C"  {
+#endif
+
+/**
+ * Flags for @m2d_asset_writer_create() and @m2d_asset_writer_add().
+ *
+ * M2D_ASSET_RLE: run-length encode surfaces, when this makes them smaller.
+ *                Images added with this flag are only packed with other
+ *                images having it.
+ * M2D_ASSET_STANDALONE: store the image in its own surface, instead of packing
+ *                       it into an atlas page. Typically for backgrounds.
+ */
+enum m2d_asset_flags
+{
+	M2D_ASSET_RLE = 1 << 0,
+	M2D_ASSET_STANDALONE = 1 << 1,
+};
+
+/**
+ * An asset pack opened for loading.
+ */
+struct m2d_asset_pack;
+
+/**
+ * Open an asset pack.
+ *
+ * Only the index is read: surfaces are loaded when first used, or by
+ * @m2d_asset_pack_load().
+ *
+ * @param[in] filename The path of the asset pack.
+ * @return a pointer to the new 'struct m2d_asset_pack', NULL otherwise.
+ */
+struct m2d_asset_pack* m2d_asset_pack_open(const char* filename);
+
+/**
+ * Close an asset pack and release all its surfaces.
+ *
+ * @param[in] pack The asset pack to close.
+ */
+void m2d_asset_pack_close(struct m2d_asset_pack* pack);
+
+/**
+ * Load all the surfaces of an asset pack now.
+ *
+ * @param[in] pack A pointer to a 'struct m2d_asset_pack'.
+ * @return 0 if successfull, -1 otherwise.
+ */
+int m2d_asset_pack_load(struct m2d_asset_pack* pack);
+
+/**
+ * Get the number of images in an asset pack.
+ *
+ * @param[in] pack A pointer to a 'const struct m2d_asset_pack'.
+ * @return the number of images.
+ */
+size_t m2d_asset_pack_num_images(const struct m2d_asset_pack* pack);
+
+/**
+ * Get the name of an image, images being sorted by name.
+ *
+ * @param[in] pack A pointer to a 'const struct m2d_asset_pack'.
+ * @param[in] index The index of the image, lower than
+ *                  @m2d_asset_pack_num_images().
+ * @return the image name, NULL if @index is out of range.
+ */
+const char* m2d_asset_pack_image_name(const struct m2d_asset_pack* pack, size_t index);
+
+/**
+ * Get an image of an asset pack, loading its surface if needed.
+ *
+ * The surface is owned by the pack: it must not be released.
+ *
+ * @param[in] pack A pointer to a 'struct m2d_asset_pack'.
+ * @param[in] name The name of the image.
+ * @param[out] image The surface and the rectangle holding the image pixels.
+ * @return 0 if successfull, -1 otherwise.
+ */
+int m2d_asset_pack_get(struct m2d_asset_pack* pack, const char* name,
+                       struct m2d_atlas_image* image);
+
+/**
+ * Build asset packs. This runs on the CPU only, hence doesn't need
+ * @m2d_init().
+ */
+struct m2d_asset_writer;
+
+/**
+ * Create an asset pack writer.
+ *
+ * @param[in] page_width The width in pixels of the atlas pages.
+ * @param[in] page_height The height in pixels of the atlas pages.
+ * @param[in] flags A combination of 'enum m2d_asset_flags' applying to the
+ *                  whole pack.
+ * @return a pointer to the new 'struct m2d_asset_writer', NULL otherwise.
+ */
+struct m2d_asset_writer* m2d_asset_writer_create(size_t page_width, size_t page_height,
+                                                 unsigned int flags);
+
+/**
+ * Release an asset pack writer.
+ *
+ * @param[in] writer The writer to release.
+ */
+void m2d_asset_writer_destroy(struct m2d_asset_writer* writer);
+
+/**
+ * Add an image to the pack. The pixels are copied.
+ *
+ * Images are packed with the other images of the same pixel format, unless
+ * they don't fit in a page or M2D_ASSET_STANDALONE is set.
+ *
+ * @param[in] writer A pointer to a 'struct m2d_asset_writer'.
+ * @param[in] name The unique name of the image.
+ * @param[in] image The image, decoded by @m2d_decode_image() for instance.
+ * @param[in] flags A combination of 'enum m2d_asset_flags' applying to this
+ *                  image.
+ * @return 0 if successfull, -1 otherwise.
+ */
+int m2d_asset_writer_add(struct m2d_asset_writer* writer, const char* name,
+                         const struct m2d_image* image, unsigned int flags);
+
+/**
+ * Write the asset pack.
+ *
+ * @param[in] writer A pointer to a 'struct m2d_asset_writer'.
+ * @param[in] filename The path of the asset pack to create.
+ * @return 0 if successfull, -1 otherwise.
+ */
+int m2d_asset_writer_save(struct m2d_asset_writer* writer, const char* filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
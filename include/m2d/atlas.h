@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __M2D_ATLAS_H__
+#define __M2D_ATLAS_H__
+/**
+ * @file
+ * @brief Microchip 2D API: texture atlases
+ */
+
+#include <m2d/m2d.h>
+
+#ifdef __cplusplus
+extern "C"  {
+#endif
+
+/**
+ * A skyline rectangle packer.
+ *
+ * It only computes positions: it doesn't own any memory region, hence it can
+ * be used to lay out surfaces offline as well.
+ */
+struct m2d_packer;
+
+/**
+ * Create a packer for a bin of @width x @height pixels.
+ *
+ * @param[in] width The width in pixels of the bin.
+ * @param[in] height The height in pixels of the bin.
+ * @return a pointer to the new 'struct m2d_packer', NULL otherwise.
+ */
+struct m2d_packer* m2d_packer_create(size_t width, size_t height);
+
+/**
+ * Release a packer created with @m2d_packer_create().
+ *
+ * @param[in] packer The packer to release.
+ */
+void m2d_packer_destroy(struct m2d_packer* packer);
+
+/**
+ * Forget every rectangle packed so far.
+ *
+ * @param[in] packer A pointer to a 'struct m2d_packer'.
+ */
+void m2d_packer_reset(struct m2d_packer* packer);
+
+/**
+ * Find a place for a @width x @height rectangle in the bin.
+ *
+ * @param[in] packer A pointer to a 'struct m2d_packer'.
+ * @param[in] width The width in pixels of the rectangle to pack.
+ * @param[in] height The height in pixels of the rectangle to pack.
+ * @param[out] x The x coordinate of the rectangle origin in the bin.
+ * @param[out] y The y coordinate of the rectangle origin in the bin.
+ * @return true if the rectangle has been packed, false if it doesn't fit.
+ */
+bool m2d_packer_add(struct m2d_packer* packer, size_t width, size_t height,
+                    dim_t* x, dim_t* y);
+
+/**
+ * A texture atlas: small images packed into a few shared pages.
+ */
+struct m2d_atlas;
+
+/**
+ * An image stored in an atlas.
+ *
+ * page: the atlas page holding the image pixels.
+ * rect: where the image pixels are located in the page.
+ */
+struct m2d_atlas_image {
+	struct m2d_buffer* page;
+	struct m2d_rectangle rect;
+};
+
+/**
+ * Create an atlas whose pages are allocated on demand.
+ *
+ * @param[in] page_width The width in pixels of each page.
+ * @param[in] page_height The height in pixels of each page.
+ * @param[in] format The pixel format of the pages (typically M2D_PF_ARGB8888
+ *                   or M2D_PF_A8).
+ * @return a pointer to the new 'struct m2d_atlas', NULL otherwise.
+ */
+struct m2d_atlas* m2d_atlas_create(size_t page_width, size_t page_height,
+                                   enum m2d_pixel_format format);
+
+/**
+ * Release an atlas and all its pages.
+ *
+ * @param[in] atlas The atlas to release.
+ */
+void m2d_atlas_destroy(struct m2d_atlas* atlas);
+
+/**
+ * Reserve room for a @width x @height image in the atlas.
+ *
+ * The caller is expected to write the image pixels itself, either from the
+ * CPU through @m2d_get_data() on the page or with the GPU.
+ *
+ * @param[in] atlas A pointer to a 'struct m2d_atlas'.
+ * @param[in] width The width in pixels of the image.
+ * @param[in] height The height in pixels of the image.
+ * @param[out] image Where the image has been placed.
+ * @return 0 if successfull, -1 otherwise.
+ */
+int m2d_atlas_reserve(struct m2d_atlas* atlas, size_t width, size_t height,
+                      struct m2d_atlas_image* image);
+
+/**
+ * Copy the whole @buf surface into the atlas with the GPU.
+ *
+ * @buf is no longer needed once this function returns, hence can be released
+ * with @m2d_free(). The renderer state is preserved.
+ *
+ * @param[in] atlas A pointer to a 'struct m2d_atlas'.
+ * @param[in] buf The surface to copy into the atlas.
+ * @param[out] image Where the image has been placed.
+ * @return 0 if successfull, -1 otherwise.
+ */
+int m2d_atlas_add(struct m2d_atlas* atlas, struct m2d_buffer* buf,
+                  struct m2d_atlas_image* image);
+
+/**
+ * Get the number of pages currently allocated by the atlas.
+ *
+ * @param[in] atlas A pointer to a 'const struct m2d_atlas'.
+ * @return the number of pages.
+ */
+size_t m2d_atlas_num_pages(const struct m2d_atlas* atlas);
+
+/**
+ * Get a page of the atlas.
+ *
+ * @param[in] atlas A pointer to a 'const struct m2d_atlas'.
+ * @param[in] index The index of the page, lower than @m2d_atlas_num_pages().
+ * @return the page surface, NULL if @index is out of range.
+ */
+struct m2d_buffer* m2d_atlas_page(const struct m2d_atlas* atlas, size_t index);
+
+/**
+ * A sprite for @m2d_draw_sprites(): @image drawn at point (@x, @y) in the
+ * target surface space.
+ */
+struct m2d_sprite {
+	const struct m2d_atlas_image* image;
+	dim_t x;
+	dim_t y;
+};
+
+/**
+ * Draw sprites according to the current renderer state, @M2D_SRC being
+ * replaced by the sprite images.
+ * This is asynchronous (non-blocking).
+ *
+ * Sprites sharing the same page and the same source origin are grouped into a
+ * single GPU command, as long as it doesn't change the result of overlapping
+ * sprites. The renderer state is preserved.
+ *
+ * @param[in] sprites The array of sprites to draw, in back-to-front order.
+ * @param[in] num_sprites The number of sprites in the 'sprites' array.
+ */
+void m2d_draw_sprites(const struct m2d_sprite* sprites, size_t num_sprites);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __M2D_CACHE_H__
+#define __M2D_CACHE_H__
+/**
+ * @file
+ * @brief Microchip 2D API: image cache
+ */
+
+#include <m2d/image.h>
+#include <m2d/m2d.h>
+
+#ifdef __cplusplus
+extern "C"  {
+#endif
+
+/**
+ * Load an image through the library image cache.
+ *
+ * Images are looked up by path, then by content: the same file loaded twice,
+ * or two files with the same content, share a single surface as long as the
+ * options are the same. A file modified since it has been cached is loaded
+ * again.
+ *
+ * Surfaces are reference counted: release them with @m2d_free() as usual.
+ * Released surfaces stay cached until they are evicted, least recently used
+ * first, when the cache budget or the memory budget is exceeded. Evicted
+ * images are loaded again by the next call.
+ *
+ * @param[in] filename The path of the image file.
+ * @param[in] options The decoding options, NULL to create an ARGB8888 surface
+ *                    at the image size.
+ * @return a pointer to the 'struct m2d_buffer', NULL otherwise.
+ */
+struct m2d_buffer* m2d_cache_load(const char* filename,
+                                  const struct m2d_image_options* options);
+
+/**
+ * Set the maximum size in bytes of the cached surfaces, whether they are in
+ * use or not. Released surfaces are evicted to stay below.
+ *
+ * @param[in] budget The budget in bytes, 0 for no limit other than the memory
+ *                   budget set by @m2d_set_memory_budget().
+ */
+void m2d_cache_set_budget(size_t budget);
+
+/**
+ * Evict every surface not in use.
+ */
+void m2d_cache_trim();
+
+/**
+ * Image cache statistics.
+ */
+struct m2d_cache_stats
+{
+	/**
+	 * The number of loads found by path.
+	 */
+	size_t hits;
+
+	/**
+	 * The number of loads found by content, under another path.
+	 */
+	size_t content_hits;
+
+	/**
+	 * The number of loads which decoded the image.
+	 */
+	size_t misses;
+
+	/**
+	 * The number of surfaces evicted.
+	 */
+	size_t evictions;
+
+	/**
+	 * The number of cached images, and the size in bytes of their surfaces.
+	 */
+	size_t num_images;
+	size_t bytes;
+
+	/**
+	 * The size in bytes of the surfaces not in use, which can be evicted.
+	 */
+	size_t unused_bytes;
+};
+
+/**
+ * Get the image cache statistics.
+ *
+ * @param[out] stats A pointer to a 'struct m2d_cache_stats'.
+ */
+void m2d_cache_get_stats(struct m2d_cache_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
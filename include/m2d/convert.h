@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __M2D_CONVERT_H__
+#define __M2D_CONVERT_H__
+/**
+ * @file
+ * @brief Microchip 2D API: pixel format conversions
+ */
+
+#include <m2d/m2d.h>
+
+#ifdef __cplusplus
+extern "C"  {
+#endif
+
+/**
+ * Conversion flags.
+ */
+enum m2d_convert_flags
+{
+	/**
+	 * Ordered dithering when converting ARGB8888 to RGB565, to hide the
+	 * banding of gradients. Ignored for the other conversions.
+	 */
+	M2D_CONVERT_DITHER = 1 << 0,
+};
+
+/**
+ * Convert pixels between libm2d formats, in CPU memory.
+ *
+ * ARGB8888 pixels are premultiplied. RGB565 has no alpha channel: ARGB8888
+ * pixels are composited over black, RGB565 pixels are opaque. A8 pixels are
+ * white, with the value as coverage.
+ *
+ * @dst may be @src when the pixels don't grow and the stride doesn't either,
+ * the conversion being done in place. Otherwise @dst must not overlap @src.
+ *
+ * @param[out] dst The destination pixels.
+ * @param[in] dst_stride The destination stride in bytes.
+ * @param[in] dst_format The destination pixel format.
+ * @param[in] src The source pixels.
+ * @param[in] src_stride The source stride in bytes.
+ * @param[in] src_format The source pixel format.
+ * @param[in] width The width in pixels.
+ * @param[in] height The height in pixels.
+ * @param[in] flags A mask of @m2d_convert_flags.
+ * @return 0 on success, -1 on unsupported format or overlapping pixels.
+ */
+int m2d_convert(void* dst, size_t dst_stride, enum m2d_pixel_format dst_format,
+                const void* src, size_t src_stride, enum m2d_pixel_format src_format,
+                size_t width, size_t height, unsigned int flags);
+
+/**
+ * Premultiply straight alpha ARGB8888 pixels. @dst may be @src.
+ *
+ * @param[out] dst The premultiplied pixels.
+ * @param[in] src The straight alpha pixels.
+ * @param[in] count The number of pixels.
+ */
+void m2d_premultiply(uint32_t* dst, const uint32_t* src, size_t count);
+
+/**
+ * Revert premultiplied ARGB8888 pixels to straight alpha. @dst may be @src.
+ *
+ * @param[out] dst The straight alpha pixels.
+ * @param[in] src The premultiplied pixels.
+ * @param[in] count The number of pixels.
+ */
+void m2d_unpremultiply(uint32_t* dst, const uint32_t* src, size_t count);
+
+/**
+ * Convert R, G, B, A bytes, as produced by most decoders, into ARGB8888
+ * pixels, keeping the alpha straight.
+ *
+ * @param[out] dst The ARGB8888 pixels.
+ * @param[in] src The R, G, B, A bytes.
+ * @param[in] count The number of pixels.
+ */
+void m2d_swizzle_rgba(uint32_t* dst, const uint8_t* src, size_t count);
+
+/**
+ * Convert R, G, B, A bytes into premultiplied ARGB8888 pixels.
+ *
+ * @param[out] dst The ARGB8888 pixels.
+ * @param[in] src The R, G, B, A bytes.
+ * @param[in] count The number of pixels.
+ */
+void m2d_premultiply_rgba(uint32_t* dst, const uint8_t* src, size_t count);
+
+/**
+ * Rotate and flip pixels, in CPU memory. @dst must not overlap @src.
+ *
+ * @param[out] dst The destination pixels, @height x @width pixels for 90 and
+ *                 270 degree rotations, @width x @height pixels otherwise.
+ * @param[in] dst_stride The destination stride in bytes.
+ * @param[in] src The source pixels.
+ * @param[in] src_stride The source stride in bytes.
+ * @param[in] format The pixel format of both.
+ * @param[in] width The source width in pixels.
+ * @param[in] height The source height in pixels.
+ * @param[in] transform A combination of @m2d_transform values.
+ * @return 0 on success, -1 on unsupported format.
+ */
+int m2d_rotate(void* dst, size_t dst_stride, const void* src, size_t src_stride,
+               enum m2d_pixel_format format, size_t width, size_t height,
+               unsigned int transform);
+
+/**
+ * Get the instruction set of the conversion kernels in use: "neon", "avx2",
+ * "sse2" or "c".
+ *
+ * @return the instruction set name.
+ */
+const char* m2d_convert_get_isa();
+
+/**
+ * Force the instruction set of the conversion kernels, to compare them.
+ * The most efficient one supported by the CPU is used by default.
+ *
+ * This may be called at any time, even while conversions run on other
+ * threads: the kernels of all the instruction sets give the same results.
+ *
+ * @param[in] isa The instruction set name, as returned by
+ *                @m2d_convert_get_isa().
+ * @return 0 on success, -1 if not supported by the build or the CPU.
+ */
+int m2d_convert_set_isa(const char* isa);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __M2D_GLYPH_H__
+#define __M2D_GLYPH_H__
+/**
+ * @file
+ * @brief Microchip 2D API: glyph cache and text
+ */
+
+#include <m2d/m2d.h>
+
+#ifdef __cplusplus
+extern "C"  {
+#endif
+
+/**
+ * A glyph rasterized by a 'm2d_glyph_render_func', laid out as the FreeType
+ * bitmaps.
+ *
+ * pixels: the A8 coverage of the glyph, @height rows of @width bytes.
+ * pitch: the number of bytes from one row to the next one.
+ * left: the distance from the pen position to the leftmost column.
+ * top: the distance from the baseline to the topmost row, upwards.
+ * advance: the distance from the pen position to the next one.
+ */
+struct m2d_glyph_bitmap {
+	const uint8_t* pixels;
+	size_t width;
+	size_t height;
+	size_t pitch;
+	dim_t left;
+	dim_t top;
+	dim_t advance;
+};
+
+/**
+ * Rasterize the glyph of the @codepoint Unicode character into @glyph.
+ *
+ * The pixels are copied once this function returns, hence they may be held
+ * by the rasterizer until the next call, as the FreeType glyph slot.
+ *
+ * @return 0 if successfull, -1 if the font has no glyph for @codepoint.
+ */
+typedef int (*m2d_glyph_render_func)(uint32_t codepoint, struct m2d_glyph_bitmap* glyph,
+                                     void* data);
+
+/**
+ * A glyph cache: the glyphs of a font at a given size, rasterized once, and
+ * the text laid out with them into A8 atlas pages.
+ */
+struct m2d_glyph_cache;
+
+/**
+ * Create a glyph cache.
+ *
+ * @param[in] ascent The distance in pixels from the top of a line to its
+ *                   baseline.
+ * @param[in] line_height The distance in pixels from one line to the next one.
+ * @param[in] render The rasterizer called for each glyph missing in the cache.
+ * @param[in] data The data passed to @render.
+ * @return a pointer to the new 'struct m2d_glyph_cache', NULL otherwise.
+ */
+struct m2d_glyph_cache* m2d_glyph_cache_create(dim_t ascent, dim_t line_height,
+                                               m2d_glyph_render_func render, void* data);
+
+/**
+ * Release a glyph cache created with @m2d_glyph_cache_create().
+ *
+ * @param[in] cache The glyph cache to release.
+ */
+void m2d_glyph_cache_destroy(struct m2d_glyph_cache* cache);
+
+/**
+ * Forget the text laid out so far, releasing the atlas pages. The glyphs stay
+ * cached.
+ *
+ * @param[in] cache A pointer to a 'struct m2d_glyph_cache'.
+ */
+void m2d_glyph_cache_trim(struct m2d_glyph_cache* cache);
+
+/**
+ * Get the size of the box holding @text: the width of its longest line, and
+ * its number of lines times the line height.
+ *
+ * @param[in] cache A pointer to a 'struct m2d_glyph_cache'.
+ * @param[in] text The UTF-8 text, lines separated by '\n'.
+ * @param[out] width The width in pixels of the text.
+ * @param[out] height The height in pixels of the text.
+ */
+void m2d_measure_text(struct m2d_glyph_cache* cache, const char* text,
+                      dim_t* width, dim_t* height);
+
+/**
+ * A text run for @m2d_draw_text(): @text drawn in the color
+ * {@red, @green, @blue, @alpha}, its first line box at point (@x, @y) in the
+ * target surface space.
+ */
+struct m2d_text_run {
+	const char* text;
+	dim_t x;
+	dim_t y;
+	uint8_t red;
+	uint8_t green;
+	uint8_t blue;
+	uint8_t alpha;
+};
+
+/**
+ * Blend text runs onto the target surface, in order.
+ * This is asynchronous (non-blocking).
+ *
+ * The first time a text is drawn, it is laid out once and for all into an
+ * atlas page, so that each run takes a single command, made of the boxes of
+ * its lines. The target, its transform and the renderer are used; the other
+ * renderer state is preserved.
+ *
+ * @param[in] cache A pointer to a 'struct m2d_glyph_cache'.
+ * @param[in] runs The array of runs to draw, in back-to-front order.
+ * @param[in] num_runs The number of runs in the 'runs' array.
+ */
+void m2d_draw_text(struct m2d_glyph_cache* cache, const struct m2d_text_run* runs,
+                   size_t num_runs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __M2D_IMAGE_H__
+#define __M2D_IMAGE_H__
+/**
+ * @file
+ * @brief Microchip 2D API: image loading
+ */
+
+#include <m2d/m2d.h>
+
+#ifdef __cplusplus
+extern "C"  {
+#endif
+
+/**
+ * Options for the image loaders.
+ *
+ * format: the pixel format of the surface to create. Pixels are converted and
+ *         their alpha premultiplied while decoding. RGB565 surfaces get the
+ *         image composited over black, A8 surfaces get the image alpha, or its
+ *         luminance for opaque images.
+ * width, height: the size the image is going to be displayed at, 0 if
+ *                unknown. JPEG images are decoded at the smallest 1/8, 1/4 or
+ *                1/2 scale which is not smaller than this size, which is a lot
+ *                faster than decoding them at full size. Other images are
+ *                always decoded at full size.
+ */
+struct m2d_image_options {
+	enum m2d_pixel_format format;
+	size_t width;
+	size_t height;
+};
+
+/**
+ * Load a PNG or JPEG image into a new surface.
+ *
+ * The image is decoded row by row straight into the surface memory, hence the
+ * whole decoded image is never held in memory twice. The surface is ready to
+ * be used by the GPU when this function returns.
+ *
+ * @param[in] filename The path of the image file.
+ * @param[in] options The decoding options, NULL to create an ARGB8888 surface
+ *                    at the image size.
+ * @return a pointer to the new 'struct m2d_buffer', NULL otherwise.
+ */
+struct m2d_buffer* m2d_load_image(const char* filename,
+                                  const struct m2d_image_options* options);
+
+/**
+ * Same as @m2d_load_image() but with an image already loaded in memory.
+ *
+ * @param[in] data The content of the PNG or JPEG file.
+ * @param[in] size The size in bytes of @data.
+ * @param[in] options The decoding options, NULL to create an ARGB8888 surface
+ *                    at the image size.
+ * @return a pointer to the new 'struct m2d_buffer', NULL otherwise.
+ */
+struct m2d_buffer* m2d_load_image_from_memory(const void* data, size_t size,
+                                              const struct m2d_image_options* options);
+
+/**
+ * An image decoded in CPU memory.
+ *
+ * data: the pixels, @height rows of @stride bytes.
+ * width, height: the size in pixels of the image.
+ * stride: the size in bytes between two consecutive rows, a multiple of 4.
+ * format: the pixel format, alpha being premultiplied.
+ */
+struct m2d_image {
+	void* data;
+	size_t width;
+	size_t height;
+	size_t stride;
+	enum m2d_pixel_format format;
+};
+
+/**
+ * Decode a PNG or JPEG image in CPU memory.
+ *
+ * This doesn't need the GPU: it can be used by offline tools, or to prepare
+ * surfaces from other threads.
+ *
+ * @param[in] filename The path of the image file.
+ * @param[in] options The decoding options, NULL to decode to ARGB8888 at the
+ *                    image size.
+ * @param[out] image The decoded image, to be released with
+ *                   @m2d_image_release().
+ * @return 0 if successfull, -1 otherwise.
+ */
+int m2d_decode_image(const char* filename, const struct m2d_image_options* options,
+                     struct m2d_image* image);
+
+/**
+ * Release the pixels of an image decoded with @m2d_decode_image().
+ *
+ * @param[in] image A pointer to a 'struct m2d_image'.
+ */
+void m2d_image_release(struct m2d_image* image);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef __M2D_LOADER_H__
+#define __M2D_LOADER_H__
+/**
+ * @file
+ * @brief Microchip 2D API: background image loading
+ *
+ * Images are decoded and uploaded into new surfaces by a pool of worker
+ * threads, so that the rendering thread never blocks on decoding, allocation
+ * or cache maintenance. Every other libm2d function must still be called from
+ * the thread which called @m2d_init().
+ */
+
+#include <m2d/image.h>
+#include <m2d/m2d.h>
+
+#ifdef __cplusplus
+extern "C"  {
+#endif
+
+/**
+ * An image being loaded in the background.
+ */
+struct m2d_load;
+
+/**
+ * The state of a 'struct m2d_load'.
+ */
+enum m2d_load_state
+{
+	M2D_LOAD_PENDING,
+	M2D_LOAD_LOADING,
+	M2D_LOAD_READY,
+	M2D_LOAD_FAILED,
+	M2D_LOAD_CANCELED,
+};
+
+/**
+ * What draws do when a source set by @m2d_set_source_load() isn't ready.
+ *
+ * M2D_LOAD_SKIP: the draw is ignored.
+ * M2D_LOAD_WAIT: the draw waits for the image, as @m2d_load_wait().
+ */
+enum m2d_load_policy
+{
+	M2D_LOAD_SKIP,
+	M2D_LOAD_WAIT,
+};
+
+/**
+ * Called by @m2d_loader_dispatch() once an image is ready or has failed to
+ * load: see @m2d_load_get_state().
+ */
+typedef void (*m2d_load_callback)(struct m2d_load* load, void* data);
+
+/**
+ * Start the loader threads.
+ *
+ * This is optional: the loader is started with one thread per CPU by the first
+ * @m2d_load_async() call otherwise. Worker threads run at a lower priority
+ * than the rendering thread.
+ *
+ * @param[in] num_threads The number of worker threads, 0 for one per CPU.
+ * @return 0 if successfull, -1 otherwise.
+ */
+int m2d_loader_init(size_t num_threads);
+
+/**
+ * Load an image in the background, see @m2d_load_image().
+ *
+ * This returns immediately. Images are loaded by decreasing priority, then in
+ * request order.
+ *
+ * @param[in] filename The path of the image file.
+ * @param[in] options The decoding options, NULL to create an ARGB8888 surface
+ *                    at the image size.
+ * @param[in] priority The load priority, higher values being loaded first.
+ * @param[in] callback The function called by @m2d_loader_dispatch() once the
+ *                     load is complete, or NULL.
+ * @param[in] data The user data passed to @callback.
+ * @return a pointer to the new 'struct m2d_load', to be released with
+ *         @m2d_load_release(), NULL otherwise.
+ */
+struct m2d_load* m2d_load_async(const char* filename,
+                                const struct m2d_image_options* options,
+                                int priority, m2d_load_callback callback,
+                                void* data);
+
+/**
+ * Get the state of a load.
+ *
+ * @param[in] load A pointer to a 'struct m2d_load'.
+ * @return the load state.
+ */
+enum m2d_load_state m2d_load_get_state(struct m2d_load* load);
+
+/**
+ * Get the surface of a load.
+ *
+ * The surface is owned by the load: it is released by @m2d_load_release().
+ *
+ * @param[in] load A pointer to a 'struct m2d_load'.
+ * @return the surface if the load is M2D_LOAD_READY, NULL otherwise.
+ */
+struct m2d_buffer* m2d_load_get_buffer(struct m2d_load* load);
+
+/**
+ * Wait for a load to complete: the readiness fence.
+ *
+ * A load which hasn't been started yet by a worker thread is performed by the
+ * calling thread instead, at once.
+ *
+ * @param[in] load A pointer to a 'struct m2d_load'.
+ * @param[in] timeout The absolute CLOCK_MONOTONIC time limit, or NULL to wait
+ *                    forever.
+ * @return 0 if the load is M2D_LOAD_READY, -1 otherwise.
+ */
+int m2d_load_wait(struct m2d_load* load, const struct timespec* timeout);
+
+/**
+ * Change the priority of a load which hasn't been started yet.
+ *
+ * @param[in] load A pointer to a 'struct m2d_load'.
+ * @param[in] priority The new load priority.
+ */
+void m2d_load_set_priority(struct m2d_load* load, int priority);
+
+/**
+ * Cancel a load: the image is dropped instead of being made ready, and the
+ * callback isn't called. This does nothing if the load is already complete.
+ *
+ * @param[in] load A pointer to a 'struct m2d_load'.
+ */
+void m2d_load_cancel(struct m2d_load* load);
+
+/**
+ * Cancel a load if not complete yet, and release it along with its surface.
+ *
+ * @param[in] load The load to release.
+ */
+void m2d_load_release(struct m2d_load* load);
+
+/**
+ * Call the callbacks of the loads completed since the previous call, from the
+ * calling thread.
+ *
+ * @return the number of completed loads.
+ */
+size_t m2d_loader_dispatch();
+
+/**
+ * Get a file descriptor which is readable when @m2d_loader_dispatch() has
+ * callbacks to call, to be watched by the application main loop.
+ *
+ * @return the file descriptor, -1 if the loader isn't started.
+ */
+int m2d_loader_get_fd();
+
+/**
+ * Set a source surface in the current renderer state from a load, as
+ * @m2d_set_source().
+ *
+ * If the image isn't ready yet, the following draws either skip or wait
+ * according to @policy, until it is. Setting the source again, with
+ * @m2d_set_source() for instance, forgets the load.
+ *
+ * @param[in] id The id of the source surface to set.
+ * @param[in] load A pointer to a 'struct m2d_load'.
+ * @param[in] x The origin x coordinate of this source surface in the target
+ *              surface space coordinate.
+ * @param[in] y The origin y coordinate of this source surface in the target
+ *              surface space coordinate.
+ * @param[in] policy What draws do while the image isn't ready.
+ */
+void m2d_set_source_load(enum m2d_source_id id, struct m2d_load* load,
+                         dim_t x, dim_t y, enum m2d_load_policy policy);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -15,6 +15,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <time.h>
 
 #define M2D_VERSION_MAJOR   1
@@ -33,6 +34,8 @@ enum m2d_pixel_format
     M2D_PF_A8,
 };
 
+#define M2D_NUM_PIXEL_FORMATS (M2D_PF_A8 + 1)
+
 /**
  * Convert an 'enum m2d_pixel_format' into a string.
  *
@@ -41,7 +44,16 @@ enum m2d_pixel_format
  */
 const char* m2d_format_name(enum m2d_pixel_format format);
 
+/**
+ * Get the size of a pixel.
+ *
+ * @param[in] format The pixel format.
+ * @return the number of bytes per pixel of @format, 0 if it is unknown.
+ */
+size_t m2d_byte_per_pixel(enum m2d_pixel_format format);
+
 struct m2d_buffer;
+struct m2d_rectangle;
 
 /**
  * Create an handle to the GPU.
@@ -101,6 +113,24 @@ struct m2d_capabilities
  */
 const struct m2d_capabilities* m2d_get_capabilities();
 
+/**
+ * Get the number of bytes of GPU memory held by the internal scratch surfaces.
+ *
+ * Scratch surfaces store the intermediate results of multi-pass operations,
+ * such as blending with a constant source color. They are shared by all the
+ * target surfaces, sized after the rectangles being drawn and shrunk when the
+ * recent operations need less.
+ *
+ * @return the size in bytes of the scratch surfaces.
+ */
+size_t m2d_scratch_size();
+
+/**
+ * Release the internal scratch surfaces: they will be allocated again on
+ * demand.
+ */
+void m2d_scratch_trim();
+
 /**
  * Allocate a new DRM GEM object to share a memory region between the userspace application and the GPU.
  *
@@ -146,9 +176,310 @@ struct m2d_import_desc {
  */
 struct m2d_buffer* m2d_import(const struct m2d_import_desc* desc);
 
+/**
+ * struct m2d_memory_stats - GPU memory held by libm2d
+ */
+struct m2d_memory_stats
+{
+    /**
+     * @allocated_bytes
+     *
+     * The size in bytes of the buffers currently allocated by @m2d_alloc().
+     */
+    size_t allocated_bytes;
+
+    /**
+     * @peak_bytes
+     *
+     * The highest value reached by @allocated_bytes.
+     */
+    size_t peak_bytes;
+
+    /**
+     * @format_bytes
+     *
+     * @allocated_bytes split per 'enum m2d_pixel_format'.
+     */
+    size_t format_bytes[M2D_NUM_PIXEL_FORMATS];
+
+    /**
+     * @scratch_bytes
+     *
+     * The size in bytes of the internal scratch surfaces, see
+     * @m2d_scratch_size().
+     */
+    size_t scratch_bytes;
+
+    /**
+     * @imported_bytes
+     *
+     * The size in bytes of the buffers imported by @m2d_import(): their memory
+     * is owned by the exporter, hence not part of @allocated_bytes.
+     */
+    size_t imported_bytes;
+
+    /**
+     * @num_buffers
+     *
+     * The number of live buffers, imported ones included.
+     */
+    size_t num_buffers;
+};
+
+/**
+ * Get the GPU memory currently held by libm2d.
+ *
+ * @param[out] stats The memory statistics.
+ */
+void m2d_get_memory_stats(struct m2d_memory_stats* stats);
+
+/**
+ * Label @buf with its owner, for the memory statistics.
+ *
+ * @param[in] buf A pointer to a 'struct m2d_buffer'.
+ * @param[in] tag A short string, truncated to 15 characters.
+ */
+void m2d_set_tag(struct m2d_buffer* buf, const char* tag);
+
+/**
+ * Get the size in bytes of the live buffers labelled with @tag.
+ *
+ * @param[in] tag The label set by @m2d_set_tag(), "" for untagged buffers.
+ * @return the number of bytes allocated for @tag.
+ */
+size_t m2d_get_tag_usage(const char* tag);
+
+/**
+ * The description of a live buffer for @m2d_foreach_buffer().
+ */
+struct m2d_buffer_info {
+	struct m2d_buffer* buf;
+	uint32_t id;
+	size_t width;
+	size_t height;
+	enum m2d_pixel_format format;
+	size_t stride;
+	size_t size;
+	bool imported;
+	bool parked;
+	const char* tag;
+};
+
+/**
+ * Call @func for every live buffer, from the oldest to the newest.
+ *
+ * @func must not allocate nor free any buffer, nor call the other memory
+ * accounting functions.
+ *
+ * @param[in] func The function to call.
+ * @param[in] data The user data passed to @func.
+ */
+void m2d_foreach_buffer(void (*func)(const struct m2d_buffer_info* info, void* data),
+                        void* data);
+
+/**
+ * Print the live buffers and the memory statistics to @stream.
+ *
+ * @param[in] stream Where to print, stderr if NULL.
+ */
+void m2d_dump_buffers(FILE* stream);
+
+/**
+ * The function called when an allocation would exceed the memory budget.
+ *
+ * @param[in] requested The size in bytes of the allocation.
+ * @param[in] allocated The size in bytes currently held by libm2d.
+ * @param[in] budget The memory budget.
+ * @param[in] data The user data passed to @m2d_set_memory_budget().
+ */
+typedef void (*m2d_budget_callback)(size_t requested, size_t allocated,
+                                    size_t budget, void* data);
+
+/**
+ * Set a soft limit on the GPU memory held by libm2d.
+ *
+ * When an allocation would exceed @budget, libm2d first releases the memory
+ * it can rebuild (scratch surfaces, caches, parkable buffers, see
+ * @m2d_set_parkable()...), then calls @callback, if
+ * any, to let the application release its own buffers. The allocation is
+ * attempted anyway. The same steps are taken when the kernel fails an
+ * allocation, before trying it again.
+ *
+ * @param[in] budget The budget in bytes, 0 for unlimited.
+ * @param[in] callback The function called when the budget is exceeded, or NULL.
+ * @param[in] data The user data passed to @callback.
+ */
+void m2d_set_memory_budget(size_t budget, m2d_budget_callback callback, void* data);
+
+/**
+ * Park @buf: its pixels are compressed into system memory and its GPU memory
+ * is released, until it is used again.
+ *
+ * Typically for the offscreen surfaces of hidden pages. A parked buffer is
+ * restored transparently, into new GPU memory, when it is set as a source or
+ * a target, or by @m2d_get_data(), @m2d_export() and @m2d_unpark(). Its
+ * mapping is released, as by @m2d_unmap(): addresses previously returned by
+ * @m2d_get_data() must no longer be used.
+ *
+ * Imported and exported buffers, and buffers set in the renderer state, can't
+ * be parked.
+ *
+ * @param[in] buf A pointer to a 'struct m2d_buffer'.
+ * @return 0 if successfull, -1 otherwise.
+ */
+int m2d_park(struct m2d_buffer* buf);
+
+/**
+ * Restore a parked buffer into GPU memory now.
+ *
+ * @param[in] buf A pointer to a 'struct m2d_buffer'.
+ * @return 0 if successfull or if @buf isn't parked, -1 otherwise.
+ */
+int m2d_unpark(struct m2d_buffer* buf);
+
+/**
+ * Tell whether @buf is parked.
+ *
+ * @param[in] buf A pointer to a 'const struct m2d_buffer'.
+ * @return true if @buf is parked, false otherwise.
+ */
+bool m2d_is_parked(const struct m2d_buffer* buf);
+
+/**
+ * Let libm2d park @buf when the memory budget is exceeded or when an
+ * allocation fails, least recently used buffers first. See @m2d_park().
+ *
+ * This may happen on any allocation, hence the application must call
+ * @m2d_get_data() again each time it accesses the pixels of a parkable
+ * buffer, rather than keeping the address it returned.
+ *
+ * @param[in] buf A pointer to a 'struct m2d_buffer'.
+ * @param[in] parkable true to let libm2d park @buf, false otherwise.
+ */
+void m2d_set_parkable(struct m2d_buffer* buf, bool parkable);
+
+/**
+ * struct m2d_park_stats - buffer parking metrics
+ */
+struct m2d_park_stats
+{
+    /**
+     * @num_parked
+     *
+     * The number of buffers currently parked.
+     */
+    size_t num_parked;
+
+    /**
+     * @parked_bytes
+     *
+     * The GPU memory released by the parked buffers, in bytes.
+     */
+    size_t parked_bytes;
+
+    /**
+     * @compressed_bytes
+     *
+     * The system memory holding the parked buffers, in bytes.
+     */
+    size_t compressed_bytes;
+
+    /**
+     * @parks, @unparks
+     *
+     * The number of buffers parked and restored so far.
+     */
+    size_t parks;
+    size_t unparks;
+
+    /**
+     * @park_ns, @unpark_ns
+     *
+     * The total time spent parking and restoring buffers, in nanoseconds.
+     */
+    uint64_t park_ns;
+    uint64_t unpark_ns;
+};
+
+/**
+ * Get the buffer parking metrics.
+ *
+ * @param[out] stats The parking metrics.
+ */
+void m2d_get_park_stats(struct m2d_park_stats* stats);
+
+/**
+ * Export the DRM GEM object associated with @buf as a DRM PRIME (DMA-BUF) file
+ * descriptor, to share it without any copy with a KMS plane, a video codec or
+ * another process.
+ *
+ * The GPU may still be writing into the buffer: wait for it with @m2d_wait()
+ * before handing the file descriptor over.
+ *
+ * @param[in] buf A pointer to a 'struct m2d_buffer'.
+ * @param[out] fd The new file descriptor, to be closed by the caller.
+ * @return 0 if successfull, -1 otherwise.
+ */
+int m2d_export(struct m2d_buffer* buf, int* fd);
+
+/**
+ * CPU access flags for the DMA-BUF helpers.
+ */
+enum m2d_access
+{
+    M2D_ACCESS_READ = 1 << 0,
+    M2D_ACCESS_WRITE = 1 << 1,
+    M2D_ACCESS_RW = M2D_ACCESS_READ | M2D_ACCESS_WRITE,
+};
+
+/**
+ * Map a DMA-BUF file descriptor, typically exported by @m2d_export(), into
+ * the userspace process memory map of the importer.
+ *
+ * CPU accesses through the mapping must be bracketed by
+ * @m2d_dmabuf_begin_cpu_access() and @m2d_dmabuf_end_cpu_access().
+ *
+ * @param[in] fd The DMA-BUF file descriptor.
+ * @param[in] size The size in bytes to map: height * stride.
+ * @param[in] access How the CPU is going to access the mapping.
+ * @return the virtual address of the mapping, NULL otherwise.
+ */
+void* m2d_dmabuf_map(int fd, size_t size, unsigned int access);
+
+/**
+ * Release a mapping created with @m2d_dmabuf_map().
+ *
+ * @param[in] addr The virtual address returned by @m2d_dmabuf_map().
+ * @param[in] size The size in bytes passed to @m2d_dmabuf_map().
+ */
+void m2d_dmabuf_unmap(void* addr, size_t size);
+
+/**
+ * Make the CPU claim the ownership of a DMA-BUF mapped by the importer
+ * (DMA_BUF_IOCTL_SYNC), invalidating the CPU caches as needed.
+ *
+ * @param[in] fd The DMA-BUF file descriptor.
+ * @param[in] access A combination of 'enum m2d_access' flags.
+ * @return 0 if successfull, -1 otherwise.
+ */
+int m2d_dmabuf_begin_cpu_access(int fd, unsigned int access);
+
+/**
+ * Give the ownership of a DMA-BUF mapped by the importer back to the devices
+ * (DMA_BUF_IOCTL_SYNC), flushing the CPU caches as needed.
+ *
+ * @param[in] fd The DMA-BUF file descriptor.
+ * @param[in] access The flags passed to @m2d_dmabuf_begin_cpu_access().
+ * @return 0 if successfull, -1 otherwise.
+ */
+int m2d_dmabuf_end_cpu_access(int fd, unsigned int access);
+
 /**
  * Release a memory region created with either @m2d_alloc() or @m2d_import().
  *
+ * Surfaces returned by @m2d_cache_load() are handed back to the image cache
+ * instead, see m2d/cache.h.
+ *
  * @param[in] buf The memory region to release.
  */
 void m2d_free(struct m2d_buffer* buf);
@@ -173,11 +504,28 @@ void m2d_sync_for_gpu(struct m2d_buffer* buf);
  * Get the virtual address in the userspace process memory map for the DRM GEM
  * object associated with @buf.
  *
+ * The DRM GEM object is mapped on the first call only, so surfaces never
+ * accessed by the CPU don't cost any mapping. The address stays valid until
+ * @buf is unmapped by @m2d_unmap() or parked: by @m2d_park(), or by libm2d
+ * itself when @buf is parkable, see @m2d_set_parkable().
+ *
  * @param[in] buf A pointer to a 'struct m2d_buffer'.
- * @return the virtual address for @buf and its associated DRM GEM object.
+ * @return the virtual address for @buf and its associated DRM GEM object,
+ *         NULL if it can't be mapped.
  */
 void* m2d_get_data(struct m2d_buffer* buf);
 
+/**
+ * Release the CPU mapping of @buf, when the CPU is not expected to access it
+ * for a while. It is mapped again by the next call to @m2d_get_data().
+ *
+ * Addresses previously returned by @m2d_get_data() must no longer be used.
+ * Mappings of imported buffers are owned by the exporter, hence kept.
+ *
+ * @param[in] buf A pointer to a 'struct m2d_buffer'.
+ */
+void m2d_unmap(struct m2d_buffer* buf);
+
 /**
  * Get the stride value for @buf.
  *
@@ -186,6 +534,45 @@ void* m2d_get_data(struct m2d_buffer* buf);
  */
 size_t m2d_get_stride(const struct m2d_buffer* buf);
 
+/**
+ * Copy pixels from the CPU into @buf, converting them to the @buf pixel
+ * format on the fly.
+ *
+ * This waits for the GPU to be done with @buf and takes care of the cache
+ * maintenance: there is no need for @m2d_sync_for_cpu() nor
+ * @m2d_sync_for_gpu().
+ *
+ * @param[in] buf A pointer to a 'struct m2d_buffer'.
+ * @param[in] rect The area of @buf to write, clipped to @buf, or NULL for the
+ *                 whole buffer.
+ * @param[in] src The pixels, starting with the top-left pixel of @rect.
+ * @param[in] src_stride The size in bytes between two rows of @src.
+ * @param[in] src_format The pixel format of @src, with premultiplied alpha.
+ * @return 0 if successfull, -1 otherwise.
+ */
+int m2d_upload(struct m2d_buffer* buf, const struct m2d_rectangle* rect,
+               const void* src, size_t src_stride,
+               enum m2d_pixel_format src_format);
+
+/**
+ * Copy pixels from @buf to the CPU, converting them to @dst_format on the fly.
+ * See @m2d_upload().
+ *
+ * A8 pixels are converted as white with coverage, and RGB565 pixels as opaque.
+ *
+ * @param[in] buf A pointer to a 'struct m2d_buffer'.
+ * @param[in] rect The area of @buf to read, clipped to @buf, or NULL for the
+ *                 whole buffer.
+ * @param[out] dst Where to write the pixels, starting with the top-left pixel
+ *                 of @rect.
+ * @param[in] dst_stride The size in bytes between two rows of @dst.
+ * @param[in] dst_format The pixel format of @dst, with premultiplied alpha.
+ * @return 0 if successfull, -1 otherwise.
+ */
+int m2d_download(struct m2d_buffer* buf, const struct m2d_rectangle* rect,
+                 void* dst, size_t dst_stride,
+                 enum m2d_pixel_format dst_format);
+
 /**
  * Wait for all queued operations/commands involving @buf to complete.
  *
@@ -201,8 +588,46 @@ int m2d_wait(const struct m2d_buffer* buf, const struct timespec* timeout);
  * @param[in] buf A pointer to the 'struct m2d_buffer' to be used as the GPU
  * target surface. The target surface is where the GPU draws; it is the result
  * of the GPU operation. Hence, it must not be NULL.
+ * @return 0 if successfull, -1 if @buf is parked and can't be restored, the
+ *         previous target staying set.
  */
-void m2d_set_target(struct m2d_buffer* buf);
+int m2d_set_target(struct m2d_buffer* buf);
+
+/**
+ * Transforms for panels mounted rotated or mirrored, combined with OR.
+ *
+ * The image is flipped first, then rotated clockwise.
+ *
+ * - M2D_TRANSFORM_ROTATE_90/180/270: the clockwise rotation.
+ * - M2D_TRANSFORM_FLIP_X: mirrored left to right.
+ * - M2D_TRANSFORM_FLIP_Y: mirrored top to bottom.
+ */
+enum m2d_transform
+{
+    M2D_TRANSFORM_NONE = 0,
+    M2D_TRANSFORM_ROTATE_90 = 1,
+    M2D_TRANSFORM_ROTATE_180 = 2,
+    M2D_TRANSFORM_ROTATE_270 = 3,
+    M2D_TRANSFORM_FLIP_X = 1 << 2,
+    M2D_TRANSFORM_FLIP_Y = 1 << 3,
+};
+
+/**
+ * Set how the target surface is transformed in the current renderer state.
+ *
+ * Drawing then happens in the logical space of the transformed target: a
+ * 480x800 portrait target rotated by 90 degrees is drawn to as an 800x480
+ * landscape surface. Rectangles and source positions are transformed, and
+ * source surfaces are read as upright images: for copies and blending, the
+ * GPU reads rotated variants of them, rotated by the CPU once and cached with
+ * the scaled variants of @m2d_stretch_blit().
+ *
+ * A source set to the target surface itself is read in the same logical
+ * space, scrolling the content for instance.
+ *
+ * @param[in] transform A combination of @m2d_transform values.
+ */
+void m2d_set_target_transform(unsigned int transform);
 
 /**
  * Identifiers for source surfaces.
@@ -233,11 +658,14 @@ const char* m2d_source_name(enum m2d_source_id);
  * @param[in] y The origin y coordiante of this source surface in the target
  *              surface space coordinate.
  *
+ * @return 0 if successfull, -1 if @buf is parked and can't be restored, the
+ *         previous source staying set.
+ *
  * @note Pixels from the source surface @index are read from the @buf
  *              'struct m2d_buffer' as if the origin of the source surface
  *              were positioned at point (@x, @y) in the target surface space.
  */
-void m2d_set_source(enum m2d_source_id id, struct m2d_buffer* buf, dim_t x, dim_t y);
+int m2d_set_source(enum m2d_source_id id, struct m2d_buffer* buf, dim_t x, dim_t y);
 
 /**
  * Enable/disable the source surface @index in the current renderer state.
@@ -364,6 +792,56 @@ void m2d_blend_factors(enum m2d_blend_factor src_rgb_factor,
 		       enum m2d_blend_factor src_alpha_factor,
 		       enum m2d_blend_factor dst_alpha_factor);
 
+/**
+ * Renderers executing the draw operations.
+ *
+ * - M2D_RENDERER_GPU: the 2D GPU, asynchronously. This is the default.
+ * - M2D_RENDERER_CPU: the CPU, synchronously: @m2d_draw_rectangles() returns
+ *                     once the pixels are written. This saves the GPU setup
+ *                     and cache maintenance for small or scattered updates,
+ *                     and offloads the GPU. The surfaces must be mappable:
+ *                     draws involving imported surfaces go to the GPU.
+ * - M2D_RENDERER_CPU_DEFERRED: the CPU, deferred: draws on a same target are
+ *                     recorded until @m2d_flush(), then executed by 64x64
+ *                     tiles, each with all its draws while its pixels are in
+ *                     the CPU caches. Multi-layer frames read and write the
+ *                     target once instead of once per layer.
+ */
+enum m2d_renderer
+{
+    M2D_RENDERER_GPU,
+    M2D_RENDERER_CPU,
+    M2D_RENDERER_CPU_DEFERRED,
+};
+
+/**
+ * Select the renderer in the current renderer state. Both follow the same
+ * operations and blend equation.
+ *
+ * @param[in] renderer The renderer executing the next draw operations.
+ */
+void m2d_set_renderer(enum m2d_renderer renderer);
+
+/**
+ * Execute the draws deferred by M2D_RENDERER_CPU_DEFERRED, typically at the
+ * end of a frame.
+ *
+ * @note This is done as well before the next GPU or non-deferred CPU draw,
+ *       before a draw on another target, and by @m2d_sync_for_cpu(),
+ *       @m2d_wait(), @m2d_unmap(), @m2d_export() and @m2d_free() called from
+ *       the render thread.
+ */
+void m2d_flush();
+
+/**
+ * Set the number of threads of the CPU renderer and conversions. Large draws
+ * are split into tiles rendered in parallel.
+ *
+ * @param[in] num_threads The number of threads, the calling one included, or
+ *            0 for one per online CPU core. This is the default.
+ */
+void m2d_set_cpu_threads(unsigned int num_threads);
+
 /**
  * The rectangle definition for @m2d_draw_rectangles().
  *
@@ -395,6 +873,343 @@ struct m2d_rectangle {
  */
 void m2d_draw_rectangles(const struct m2d_rectangle* rects, size_t num_rects);
 
+/**
+ * Filters for @m2d_stretch_blit().
+ *
+ * - M2D_FILTER_NEAREST: the nearest source pixel, for pixel art and masks.
+ * - M2D_FILTER_BILINEAR: the 4 nearest source pixels, linearly interpolated.
+ */
+enum m2d_filter
+{
+    M2D_FILTER_NEAREST,
+    M2D_FILTER_BILINEAR,
+};
+
+/**
+ * Draw the @src_rect area of the M2D_SRC source surface stretched to fit
+ * @dst_rect in the target surface, with the current renderer state otherwise:
+ * blending for instance.
+ *
+ * Without @stretched_blit capability, the source is resampled by the CPU into
+ * a surface of the @dst_rect size, kept in a cache of scaled variants: later
+ * blits of the same source content to the same size are plain draws.
+ *
+ * @param[in] src_rect The area to draw, in the source surface coordinates.
+ *                     The source surface position is ignored.
+ * @param[in] dst_rect The area to fill, in the target surface space.
+ * @param[in] filter The resampling filter.
+ */
+void m2d_stretch_blit(const struct m2d_rectangle* src_rect,
+                      const struct m2d_rectangle* dst_rect,
+                      enum m2d_filter filter);
+
+/**
+ * Set the maximum size in bytes of the scaled variants cached by
+ * @m2d_stretch_blit(), 4 MiB by default. 0 caches the last variant only.
+ *
+ * @param[in] budget The budget in bytes.
+ */
+void m2d_set_scale_cache_budget(size_t budget);
+
+/**
+ * Copy a whole surface transformed into another one, with the CPU: to
+ * present a frame rendered upright on a panel mounted rotated, for instance.
+ *
+ * Rotations by 90 and 270 degrees transpose the pixels by tiles in cache
+ * sized blocks, with SIMD when available. Blocks of rows are rotated by the
+ * threads set by @m2d_set_cpu_threads().
+ *
+ * @param[in] dst The destination surface, of the same format as @src and of
+ *                the size of the transformed @src.
+ * @param[in] src The source surface.
+ * @param[in] transform A combination of @m2d_transform values.
+ * @return 0 on success, -1 on error.
+ */
+int m2d_blit_transformed(struct m2d_buffer* dst, struct m2d_buffer* src, unsigned int transform);
+
+/**
+ * Draw the @src_rect area of the M2D_SRC source surface blurred, as if the
+ * area were at (@x, @y) in the target surface, with the current renderer
+ * state otherwise: blending for instance. The blurred image spreads @radius
+ * pixels further on each side.
+ *
+ * Blurred surfaces are cached with the scaled variants of
+ * @m2d_stretch_blit(). Radii up to 4 are blurred by blends of shifted copies
+ * (box filter); larger ones by the CPU, on a downscaled copy (close to a
+ * gaussian). Radii are clamped to 255.
+ *
+ * @param[in] src_rect The area to blur, in the source surface coordinates.
+ *                     The source surface position is ignored.
+ * @param[in] x The x coordinate of the area in the target surface space.
+ * @param[in] y The y coordinate of the area in the target surface space.
+ * @param[in] radius The blur radius in pixels.
+ */
+void m2d_blur_blit(const struct m2d_rectangle* src_rect, dim_t x, dim_t y, unsigned int radius);
+
+/**
+ * Blend the drop shadow of the @src_rect area of the M2D_SRC source surface:
+ * its alpha, tinted with a color and blurred like @m2d_blur_blit(), as if the
+ * area were at (@x, @y) in the target surface. Draw the shadow at an offset,
+ * then the source over it.
+ *
+ * @param[in] src_rect The area casting the shadow, in the source surface
+ *                     coordinates.
+ * @param[in] x The x coordinate of the shadow in the target surface space.
+ * @param[in] y The y coordinate of the shadow in the target surface space.
+ * @param[in] radius The blur radius in pixels.
+ * @param[in] red The red component of the premultiplied shadow color.
+ * @param[in] green The green component of the premultiplied shadow color.
+ * @param[in] blue The blue component of the premultiplied shadow color.
+ * @param[in] alpha The opacity of the shadow.
+ */
+void m2d_draw_shadow(const struct m2d_rectangle* src_rect, dim_t x, dim_t y, unsigned int radius,
+                     uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha);
+
+enum m2d_gradient_type
+{
+    M2D_GRADIENT_LINEAR,
+    M2D_GRADIENT_RADIAL,
+};
+
+/**
+ * A color of a gradient, at @offset from 0 (the start of the gradient) to 255
+ * (its end). The color is premultiplied.
+ */
+struct m2d_gradient_stop
+{
+    uint8_t offset;
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+    uint8_t alpha;
+};
+
+#define M2D_GRADIENT_MAX_STOPS 16
+
+/**
+ * The gradient definition for @m2d_fill_gradient(), in the target surface
+ * space coordinates.
+ *
+ * A linear gradient goes from point {x0, y0} to point {x1, y1}; a radial one
+ * from its center {x0, y0} to @radius. Beyond its ends, the gradient has the
+ * color of its first or last stop.
+ */
+struct m2d_gradient
+{
+    enum m2d_gradient_type type;
+    dim_t x0;
+    dim_t y0;
+    dim_t x1;
+    dim_t y1;
+    dim_t radius;
+    /* 1 to M2D_GRADIENT_MAX_STOPS stops, by increasing offset. */
+    const struct m2d_gradient_stop* stops;
+    size_t num_stops;
+};
+
+/**
+ * Fill @rect with a gradient, as if it were the M2D_SRC source surface, with
+ * the current renderer state otherwise: blending for instance.
+ *
+ * Gradients are rendered by the CPU and cached. Horizontal and vertical
+ * linear gradients only render a few rows or columns, that are then
+ * expanded by the GPU.
+ *
+ * @param[in] rect The rectangle to fill.
+ * @param[in] gradient The gradient.
+ */
+void m2d_fill_gradient(const struct m2d_rectangle* rect, const struct m2d_gradient* gradient);
+
+/**
+ * The widths of the borders of a nine-patch, for @m2d_draw_nine_patch().
+ */
+struct m2d_insets
+{
+    dim_t left;
+    dim_t top;
+    dim_t right;
+    dim_t bottom;
+};
+
+/**
+ * How the edges and the center of a nine-patch fill the destination.
+ *
+ * - M2D_NINE_PATCH_STRETCH: stretched, with bilinear filtering.
+ * - M2D_NINE_PATCH_REPEAT: repeated from the top left corner.
+ */
+enum m2d_nine_patch_mode
+{
+    M2D_NINE_PATCH_STRETCH,
+    M2D_NINE_PATCH_REPEAT,
+};
+
+/**
+ * Draw the @src_rect area of the M2D_SRC source surface as a nine-patch
+ * filling @dst_rect in the target surface, with the current renderer state
+ * otherwise: blending for instance.
+ *
+ * The @insets split @src_rect into 3x3 slices: the corners are drawn as they
+ * are, the top and bottom edges fill the width, the left and right edges the
+ * height, and the center both. Corners larger than @dst_rect are shrunk,
+ * keeping their outer part.
+ *
+ * Copies of repeating nine-patches take a few draws: the tiles are repeated
+ * by copying the target onto itself. Other nine-patches are composed by the
+ * CPU into a surface of the @dst_rect size, cached with the scaled variants
+ * of @m2d_stretch_blit(), and drawn at once.
+ *
+ * @param[in] src_rect The nine-patch, in the source surface coordinates.
+ *                     The source surface position is ignored.
+ * @param[in] insets The borders of the nine-patch.
+ * @param[in] dst_rect The area to fill, in the target surface space.
+ * @param[in] mode How edges and center fill @dst_rect.
+ */
+void m2d_draw_nine_patch(const struct m2d_rectangle* src_rect, const struct m2d_insets* insets,
+                         const struct m2d_rectangle* dst_rect, enum m2d_nine_patch_mode mode);
+
+/**
+ * Fill @dst_rect with the @src_rect area of the M2D_SRC source surface
+ * repeated, as tiles starting at (@x, @y) in the target surface, with the
+ * current renderer state otherwise: blending for instance. Areas filled with
+ * the same (@x, @y) match at their borders.
+ *
+ * Copies draw the first tiles, then double the area filled by copying the
+ * target onto itself: a few draws whatever the number of tiles. Blends draw
+ * the pattern repeated by the CPU, cached with the scaled variants of
+ * @m2d_stretch_blit(). Areas up to 64x64 pixels are drawn by the CPU
+ * renderer.
+ *
+ * @param[in] src_rect The pattern tile, in the source surface coordinates.
+ *                     The source surface position is ignored.
+ * @param[in] dst_rect The area to fill, in the target surface space.
+ * @param[in] x The x coordinate of a tile in the target surface space.
+ * @param[in] y The y coordinate of a tile in the target surface space.
+ */
+void m2d_fill_pattern(const struct m2d_rectangle* src_rect, const struct m2d_rectangle* dst_rect,
+                      dim_t x, dim_t y);
+
+/**
+ * Copy the @src_rect area of the M2D_SRC source surface at (@x, @y) in the
+ * target surface, except its pixels of the key color, which are transparent.
+ * The source is RGB565 or ARGB8888, compared without its alpha. Blending is
+ * not applied: other pixels replace the target ones, alpha included, with
+ * both renderers.
+ *
+ * The GPU draws the source through an A8 mask of the key, made by the CPU and
+ * cached with the scaled variants of @m2d_stretch_blit(): the source keeps
+ * its format. The CPU renderer blits by the CPU.
+ *
+ * @param[in] src_rect The area to copy, in the source surface coordinates.
+ *                     The source surface position is ignored.
+ * @param[in] x The x coordinate of the area in the target surface space.
+ * @param[in] y The y coordinate of the area in the target surface space.
+ * @param[in] red The red component of the key color.
+ * @param[in] green The green component of the key color.
+ * @param[in] blue The blue component of the key color.
+ */
+void m2d_color_key_blit(const struct m2d_rectangle* src_rect, dim_t x, dim_t y,
+                        uint8_t red, uint8_t green, uint8_t blue);
+
+/**
+ * Fill @rect with rounded corners of @radius pixels, antialiased, in the
+ * constant source color set by @m2d_source_color(). The shape is blended onto
+ * the target surface whatever the blending state.
+ *
+ * The straight edges and the interior are filled with plain rectangles; the
+ * corners are drawn through an A8 coverage mask rendered once by the CPU for
+ * each radius and cached. A radius larger than half the rectangle is reduced.
+ *
+ * @param[in] rect The rectangle to fill in the target surface space.
+ * @param[in] radius The radius in pixels of the corners.
+ */
+void m2d_fill_rounded_rectangle(const struct m2d_rectangle* rect, dim_t radius);
+
+/**
+ * Fill a circle, antialiased, in the constant source color set by
+ * @m2d_source_color(). The shape is blended onto the target surface whatever
+ * the blending state.
+ *
+ * This is a rounded square whose corners meet: its cached coverage mask is
+ * shared with @m2d_fill_rounded_rectangle().
+ *
+ * @param[in] x The x coordinate of the center in the target surface space.
+ * @param[in] y The y coordinate of the center in the target surface space.
+ * @param[in] radius The radius in pixels of the circle.
+ */
+void m2d_fill_circle(dim_t x, dim_t y, dim_t radius);
+
+/**
+ * Draw an arc of circle, antialiased, in the constant source color set by
+ * @m2d_source_color(). The shape is blended onto the target surface whatever
+ * the blending state.
+ *
+ * Angles are in degrees, clockwise from the positive x axis, as the y axis
+ * points down. The arc goes from @start_angle to @end_angle: a whole turn or
+ * more draws a ring. Its coverage mask is rendered once by the CPU for each
+ * radius, width and angles, and cached.
+ *
+ * @param[in] x The x coordinate of the center in the target surface space.
+ * @param[in] y The y coordinate of the center in the target surface space.
+ * @param[in] radius The outer radius in pixels of the arc.
+ * @param[in] width The width in pixels of the arc, down to a sector when
+ *                  @radius or more.
+ * @param[in] start_angle The angle where the arc starts.
+ * @param[in] end_angle The angle where the arc ends.
+ */
+void m2d_draw_arc(dim_t x, dim_t y, dim_t radius, dim_t width,
+                  int start_angle, int end_angle);
+
+/**
+ * A polygon vertex for @m2d_fill_polygon(), at point (@x, @y) in the target
+ * surface space.
+ */
+struct m2d_point {
+	dim_t x;
+	dim_t y;
+};
+
+/**
+ * Fill a polygon according to the current renderer state, M2D_SRC being
+ * disabled: with the constant source color, blended if blending is enabled.
+ * This is asynchronous (non-blocking).
+ *
+ * Pixels whose center is inside the polygon, by the nonzero winding rule,
+ * are filled, without antialiasing. The CPU converts the polygon into the
+ * horizontal spans of each row, merging the spans of consecutive rows with
+ * the same extents into taller rectangles, and the GPU fills them all with a
+ * single command. Rows and spans out of the target are clipped.
+ *
+ * @param[in] points The vertices of the polygon, closed from the last one to
+ *                   the first one.
+ * @param[in] num_points The number of points in the 'points' array.
+ */
+void m2d_fill_polygon(const struct m2d_point* points, size_t num_points);
+
+/**
+ * Fill an ellipse as @m2d_fill_polygon() fills polygons.
+ *
+ * @param[in] x The x coordinate of the center in the target surface space.
+ * @param[in] y The y coordinate of the center in the target surface space.
+ * @param[in] radius_x The horizontal radius in pixels.
+ * @param[in] radius_y The vertical radius in pixels.
+ */
+void m2d_fill_ellipse(dim_t x, dim_t y, dim_t radius_x, dim_t radius_y);
+
+/**
+ * Fill a pie slice, a sector of circle, as @m2d_fill_polygon() fills
+ * polygons.
+ *
+ * Angles are in degrees, clockwise from the positive x axis, as for
+ * @m2d_draw_arc(): a whole turn or more fills a circle.
+ *
+ * @param[in] x The x coordinate of the center in the target surface space.
+ * @param[in] y The y coordinate of the center in the target surface space.
+ * @param[in] radius The radius in pixels of the slice.
+ * @param[in] start_angle The angle where the slice starts.
+ * @param[in] end_angle The angle where the slice ends.
+ */
+void m2d_fill_pie(dim_t x, dim_t y, dim_t radius, int start_angle, int end_angle);
+
 
 /* LINES OPERATIONS ARE NOT SUPPORTED BY THE GFX2D */
 
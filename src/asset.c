@@ -0,0 +1,965 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/asset.h"
+#include "m2d_priv.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * File layout, all fields being little-endian:
+ *
+ *   struct asset_header
+ *   struct asset_surface[num_surfaces]
+ *   struct asset_image[num_images], sorted by name
+ *   strings: NUL-terminated image names
+ *   surface data, each surface starting on an ASSET_ALIGN boundary
+ *
+ * The structures are serialized field by field, in order, without padding:
+ * ASSET_*_SIZE bytes each.
+ */
+#define ASSET_MAGIC "M2DA"
+#define ASSET_VERSION 1
+#define ASSET_ALIGN 4096
+
+#define ASSET_HEADER_SIZE 24
+#define ASSET_SURFACE_SIZE 40
+#define ASSET_IMAGE_SIZE 24
+
+/* Transparent pixels kept between images packed in the same page. */
+#define ASSET_GAP 1
+
+enum asset_compression
+{
+    ASSET_RAW,
+    ASSET_RLE,
+};
+
+struct asset_header
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t num_surfaces;
+    uint32_t num_images;
+    uint32_t strings_size;
+    uint32_t reserved;
+};
+
+struct asset_surface
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t format;
+    uint32_t compression;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct asset_image
+{
+    uint32_t name;
+    uint32_t surface;
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct m2d_asset_pack
+{
+    int fd;
+    struct asset_header header;
+    struct asset_surface* surfaces;
+    struct asset_image* images;
+    char* strings;
+    struct m2d_buffer** buffers;
+};
+
+static uint32_t asset_get32(const uint8_t** p)
+{
+    const uint8_t* b = *p;
+
+    *p += 4;
+
+    return (uint32_t)b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+static uint64_t asset_get64(const uint8_t** p)
+{
+    uint64_t low = asset_get32(p);
+
+    return low | (uint64_t)asset_get32(p) << 32;
+}
+
+static void asset_put32(uint8_t** p, uint32_t value)
+{
+    uint8_t* b = *p;
+
+    b[0] = (uint8_t)value;
+    b[1] = (uint8_t)(value >> 8);
+    b[2] = (uint8_t)(value >> 16);
+    b[3] = (uint8_t)(value >> 24);
+    *p += 4;
+}
+
+static void asset_put64(uint8_t** p, uint64_t value)
+{
+    asset_put32(p, (uint32_t)value);
+    asset_put32(p, (uint32_t)(value >> 32));
+}
+
+static void asset_get_header(const uint8_t** p, struct asset_header* header)
+{
+    memcpy(header->magic, *p, sizeof(header->magic));
+    *p += sizeof(header->magic);
+    header->version = asset_get32(p);
+    header->num_surfaces = asset_get32(p);
+    header->num_images = asset_get32(p);
+    header->strings_size = asset_get32(p);
+    header->reserved = asset_get32(p);
+}
+
+static void asset_put_header(uint8_t** p, const struct asset_header* header)
+{
+    memcpy(*p, header->magic, sizeof(header->magic));
+    *p += sizeof(header->magic);
+    asset_put32(p, header->version);
+    asset_put32(p, header->num_surfaces);
+    asset_put32(p, header->num_images);
+    asset_put32(p, header->strings_size);
+    asset_put32(p, header->reserved);
+}
+
+static void asset_get_surface(const uint8_t** p, struct asset_surface* surface)
+{
+    surface->width = asset_get32(p);
+    surface->height = asset_get32(p);
+    surface->stride = asset_get32(p);
+    surface->format = asset_get32(p);
+    surface->compression = asset_get32(p);
+    surface->reserved = asset_get32(p);
+    surface->offset = asset_get64(p);
+    surface->size = asset_get64(p);
+}
+
+static void asset_put_surface(uint8_t** p, const struct asset_surface* surface)
+{
+    asset_put32(p, surface->width);
+    asset_put32(p, surface->height);
+    asset_put32(p, surface->stride);
+    asset_put32(p, surface->format);
+    asset_put32(p, surface->compression);
+    asset_put32(p, surface->reserved);
+    asset_put64(p, surface->offset);
+    asset_put64(p, surface->size);
+}
+
+static void asset_get_image(const uint8_t** p, struct asset_image* image)
+{
+    image->name = asset_get32(p);
+    image->surface = asset_get32(p);
+    image->x = asset_get32(p);
+    image->y = asset_get32(p);
+    image->width = asset_get32(p);
+    image->height = asset_get32(p);
+}
+
+static void asset_put_image(uint8_t** p, const struct asset_image* image)
+{
+    asset_put32(p, image->name);
+    asset_put32(p, image->surface);
+    asset_put32(p, image->x);
+    asset_put32(p, image->y);
+    asset_put32(p, image->width);
+    asset_put32(p, image->height);
+}
+
+static size_t asset_stride(size_t width, enum m2d_pixel_format format)
+{
+    return (width * m2d_byte_per_pixel(format) + 3) & ~(size_t)3;
+}
+
+static int asset_read(int fd, void* data, size_t size, off_t offset)
+{
+    uint8_t* p = data;
+
+    while (size)
+    {
+        ssize_t n = pread(fd, p, size, offset);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            LIBM2D_ERROR("failed to read asset pack: %s\n", strerror(errno));
+            return -1;
+        }
+
+        if (!n)
+        {
+            LIBM2D_ERROR("unexpected end of asset pack\n");
+            return -1;
+        }
+
+        p += n;
+        size -= (size_t)n;
+        offset += n;
+    }
+
+    return 0;
+}
+
+static bool asset_pack_is_valid(const struct m2d_asset_pack* pack, uint64_t file_size)
+{
+    const struct asset_header* header = &pack->header;
+    uint32_t i;
+
+    /* Image names are checked to be in range below: a pack may be empty. */
+    if (header->strings_size && pack->strings[header->strings_size - 1])
+        return false;
+
+    for (i = 0; i < header->num_surfaces; i++)
+    {
+        const struct asset_surface* surface = &pack->surfaces[i];
+        size_t bpp = m2d_byte_per_pixel((enum m2d_pixel_format)surface->format);
+
+        if (!bpp || surface->format >= M2D_NUM_PIXEL_FORMATS ||
+            surface->stride % 4 || surface->stride < (uint64_t)surface->width * bpp)
+            return false;
+
+        if (surface->offset > file_size || surface->size > file_size - surface->offset)
+            return false;
+
+        if (surface->compression == ASSET_RAW)
+        {
+            if (surface->size != (uint64_t)surface->height * surface->stride)
+                return false;
+        }
+        else if (surface->compression != ASSET_RLE)
+        {
+            return false;
+        }
+    }
+
+    for (i = 0; i < header->num_images; i++)
+    {
+        const struct asset_image* image = &pack->images[i];
+        const struct asset_surface* surface;
+
+        if (image->name >= header->strings_size || image->surface >= header->num_surfaces)
+            return false;
+
+        surface = &pack->surfaces[image->surface];
+        if (image->x > surface->width || image->width > surface->width - image->x ||
+            image->y > surface->height || image->height > surface->height - image->y)
+            return false;
+    }
+
+    return true;
+}
+
+struct m2d_asset_pack* m2d_asset_pack_open(const char* filename)
+{
+    uint8_t raw_header[ASSET_HEADER_SIZE];
+    struct m2d_asset_pack* pack;
+    struct asset_header* header;
+    const uint8_t* p;
+    uint8_t* index = NULL;
+    uint64_t index_size;
+    struct stat st;
+    uint32_t i;
+
+    pack = calloc(1, sizeof(*pack));
+    if (!pack)
+    {
+        LIBM2D_ERROR("failed to allocate asset pack: %s\n", strerror(errno));
+        return NULL;
+    }
+    header = &pack->header;
+
+    pack->fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (pack->fd < 0)
+    {
+        LIBM2D_ERROR("failed to open %s: %s\n", filename, strerror(errno));
+        goto free_pack;
+    }
+
+    if (fstat(pack->fd, &st))
+    {
+        LIBM2D_ERROR("failed to stat %s: %s\n", filename, strerror(errno));
+        goto close_file;
+    }
+
+    if (asset_read(pack->fd, raw_header, sizeof(raw_header), 0))
+        goto close_file;
+
+    p = raw_header;
+    asset_get_header(&p, header);
+
+    if (memcmp(header->magic, ASSET_MAGIC, sizeof(header->magic)) ||
+        header->version != ASSET_VERSION)
+    {
+        LIBM2D_ERROR("%s is not a supported asset pack\n", filename);
+        goto close_file;
+    }
+
+    index_size = (uint64_t)header->num_surfaces * ASSET_SURFACE_SIZE +
+                 (uint64_t)header->num_images * ASSET_IMAGE_SIZE +
+                 header->strings_size;
+    if (index_size > (uint64_t)st.st_size - ASSET_HEADER_SIZE)
+    {
+        LIBM2D_ERROR("%s: truncated asset pack\n", filename);
+        goto close_file;
+    }
+
+    index = malloc(index_size);
+    pack->surfaces = calloc(header->num_surfaces, sizeof(*pack->surfaces));
+    pack->images = calloc(header->num_images, sizeof(*pack->images));
+    pack->strings = malloc(header->strings_size);
+    if ((index_size && !index) || (header->num_surfaces && !pack->surfaces) ||
+        (header->num_images && !pack->images) || (header->strings_size && !pack->strings))
+    {
+        LIBM2D_ERROR("failed to allocate asset pack index: %s\n", strerror(errno));
+        goto free_index;
+    }
+
+    if (asset_read(pack->fd, index, index_size, ASSET_HEADER_SIZE))
+        goto free_index;
+
+    p = index;
+    for (i = 0; i < header->num_surfaces; i++)
+        asset_get_surface(&p, &pack->surfaces[i]);
+    for (i = 0; i < header->num_images; i++)
+        asset_get_image(&p, &pack->images[i]);
+    if (header->strings_size)
+        memcpy(pack->strings, p, header->strings_size);
+
+    free(index);
+    index = NULL;
+
+    if (!asset_pack_is_valid(pack, st.st_size))
+    {
+        LIBM2D_ERROR("%s: corrupted asset pack\n", filename);
+        goto free_index;
+    }
+
+    pack->buffers = calloc(header->num_surfaces, sizeof(*pack->buffers));
+    if (header->num_surfaces && !pack->buffers)
+    {
+        LIBM2D_ERROR("failed to allocate asset pack surfaces: %s\n", strerror(errno));
+        goto free_index;
+    }
+
+    LIBM2D_DEBUG("opened asset pack %s (%u surface(s), %u image(s))\n",
+                 filename, header->num_surfaces, header->num_images);
+
+    return pack;
+
+free_index:
+    free(index);
+    free(pack->strings);
+    free(pack->images);
+    free(pack->surfaces);
+
+close_file:
+    close(pack->fd);
+
+free_pack:
+    free(pack);
+
+    return NULL;
+}
+
+void m2d_asset_pack_close(struct m2d_asset_pack* pack)
+{
+    uint32_t i;
+
+    if (!pack)
+        return;
+
+    for (i = 0; i < pack->header.num_surfaces; i++)
+        m2d_free(pack->buffers[i]);
+
+    free(pack->buffers);
+    free(pack->strings);
+    free(pack->images);
+    free(pack->surfaces);
+    close(pack->fd);
+    free(pack);
+}
+
+/* Compressed data is decoded from the page cache, without any copy. */
+static int asset_decode_rle(struct m2d_asset_pack* pack,
+                            const struct asset_surface* surface, void* data)
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    off_t start = (off_t)(surface->offset & ~(uint64_t)(page_size - 1));
+    size_t delta = (size_t)(surface->offset - (uint64_t)start);
+    size_t length = delta + surface->size;
+    void* map;
+    int ret;
+
+    map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, pack->fd, start);
+    if (map == MAP_FAILED)
+    {
+        LIBM2D_ERROR("failed to map asset pack: %s\n", strerror(errno));
+        return -1;
+    }
+
+    ret = m2d_rle_decode(data, (size_t)surface->height * surface->stride,
+                         (const uint8_t*)map + delta, surface->size,
+                         m2d_byte_per_pixel((enum m2d_pixel_format)surface->format));
+    if (ret)
+        LIBM2D_ERROR("corrupted asset surface\n");
+
+    munmap(map, length);
+
+    return ret;
+}
+
+static struct m2d_buffer* asset_load_surface(struct m2d_asset_pack* pack, uint32_t index)
+{
+    const struct asset_surface* surface = &pack->surfaces[index];
+    struct m2d_buffer* buf;
+    struct timespec timeout;
+    void* data;
+    int ret;
+
+    if (pack->buffers[index])
+        return pack->buffers[index];
+
+    buf = m2d_alloc(surface->width, surface->height,
+                    (enum m2d_pixel_format)surface->format, surface->stride);
+    if (!buf)
+        return NULL;
+
+    m2d_set_tag(buf, "asset");
+
+    if (m2d_get_stride(buf) != surface->stride)
+    {
+        LIBM2D_ERROR("unexpected asset surface stride: %zu instead of %u\n",
+                     m2d_get_stride(buf), surface->stride);
+        goto free_buffer;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &timeout);
+    timeout.tv_sec += 1;
+    if (m2d_sync_for_cpu(buf, &timeout))
+        goto free_buffer;
+
+    data = m2d_get_data(buf);
+    if (!data)
+        goto free_buffer;
+
+    if (surface->compression == ASSET_RLE)
+        ret = asset_decode_rle(pack, surface, data);
+    else
+        ret = asset_read(pack->fd, data, surface->size, (off_t)surface->offset);
+    if (ret)
+        goto free_buffer;
+
+    m2d_sync_for_gpu(buf);
+
+    /* The CPU is done with it. */
+    m2d_unmap(buf);
+
+    LIBM2D_DEBUG("loaded asset surface %u in buffer %u\n", index, buf->id);
+
+    pack->buffers[index] = buf;
+
+    return buf;
+
+free_buffer:
+    m2d_free(buf);
+
+    return NULL;
+}
+
+int m2d_asset_pack_load(struct m2d_asset_pack* pack)
+{
+    uint32_t i;
+
+    for (i = 0; i < pack->header.num_surfaces; i++)
+        if (!asset_load_surface(pack, i))
+            return -1;
+
+    return 0;
+}
+
+size_t m2d_asset_pack_num_images(const struct m2d_asset_pack* pack)
+{
+    return pack->header.num_images;
+}
+
+const char* m2d_asset_pack_image_name(const struct m2d_asset_pack* pack, size_t index)
+{
+    if (index >= pack->header.num_images)
+        return NULL;
+
+    return pack->strings + pack->images[index].name;
+}
+
+int m2d_asset_pack_get(struct m2d_asset_pack* pack, const char* name,
+                       struct m2d_atlas_image* image)
+{
+    size_t low = 0;
+    size_t high = pack->header.num_images;
+
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        const struct asset_image* entry = &pack->images[middle];
+        int cmp = strcmp(name, pack->strings + entry->name);
+
+        if (cmp < 0)
+        {
+            high = middle;
+        }
+        else if (cmp > 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            image->page = asset_load_surface(pack, entry->surface);
+            if (!image->page)
+                return -1;
+
+            image->rect.x = (dim_t)entry->x;
+            image->rect.y = (dim_t)entry->y;
+            image->rect.w = (dim_t)entry->width;
+            image->rect.h = (dim_t)entry->height;
+
+            return 0;
+        }
+    }
+
+    LIBM2D_ERROR("no such asset: %s\n", name);
+
+    return -1;
+}
+
+/*
+ * Writer: pixels are kept in memory until saved. Atlas pages only store the
+ * area actually used by their images.
+ */
+struct asset_page
+{
+    enum m2d_pixel_format format;
+    unsigned int flags; /* M2D_ASSET_RLE, shared by all its images */
+    struct m2d_packer* packer; /* NULL for standalone surfaces */
+    size_t width;
+    size_t height;
+    size_t stride;
+    size_t used_width;
+    size_t used_height;
+    uint8_t* data;
+};
+
+struct asset_entry
+{
+    char* name;
+    size_t page;
+    struct m2d_rectangle rect;
+};
+
+struct m2d_asset_writer
+{
+    size_t page_width;
+    size_t page_height;
+    unsigned int flags;
+
+    struct asset_page* pages;
+    size_t num_pages;
+
+    struct asset_entry* entries;
+    size_t num_entries;
+};
+
+struct m2d_asset_writer* m2d_asset_writer_create(size_t page_width, size_t page_height,
+                                                 unsigned int flags)
+{
+    struct m2d_asset_writer* writer;
+
+    writer = calloc(1, sizeof(*writer));
+    if (!writer)
+    {
+        LIBM2D_ERROR("failed to allocate asset writer: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    writer->page_width = page_width;
+    writer->page_height = page_height;
+    writer->flags = flags;
+
+    return writer;
+}
+
+void m2d_asset_writer_destroy(struct m2d_asset_writer* writer)
+{
+    size_t i;
+
+    if (!writer)
+        return;
+
+    for (i = 0; i < writer->num_pages; i++)
+    {
+        m2d_packer_destroy(writer->pages[i].packer);
+        free(writer->pages[i].data);
+    }
+
+    for (i = 0; i < writer->num_entries; i++)
+        free(writer->entries[i].name);
+
+    free(writer->pages);
+    free(writer->entries);
+    free(writer);
+}
+
+static struct asset_page* asset_writer_new_page(struct m2d_asset_writer* writer,
+                                                enum m2d_pixel_format format,
+                                                unsigned int flags,
+                                                size_t width, size_t height,
+                                                bool atlas)
+{
+    struct asset_page* pages;
+    struct asset_page* page;
+
+    pages = realloc(writer->pages, (writer->num_pages + 1) * sizeof(*pages));
+    if (!pages)
+        return NULL;
+    writer->pages = pages;
+
+    page = &pages[writer->num_pages];
+    memset(page, 0, sizeof(*page));
+    page->format = format;
+    page->flags = flags & M2D_ASSET_RLE;
+    page->width = width;
+    page->height = height;
+    page->stride = asset_stride(width, format);
+
+    if (atlas)
+    {
+        page->packer = m2d_packer_create(width, height);
+        if (!page->packer)
+            return NULL;
+    }
+
+    page->data = calloc(height, page->stride);
+    if (!page->data)
+    {
+        m2d_packer_destroy(page->packer);
+        return NULL;
+    }
+
+    writer->num_pages++;
+
+    return page;
+}
+
+int m2d_asset_writer_add(struct m2d_asset_writer* writer, const char* name,
+                         const struct m2d_image* image, unsigned int flags)
+{
+    size_t bpp = m2d_byte_per_pixel(image->format);
+    size_t width = image->width + ASSET_GAP;
+    size_t height = image->height + ASSET_GAP;
+    struct asset_entry* entries;
+    struct asset_entry* entry;
+    struct asset_page* page = NULL;
+    dim_t x = 0;
+    dim_t y = 0;
+    size_t row;
+    size_t i;
+
+    if (!bpp || !image->width || !image->height)
+    {
+        LIBM2D_ERROR("%s: invalid image\n", name);
+        return -1;
+    }
+
+    for (i = 0; i < writer->num_entries; i++)
+    {
+        if (!strcmp(writer->entries[i].name, name))
+        {
+            LIBM2D_ERROR("%s: duplicated image name\n", name);
+            return -1;
+        }
+    }
+
+    flags |= writer->flags;
+    if (!(flags & M2D_ASSET_STANDALONE) &&
+        width <= writer->page_width && height <= writer->page_height)
+    {
+        for (i = 0; i < writer->num_pages && !page; i++)
+        {
+            if (writer->pages[i].packer && writer->pages[i].format == image->format &&
+                writer->pages[i].flags == (flags & M2D_ASSET_RLE) &&
+                m2d_packer_add(writer->pages[i].packer, width, height, &x, &y))
+                page = &writer->pages[i];
+        }
+
+        if (!page)
+        {
+            page = asset_writer_new_page(writer, image->format, flags, writer->page_width,
+                                         writer->page_height, true);
+            if (!page || !m2d_packer_add(page->packer, width, height, &x, &y))
+                goto error;
+        }
+    }
+    else
+    {
+        page = asset_writer_new_page(writer, image->format, flags, image->width,
+                                     image->height, false);
+        if (!page)
+            goto error;
+    }
+
+    entries = realloc(writer->entries, (writer->num_entries + 1) * sizeof(*entries));
+    if (!entries)
+        goto error;
+    writer->entries = entries;
+
+    entry = &entries[writer->num_entries];
+    entry->name = strdup(name);
+    if (!entry->name)
+        goto error;
+    entry->page = (size_t)(page - writer->pages);
+    entry->rect.x = x;
+    entry->rect.y = y;
+    entry->rect.w = (dim_t)image->width;
+    entry->rect.h = (dim_t)image->height;
+    writer->num_entries++;
+
+    for (row = 0; row < image->height; row++)
+        memcpy(page->data + (y + row) * page->stride + x * bpp,
+               (const uint8_t*)image->data + row * image->stride, image->width * bpp);
+
+    if (x + image->width > page->used_width)
+        page->used_width = x + image->width;
+    if (y + image->height > page->used_height)
+        page->used_height = y + image->height;
+
+    return 0;
+
+error:
+    LIBM2D_ERROR("%s: failed to add image: %s\n", name, strerror(errno));
+
+    return -1;
+}
+
+static int asset_entry_compare(const void* a, const void* b)
+{
+    const struct asset_entry* const* entry_a = a;
+    const struct asset_entry* const* entry_b = b;
+
+    return strcmp((*entry_a)->name, (*entry_b)->name);
+}
+
+static uint64_t asset_align(uint64_t offset)
+{
+    return (offset + ASSET_ALIGN - 1) & ~(uint64_t)(ASSET_ALIGN - 1);
+}
+
+/* Crop a page to its used area, and compress it if worth it. */
+static void* asset_page_data(const struct asset_page* page, struct asset_surface* surface)
+{
+    size_t bpp = m2d_byte_per_pixel(page->format);
+    size_t size;
+    size_t row;
+    uint8_t* data;
+    uint8_t* rle;
+
+    surface->width = (uint32_t)page->used_width;
+    surface->height = (uint32_t)page->used_height;
+    surface->stride = (uint32_t)asset_stride(page->used_width, page->format);
+    surface->format = page->format;
+    surface->compression = ASSET_RAW;
+
+    size = (size_t)surface->height * surface->stride;
+    data = calloc(1, size);
+    if (!data)
+        return NULL;
+
+    for (row = 0; row < surface->height; row++)
+        memcpy(data + row * surface->stride, page->data + row * page->stride,
+               page->used_width * bpp);
+    surface->size = size;
+
+    if (!(page->flags & M2D_ASSET_RLE))
+        return data;
+
+    rle = malloc(m2d_rle_bound(size, bpp));
+    if (!rle)
+        return data;
+
+    surface->size = m2d_rle_encode(rle, data, size, bpp);
+    if (surface->size >= size)
+    {
+        surface->size = size;
+        free(rle);
+        return data;
+    }
+
+    surface->compression = ASSET_RLE;
+    free(data);
+
+    return rle;
+}
+
+static int asset_write(FILE* file, const void* data, size_t size)
+{
+    if (size && fwrite(data, size, 1, file) != 1)
+    {
+        LIBM2D_ERROR("failed to write asset pack: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int asset_pad(FILE* file, uint64_t offset)
+{
+    static const uint8_t zeros[ASSET_ALIGN];
+    long position = ftell(file);
+
+    if (position < 0 || (uint64_t)position > offset)
+        return -1;
+
+    return asset_write(file, zeros, (size_t)(offset - (uint64_t)position));
+}
+
+int m2d_asset_writer_save(struct m2d_asset_writer* writer, const char* filename)
+{
+    struct asset_header header = {
+        .magic = ASSET_MAGIC,
+        .version = ASSET_VERSION,
+        .num_surfaces = (uint32_t)writer->num_pages,
+        .num_images = (uint32_t)writer->num_entries,
+    };
+    const struct asset_entry** sorted = NULL;
+    struct asset_surface* surfaces = NULL;
+    struct asset_image* images = NULL;
+    void** blobs = NULL;
+    char* strings = NULL;
+    uint8_t* index = NULL;
+    FILE* file = NULL;
+    size_t index_size;
+    uint64_t offset;
+    uint8_t* p;
+    size_t i;
+    int ret = -1;
+
+    sorted = calloc(writer->num_entries, sizeof(*sorted));
+    images = calloc(writer->num_entries, sizeof(*images));
+    surfaces = calloc(writer->num_pages, sizeof(*surfaces));
+    blobs = calloc(writer->num_pages, sizeof(*blobs));
+    if ((writer->num_entries && (!sorted || !images)) ||
+        (writer->num_pages && (!surfaces || !blobs)))
+        goto out;
+
+    /* Images are sorted by name, for lookups to be a binary search. */
+    for (i = 0; i < writer->num_entries; i++)
+    {
+        sorted[i] = &writer->entries[i];
+        header.strings_size += (uint32_t)strlen(writer->entries[i].name) + 1;
+    }
+    qsort(sorted, writer->num_entries, sizeof(*sorted), asset_entry_compare);
+
+    strings = malloc(header.strings_size);
+    if (header.strings_size && !strings)
+        goto out;
+
+    offset = 0;
+    for (i = 0; i < writer->num_entries; i++)
+    {
+        size_t length = strlen(sorted[i]->name) + 1;
+
+        memcpy(strings + offset, sorted[i]->name, length);
+        images[i].name = (uint32_t)offset;
+        images[i].surface = (uint32_t)sorted[i]->page;
+        images[i].x = (uint32_t)sorted[i]->rect.x;
+        images[i].y = (uint32_t)sorted[i]->rect.y;
+        images[i].width = (uint32_t)sorted[i]->rect.w;
+        images[i].height = (uint32_t)sorted[i]->rect.h;
+        offset += length;
+    }
+
+    index_size = ASSET_HEADER_SIZE + writer->num_pages * ASSET_SURFACE_SIZE +
+                 writer->num_entries * ASSET_IMAGE_SIZE + header.strings_size;
+    index = malloc(index_size);
+    if (!index)
+        goto out;
+
+    offset = index_size;
+    for (i = 0; i < writer->num_pages; i++)
+    {
+        blobs[i] = asset_page_data(&writer->pages[i], &surfaces[i]);
+        if (!blobs[i])
+            goto out;
+
+        surfaces[i].offset = asset_align(offset);
+        offset = surfaces[i].offset + surfaces[i].size;
+    }
+
+    p = index;
+    asset_put_header(&p, &header);
+    for (i = 0; i < writer->num_pages; i++)
+        asset_put_surface(&p, &surfaces[i]);
+    for (i = 0; i < writer->num_entries; i++)
+        asset_put_image(&p, &images[i]);
+    if (header.strings_size)
+        memcpy(p, strings, header.strings_size);
+
+    file = fopen(filename, "wb");
+    if (!file)
+    {
+        LIBM2D_ERROR("failed to create %s: %s\n", filename, strerror(errno));
+        goto out;
+    }
+
+    if (asset_write(file, index, index_size))
+        goto out;
+
+    for (i = 0; i < writer->num_pages; i++)
+    {
+        if (asset_pad(file, surfaces[i].offset) ||
+            asset_write(file, blobs[i], (size_t)surfaces[i].size))
+            goto out;
+    }
+
+    ret = 0;
+
+out:
+    if (file && fclose(file))
+    {
+        LIBM2D_ERROR("failed to write %s: %s\n", filename, strerror(errno));
+        ret = -1;
+    }
+
+    if (ret)
+        LIBM2D_ERROR("failed to save asset pack %s\n", filename);
+
+    for (i = 0; blobs && i < writer->num_pages; i++)
+        free(blobs[i]);
+    free(blobs);
+    free(index);
+    free(strings);
+    free(surfaces);
+    free(images);
+    free(sorted);
+
+    return ret;
+}
@@ -0,0 +1,496 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/atlas.h"
+#include "m2d_priv.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Skyline bottom-left packer: the top edge of the packed rectangles is kept
+ * as a list of horizontal segments, sorted by x and covering the whole bin
+ * width. A new rectangle is placed on the segment minimizing its bottom edge.
+ */
+struct m2d_skyline_node
+{
+    int x;
+    int y;
+    int width;
+};
+
+struct m2d_packer
+{
+    int width;
+    int height;
+
+    struct m2d_skyline_node* nodes;
+    size_t num_nodes;
+};
+
+struct m2d_atlas
+{
+    size_t page_width;
+    size_t page_height;
+    enum m2d_pixel_format format;
+
+    struct m2d_buffer** pages;
+    struct m2d_packer** packers;
+    size_t num_pages;
+};
+
+struct m2d_packer* m2d_packer_create(size_t width, size_t height)
+{
+    struct m2d_packer* packer;
+
+    if (!width || !height || width > INT_MAX || height > INT_MAX)
+        return NULL;
+
+    packer = calloc(1, sizeof(*packer));
+    if (!packer)
+    {
+        LIBM2D_ERROR("could not allocate memory for packer: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    /* There can't be more segments than pixel columns. */
+    packer->nodes = calloc(width, sizeof(*packer->nodes));
+    if (!packer->nodes)
+    {
+        LIBM2D_ERROR("could not allocate memory for packer: %s\n", strerror(errno));
+        free(packer);
+        return NULL;
+    }
+
+    packer->width = (int)width;
+    packer->height = (int)height;
+    m2d_packer_reset(packer);
+
+    return packer;
+}
+
+void m2d_packer_destroy(struct m2d_packer* packer)
+{
+    if (!packer)
+        return;
+
+    free(packer->nodes);
+    free(packer);
+}
+
+void m2d_packer_reset(struct m2d_packer* packer)
+{
+    packer->nodes[0].x = 0;
+    packer->nodes[0].y = 0;
+    packer->nodes[0].width = packer->width;
+    packer->num_nodes = 1;
+}
+
+/*
+ * Compute the y coordinate where a @width x @height rectangle would land if
+ * its left edge was aligned with node @index, -1 if it doesn't fit there.
+ */
+static int m2d_packer_fit(const struct m2d_packer* packer, size_t index,
+                          int width, int height)
+{
+    const struct m2d_skyline_node* node = &packer->nodes[index];
+    int width_left = width;
+    int y = node->y;
+
+    if (node->x + width > packer->width)
+        return -1;
+
+    while (width_left > 0)
+    {
+        y = max_int(y, node->y);
+        if (y + height > packer->height)
+            return -1;
+
+        width_left -= node->width;
+        node++;
+    }
+
+    return y;
+}
+
+static void m2d_packer_insert(struct m2d_packer* packer, size_t index,
+                              int x, int y, int width)
+{
+    struct m2d_skyline_node* nodes = packer->nodes;
+    size_t i;
+
+    memmove(&nodes[index + 1], &nodes[index],
+            (packer->num_nodes - index) * sizeof(*nodes));
+    nodes[index].x = x;
+    nodes[index].y = y;
+    nodes[index].width = width;
+    packer->num_nodes++;
+
+    /* Trim or remove the segments now hidden below the new one. */
+    i = index + 1;
+    while (i < packer->num_nodes)
+    {
+        const struct m2d_skyline_node* prev = &nodes[i - 1];
+        int shrink = prev->x + prev->width - nodes[i].x;
+
+        if (shrink <= 0)
+            break;
+
+        if (shrink < nodes[i].width)
+        {
+            nodes[i].x += shrink;
+            nodes[i].width -= shrink;
+            break;
+        }
+
+        memmove(&nodes[i], &nodes[i + 1],
+                (packer->num_nodes - i - 1) * sizeof(*nodes));
+        packer->num_nodes--;
+    }
+
+    /* Merge neighbour segments at the same height. */
+    i = 0;
+    while (i + 1 < packer->num_nodes)
+    {
+        if (nodes[i].y == nodes[i + 1].y)
+        {
+            nodes[i].width += nodes[i + 1].width;
+            memmove(&nodes[i + 1], &nodes[i + 2],
+                    (packer->num_nodes - i - 2) * sizeof(*nodes));
+            packer->num_nodes--;
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+bool m2d_packer_add(struct m2d_packer* packer, size_t width, size_t height,
+                    dim_t* x, dim_t* y)
+{
+    int best_bottom = INT_MAX;
+    int best_width = INT_MAX;
+    size_t best_index = 0;
+    int best_y = 0;
+    size_t i;
+
+    if (!width || !height ||
+        width > (size_t)packer->width || height > (size_t)packer->height)
+        return false;
+
+    for (i = 0; i < packer->num_nodes; i++)
+    {
+        int top = m2d_packer_fit(packer, i, (int)width, (int)height);
+        int bottom = top + (int)height;
+
+        if (top < 0)
+            continue;
+
+        if (bottom < best_bottom ||
+            (bottom == best_bottom && packer->nodes[i].width < best_width))
+        {
+            best_bottom = bottom;
+            best_width = packer->nodes[i].width;
+            best_index = i;
+            best_y = top;
+        }
+    }
+
+    if (best_bottom == INT_MAX)
+        return false;
+
+    *x = packer->nodes[best_index].x;
+    *y = best_y;
+    m2d_packer_insert(packer, best_index, *x, best_bottom, (int)width);
+
+    return true;
+}
+
+struct m2d_atlas* m2d_atlas_create(size_t page_width, size_t page_height,
+                                   enum m2d_pixel_format format)
+{
+    struct m2d_atlas* atlas;
+
+    if (!page_width || !page_height || !m2d_byte_per_pixel(format))
+    {
+        LIBM2D_ERROR("invalid atlas page: [%zux%zu], format: %s\n",
+                     page_width, page_height, m2d_format_name(format));
+        return NULL;
+    }
+
+    atlas = calloc(1, sizeof(*atlas));
+    if (!atlas)
+    {
+        LIBM2D_ERROR("could not allocate memory for atlas: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    atlas->page_width = page_width;
+    atlas->page_height = page_height;
+    atlas->format = format;
+
+    return atlas;
+}
+
+void m2d_atlas_destroy(struct m2d_atlas* atlas)
+{
+    size_t i;
+
+    if (!atlas)
+        return;
+
+    for (i = 0; i < atlas->num_pages; i++)
+    {
+        m2d_packer_destroy(atlas->packers[i]);
+        m2d_free(atlas->pages[i]);
+    }
+
+    free(atlas->packers);
+    free(atlas->pages);
+    free(atlas);
+}
+
+static int m2d_atlas_add_page(struct m2d_atlas* atlas)
+{
+    /* 4-byte aligned rows, as for any surface shared with pixman/cairo. */
+    size_t stride = (atlas->page_width * m2d_byte_per_pixel(atlas->format) + 3) & ~(size_t)3;
+    struct m2d_buffer** pages;
+    struct m2d_packer** packers;
+    struct m2d_rectangle rect;
+    struct m2d_buffer* page;
+    struct m2d_packer* packer;
+
+    pages = realloc(atlas->pages, (atlas->num_pages + 1) * sizeof(*pages));
+    if (!pages)
+        goto enomem;
+    atlas->pages = pages;
+
+    packers = realloc(atlas->packers, (atlas->num_pages + 1) * sizeof(*packers));
+    if (!packers)
+        goto enomem;
+    atlas->packers = packers;
+
+    packer = m2d_packer_create(atlas->page_width, atlas->page_height);
+    if (!packer)
+        return -1;
+
+    page = m2d_alloc(atlas->page_width, atlas->page_height, atlas->format, stride);
+    if (!page)
+    {
+        m2d_packer_destroy(packer);
+        return -1;
+    }
+
+    /* Start from a transparent page: gaps between images must not show garbage. */
+    m2d_push_state();
+    m2d_set_target(page);
+    m2d_source_enable(M2D_SRC, false);
+    m2d_source_enable(M2D_DST, false);
+    m2d_blend_enable(false);
+    m2d_source_color(0, 0, 0, 0);
+    rect.x = 0;
+    rect.y = 0;
+    rect.w = (dim_t)atlas->page_width;
+    rect.h = (dim_t)atlas->page_height;
+    m2d_draw_rectangles(&rect, 1);
+    m2d_pop_state();
+
+    m2d_set_tag(page, "atlas");
+
+    atlas->pages[atlas->num_pages] = page;
+    atlas->packers[atlas->num_pages] = packer;
+    atlas->num_pages++;
+
+    LIBM2D_DEBUG("atlas page %zu: buffer %u\n", atlas->num_pages - 1, page->id);
+
+    return 0;
+
+enomem:
+    LIBM2D_ERROR("could not allocate memory for atlas page: %s\n", strerror(errno));
+    return -1;
+}
+
+int m2d_atlas_reserve(struct m2d_atlas* atlas, size_t width, size_t height,
+                      struct m2d_atlas_image* image)
+{
+    size_t i;
+
+    if (width > atlas->page_width || height > atlas->page_height)
+    {
+        LIBM2D_ERROR("image [%zux%zu] doesn't fit in atlas pages [%zux%zu]\n",
+                     width, height, atlas->page_width, atlas->page_height);
+        return -1;
+    }
+
+    for (i = 0; ; i++)
+    {
+        if (i == atlas->num_pages && m2d_atlas_add_page(atlas))
+            return -1;
+
+        if (m2d_packer_add(atlas->packers[i], width, height,
+                           &image->rect.x, &image->rect.y))
+            break;
+    }
+
+    image->page = atlas->pages[i];
+    image->rect.w = (dim_t)width;
+    image->rect.h = (dim_t)height;
+
+    return 0;
+}
+
+int m2d_atlas_add(struct m2d_atlas* atlas, struct m2d_buffer* buf,
+                  struct m2d_atlas_image* image)
+{
+    if (m2d_atlas_reserve(atlas, buf->width, buf->height, image))
+        return -1;
+
+    m2d_push_state();
+    m2d_set_target(image->page);
+    m2d_set_source(M2D_SRC, buf, image->rect.x, image->rect.y);
+    m2d_source_enable(M2D_SRC, true);
+    m2d_source_enable(M2D_DST, false);
+    m2d_blend_enable(false);
+    m2d_draw_rectangles(&image->rect, 1);
+    m2d_pop_state();
+
+    return 0;
+}
+
+size_t m2d_atlas_num_pages(const struct m2d_atlas* atlas)
+{
+    return atlas->num_pages;
+}
+
+struct m2d_buffer* m2d_atlas_page(const struct m2d_atlas* atlas, size_t index)
+{
+    return index < atlas->num_pages ? atlas->pages[index] : NULL;
+}
+
+/*
+ * A group of sprites drawn with a single command: same page, same source
+ * origin.
+ */
+struct m2d_sprite_batch
+{
+    struct m2d_buffer* page;
+    dim_t x;
+    dim_t y;
+    struct m2d_rectangle bounds;
+    size_t first;
+    size_t count;
+};
+
+void m2d_draw_sprites(const struct m2d_sprite* sprites, size_t num_sprites)
+{
+    struct m2d_sprite_batch* batches;
+    struct m2d_rectangle* rects;
+    size_t* batch_of;
+    size_t num_batches = 0;
+    size_t first;
+    size_t i;
+
+    if (!num_sprites)
+        return;
+
+    batches = malloc(num_sprites * sizeof(*batches));
+    rects = malloc(num_sprites * sizeof(*rects));
+    batch_of = malloc(num_sprites * sizeof(*batch_of));
+    if (!batches || !rects || !batch_of)
+    {
+        LIBM2D_ERROR("could not allocate memory for sprites: %s\n", strerror(errno));
+        goto out;
+    }
+
+    /*
+     * A sprite may join an earlier batch only if it doesn't overlap any batch
+     * drawn in between, otherwise the stacking order would change.
+     */
+    for (i = 0; i < num_sprites; i++)
+    {
+        const struct m2d_atlas_image* image = sprites[i].image;
+        struct m2d_rectangle r = {
+            .x = sprites[i].x,
+            .y = sprites[i].y,
+            .w = image->rect.w,
+            .h = image->rect.h,
+        };
+        dim_t x = sprites[i].x - image->rect.x;
+        dim_t y = sprites[i].y - image->rect.y;
+        struct m2d_rectangle overlap;
+        size_t b;
+
+        for (b = num_batches; b > 0; b--)
+        {
+            const struct m2d_sprite_batch* batch = &batches[b - 1];
+
+            if (batch->page == image->page && batch->x == x && batch->y == y)
+                break;
+
+            if (m2d_intersect(&batch->bounds, &r, &overlap))
+            {
+                b = 0;
+                break;
+            }
+        }
+
+        if (b == 0)
+        {
+            b = ++num_batches;
+            batches[b - 1].page = image->page;
+            batches[b - 1].x = x;
+            batches[b - 1].y = y;
+            batches[b - 1].bounds = r;
+            batches[b - 1].count = 0;
+        }
+        else
+        {
+            m2d_rectangle_union(&batches[b - 1].bounds, &r);
+        }
+
+        batches[b - 1].count++;
+        batch_of[i] = b - 1;
+    }
+
+    /* Lay the rectangles out batch after batch, keeping the sprite order. */
+    for (i = 0, first = 0; i < num_batches; i++)
+    {
+        batches[i].first = first;
+        first += batches[i].count;
+        batches[i].count = 0;
+    }
+
+    for (i = 0; i < num_sprites; i++)
+    {
+        struct m2d_sprite_batch* batch = &batches[batch_of[i]];
+        struct m2d_rectangle* r = &rects[batch->first + batch->count++];
+
+        r->x = sprites[i].x;
+        r->y = sprites[i].y;
+        r->w = sprites[i].image->rect.w;
+        r->h = sprites[i].image->rect.h;
+    }
+
+    LIBM2D_DEBUG("drawing %zu sprite(s) in %zu batch(es)\n", num_sprites, num_batches);
+
+    m2d_push_state();
+    m2d_source_enable(M2D_SRC, true);
+    for (i = 0; i < num_batches; i++)
+    {
+        const struct m2d_sprite_batch* batch = &batches[i];
+
+        m2d_set_source(M2D_SRC, batch->page, batch->x, batch->y);
+        m2d_draw_rectangles(&rects[batch->first], batch->count);
+    }
+    m2d_pop_state();
+
+out:
+    free(batch_of);
+    free(rects);
+    free(batches);
+}
@@ -0,0 +1,589 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/m2d.h"
+#include "m2d_priv.h"
+
+#include <string.h>
+
+/*
+ * CPU blend kernels: blend a row of source pixels with a row of destination
+ * pixels, in the target format, following the GFX2D equation.
+ *
+ * Kernels are generated from an always inlined template, for each blend mode
+ * of blend_modes[] and each pair of target and source formats: the factors,
+ * the function and the pixel formats are compile-time constants there, so the
+ * per-pixel switches are folded away. Other modes use the generic kernels,
+ * specialized by formats only, which evaluate the factors for each pixel.
+ *
+ * The most common modes have hand-tuned kernels, which process two channels
+ * per multiplication and skip the transparent and opaque pixels. They give
+ * the same results as the generated kernels.
+ */
+#define BLEND_INLINE static inline __attribute__((always_inline))
+
+#define F(factor) M2D_BLEND_##factor
+
+/* round(t / 255), for t <= 255 * 255, on two 16-bit lanes. */
+static inline uint32_t div255_x2(uint32_t t)
+{
+    t += 0x00800080u;
+
+    return ((t + ((t >> 8) & 0x00ff00ffu)) >> 8) & 0x00ff00ffu;
+}
+
+/* Multiply the 4 channels of @p by @a / 255. */
+static inline uint32_t mul_div255_x4(uint32_t p, uint32_t a)
+{
+    return div255_x2((p & 0x00ff00ffu) * a) |
+        div255_x2(((p >> 8) & 0x00ff00ffu) * a) << 8;
+}
+
+/* Add the 4 channels of @p and @q, with saturation. */
+static inline uint32_t add_sat_x4(uint32_t p, uint32_t q)
+{
+    uint32_t rb = (p & 0x00ff00ffu) + (q & 0x00ff00ffu);
+    uint32_t ag = ((p >> 8) & 0x00ff00ffu) + ((q >> 8) & 0x00ff00ffu);
+
+    rb = (rb | (0x01000100u - ((rb >> 8) & 0x00010001u))) & 0x00ff00ffu;
+    ag = (ag | (0x01000100u - ((ag >> 8) & 0x00010001u))) & 0x00ff00ffu;
+
+    return rb | ag << 8;
+}
+
+static inline uint32_t unpack_rgb565(uint16_t p)
+{
+    uint32_t r = p >> 11;
+    uint32_t g = (p >> 5) & 0x3f;
+    uint32_t b = p & 0x1f;
+
+    r = (r << 3) | (r >> 2);
+    g = (g << 2) | (g >> 4);
+    b = (b << 3) | (b >> 2);
+
+    return 0xff000000u | (r << 16) | (g << 8) | b;
+}
+
+static inline uint16_t pack_rgb565(uint32_t p)
+{
+    return (uint16_t)(((p >> 8) & 0xf800) | ((p >> 5) & 0x07e0) | ((p >> 3) & 0x001f));
+}
+
+/* Load a pixel as premultiplied ARGB8888: A8 pixels are white. */
+BLEND_INLINE uint32_t blend_load(const uint8_t* row, size_t i,
+                                 enum m2d_pixel_format format)
+{
+    switch (format)
+    {
+    case M2D_PF_ARGB8888:
+        return ((const uint32_t*)row)[i];
+    case M2D_PF_RGB565:
+        return unpack_rgb565(((const uint16_t*)row)[i]);
+    case M2D_PF_A8:
+        return row[i] * 0x01010101u;
+    }
+
+    return 0;
+}
+
+BLEND_INLINE void blend_store(uint8_t* row, size_t i, uint32_t p,
+                              enum m2d_pixel_format format)
+{
+    switch (format)
+    {
+    case M2D_PF_ARGB8888:
+        ((uint32_t*)row)[i] = p;
+        break;
+    case M2D_PF_RGB565:
+        ((uint16_t*)row)[i] = pack_rgb565(p);
+        break;
+    case M2D_PF_A8:
+        row[i] = p >> 24;
+        break;
+    }
+}
+
+/* The factor for the channel at @shift, 24 for alpha. */
+BLEND_INLINE uint32_t blend_factor(enum m2d_blend_factor factor, unsigned int shift,
+                                   uint32_t s, uint32_t d, uint32_t k)
+{
+    uint32_t sa = s >> 24;
+    uint32_t da = d >> 24;
+
+    switch (factor)
+    {
+    case M2D_BLEND_ZERO:
+        return 0;
+    case M2D_BLEND_ONE:
+        return 255;
+    case M2D_BLEND_SRC_COLOR:
+        return (s >> shift) & 0xff;
+    case M2D_BLEND_ONE_MINUS_SRC_COLOR:
+        return 255 - ((s >> shift) & 0xff);
+    case M2D_BLEND_DST_COLOR:
+        return (d >> shift) & 0xff;
+    case M2D_BLEND_ONE_MINUS_DST_COLOR:
+        return 255 - ((d >> shift) & 0xff);
+    case M2D_BLEND_SRC_ALPHA:
+        return sa;
+    case M2D_BLEND_ONE_MINUS_SRC_ALPHA:
+        return 255 - sa;
+    case M2D_BLEND_DST_ALPHA:
+        return da;
+    case M2D_BLEND_ONE_MINUS_DST_ALPHA:
+        return 255 - da;
+    case M2D_BLEND_CONSTANT_COLOR:
+        return (k >> shift) & 0xff;
+    case M2D_BLEND_ONE_MINUS_CONSTANT_COLOR:
+        return 255 - ((k >> shift) & 0xff);
+    case M2D_BLEND_CONSTANT_ALPHA:
+        return k >> 24;
+    case M2D_BLEND_ONE_MINUS_CONSTANT_ALPHA:
+        return 255 - (k >> 24);
+    case M2D_BLEND_SRC_ALPHA_SATURATE:
+        if (shift == 24)
+            return 255;
+        return sa < 255 - da ? sa : 255 - da;
+    }
+
+    return 0;
+}
+
+BLEND_INLINE uint32_t blend_channel(enum m2d_blend_function function,
+                                    uint32_t s, uint32_t d, uint32_t fs, uint32_t fd)
+{
+    int32_t t = 0;
+
+    switch (function)
+    {
+    case M2D_FUNC_ADD:
+        t = (int32_t)(s * fs + d * fd);
+        break;
+    case M2D_FUNC_SUBTRACT:
+        t = (int32_t)(s * fs) - (int32_t)(d * fd);
+        break;
+    case M2D_FUNC_REVERSE:
+        t = (int32_t)(d * fd) - (int32_t)(s * fs);
+        break;
+    case M2D_FUNC_MIN:
+        return s < d ? s : d;
+    case M2D_FUNC_MAX:
+        return s > d ? s : d;
+    }
+
+    if (t <= 0)
+        return 0;
+
+    t = (t + 127) / 255;
+
+    return t > 255 ? 255 : (uint32_t)t;
+}
+
+BLEND_INLINE void blend_row(uint8_t* out, const uint8_t* src, const uint8_t* dst,
+                            size_t width, const struct m2d_blend_args* args,
+                            enum m2d_blend_function function,
+                            enum m2d_blend_factor scfactor, enum m2d_blend_factor dcfactor,
+                            enum m2d_blend_factor safactor, enum m2d_blend_factor dafactor,
+                            enum m2d_pixel_format target_format,
+                            enum m2d_pixel_format src_format)
+{
+    uint32_t k = args->blend_color;
+    size_t i;
+
+    for (i = 0; i < width; i++)
+    {
+        uint32_t s = blend_load(src, i, src_format);
+        uint32_t d = blend_load(dst, i, target_format);
+        uint32_t p = 0;
+        unsigned int shift;
+
+        for (shift = 0; shift < 32; shift += 8)
+        {
+            enum m2d_blend_factor sf = shift == 24 ? safactor : scfactor;
+            enum m2d_blend_factor df = shift == 24 ? dafactor : dcfactor;
+
+            p |= blend_channel(function, (s >> shift) & 0xff, (d >> shift) & 0xff,
+                               blend_factor(sf, shift, s, d, k),
+                               blend_factor(df, shift, s, d, k)) << shift;
+        }
+
+        blend_store(out, i, p, target_format);
+    }
+}
+
+#define BLEND_KERNEL(name, target, source, ...)                                 \
+    static void blend_##name##_##target##_##source(uint8_t* out,                \
+                                                   const uint8_t* src,          \
+                                                   const uint8_t* dst,          \
+                                                   size_t width,                \
+                                                   const struct m2d_blend_args* args) \
+    {                                                                           \
+        blend_row(out, src, dst, width, args, __VA_ARGS__,                      \
+                  M2D_PF_##target, M2D_PF_##source);                            \
+    }
+
+#define BLEND_KERNELS(name, ...)                                                \
+    BLEND_KERNEL(name, ARGB8888, ARGB8888, __VA_ARGS__)                         \
+    BLEND_KERNEL(name, ARGB8888, RGB565, __VA_ARGS__)                           \
+    BLEND_KERNEL(name, ARGB8888, A8, __VA_ARGS__)                               \
+    BLEND_KERNEL(name, RGB565, ARGB8888, __VA_ARGS__)                           \
+    BLEND_KERNEL(name, RGB565, RGB565, __VA_ARGS__)                             \
+    BLEND_KERNEL(name, RGB565, A8, __VA_ARGS__)                                 \
+    BLEND_KERNEL(name, A8, ARGB8888, __VA_ARGS__)                               \
+    BLEND_KERNEL(name, A8, RGB565, __VA_ARGS__)                                 \
+    BLEND_KERNEL(name, A8, A8, __VA_ARGS__)                                     \
+                                                                                \
+    static const m2d_blend_func blend_##name[M2D_NUM_PIXEL_FORMATS][M2D_NUM_PIXEL_FORMATS] = \
+    {                                                                           \
+        [M2D_PF_ARGB8888] =                                                     \
+        {                                                                       \
+            [M2D_PF_ARGB8888] = blend_##name##_ARGB8888_ARGB8888,               \
+            [M2D_PF_RGB565] = blend_##name##_ARGB8888_RGB565,                   \
+            [M2D_PF_A8] = blend_##name##_ARGB8888_A8,                           \
+        },                                                                      \
+        [M2D_PF_RGB565] =                                                       \
+        {                                                                       \
+            [M2D_PF_ARGB8888] = blend_##name##_RGB565_ARGB8888,                 \
+            [M2D_PF_RGB565] = blend_##name##_RGB565_RGB565,                     \
+            [M2D_PF_A8] = blend_##name##_RGB565_A8,                             \
+        },                                                                      \
+        [M2D_PF_A8] =                                                           \
+        {                                                                       \
+            [M2D_PF_ARGB8888] = blend_##name##_A8_ARGB8888,                     \
+            [M2D_PF_RGB565] = blend_##name##_A8_RGB565,                         \
+            [M2D_PF_A8] = blend_##name##_A8_A8,                                 \
+        },                                                                      \
+    };
+
+/* Porter-Duff operators on premultiplied pixels, then the usual extras. */
+BLEND_KERNELS(clear, M2D_FUNC_ADD, F(ZERO), F(ZERO), F(ZERO), F(ZERO))
+BLEND_KERNELS(src, M2D_FUNC_ADD, F(ONE), F(ZERO), F(ONE), F(ZERO))
+BLEND_KERNELS(src_over, M2D_FUNC_ADD, F(ONE), F(ONE_MINUS_SRC_ALPHA), F(ONE), F(ONE_MINUS_SRC_ALPHA))
+BLEND_KERNELS(dst_over, M2D_FUNC_ADD, F(ONE_MINUS_DST_ALPHA), F(ONE), F(ONE_MINUS_DST_ALPHA), F(ONE))
+BLEND_KERNELS(src_in, M2D_FUNC_ADD, F(DST_ALPHA), F(ZERO), F(DST_ALPHA), F(ZERO))
+BLEND_KERNELS(dst_in, M2D_FUNC_ADD, F(ZERO), F(SRC_ALPHA), F(ZERO), F(SRC_ALPHA))
+BLEND_KERNELS(src_out, M2D_FUNC_ADD, F(ONE_MINUS_DST_ALPHA), F(ZERO), F(ONE_MINUS_DST_ALPHA), F(ZERO))
+BLEND_KERNELS(dst_out, M2D_FUNC_ADD, F(ZERO), F(ONE_MINUS_SRC_ALPHA), F(ZERO), F(ONE_MINUS_SRC_ALPHA))
+BLEND_KERNELS(src_atop, M2D_FUNC_ADD, F(DST_ALPHA), F(ONE_MINUS_SRC_ALPHA), F(DST_ALPHA), F(ONE_MINUS_SRC_ALPHA))
+BLEND_KERNELS(dst_atop, M2D_FUNC_ADD, F(ONE_MINUS_DST_ALPHA), F(SRC_ALPHA), F(ONE_MINUS_DST_ALPHA), F(SRC_ALPHA))
+BLEND_KERNELS(xor, M2D_FUNC_ADD, F(ONE_MINUS_DST_ALPHA), F(ONE_MINUS_SRC_ALPHA), F(ONE_MINUS_DST_ALPHA), F(ONE_MINUS_SRC_ALPHA))
+BLEND_KERNELS(add, M2D_FUNC_ADD, F(ONE), F(ONE), F(ONE), F(ONE))
+BLEND_KERNELS(multiply, M2D_FUNC_ADD, F(DST_COLOR), F(ONE_MINUS_SRC_ALPHA), F(ONE), F(ONE_MINUS_SRC_ALPHA))
+BLEND_KERNELS(screen, M2D_FUNC_ADD, F(ONE), F(ONE_MINUS_SRC_COLOR), F(ONE), F(ONE_MINUS_SRC_ALPHA))
+BLEND_KERNELS(alpha_over, M2D_FUNC_ADD, F(SRC_ALPHA), F(ONE_MINUS_SRC_ALPHA), F(ONE), F(ONE_MINUS_SRC_ALPHA))
+BLEND_KERNELS(mask, M2D_FUNC_ADD, F(ONE), F(ZERO), F(DST_ALPHA), F(ZERO))
+BLEND_KERNELS(fade, M2D_FUNC_ADD, F(CONSTANT_ALPHA), F(ONE_MINUS_CONSTANT_ALPHA), F(CONSTANT_ALPHA), F(ONE_MINUS_CONSTANT_ALPHA))
+BLEND_KERNELS(min, M2D_FUNC_MIN, F(ONE), F(ONE), F(ONE), F(ONE))
+BLEND_KERNELS(max, M2D_FUNC_MAX, F(ONE), F(ONE), F(ONE), F(ONE))
+BLEND_KERNELS(generic, args->mode.function, args->mode.scfactor, args->mode.dcfactor,
+              args->mode.safactor, args->mode.dafactor)
+
+#define BLEND_MODE(name, func, sc, dc, sa, da) \
+    { { M2D_FUNC_##func, F(sc), F(dc), F(sa), F(da) }, blend_##name }
+
+static const struct
+{
+    struct m2d_blend_mode mode;
+    const m2d_blend_func (*kernels)[M2D_NUM_PIXEL_FORMATS];
+} blend_modes[] =
+{
+    /* Most used first. */
+    BLEND_MODE(alpha_over, ADD, SRC_ALPHA, ONE_MINUS_SRC_ALPHA, ONE, ONE_MINUS_SRC_ALPHA),
+    BLEND_MODE(src_over, ADD, ONE, ONE_MINUS_SRC_ALPHA, ONE, ONE_MINUS_SRC_ALPHA),
+    BLEND_MODE(mask, ADD, ONE, ZERO, DST_ALPHA, ZERO),
+    BLEND_MODE(fade, ADD, CONSTANT_ALPHA, ONE_MINUS_CONSTANT_ALPHA, CONSTANT_ALPHA, ONE_MINUS_CONSTANT_ALPHA),
+    BLEND_MODE(add, ADD, ONE, ONE, ONE, ONE),
+    BLEND_MODE(multiply, ADD, DST_COLOR, ONE_MINUS_SRC_ALPHA, ONE, ONE_MINUS_SRC_ALPHA),
+    BLEND_MODE(screen, ADD, ONE, ONE_MINUS_SRC_COLOR, ONE, ONE_MINUS_SRC_ALPHA),
+    BLEND_MODE(src, ADD, ONE, ZERO, ONE, ZERO),
+    BLEND_MODE(clear, ADD, ZERO, ZERO, ZERO, ZERO),
+    BLEND_MODE(dst_over, ADD, ONE_MINUS_DST_ALPHA, ONE, ONE_MINUS_DST_ALPHA, ONE),
+    BLEND_MODE(src_in, ADD, DST_ALPHA, ZERO, DST_ALPHA, ZERO),
+    BLEND_MODE(dst_in, ADD, ZERO, SRC_ALPHA, ZERO, SRC_ALPHA),
+    BLEND_MODE(src_out, ADD, ONE_MINUS_DST_ALPHA, ZERO, ONE_MINUS_DST_ALPHA, ZERO),
+    BLEND_MODE(dst_out, ADD, ZERO, ONE_MINUS_SRC_ALPHA, ZERO, ONE_MINUS_SRC_ALPHA),
+    BLEND_MODE(src_atop, ADD, DST_ALPHA, ONE_MINUS_SRC_ALPHA, DST_ALPHA, ONE_MINUS_SRC_ALPHA),
+    BLEND_MODE(dst_atop, ADD, ONE_MINUS_DST_ALPHA, SRC_ALPHA, ONE_MINUS_DST_ALPHA, SRC_ALPHA),
+    BLEND_MODE(xor, ADD, ONE_MINUS_DST_ALPHA, ONE_MINUS_SRC_ALPHA, ONE_MINUS_DST_ALPHA, ONE_MINUS_SRC_ALPHA),
+    BLEND_MODE(min, MIN, ONE, ONE, ONE, ONE),
+    BLEND_MODE(max, MAX, ONE, ONE, ONE, ONE),
+};
+
+/* Premultiplied source over: S + D * (1 - Sa). */
+static void tuned_src_over(uint8_t* out, const uint8_t* src, const uint8_t* dst,
+                           size_t width, const struct m2d_blend_args* args)
+{
+    const uint32_t* s = (const uint32_t*)src;
+    const uint32_t* d = (const uint32_t*)dst;
+    uint32_t* o = (uint32_t*)out;
+    size_t i;
+
+    (void)args;
+
+    for (i = 0; i < width; i++)
+    {
+        uint32_t a = s[i] >> 24;
+
+        if (a == 255)
+            o[i] = s[i];
+        else if (a == 0)
+            o[i] = add_sat_x4(s[i], d[i]);
+        else
+            o[i] = add_sat_x4(s[i], mul_div255_x4(d[i], 255 - a));
+    }
+}
+
+static void tuned_src_over_rgb565(uint8_t* out, const uint8_t* src, const uint8_t* dst,
+                                  size_t width, const struct m2d_blend_args* args)
+{
+    const uint32_t* s = (const uint32_t*)src;
+    const uint16_t* d = (const uint16_t*)dst;
+    uint16_t* o = (uint16_t*)out;
+    size_t i;
+
+    (void)args;
+
+    for (i = 0; i < width; i++)
+    {
+        uint32_t a = s[i] >> 24;
+
+        if (a == 255)
+            o[i] = pack_rgb565(s[i]);
+        else if (s[i] == 0)
+            o[i] = d[i];
+        else
+            o[i] = pack_rgb565(add_sat_x4(s[i], mul_div255_x4(unpack_rgb565(d[i]), 255 - a)));
+    }
+}
+
+/*
+ * Straight alpha source over: S * Sa + D * (1 - Sa) for the colors. Both
+ * products are summed before the division, on two channels at once: the sum
+ * of a convex combination can't overflow the 16-bit lanes.
+ */
+static void tuned_alpha_over(uint8_t* out, const uint8_t* src, const uint8_t* dst,
+                             size_t width, const struct m2d_blend_args* args)
+{
+    const uint32_t* s = (const uint32_t*)src;
+    const uint32_t* d = (const uint32_t*)dst;
+    uint32_t* o = (uint32_t*)out;
+    size_t i;
+
+    (void)args;
+
+    for (i = 0; i < width; i++)
+    {
+        uint32_t a = s[i] >> 24;
+        uint32_t rb;
+        uint32_t ag;
+
+        if (a == 255)
+        {
+            o[i] = s[i];
+            continue;
+        }
+
+        if (a == 0)
+        {
+            o[i] = d[i];
+            continue;
+        }
+
+        rb = (s[i] & 0x00ff00ffu) * a + (d[i] & 0x00ff00ffu) * (255 - a);
+        ag = ((s[i] >> 8) & 0xffu) * a + ((d[i] >> 8) & 0x00ff00ffu) * (255 - a) +
+            (a * 255 << 16);
+        o[i] = div255_x2(rb) | div255_x2(ag) << 8;
+    }
+}
+
+static void tuned_add(uint8_t* out, const uint8_t* src, const uint8_t* dst,
+                      size_t width, const struct m2d_blend_args* args)
+{
+    const uint32_t* s = (const uint32_t*)src;
+    const uint32_t* d = (const uint32_t*)dst;
+    uint32_t* o = (uint32_t*)out;
+    size_t i;
+
+    (void)args;
+
+    for (i = 0; i < width; i++)
+        o[i] = add_sat_x4(s[i], d[i]);
+}
+
+/* Premultiplied multiply: S * D + D * (1 - Sa) = D * (S + 1 - Sa). */
+static void tuned_multiply(uint8_t* out, const uint8_t* src, const uint8_t* dst,
+                           size_t width, const struct m2d_blend_args* args)
+{
+    const uint32_t* s = (const uint32_t*)src;
+    const uint32_t* d = (const uint32_t*)dst;
+    uint32_t* o = (uint32_t*)out;
+    size_t i;
+
+    (void)args;
+
+    for (i = 0; i < width; i++)
+    {
+        uint32_t a = s[i] >> 24;
+        uint32_t p = 0;
+        unsigned int shift;
+
+        if (a == 0 && s[i] == 0)
+        {
+            o[i] = d[i];
+            continue;
+        }
+
+        for (shift = 0; shift < 24; shift += 8)
+        {
+            uint32_t t = ((d[i] >> shift) & 0xff) * (((s[i] >> shift) & 0xff) + 255 - a);
+
+            t = (t + 127) / 255;
+            p |= (t > 255 ? 255 : t) << shift;
+        }
+
+        o[i] = p | ((a * 255 + (d[i] >> 24) * (255 - a) + 127) / 255) << 24;
+    }
+}
+
+static void tuned_copy(uint8_t* out, const uint8_t* src, const uint8_t* dst,
+                       size_t width, const struct m2d_blend_args* args)
+{
+    (void)dst;
+    (void)args;
+
+    memmove(out, src, width * sizeof(uint32_t));
+}
+
+/* A8 coverage times the constant source color, over the destination. */
+static void tuned_mask_over(uint8_t* out, const uint8_t* src, const uint8_t* dst,
+                            size_t width, const struct m2d_blend_args* args)
+{
+    const uint32_t* d = (const uint32_t*)dst;
+    uint32_t color = args->source_color;
+    uint32_t* o = (uint32_t*)out;
+    size_t i;
+
+    for (i = 0; i < width; i++)
+    {
+        uint32_t s;
+
+        if (src[i] == 0)
+        {
+            o[i] = d[i];
+            continue;
+        }
+
+        s = src[i] == 255 ? color : mul_div255_x4(color, src[i]);
+        o[i] = add_sat_x4(s, mul_div255_x4(d[i], 255 - (s >> 24)));
+    }
+}
+
+static void tuned_mask_over_rgb565(uint8_t* out, const uint8_t* src, const uint8_t* dst,
+                                   size_t width, const struct m2d_blend_args* args)
+{
+    const uint16_t* d = (const uint16_t*)dst;
+    uint32_t color = args->source_color;
+    uint16_t* o = (uint16_t*)out;
+    size_t i;
+
+    for (i = 0; i < width; i++)
+    {
+        uint32_t s;
+
+        if (src[i] == 0)
+        {
+            o[i] = d[i];
+            continue;
+        }
+
+        s = src[i] == 255 ? color : mul_div255_x4(color, src[i]);
+        o[i] = pack_rgb565(add_sat_x4(s, mul_div255_x4(unpack_rgb565(d[i]), 255 - (s >> 24))));
+    }
+}
+
+static bool blend_same_mode(const struct m2d_blend_mode* a, const struct m2d_blend_mode* b)
+{
+    return a->function == b->function &&
+        a->scfactor == b->scfactor && a->dcfactor == b->dcfactor &&
+        a->safactor == b->safactor && a->dafactor == b->dafactor;
+}
+
+static const struct
+{
+    struct m2d_blend_mode mode;
+    enum m2d_pixel_format target_format;
+    enum m2d_pixel_format src_format;
+    bool modulated;
+    m2d_blend_func kernel;
+} blend_tuned[] =
+{
+#define TUNED(name, func, sc, dc, sa, da, target, source, modulated) \
+    { { M2D_FUNC_##func, F(sc), F(dc), F(sa), F(da) }, M2D_PF_##target, M2D_PF_##source, modulated, tuned_##name }
+
+    TUNED(alpha_over, ADD, SRC_ALPHA, ONE_MINUS_SRC_ALPHA, ONE, ONE_MINUS_SRC_ALPHA, ARGB8888, ARGB8888, false),
+    TUNED(src_over, ADD, ONE, ONE_MINUS_SRC_ALPHA, ONE, ONE_MINUS_SRC_ALPHA, ARGB8888, ARGB8888, false),
+    TUNED(src_over_rgb565, ADD, ONE, ONE_MINUS_SRC_ALPHA, ONE, ONE_MINUS_SRC_ALPHA, RGB565, ARGB8888, false),
+    TUNED(mask_over, ADD, ONE, ONE_MINUS_SRC_ALPHA, ONE, ONE_MINUS_SRC_ALPHA, ARGB8888, A8, true),
+    TUNED(mask_over_rgb565, ADD, ONE, ONE_MINUS_SRC_ALPHA, ONE, ONE_MINUS_SRC_ALPHA, RGB565, A8, true),
+    TUNED(add, ADD, ONE, ONE, ONE, ONE, ARGB8888, ARGB8888, false),
+    TUNED(multiply, ADD, DST_COLOR, ONE_MINUS_SRC_ALPHA, ONE, ONE_MINUS_SRC_ALPHA, ARGB8888, ARGB8888, false),
+    TUNED(copy, ADD, ONE, ZERO, ONE, ZERO, ARGB8888, ARGB8888, false),
+};
+
+m2d_blend_func m2d_blend_select(const struct m2d_blend_mode* mode,
+                                enum m2d_pixel_format target_format,
+                                enum m2d_pixel_format src_format,
+                                bool modulated)
+{
+    struct m2d_blend_mode key = *mode;
+    size_t i;
+
+    /* MIN and MAX ignore the factors. */
+    if (key.function == M2D_FUNC_MIN || key.function == M2D_FUNC_MAX)
+    {
+        key.scfactor = M2D_BLEND_ONE;
+        key.dcfactor = M2D_BLEND_ONE;
+        key.safactor = M2D_BLEND_ONE;
+        key.dafactor = M2D_BLEND_ONE;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(blend_tuned); i++)
+    {
+        if (blend_tuned[i].target_format == target_format &&
+            blend_tuned[i].src_format == src_format &&
+            blend_tuned[i].modulated == modulated &&
+            blend_same_mode(&blend_tuned[i].mode, &key))
+            return blend_tuned[i].kernel;
+    }
+
+    /* The source has to be modulated first. */
+    if (modulated)
+        return NULL;
+
+    for (i = 0; i < ARRAY_SIZE(blend_modes); i++)
+        if (blend_same_mode(&blend_modes[i].mode, &key))
+            return blend_modes[i].kernels[target_format][src_format];
+
+    return blend_generic[target_format][src_format];
+}
+
+void m2d_blend_modulate(uint32_t* out, const uint8_t* src,
+                        enum m2d_pixel_format src_format, size_t width,
+                        uint32_t color)
+{
+    size_t i;
+
+    for (i = 0; i < width; i++)
+    {
+        uint32_t s = blend_load(src, i, src_format);
+        uint32_t p = 0;
+        unsigned int shift;
+
+        for (shift = 0; shift < 32; shift += 8)
+            p |= ((((s >> shift) & 0xff) * ((color >> shift) & 0xff) + 127) / 255) << shift;
+
+        out[i] = p;
+    }
+}
@@ -0,0 +1,649 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/m2d.h"
+#include "m2d_priv.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define BLUR_TIMEOUT_SECS 1
+
+/* Larger radii are clamped. */
+#define BLUR_MAX_RADIUS 255
+
+/* Radii blurred by blends of shifted copies: 2 * radius + 1 per direction. */
+#define BLUR_GPU_MAX_RADIUS 4
+
+/* Larger radii are blurred by the CPU on surfaces downscaled to fit. */
+#define BLUR_CPU_MAX_RADIUS 6
+
+/* Rows and columns of the downscaled surface blurred by each CPU thread. */
+#define BLUR_BAND_ROWS 32
+#define BLUR_STRIPE_WIDTH 64
+
+/*
+ * Blurs and drop shadows.
+ *
+ * A blurred surface spreads the source @radius pixels further on each side,
+ * and is cached with the scaled variants: see scale.c. A shadow is the alpha
+ * of the source, tinted with the shadow color, then blurred.
+ *
+ * Small radii are blurred by the renderer: the source is copied, padded,
+ * into a surface, then averaged with its 2 * @radius shifted copies, first
+ * horizontally then vertically. The running average of k copies is blended
+ * with the next one by a constant alpha of 1 / (k + 1).
+ *
+ * Larger radii are blurred by the CPU: the padded source is averaged down by
+ * an integer factor so that the radius gets small, blurred by three box
+ * filters in a row, close to a gaussian, then scaled back up with bilinear
+ * filtering. Box filters keep running sums: horizontally, the four channels
+ * of a pixel in one 64-bit word; vertically, whole rows at once with SIMD.
+ */
+struct blur_job
+{
+    /* The source rectangle, padded by @radius pixels. */
+    const uint8_t* src;
+    size_t src_stride;
+    size_t src_width;
+    size_t src_height;
+    enum m2d_pixel_format format;
+    size_t radius;
+    bool shadow;
+    uint32_t color;
+
+    /* The downscaled surface, and a copy for the box filters. */
+    size_t factor;
+    uint32_t* small;
+    uint32_t* tmp;
+    size_t width;
+    size_t height;
+    size_t box_radius;
+    uint32_t box_inv;
+
+    /* Set by the jobs which could not allocate their rows. */
+    bool failed;
+};
+
+/* @color, premultiplied, weighted by the alpha of @p. */
+static inline uint32_t blur_tint(uint32_t p, uint32_t color)
+{
+    uint32_t a = p >> 24;
+    uint32_t rb;
+    uint32_t ag;
+
+    a += a >> 7;
+    rb = ((color & 0x00ff00ffu) * a >> 8) & 0x00ff00ffu;
+    ag = ((color >> 8) & 0x00ff00ffu) * a & 0xff00ff00u;
+
+    return rb | ag;
+}
+
+static void blur_downscale_row(size_t row, void* data)
+{
+    struct blur_job* job = data;
+    size_t factor = job->factor;
+    size_t area = factor * factor;
+    m2d_row_func convert = NULL;
+    uint32_t* out = job->small + row * job->width;
+    uint32_t* sums;
+    uint32_t* line;
+    size_t py;
+    size_t x;
+
+    sums = calloc(job->width * 4, sizeof(*sums));
+    line = malloc(job->src_width * sizeof(*line));
+    if (!sums || !line)
+    {
+        /* Reported by the caller. */
+        __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+        goto out;
+    }
+
+    if (job->format != M2D_PF_ARGB8888)
+        convert = m2d_pixel_row_func(M2D_PF_ARGB8888, job->format);
+
+    for (py = row * factor; py < (row + 1) * factor; py++)
+    {
+        const uint8_t* s;
+        const uint32_t* pixels;
+        uint32_t* acc;
+        size_t rem;
+
+        if (py < job->radius || py - job->radius >= job->src_height)
+            continue;
+
+        s = job->src + (py - job->radius) * job->src_stride;
+        pixels = (const uint32_t*)s;
+        if (convert)
+        {
+            convert(line, s, job->src_width);
+            pixels = line;
+        }
+
+        acc = &sums[job->radius / factor * 4];
+        rem = job->radius % factor;
+        for (x = 0; x < job->src_width; x++)
+        {
+            uint32_t p = job->shadow ? blur_tint(pixels[x], job->color) : pixels[x];
+
+            acc[0] += p & 0xff;
+            acc[1] += (p >> 8) & 0xff;
+            acc[2] += (p >> 16) & 0xff;
+            acc[3] += p >> 24;
+
+            if (++rem == factor)
+            {
+                rem = 0;
+                acc += 4;
+            }
+        }
+    }
+
+    for (x = 0; x < job->width; x++)
+    {
+        const uint32_t* acc = &sums[x * 4];
+
+        out[x] = (acc[0] / area) | (acc[1] / area) << 8 | (acc[2] / area) << 16 |
+                 (acc[3] / area) << 24;
+    }
+
+out:
+    free(line);
+    free(sums);
+}
+
+/* The channels of @p in 16-bit lanes, blue, red, green and alpha. */
+static inline uint64_t blur_spread(uint32_t p)
+{
+    return (p & 0x00ff00ffu) | (uint64_t)(p & 0xff00ff00u) << 24;
+}
+
+static inline uint32_t blur_gather(uint64_t sum, uint32_t inv)
+{
+    uint32_t b = (uint32_t)((sum & 0xffff) * inv >> 16);
+    uint32_t r = (uint32_t)(((sum >> 16) & 0xffff) * inv >> 16);
+    uint32_t g = (uint32_t)(((sum >> 32) & 0xffff) * inv >> 16);
+    uint32_t a = (uint32_t)((sum >> 48) * inv >> 16);
+
+    return a << 24 | r << 16 | g << 8 | b;
+}
+
+static void blur_rows(size_t band, void* data)
+{
+    const struct blur_job* job = data;
+    size_t first = band * BLUR_BAND_ROWS;
+    size_t last = first + BLUR_BAND_ROWS < job->height ? first + BLUR_BAND_ROWS : job->height;
+    size_t radius = job->box_radius;
+    size_t width = job->width;
+    size_t x;
+    size_t y;
+
+    for (y = first; y < last; y++)
+    {
+        const uint32_t* src = job->small + y * width;
+        uint32_t* dst = job->tmp + y * width;
+        uint64_t sum = 0;
+
+        for (x = 0; x < radius && x < width; x++)
+            sum += blur_spread(src[x]);
+
+        for (x = 0; x < width; x++)
+        {
+            if (x + radius < width)
+                sum += blur_spread(src[x + radius]);
+            dst[x] = blur_gather(sum, job->box_inv);
+            if (x >= radius)
+                sum -= blur_spread(src[x - radius]);
+        }
+    }
+}
+
+/* Add (@sign > 0) or subtract the bytes of @row to the 16-bit @sums. */
+static void blur_accumulate(uint16_t* sums, const uint8_t* row, size_t count, int sign)
+{
+    size_t i = 0;
+
+#if defined(__ARM_NEON)
+    for (; i + 16 <= count; i += 16)
+    {
+        uint8x16_t v = vld1q_u8(row + i);
+        uint16x8_t lo = vld1q_u16(sums + i);
+        uint16x8_t hi = vld1q_u16(sums + i + 8);
+
+        if (sign > 0)
+        {
+            lo = vaddw_u8(lo, vget_low_u8(v));
+            hi = vaddw_u8(hi, vget_high_u8(v));
+        }
+        else
+        {
+            lo = vsubw_u8(lo, vget_low_u8(v));
+            hi = vsubw_u8(hi, vget_high_u8(v));
+        }
+
+        vst1q_u16(sums + i, lo);
+        vst1q_u16(sums + i + 8, hi);
+    }
+#elif defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(row + i));
+        __m128i lo = _mm_loadu_si128((const __m128i*)(sums + i));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(sums + i + 8));
+
+        if (sign > 0)
+        {
+            lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+            hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+        }
+        else
+        {
+            lo = _mm_sub_epi16(lo, _mm_unpacklo_epi8(v, zero));
+            hi = _mm_sub_epi16(hi, _mm_unpackhi_epi8(v, zero));
+        }
+
+        _mm_storeu_si128((__m128i*)(sums + i), lo);
+        _mm_storeu_si128((__m128i*)(sums + i + 8), hi);
+    }
+#endif
+
+    for (; i < count; i++)
+        sums[i] = (uint16_t)(sign > 0 ? sums[i] + row[i] : sums[i] - row[i]);
+}
+
+/* @out = @sums * @inv / 65536, which is at most 255. */
+static void blur_average(uint8_t* out, const uint16_t* sums, size_t count, uint32_t inv)
+{
+    size_t i = 0;
+
+#if defined(__ARM_NEON)
+    uint16x4_t vinv = vdup_n_u16((uint16_t)inv);
+
+    for (; i + 8 <= count; i += 8)
+    {
+        uint16x8_t s = vld1q_u16(sums + i);
+        uint16x4_t lo = vshrn_n_u32(vmull_u16(vget_low_u16(s), vinv), 16);
+        uint16x4_t hi = vshrn_n_u32(vmull_u16(vget_high_u16(s), vinv), 16);
+
+        vst1_u8(out + i, vmovn_u16(vcombine_u16(lo, hi)));
+    }
+#elif defined(__SSE2__)
+    __m128i vinv = _mm_set1_epi16((short)inv);
+
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i lo = _mm_mulhi_epu16(_mm_loadu_si128((const __m128i*)(sums + i)), vinv);
+        __m128i hi = _mm_mulhi_epu16(_mm_loadu_si128((const __m128i*)(sums + i + 8)), vinv);
+
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for (; i < count; i++)
+        out[i] = (uint8_t)(sums[i] * inv >> 16);
+}
+
+static void blur_columns(size_t stripe, void* data)
+{
+    const struct blur_job* job = data;
+    size_t first = stripe * BLUR_STRIPE_WIDTH;
+    size_t last = first + BLUR_STRIPE_WIDTH < job->width ? first + BLUR_STRIPE_WIDTH : job->width;
+    size_t count = (last - first) * 4;
+    size_t radius = job->box_radius;
+    size_t height = job->height;
+    uint16_t sums[BLUR_STRIPE_WIDTH * 4];
+    size_t y;
+
+    memset(sums, 0, sizeof(sums));
+
+#define BLUR_ROW(buf, y) ((uint8_t*)((buf) + (y) * job->width + first))
+
+    for (y = 0; y < radius && y < height; y++)
+        blur_accumulate(sums, BLUR_ROW(job->tmp, y), count, 1);
+
+    for (y = 0; y < height; y++)
+    {
+        if (y + radius < height)
+            blur_accumulate(sums, BLUR_ROW(job->tmp, y + radius), count, 1);
+        blur_average(BLUR_ROW(job->small, y), sums, count, job->box_inv);
+        if (y >= radius)
+            blur_accumulate(sums, BLUR_ROW(job->tmp, y - radius), count, -1);
+    }
+
+#undef BLUR_ROW
+}
+
+static struct m2d_buffer* blur_cpu(struct m2d_buffer* src, const struct m2d_rectangle* src_rect,
+                                   unsigned int radius, bool shadow, uint32_t color)
+{
+    size_t width = (size_t)src_rect->w + 2 * radius;
+    size_t height = (size_t)src_rect->h + 2 * radius;
+    size_t bpp = m2d_byte_per_pixel(src->format);
+    struct m2d_buffer* buf;
+    struct timespec timeout;
+    struct blur_job job;
+    uint8_t* src_data;
+    uint8_t* data;
+    size_t small_radius;
+    size_t y;
+    int pass;
+
+    buf = m2d_alloc(width, height, M2D_PF_ARGB8888, width * sizeof(uint32_t));
+    if (!buf)
+        return NULL;
+
+    memset(&job, 0, sizeof(job));
+    job.src_stride = src->stride;
+    job.src_width = (size_t)src_rect->w;
+    job.src_height = (size_t)src_rect->h;
+    job.format = src->format;
+    job.radius = radius;
+    job.shadow = shadow;
+    job.color = color;
+
+    job.factor = (radius + BLUR_CPU_MAX_RADIUS - 1) / BLUR_CPU_MAX_RADIUS;
+    job.width = (width + job.factor - 1) / job.factor;
+    job.height = (height + job.factor - 1) / job.factor;
+
+    /* Three boxes spread as far as one of their added radii. */
+    small_radius = radius / job.factor;
+    job.box_radius = small_radius >= 3 ? (small_radius + 1) / 3 : 1;
+    job.box_inv = (65536 + 2 * (uint32_t)job.box_radius) / (2 * (uint32_t)job.box_radius + 1);
+
+    job.small = malloc(job.width * job.height * sizeof(uint32_t));
+    job.tmp = malloc(job.width * job.height * sizeof(uint32_t));
+    if (!job.small || !job.tmp)
+    {
+        LIBM2D_ERROR("could not allocate memory to blur: %s\n", strerror(errno));
+        goto free_buf;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &timeout);
+    timeout.tv_sec += BLUR_TIMEOUT_SECS;
+    if (m2d_sync_for_cpu_read(src, &timeout) || m2d_sync_for_cpu(buf, &timeout))
+        goto free_buf;
+
+    src_data = m2d_get_data(src);
+    data = m2d_get_data(buf);
+    if (!src_data || !data)
+    {
+        LIBM2D_ERROR("buffer %u can't be accessed by the CPU to be blurred\n", src->id);
+        goto sync;
+    }
+
+    job.src = src_data + (size_t)src_rect->y * src->stride + (size_t)src_rect->x * bpp;
+    m2d_pool_run(job.height, blur_downscale_row, &job);
+    if (job.failed)
+    {
+        LIBM2D_ERROR("could not allocate memory to blur: %s\n", strerror(ENOMEM));
+        goto sync;
+    }
+
+    for (pass = 0; pass < 3; pass++)
+    {
+        m2d_pool_run((job.height + BLUR_BAND_ROWS - 1) / BLUR_BAND_ROWS, blur_rows, &job);
+        m2d_pool_run((job.width + BLUR_STRIPE_WIDTH - 1) / BLUR_STRIPE_WIDTH, blur_columns, &job);
+    }
+
+    if (job.factor == 1)
+    {
+        for (y = 0; y < height; y++)
+            memcpy(data + y * buf->stride, job.small + y * job.width, width * sizeof(uint32_t));
+    }
+    else if (m2d_resample(data, buf->stride, width, height, job.small,
+                          job.width * sizeof(uint32_t), job.width, job.height,
+                          M2D_PF_ARGB8888, M2D_FILTER_BILINEAR))
+    {
+        goto sync;
+    }
+
+    m2d_sync_for_gpu(buf);
+    m2d_sync_for_gpu(src);
+    free(job.tmp);
+    free(job.small);
+
+    return buf;
+
+sync:
+    m2d_sync_for_gpu(buf);
+    m2d_sync_for_gpu(src);
+free_buf:
+    free(job.tmp);
+    free(job.small);
+    m2d_free(buf);
+    return NULL;
+}
+
+/* Average @count copies of @src shifted by (@dx, @dy) into @dst. */
+static void blur_gpu_pass(struct m2d_buffer* dst, struct m2d_buffer* src,
+                          dim_t dx, dim_t dy, unsigned int count)
+{
+    struct m2d_rectangle rect;
+    unsigned int k;
+
+    rect.x = 0;
+    rect.y = 0;
+    rect.w = (dim_t)dst->width;
+    rect.h = (dim_t)dst->height;
+
+    m2d_set_target(dst);
+    m2d_source_enable(M2D_SRC, true);
+    m2d_blend_functions(M2D_FUNC_ADD, M2D_FUNC_ADD);
+    m2d_blend_factors(M2D_BLEND_CONSTANT_ALPHA, M2D_BLEND_ONE_MINUS_CONSTANT_ALPHA,
+                      M2D_BLEND_CONSTANT_ALPHA, M2D_BLEND_ONE_MINUS_CONSTANT_ALPHA);
+
+    for (k = 0; k < count; k++)
+    {
+        m2d_set_source(M2D_SRC, src, -(dim_t)k * dx, -(dim_t)k * dy);
+        m2d_blend_enable(k > 0);
+        m2d_blend_color(0, 0, 0, (uint8_t)((255 + (k + 1) / 2) / (k + 1)));
+        m2d_draw_rectangles(&rect, 1);
+    }
+}
+
+static struct m2d_buffer* blur_gpu(struct m2d_buffer* src, const struct m2d_rectangle* src_rect,
+                                   unsigned int radius, bool shadow, uint32_t color)
+{
+    size_t pad = 2 * (size_t)radius;
+    size_t width = (size_t)src_rect->w;
+    size_t height = (size_t)src_rect->h;
+    struct m2d_buffer* padded;
+    struct m2d_buffer* rows = NULL;
+    struct m2d_buffer* buf = NULL;
+    struct m2d_rectangle rect;
+
+    /* The copies shifted by up to 2 * @radius read transparent pixels. */
+    padded = m2d_alloc(width + 2 * pad, height + 2 * pad, M2D_PF_ARGB8888,
+                       (width + 2 * pad) * sizeof(uint32_t));
+    rows = m2d_alloc(width + pad, height + 2 * pad, M2D_PF_ARGB8888,
+                     (width + pad) * sizeof(uint32_t));
+    buf = m2d_alloc(width + pad, height + pad, M2D_PF_ARGB8888,
+                    (width + pad) * sizeof(uint32_t));
+    if (!padded || !rows || !buf)
+    {
+        if (buf)
+            m2d_free(buf);
+        buf = NULL;
+        goto free_bufs;
+    }
+
+    m2d_push_state();
+    m2d_set_target_transform(M2D_TRANSFORM_NONE);
+    m2d_source_enable(M2D_DST, false);
+    m2d_source_enable(M2D_MSK, false);
+
+    m2d_set_target(padded);
+    m2d_source_enable(M2D_SRC, false);
+    m2d_blend_enable(false);
+    m2d_source_color(0, 0, 0, 0);
+    rect.x = 0;
+    rect.y = 0;
+    rect.w = (dim_t)padded->width;
+    rect.h = (dim_t)padded->height;
+    m2d_draw_rectangles(&rect, 1);
+
+    rect.x = (dim_t)pad;
+    rect.y = (dim_t)pad;
+    rect.w = src_rect->w;
+    rect.h = src_rect->h;
+    m2d_set_source(M2D_SRC, src, rect.x - src_rect->x, rect.y - src_rect->y);
+
+    if (shadow)
+    {
+        /* The shadow color, weighted by the source alpha. */
+        m2d_source_color((color >> 16) & 0xff, (color >> 8) & 0xff, color & 0xff, color >> 24);
+        m2d_draw_rectangles(&rect, 1);
+        m2d_source_enable(M2D_SRC, true);
+        m2d_blend_enable(true);
+        m2d_blend_functions(M2D_FUNC_ADD, M2D_FUNC_ADD);
+        m2d_blend_factors(M2D_BLEND_ZERO, M2D_BLEND_SRC_ALPHA,
+                          M2D_BLEND_ZERO, M2D_BLEND_SRC_ALPHA);
+    }
+    else
+    {
+        m2d_source_enable(M2D_SRC, true);
+    }
+    m2d_draw_rectangles(&rect, 1);
+
+    blur_gpu_pass(rows, padded, 1, 0, 2 * radius + 1);
+    blur_gpu_pass(buf, rows, 0, 1, 2 * radius + 1);
+
+    m2d_pop_state();
+
+free_bufs:
+    /* Freed once the GPU is done with them. */
+    if (rows)
+        m2d_free(rows);
+    if (padded)
+        m2d_free(padded);
+
+    return buf;
+}
+
+struct m2d_buffer* m2d_blur_create(struct m2d_buffer* src, const struct m2d_rectangle* src_rect,
+                                   unsigned int radius, bool shadow, uint32_t color)
+{
+    struct m2d_buffer* buf;
+
+    if (radius <= BLUR_GPU_MAX_RADIUS)
+        buf = blur_gpu(src, src_rect, radius, shadow, color);
+    else
+        buf = blur_cpu(src, src_rect, radius, shadow, color);
+
+    if (!buf)
+        return NULL;
+
+    m2d_set_tag(buf, shadow ? "shadow" : "blurred");
+
+    LIBM2D_DEBUG("blurred %dx%d pixels of buffer %u by %u on the %s\n", src_rect->w,
+                 src_rect->h, src->id, radius, radius <= BLUR_GPU_MAX_RADIUS ? "GPU" : "CPU");
+
+    return buf;
+}
+
+/* Draw the @variant of @src_rect, spread by @radius, as if @src_rect were at (@x, @y). */
+static void blur_draw(struct m2d_buffer* variant, const struct m2d_rectangle* src_rect,
+                      dim_t x, dim_t y, unsigned int radius)
+{
+    struct m2d_rectangle rect;
+
+    rect.x = x - (dim_t)radius;
+    rect.y = y - (dim_t)radius;
+    rect.w = src_rect->w + 2 * (dim_t)radius;
+    rect.h = src_rect->h + 2 * (dim_t)radius;
+
+    m2d_source_enable(M2D_SRC, true);
+    m2d_set_source(M2D_SRC, variant, rect.x, rect.y);
+    m2d_draw_rectangles(&rect, 1);
+}
+
+static bool blur_check(struct m2d_buffer* src, const struct m2d_rectangle* src_rect,
+                       unsigned int* radius)
+{
+    if (!src)
+    {
+        LIBM2D_ERROR("no source surface to blur\n");
+        return false;
+    }
+
+    if (!m2d_source_rect_is_valid(src, src_rect))
+        return false;
+
+    if (*radius > BLUR_MAX_RADIUS)
+    {
+        LIBM2D_WARN("blur radius %u clamped to %u\n", *radius, BLUR_MAX_RADIUS);
+        *radius = BLUR_MAX_RADIUS;
+    }
+
+    return true;
+}
+
+void m2d_blur_blit(const struct m2d_rectangle* src_rect, dim_t x, dim_t y, unsigned int radius)
+{
+    struct m2d_buffer* src = m2d_get_source(M2D_SRC);
+    struct m2d_buffer* variant;
+    struct m2d_rectangle rect;
+
+    if (!blur_check(src, src_rect, &radius))
+        return;
+
+    if (!radius)
+    {
+        rect.x = x;
+        rect.y = y;
+        rect.w = src_rect->w;
+        rect.h = src_rect->h;
+
+        m2d_push_state();
+        m2d_source_enable(M2D_SRC, true);
+        m2d_set_source(M2D_SRC, src, x - src_rect->x, y - src_rect->y);
+        m2d_draw_rectangles(&rect, 1);
+        m2d_pop_state();
+        return;
+    }
+
+    variant = m2d_blurred_variant(src, src_rect, radius, false, 0);
+    if (!variant)
+        return;
+
+    m2d_push_state();
+    blur_draw(variant, src_rect, x, y, radius);
+    m2d_pop_state();
+}
+
+void m2d_draw_shadow(const struct m2d_rectangle* src_rect, dim_t x, dim_t y, unsigned int radius,
+                     uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha)
+{
+    struct m2d_buffer* src = m2d_get_source(M2D_SRC);
+    uint32_t color = (uint32_t)alpha << 24 | (uint32_t)red << 16 | (uint32_t)green << 8 | blue;
+    struct m2d_buffer* variant;
+
+    if (!blur_check(src, src_rect, &radius))
+        return;
+
+    variant = m2d_blurred_variant(src, src_rect, radius, true, color);
+    if (!variant)
+        return;
+
+    m2d_push_state();
+    m2d_source_enable(M2D_DST, false);
+    m2d_blend_enable(true);
+    m2d_blend_functions(M2D_FUNC_ADD, M2D_FUNC_ADD);
+    m2d_blend_factors(M2D_BLEND_ONE, M2D_BLEND_ONE_MINUS_SRC_ALPHA,
+                      M2D_BLEND_ONE, M2D_BLEND_ONE_MINUS_SRC_ALPHA);
+    blur_draw(variant, src_rect, x, y, radius);
+    m2d_pop_state();
+}
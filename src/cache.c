@@ -0,0 +1,388 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/cache.h"
+#include "m2d_priv.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/*
+ * Cached images are linked from the most to the least recently used. The
+ * cache holds a few dozens of images at most, backgrounds and icons, so
+ * lookups simply walk the list.
+ *
+ * The path key is checked against the file modification time and size. The
+ * content key is the FNV-1a hash and size of the file.
+ */
+struct m2d_cache_entry
+{
+    char* filename;
+    struct timespec mtime;
+    off_t file_size;
+    uint64_t hash;
+    struct m2d_image_options options;
+
+    struct m2d_buffer* buf;
+    unsigned int refs;
+
+    struct m2d_cache_entry* prev;
+    struct m2d_cache_entry* next;
+};
+
+static struct
+{
+    struct m2d_cache_entry* first;
+    struct m2d_cache_entry* last;
+
+    size_t budget;
+    struct m2d_reclaimer reclaimer;
+    bool registered;
+
+    struct m2d_cache_stats stats;
+} cache;
+
+static const struct m2d_image_options cache_default_options =
+{
+    .format = M2D_PF_ARGB8888,
+};
+
+uint64_t m2d_hash(const void* data, size_t size)
+{
+    const uint8_t* bytes = data;
+    uint64_t hash = FNV_OFFSET_BASIS;
+    size_t i;
+
+    for (i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static bool cache_same_options(const struct m2d_image_options* a,
+                               const struct m2d_image_options* b)
+{
+    return a->format == b->format && a->width == b->width &&
+        a->height == b->height;
+}
+
+static void cache_unlink(struct m2d_cache_entry* entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        cache.first = entry->next;
+
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        cache.last = entry->prev;
+
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+static void cache_link_first(struct m2d_cache_entry* entry)
+{
+    entry->prev = NULL;
+    entry->next = cache.first;
+
+    if (cache.first)
+        cache.first->prev = entry;
+    else
+        cache.last = entry;
+
+    cache.first = entry;
+}
+
+static struct m2d_buffer* cache_get(struct m2d_cache_entry* entry)
+{
+    size_t size = m2d_buffer_size(entry->buf);
+
+    if (!entry->refs++)
+        cache.stats.unused_bytes -= size;
+
+    cache_unlink(entry);
+    cache_link_first(entry);
+
+    return entry->buf;
+}
+
+static size_t cache_evict(struct m2d_cache_entry* entry)
+{
+    struct m2d_buffer* buf = entry->buf;
+    size_t size = m2d_buffer_size(buf);
+
+    LIBM2D_DEBUG("evicting %s, %zu byte(s)\n", entry->filename, size);
+
+    cache_unlink(entry);
+
+    cache.stats.num_images--;
+    cache.stats.bytes -= size;
+    cache.stats.unused_bytes -= size;
+    cache.stats.evictions++;
+
+    /* Not cached anymore: m2d_free() releases it for real. */
+    buf->cache_entry = NULL;
+    m2d_free(buf);
+
+    free(entry->filename);
+    free(entry);
+
+    return size;
+}
+
+/* Evict unused images, least recently used first, until @bytes are released. */
+static size_t cache_evict_unused(size_t bytes)
+{
+    struct m2d_cache_entry* entry;
+    struct m2d_cache_entry* prev;
+    size_t released = 0;
+
+    for (entry = cache.last; entry && released < bytes; entry = prev)
+    {
+        prev = entry->prev;
+        if (!entry->refs)
+            released += cache_evict(entry);
+    }
+
+    return released;
+}
+
+static size_t cache_reclaim(size_t bytes, void* data)
+{
+    (void)data;
+
+    return cache_evict_unused(bytes);
+}
+
+static void cache_enforce_budget(void)
+{
+    if (cache.budget && cache.stats.bytes > cache.budget)
+        cache_evict_unused(cache.stats.bytes - cache.budget);
+}
+
+static struct m2d_cache_entry* cache_find_path(const char* filename,
+                                               const struct stat* st,
+                                               const struct m2d_image_options* options)
+{
+    struct m2d_cache_entry* entry;
+
+    for (entry = cache.first; entry; entry = entry->next)
+    {
+        if (strcmp(entry->filename, filename) ||
+            !cache_same_options(&entry->options, options))
+            continue;
+
+        if (entry->file_size == st->st_size &&
+            entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+            entry->mtime.tv_nsec == st->st_mtim.tv_nsec)
+            return entry;
+    }
+
+    return NULL;
+}
+
+static struct m2d_cache_entry* cache_find_content(uint64_t hash, off_t size,
+                                                  const struct m2d_image_options* options)
+{
+    struct m2d_cache_entry* entry;
+
+    for (entry = cache.first; entry; entry = entry->next)
+    {
+        if (entry->hash == hash && entry->file_size == size &&
+            cache_same_options(&entry->options, options))
+            return entry;
+    }
+
+    return NULL;
+}
+
+static void* cache_read_file(int fd, size_t size)
+{
+    uint8_t* data;
+    size_t offset = 0;
+
+    data = malloc(size ? size : 1);
+    if (!data)
+    {
+        LIBM2D_ERROR("could not allocate memory for image file: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    while (offset < size)
+    {
+        ssize_t n = read(fd, data + offset, size - offset);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+        {
+            LIBM2D_ERROR("can't read image file: %s\n",
+                         n ? strerror(errno) : "unexpected end of file");
+            free(data);
+            return NULL;
+        }
+
+        offset += n;
+    }
+
+    return data;
+}
+
+struct m2d_buffer* m2d_cache_load(const char* filename,
+                                  const struct m2d_image_options* options)
+{
+    struct m2d_cache_entry* entry;
+    struct m2d_buffer* buf = NULL;
+    struct stat st;
+    uint8_t* data = NULL;
+    uint64_t hash;
+    int fd;
+
+    if (!options)
+        options = &cache_default_options;
+
+    if (!cache.registered)
+    {
+        cache.reclaimer.reclaim = cache_reclaim;
+        m2d_register_reclaimer(&cache.reclaimer);
+        cache.registered = true;
+    }
+
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        LIBM2D_ERROR("can't open %s: %s\n", filename, strerror(errno));
+        return NULL;
+    }
+
+    if (fstat(fd, &st))
+    {
+        LIBM2D_ERROR("can't stat %s: %s\n", filename, strerror(errno));
+        goto out;
+    }
+
+    entry = cache_find_path(filename, &st, options);
+    if (entry)
+    {
+        cache.stats.hits++;
+        buf = cache_get(entry);
+        goto out;
+    }
+
+    data = cache_read_file(fd, st.st_size);
+    if (!data)
+        goto out;
+
+    hash = m2d_hash(data, st.st_size);
+
+    entry = cache_find_content(hash, st.st_size, options);
+    if (entry)
+    {
+        cache.stats.content_hits++;
+        buf = cache_get(entry);
+        goto out;
+    }
+
+    entry = calloc(1, sizeof(*entry));
+    if (!entry)
+    {
+        LIBM2D_ERROR("could not allocate memory for cache entry: %s\n", strerror(errno));
+        goto out;
+    }
+
+    entry->filename = strdup(filename);
+    if (!entry->filename)
+    {
+        LIBM2D_ERROR("could not allocate memory for cache entry: %s\n", strerror(errno));
+        free(entry);
+        goto out;
+    }
+
+    cache.stats.misses++;
+
+    entry->buf = m2d_load_image_from_memory(data, st.st_size, options);
+    if (!entry->buf)
+    {
+        free(entry->filename);
+        free(entry);
+        goto out;
+    }
+
+    entry->mtime = st.st_mtim;
+    entry->file_size = st.st_size;
+    entry->hash = hash;
+    entry->options = *options;
+    entry->refs = 1;
+    entry->buf->cache_entry = entry;
+    m2d_set_tag(entry->buf, "cache");
+
+    cache_link_first(entry);
+    cache.stats.num_images++;
+    cache.stats.bytes += m2d_buffer_size(entry->buf);
+
+    buf = entry->buf;
+
+    cache_enforce_budget();
+
+out:
+    free(data);
+    close(fd);
+
+    return buf;
+}
+
+void m2d_cache_put(struct m2d_buffer* buf)
+{
+    struct m2d_cache_entry* entry = buf->cache_entry;
+
+    if (--entry->refs)
+        return;
+
+    cache.stats.unused_bytes += m2d_buffer_size(buf);
+    cache_enforce_budget();
+}
+
+void m2d_cache_set_budget(size_t budget)
+{
+    cache.budget = budget;
+    cache_enforce_budget();
+}
+
+void m2d_cache_trim()
+{
+    cache_evict_unused(SIZE_MAX);
+}
+
+void m2d_cache_get_stats(struct m2d_cache_stats* stats)
+{
+    *stats = cache.stats;
+}
+
+void m2d_cache_cleanup(void)
+{
+    m2d_cache_trim();
+
+    if (cache.stats.num_images)
+        LIBM2D_WARN("%zu cached image(s) still in use\n", cache.stats.num_images);
+
+    if (cache.registered)
+    {
+        m2d_unregister_reclaimer(&cache.reclaimer);
+        cache.registered = false;
+    }
+}
@@ -0,0 +1,558 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/m2d.h"
+#include "m2d_priv.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define COLOR_KEY_TIMEOUT_SECS 1
+
+/* Rows blitted by each CPU thread at once. */
+#define COLOR_KEY_BAND_ROWS 32
+
+/*
+ * Color keyed blits.
+ *
+ * The pixels of the key color are transparent. The GPU has no color key, but
+ * masks colors by blending: the key is turned into an A8 mask by the CPU,
+ * cached with the scaled variants, so that the source keeps its format. A
+ * draw takes two blends: the source with the alpha of the mask into a
+ * scratch surface, then the scratch surface onto the target. The pixels of
+ * ARGB8888 sources may be translucent, and are copied as they are: the mask
+ * clears the target first, then the masked source is added to it.
+ *
+ * The CPU renderer, or a GPU short of memory, blits by the CPU instead:
+ * each row compares the source pixels with the key and selects the source
+ * or the target pixel, 16 pixels at once with SIMD.
+ */
+static struct
+{
+    struct m2d_buffer* scratch;
+    struct m2d_reclaimer reclaimer;
+    bool registered;
+} color_key;
+
+struct color_key_job
+{
+    uint8_t* dst;
+    size_t dst_stride;
+    enum m2d_pixel_format dst_format;
+    const uint8_t* src;
+    size_t src_stride;
+    enum m2d_pixel_format src_format;
+    size_t width;
+    size_t height;
+    uint32_t key;
+    m2d_row_func convert;
+
+    /* Set by the jobs which could not allocate their rows. */
+    bool failed;
+};
+
+/* The key in the source @format, compared with its color bits only. */
+static uint32_t color_key_native(enum m2d_pixel_format format, uint32_t rgb)
+{
+    if (format == M2D_PF_RGB565)
+        return ((rgb >> 8) & 0xf800) | ((rgb >> 5) & 0x07e0) | ((rgb >> 3) & 0x001f);
+
+    return rgb & 0x00ffffff;
+}
+
+/* Set @mask to 0 where the @width pixels of @src are @key, 255 elsewhere. */
+static void color_key_mask_row(uint8_t* mask, const uint8_t* src, size_t width,
+                               enum m2d_pixel_format format, uint32_t key)
+{
+    size_t x = 0;
+
+    if (format == M2D_PF_RGB565)
+    {
+        const uint16_t* s = (const uint16_t*)src;
+
+#if defined(__ARM_NEON)
+        uint16x8_t k = vdupq_n_u16((uint16_t)key);
+
+        for (; x + 16 <= width; x += 16)
+        {
+            uint8x8_t lo = vmovn_u16(vceqq_u16(vld1q_u16(s + x), k));
+            uint8x8_t hi = vmovn_u16(vceqq_u16(vld1q_u16(s + x + 8), k));
+
+            vst1q_u8(mask + x, vmvnq_u8(vcombine_u8(lo, hi)));
+        }
+#elif defined(__SSE2__)
+        __m128i k = _mm_set1_epi16((short)key);
+        __m128i ones = _mm_set1_epi8(-1);
+
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i lo = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(s + x)), k);
+            __m128i hi = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(s + x + 8)), k);
+
+            _mm_storeu_si128((__m128i*)(mask + x),
+                             _mm_andnot_si128(_mm_packs_epi16(lo, hi), ones));
+        }
+#endif
+        for (; x < width; x++)
+            mask[x] = s[x] == key ? 0 : 255;
+    }
+    else
+    {
+        const uint32_t* s = (const uint32_t*)src;
+
+#if defined(__ARM_NEON)
+        uint32x4_t k = vdupq_n_u32(key);
+        uint32x4_t rgb = vdupq_n_u32(0x00ffffff);
+
+        for (; x + 16 <= width; x += 16)
+        {
+            uint16x4_t a = vmovn_u32(vceqq_u32(vandq_u32(vld1q_u32(s + x), rgb), k));
+            uint16x4_t b = vmovn_u32(vceqq_u32(vandq_u32(vld1q_u32(s + x + 4), rgb), k));
+            uint16x4_t c = vmovn_u32(vceqq_u32(vandq_u32(vld1q_u32(s + x + 8), rgb), k));
+            uint16x4_t d = vmovn_u32(vceqq_u32(vandq_u32(vld1q_u32(s + x + 12), rgb), k));
+            uint8x8_t lo = vmovn_u16(vcombine_u16(a, b));
+            uint8x8_t hi = vmovn_u16(vcombine_u16(c, d));
+
+            vst1q_u8(mask + x, vmvnq_u8(vcombine_u8(lo, hi)));
+        }
+#elif defined(__SSE2__)
+        __m128i k = _mm_set1_epi32((int)key);
+        __m128i rgb = _mm_set1_epi32(0x00ffffff);
+        __m128i ones = _mm_set1_epi8(-1);
+
+        for (; x + 16 <= width; x += 16)
+        {
+            const __m128i* p = (const __m128i*)(s + x);
+            __m128i a = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128(p), rgb), k);
+            __m128i b = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128(p + 1), rgb), k);
+            __m128i c = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128(p + 2), rgb), k);
+            __m128i d = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128(p + 3), rgb), k);
+            __m128i eq = _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+
+            _mm_storeu_si128((__m128i*)(mask + x), _mm_andnot_si128(eq, ones));
+        }
+#endif
+        for (; x < width; x++)
+            mask[x] = (s[x] & 0x00ffffff) == key ? 0 : 255;
+    }
+}
+
+/* Copy the @width pixels of @src into @dst where @mask is set. */
+static void color_key_select_row(uint8_t* dst, const uint8_t* src, const uint8_t* mask,
+                                 size_t width, size_t bpp)
+{
+    size_t x = 0;
+
+#if defined(__ARM_NEON)
+    for (; x + 16 <= width; x += 16)
+    {
+        uint8x16_t m = vld1q_u8(mask + x);
+        uint8x16x2_t m16 = vzipq_u8(m, m);
+        size_t i;
+
+        if (bpp == 1)
+        {
+            vst1q_u8(dst + x, vbslq_u8(m, vld1q_u8(src + x), vld1q_u8(dst + x)));
+            continue;
+        }
+
+        for (i = 0; i < 2; i++)
+        {
+            uint8_t* d = dst + (x + 8 * i) * bpp;
+            const uint8_t* s = src + (x + 8 * i) * bpp;
+
+            if (bpp == 2)
+            {
+                vst1q_u8(d, vbslq_u8(m16.val[i], vld1q_u8(s), vld1q_u8(d)));
+            }
+            else
+            {
+                uint16x8x2_t m32 = vzipq_u16(vreinterpretq_u16_u8(m16.val[i]),
+                                             vreinterpretq_u16_u8(m16.val[i]));
+
+                vst1q_u8(d, vbslq_u8(vreinterpretq_u8_u16(m32.val[0]), vld1q_u8(s),
+                                     vld1q_u8(d)));
+                vst1q_u8(d + 16, vbslq_u8(vreinterpretq_u8_u16(m32.val[1]), vld1q_u8(s + 16),
+                                          vld1q_u8(d + 16)));
+            }
+        }
+    }
+#elif defined(__SSE2__)
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i m = _mm_loadu_si128((const __m128i*)(mask + x));
+        __m128i m16[2];
+        __m128i s;
+        __m128i d;
+        size_t i;
+        size_t j;
+
+        if (bpp == 1)
+        {
+            s = _mm_loadu_si128((const __m128i*)(src + x));
+            d = _mm_loadu_si128((const __m128i*)(dst + x));
+            _mm_storeu_si128((__m128i*)(dst + x),
+                             _mm_or_si128(_mm_and_si128(m, s), _mm_andnot_si128(m, d)));
+            continue;
+        }
+
+        m16[0] = _mm_unpacklo_epi8(m, m);
+        m16[1] = _mm_unpackhi_epi8(m, m);
+
+        for (i = 0; i < 2; i++)
+        {
+            __m128i lanes[2];
+            size_t num_lanes = bpp == 2 ? 1 : 2;
+
+            if (bpp == 2)
+            {
+                lanes[0] = m16[i];
+            }
+            else
+            {
+                lanes[0] = _mm_unpacklo_epi16(m16[i], m16[i]);
+                lanes[1] = _mm_unpackhi_epi16(m16[i], m16[i]);
+            }
+
+            for (j = 0; j < num_lanes; j++)
+            {
+                __m128i* p = (__m128i*)(dst + (x + 8 * i + 4 * j) * bpp);
+
+                s = _mm_loadu_si128((const __m128i*)(src + (x + 8 * i + 4 * j) * bpp));
+                d = _mm_loadu_si128(p);
+                _mm_storeu_si128(p, _mm_or_si128(_mm_and_si128(lanes[j], s),
+                                                 _mm_andnot_si128(lanes[j], d)));
+            }
+        }
+    }
+#endif
+    for (; x < width; x++)
+    {
+        if (mask[x])
+            memcpy(dst + x * bpp, src + x * bpp, bpp);
+    }
+}
+
+static void color_key_band(size_t band, void* data)
+{
+    struct color_key_job* job = data;
+    size_t first = band * COLOR_KEY_BAND_ROWS;
+    size_t last = first + COLOR_KEY_BAND_ROWS < job->height ? first + COLOR_KEY_BAND_ROWS
+                                                            : job->height;
+    size_t bpp = m2d_byte_per_pixel(job->dst_format);
+    uint8_t* mask;
+    uint8_t* row = NULL;
+    size_t y;
+
+    mask = malloc(job->width);
+    if (job->convert)
+        row = malloc(job->width * bpp);
+    if (!mask || (job->convert && !row))
+    {
+        __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+        goto out;
+    }
+
+    for (y = first; y < last; y++)
+    {
+        const uint8_t* src = job->src + y * job->src_stride;
+
+        color_key_mask_row(mask, src, job->width, job->src_format, job->key);
+        if (job->convert)
+        {
+            job->convert(row, src, job->width);
+            src = row;
+        }
+
+        color_key_select_row(job->dst + y * job->dst_stride, src, mask, job->width, bpp);
+    }
+
+out:
+    free(row);
+    free(mask);
+}
+
+static bool color_key_blit_cpu(struct m2d_buffer* src, const struct m2d_rectangle* src_rect,
+                               dim_t x, dim_t y, uint32_t key)
+{
+    struct m2d_buffer* target = m2d_get_target();
+    struct m2d_rectangle bounds;
+    struct m2d_rectangle rect;
+    struct color_key_job job;
+    struct timespec timeout;
+    uint8_t* src_data;
+    uint8_t* dst_data;
+    bool done = false;
+
+    bounds.x = 0;
+    bounds.y = 0;
+    bounds.w = (dim_t)target->width;
+    bounds.h = (dim_t)target->height;
+    rect.x = x;
+    rect.y = y;
+    rect.w = src_rect->w;
+    rect.h = src_rect->h;
+    if (!m2d_intersect(&rect, &bounds, &rect))
+        return true;
+
+    clock_gettime(CLOCK_MONOTONIC, &timeout);
+    timeout.tv_sec += COLOR_KEY_TIMEOUT_SECS;
+    if (m2d_sync_for_cpu_read(src, &timeout))
+        return false;
+    if (m2d_sync_for_cpu(target, &timeout))
+        goto sync_src;
+
+    src_data = m2d_get_data(src);
+    dst_data = m2d_get_data(target);
+    if (!src_data || !dst_data)
+        goto sync;
+
+    memset(&job, 0, sizeof(job));
+    job.dst_format = target->format;
+    job.dst_stride = target->stride;
+    job.dst = dst_data + (size_t)rect.y * job.dst_stride +
+              (size_t)rect.x * m2d_byte_per_pixel(job.dst_format);
+    job.src_format = src->format;
+    job.src_stride = src->stride;
+    job.src = src_data + (size_t)(src_rect->y + rect.y - y) * job.src_stride +
+              (size_t)(src_rect->x + rect.x - x) * m2d_byte_per_pixel(job.src_format);
+    job.width = (size_t)rect.w;
+    job.height = (size_t)rect.h;
+    job.key = key;
+    job.convert = m2d_pixel_row_func(target->format, src->format);
+
+    m2d_pool_run((job.height + COLOR_KEY_BAND_ROWS - 1) / COLOR_KEY_BAND_ROWS, color_key_band,
+                 &job);
+    done = !job.failed;
+    if (!done)
+        LIBM2D_ERROR("could not allocate memory for a color keyed blit\n");
+
+sync:
+    m2d_sync_for_gpu(target);
+sync_src:
+    m2d_sync_for_gpu(src);
+    return done;
+}
+
+struct m2d_buffer* m2d_color_key_mask_create(struct m2d_buffer* src,
+                                             const struct m2d_rectangle* src_rect, uint32_t key)
+{
+    size_t bpp = m2d_byte_per_pixel(src->format);
+    size_t stride = ((size_t)src_rect->w + 3) & ~(size_t)3;
+    struct timespec timeout;
+    struct m2d_buffer* buf;
+    const uint8_t* src_data;
+    uint8_t* data;
+    dim_t y;
+
+    buf = m2d_alloc((size_t)src_rect->w, (size_t)src_rect->h, M2D_PF_A8, stride);
+    if (!buf)
+        return NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &timeout);
+    timeout.tv_sec += COLOR_KEY_TIMEOUT_SECS;
+    if (m2d_sync_for_cpu_read(src, &timeout) || m2d_sync_for_cpu(buf, &timeout))
+        goto free_buf;
+
+    src_data = m2d_get_data(src);
+    data = m2d_get_data(buf);
+    if (!src_data || !data)
+    {
+        LIBM2D_ERROR("buffer %u can't be accessed by the CPU to be keyed\n", src->id);
+        goto sync;
+    }
+
+    src_data += (size_t)src_rect->y * src->stride + (size_t)src_rect->x * bpp;
+    for (y = 0; y < src_rect->h; y++)
+        color_key_mask_row(data + (size_t)y * buf->stride, src_data + (size_t)y * src->stride,
+                           (size_t)src_rect->w, src->format, key);
+
+    m2d_sync_for_gpu(buf);
+    m2d_sync_for_gpu(src);
+    m2d_set_tag(buf, "color key");
+
+    LIBM2D_DEBUG("masked the color key %#x of buffer %u\n", key, src->id);
+
+    return buf;
+
+sync:
+    m2d_sync_for_gpu(buf);
+    m2d_sync_for_gpu(src);
+free_buf:
+    m2d_free(buf);
+    return NULL;
+}
+
+static size_t color_key_reclaim(size_t bytes, void* data)
+{
+    size_t size;
+
+    (void)bytes;
+    (void)data;
+
+    if (!color_key.scratch || m2d_buffer_is_bound(color_key.scratch))
+        return 0;
+
+    size = m2d_buffer_size(color_key.scratch);
+    m2d_free(color_key.scratch);
+    color_key.scratch = NULL;
+
+    return size;
+}
+
+/* The scratch surface, grown to @width x @height at least. */
+static struct m2d_buffer* color_key_scratch(dim_t width, dim_t height)
+{
+    struct m2d_buffer* scratch = color_key.scratch;
+    size_t w = (size_t)width;
+    size_t h = (size_t)height;
+
+    if (scratch && scratch->width >= w && scratch->height >= h)
+        return scratch;
+
+    if (scratch)
+    {
+        w = max_int(width, (int)scratch->width);
+        h = max_int(height, (int)scratch->height);
+        m2d_free(scratch);
+        color_key.scratch = NULL;
+    }
+
+    scratch = m2d_alloc(w, h, M2D_PF_ARGB8888, w * sizeof(uint32_t));
+    if (!scratch)
+        return NULL;
+
+    m2d_set_tag(scratch, "color key");
+
+    if (!color_key.registered)
+    {
+        color_key.reclaimer.reclaim = color_key_reclaim;
+        m2d_register_reclaimer(&color_key.reclaimer);
+        color_key.registered = true;
+    }
+
+    color_key.scratch = scratch;
+    return scratch;
+}
+
+void m2d_color_key_blit(const struct m2d_rectangle* src_rect, dim_t x, dim_t y,
+                        uint8_t red, uint8_t green, uint8_t blue)
+{
+    struct m2d_buffer* src = m2d_get_source(M2D_SRC);
+    struct m2d_buffer* target = m2d_get_target();
+    struct m2d_buffer* scratch;
+    struct m2d_buffer* mask;
+    struct m2d_rectangle rect;
+    uint32_t key;
+    bool opaque;
+
+    if (!src)
+    {
+        LIBM2D_ERROR("no source surface to blit\n");
+        return;
+    }
+
+    if (!target)
+    {
+        LIBM2D_ERROR("no target surface\n");
+        return;
+    }
+
+    if (src->format == M2D_PF_A8)
+    {
+        LIBM2D_ERROR("color keys need color sources\n");
+        return;
+    }
+
+    if (!m2d_source_rect_is_valid(src, src_rect) || src_rect->w <= 0 || src_rect->h <= 0)
+        return;
+
+    key = color_key_native(src->format, (uint32_t)red << 16 | (uint32_t)green << 8 | blue);
+    opaque = src->format == M2D_PF_RGB565;
+
+    if (m2d_get_renderer() != M2D_RENDERER_GPU && !m2d_get_target_transform() &&
+        color_key_blit_cpu(src, src_rect, x, y, key))
+        return;
+
+    mask = m2d_color_key_variant(src, src_rect, key);
+    scratch = mask ? color_key_scratch(src_rect->w, src_rect->h) : NULL;
+    if (!scratch)
+    {
+        if (m2d_get_target_transform() || !color_key_blit_cpu(src, src_rect, x, y, key))
+            LIBM2D_ERROR("could not blit buffer %u with a color key\n", src->id);
+        return;
+    }
+
+    m2d_push_state();
+    m2d_set_renderer(M2D_RENDERER_GPU);
+    m2d_source_enable(M2D_SRC, true);
+    m2d_source_enable(M2D_DST, true);
+    m2d_blend_enable(true);
+    m2d_blend_functions(M2D_FUNC_ADD, M2D_FUNC_ADD);
+
+    /* The source colors with the alpha of the mask, masked too unless opaque. */
+    rect.x = 0;
+    rect.y = 0;
+    rect.w = src_rect->w;
+    rect.h = src_rect->h;
+    m2d_set_target(scratch);
+    m2d_set_target_transform(M2D_TRANSFORM_NONE);
+    m2d_set_source(M2D_SRC, src, -src_rect->x, -src_rect->y);
+    m2d_set_source(M2D_DST, mask, 0, 0);
+    m2d_blend_factors(opaque ? M2D_BLEND_ONE : M2D_BLEND_DST_ALPHA, M2D_BLEND_ZERO,
+                      M2D_BLEND_DST_ALPHA, M2D_BLEND_ZERO);
+    m2d_draw_rectangles(&rect, 1);
+    m2d_pop_state();
+
+    m2d_push_state();
+    m2d_set_renderer(M2D_RENDERER_GPU);
+    m2d_source_enable(M2D_SRC, true);
+    m2d_source_enable(M2D_DST, false);
+    m2d_blend_enable(true);
+    m2d_blend_functions(M2D_FUNC_ADD, M2D_FUNC_ADD);
+    rect.x = x;
+    rect.y = y;
+    if (opaque)
+    {
+        /* The alpha of the mask selects the source or the target pixels. */
+        m2d_blend_factors(M2D_BLEND_SRC_ALPHA, M2D_BLEND_ONE_MINUS_SRC_ALPHA,
+                          M2D_BLEND_ONE, M2D_BLEND_ONE_MINUS_SRC_ALPHA);
+    }
+    else
+    {
+        m2d_blend_factors(M2D_BLEND_ZERO, M2D_BLEND_ONE_MINUS_SRC_ALPHA,
+                          M2D_BLEND_ZERO, M2D_BLEND_ONE_MINUS_SRC_ALPHA);
+        m2d_set_source(M2D_SRC, mask, x, y);
+        m2d_draw_rectangles(&rect, 1);
+
+        m2d_blend_factors(M2D_BLEND_ONE, M2D_BLEND_ONE, M2D_BLEND_ONE, M2D_BLEND_ONE);
+    }
+    m2d_set_source(M2D_SRC, scratch, x, y);
+    m2d_draw_rectangles(&rect, 1);
+    m2d_pop_state();
+}
+
+void m2d_color_key_cleanup(void)
+{
+    if (color_key.scratch)
+    {
+        m2d_free(color_key.scratch);
+        color_key.scratch = NULL;
+    }
+
+    if (color_key.registered)
+    {
+        m2d_unregister_reclaimer(&color_key.reclaimer);
+        color_key.registered = false;
+    }
+}
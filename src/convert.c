@@ -0,0 +1,555 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/convert.h"
+#include "m2d_priv.h"
+
+#include <pthread.h>
+#include <string.h>
+
+/*
+ * Pixel format conversions.
+ *
+ * ARGB8888 is stored as a native 32-bit word: B, G, R, A bytes on little
+ * endian CPUs. Decoders produce R, G, B(, A) bytes with straight alpha.
+ *
+ * The hot loops come in one set of kernels per instruction set, picked once
+ * at runtime: NEON is known at build time, AVX2 is probed on x86 CPUs on top
+ * of the SSE2 baseline. Less common conversions are scalar only.
+ */
+
+/* x * a / 255, correctly rounded. */
+static inline uint32_t mul_div255(uint32_t x, uint32_t a)
+{
+    uint32_t t = x * a + 128;
+
+    return (t + (t >> 8)) >> 8;
+}
+
+/* Multiply the R and B bytes of @rb, 16 bits apart, by @a at once. */
+static inline uint32_t mul_div255_rb(uint32_t rb, uint32_t a)
+{
+    rb = rb * a + 0x00800080u;
+
+    return ((rb + ((rb >> 8) & 0x00ff00ffu)) >> 8) & 0x00ff00ffu;
+}
+
+static inline uint32_t premultiply_rgba(const uint8_t* p)
+{
+    uint32_t a = p[3];
+
+    if (a == 255)
+        return 0xff000000u | (p[0] << 16) | (p[1] << 8) | p[2];
+
+    if (a == 0)
+        return 0;
+
+    return (a << 24) | mul_div255_rb((uint32_t)p[0] << 16 | p[2], a) |
+        (mul_div255(p[1], a) << 8);
+}
+
+static inline uint32_t premultiply_argb(uint32_t p)
+{
+    uint32_t a = p >> 24;
+
+    if (a == 255)
+        return p;
+
+    if (a == 0)
+        return 0;
+
+    return (a << 24) | mul_div255_rb(p & 0x00ff00ffu, a) |
+        (mul_div255((p >> 8) & 0xff, a) << 8);
+}
+
+static inline uint16_t pack_rgb565(uint32_t r, uint32_t g, uint32_t b)
+{
+    return (uint16_t)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+}
+
+static inline uint32_t unpack_rgb565(uint16_t p)
+{
+    uint32_t r = (p >> 11) & 0x1f;
+    uint32_t g = (p >> 5) & 0x3f;
+    uint32_t b = p & 0x1f;
+
+    /* Replicate the high bits, so that white stays white. */
+    r = (r << 3) | (r >> 2);
+    g = (g << 2) | (g >> 4);
+    b = (b << 3) | (b >> 2);
+
+    return 0xff000000u | (r << 16) | (g << 8) | b;
+}
+
+/* Add the B, G, R bytes of @bias to @p, with saturation. */
+static inline uint32_t add_bias(uint32_t p, uint32_t bias)
+{
+    uint32_t r = ((p >> 16) & 0xff) + ((bias >> 16) & 0xff);
+    uint32_t g = ((p >> 8) & 0xff) + ((bias >> 8) & 0xff);
+    uint32_t b = (p & 0xff) + (bias & 0xff);
+
+    return (r > 255 ? 255 : r) << 16 | (g > 255 ? 255 : g) << 8 |
+        (b > 255 ? 255 : b);
+}
+
+static void c_rgba_premultiply(void* dst, const uint8_t* src, size_t width)
+{
+    uint32_t* d = dst;
+    size_t i;
+
+    for (i = 0; i < width; i++, src += 4)
+        d[i] = premultiply_rgba(src);
+}
+
+static void c_rgba_swizzle(void* dst, const uint8_t* src, size_t width)
+{
+    uint32_t* d = dst;
+    size_t i;
+
+    for (i = 0; i < width; i++, src += 4)
+        d[i] = (uint32_t)src[3] << 24 | src[0] << 16 | src[1] << 8 | src[2];
+}
+
+static void c_premultiply(void* dst, const uint8_t* src, size_t width)
+{
+    const uint32_t* s = (const uint32_t*)src;
+    uint32_t* d = dst;
+    size_t i;
+
+    for (i = 0; i < width; i++)
+        d[i] = premultiply_argb(s[i]);
+}
+
+static void c_argb8888_to_a8(void* dst, const uint8_t* src, size_t width)
+{
+    const uint32_t* s = (const uint32_t*)src;
+    uint8_t* d = dst;
+    size_t i;
+
+    for (i = 0; i < width; i++)
+        d[i] = (uint8_t)(s[i] >> 24);
+}
+
+/* A8 pixels are alpha masks, that is white with coverage. */
+static void c_a8_to_argb8888(void* dst, const uint8_t* src, size_t width)
+{
+    uint32_t* d = dst;
+    size_t i;
+
+    for (i = 0; i < width; i++)
+        d[i] = src[i] * 0x01010101u;
+}
+
+static void c_rgb565_to_argb8888(void* dst, const uint8_t* src, size_t width)
+{
+    const uint16_t* s = (const uint16_t*)src;
+    uint32_t* d = dst;
+    size_t i;
+
+    for (i = 0; i < width; i++)
+        d[i] = unpack_rgb565(s[i]);
+}
+
+/* RGB565 has no alpha: premultiplied pixels are composited over black. */
+static void c_argb8888_to_rgb565(void* dst, const uint8_t* src, size_t width,
+                                 const uint32_t* bias)
+{
+    const uint32_t* s = (const uint32_t*)src;
+    uint16_t* d = dst;
+    size_t i;
+
+    for (i = 0; i < width; i++)
+    {
+        uint32_t p = bias ? add_bias(s[i], bias[i & 3]) : s[i];
+
+        d[i] = pack_rgb565((p >> 16) & 0xff, (p >> 8) & 0xff, p & 0xff);
+    }
+}
+
+const struct m2d_convert_kernels m2d_convert_c =
+{
+    .isa = "c",
+    .rgba_premultiply = c_rgba_premultiply,
+    .rgba_swizzle = c_rgba_swizzle,
+    .premultiply = c_premultiply,
+    .argb8888_to_a8 = c_argb8888_to_a8,
+    .a8_to_argb8888 = c_a8_to_argb8888,
+    .rgb565_to_argb8888 = c_rgb565_to_argb8888,
+    .argb8888_to_rgb565 = c_argb8888_to_rgb565,
+};
+
+static const struct m2d_convert_kernels* const convert_isas[] =
+{
+#if defined(__ARM_NEON)
+    &m2d_convert_neon,
+#endif
+#if defined(M2D_CONVERT_AVX2)
+    &m2d_convert_avx2,
+#endif
+#if defined(__SSE2__)
+    &m2d_convert_sse2,
+#endif
+    &m2d_convert_c,
+};
+
+/* Atomic: m2d_convert_set_isa() may run while the pool threads convert. */
+static const struct m2d_convert_kernels* kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static bool convert_isa_supported(const struct m2d_convert_kernels* isa)
+{
+#if defined(M2D_CONVERT_AVX2)
+    if (isa == &m2d_convert_avx2)
+        return __builtin_cpu_supports("avx2");
+#endif
+    (void)isa;
+
+    return true;
+}
+
+/* The first supported instruction set, the most efficient one. */
+static void convert_select(void)
+{
+    size_t i;
+
+    for (i = 0; !kernels; i++)
+        if (convert_isa_supported(convert_isas[i]))
+            kernels = convert_isas[i];
+
+    LIBM2D_DEBUG("pixel conversions use %s kernels\n", kernels->isa);
+}
+
+static inline const struct m2d_convert_kernels* convert_kernels(void)
+{
+    pthread_once(&kernels_once, convert_select);
+
+    return __atomic_load_n(&kernels, __ATOMIC_ACQUIRE);
+}
+
+const char* m2d_convert_get_isa()
+{
+    return convert_kernels()->isa;
+}
+
+int m2d_convert_set_isa(const char* isa)
+{
+    size_t i;
+
+    pthread_once(&kernels_once, convert_select);
+
+    for (i = 0; i < ARRAY_SIZE(convert_isas); i++)
+    {
+        if (!strcmp(convert_isas[i]->isa, isa) && convert_isa_supported(convert_isas[i]))
+        {
+            __atomic_store_n(&kernels, convert_isas[i], __ATOMIC_RELEASE);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Ordered dithering: 4x4 Bayer thresholds, scaled to the quantization steps
+ * of the 5-bit (red, blue) and 6-bit (green) channels.
+ */
+#define DITHER(t) (((t) >> 1) << 16 | ((t) >> 2) << 8 | ((t) >> 1))
+
+static const uint32_t dither_bias[4][4] =
+{
+    { DITHER(0), DITHER(8), DITHER(2), DITHER(10) },
+    { DITHER(12), DITHER(4), DITHER(14), DITHER(6) },
+    { DITHER(3), DITHER(11), DITHER(1), DITHER(9) },
+    { DITHER(15), DITHER(7), DITHER(13), DITHER(5) },
+};
+
+static void argb8888_to_rgb565(void* dst, const uint8_t* src, size_t width)
+{
+    convert_kernels()->argb8888_to_rgb565(dst, src, width, NULL);
+}
+
+static void unpremultiply(void* dst, const uint8_t* src, size_t width)
+{
+    const uint32_t* s = (const uint32_t*)src;
+    uint32_t* d = dst;
+    size_t i;
+
+    for (i = 0; i < width; i++)
+    {
+        uint32_t a = s[i] >> 24;
+        uint32_t r;
+        uint32_t g;
+        uint32_t b;
+
+        if (a == 255 || a == 0)
+        {
+            d[i] = a ? s[i] : 0;
+            continue;
+        }
+
+        /* Rounded c * 255 / a, clamped for out of range premultiplied colors. */
+        r = (((s[i] >> 16) & 0xff) * 255 + a / 2) / a;
+        g = (((s[i] >> 8) & 0xff) * 255 + a / 2) / a;
+        b = ((s[i] & 0xff) * 255 + a / 2) / a;
+        d[i] = a << 24 | (r > 255 ? 255 : r) << 16 | (g > 255 ? 255 : g) << 8 |
+            (b > 255 ? 255 : b);
+    }
+}
+
+static void rgb565_to_a8(void* dst, const uint8_t* src, size_t width)
+{
+    (void)src;
+
+    memset(dst, 0xff, width);
+}
+
+static void a8_to_rgb565(void* dst, const uint8_t* src, size_t width)
+{
+    uint16_t* d = dst;
+    size_t i;
+
+    for (i = 0; i < width; i++)
+        d[i] = pack_rgb565(src[i], src[i], src[i]);
+}
+
+static void rgba_to_rgb565(void* dst, const uint8_t* src, size_t width)
+{
+    uint16_t* d = dst;
+    size_t i;
+
+    for (i = 0; i < width; i++, src += 4)
+    {
+        uint32_t a = src[3];
+
+        if (a == 255)
+            d[i] = pack_rgb565(src[0], src[1], src[2]);
+        else
+            d[i] = pack_rgb565(mul_div255(src[0], a), mul_div255(src[1], a),
+                               mul_div255(src[2], a));
+    }
+}
+
+static void rgba_to_a8(void* dst, const uint8_t* src, size_t width)
+{
+    uint8_t* d = dst;
+    size_t i;
+
+    for (i = 0; i < width; i++, src += 4)
+        d[i] = src[3];
+}
+
+static void rgb_to_argb8888(void* dst, const uint8_t* src, size_t width)
+{
+    uint32_t* d = dst;
+    size_t i;
+
+    for (i = 0; i < width; i++, src += 3)
+        d[i] = 0xff000000u | (src[0] << 16) | (src[1] << 8) | src[2];
+}
+
+static void rgb_to_rgb565(void* dst, const uint8_t* src, size_t width)
+{
+    uint16_t* d = dst;
+    size_t i;
+
+    for (i = 0; i < width; i++, src += 3)
+        d[i] = pack_rgb565(src[0], src[1], src[2]);
+}
+
+/* Opaque images used as masks: the luminance tells the coverage. */
+static void rgb_to_a8(void* dst, const uint8_t* src, size_t width)
+{
+    uint8_t* d = dst;
+    size_t i;
+
+    for (i = 0; i < width; i++, src += 3)
+        d[i] = (uint8_t)((src[0] * 77 + src[1] * 150 + src[2] * 29) >> 8);
+}
+
+m2d_row_func m2d_pixel_row_func(enum m2d_pixel_format dst_format,
+                                enum m2d_pixel_format src_format)
+{
+    const struct m2d_convert_kernels* k = convert_kernels();
+
+    if (dst_format >= M2D_NUM_PIXEL_FORMATS || src_format >= M2D_NUM_PIXEL_FORMATS)
+        return NULL;
+
+    const m2d_row_func funcs[M2D_NUM_PIXEL_FORMATS][M2D_NUM_PIXEL_FORMATS] =
+    {
+        [M2D_PF_ARGB8888] =
+        {
+            [M2D_PF_RGB565] = k->rgb565_to_argb8888,
+            [M2D_PF_A8] = k->a8_to_argb8888,
+        },
+        [M2D_PF_RGB565] =
+        {
+            [M2D_PF_ARGB8888] = argb8888_to_rgb565,
+            [M2D_PF_A8] = a8_to_rgb565,
+        },
+        [M2D_PF_A8] =
+        {
+            [M2D_PF_ARGB8888] = k->argb8888_to_a8,
+            [M2D_PF_RGB565] = rgb565_to_a8,
+        },
+    };
+
+    return funcs[dst_format][src_format];
+}
+
+m2d_row_func m2d_rgba_row_func(enum m2d_pixel_format format)
+{
+    switch (format)
+    {
+    case M2D_PF_ARGB8888:
+        return convert_kernels()->rgba_premultiply;
+
+    case M2D_PF_RGB565:
+        return rgba_to_rgb565;
+
+    case M2D_PF_A8:
+        return rgba_to_a8;
+
+    default:
+        break;
+    }
+
+    return NULL;
+}
+
+m2d_row_func m2d_rgb_row_func(enum m2d_pixel_format format)
+{
+    switch (format)
+    {
+    case M2D_PF_ARGB8888:
+        return rgb_to_argb8888;
+
+    case M2D_PF_RGB565:
+        return rgb_to_rgb565;
+
+    case M2D_PF_A8:
+        return rgb_to_a8;
+
+    default:
+        break;
+    }
+
+    return NULL;
+}
+
+/*
+ * Large conversions are split into bands of rows of about CONVERT_BAND_SIZE
+ * bytes, converted by the CPU threads.
+ */
+#define CONVERT_BAND_SIZE (64 * 1024)
+#define CONVERT_PARALLEL_MIN (256 * 1024)
+
+struct convert_job
+{
+    uint8_t* dst;
+    size_t dst_stride;
+    enum m2d_pixel_format dst_format;
+    const uint8_t* src;
+    size_t src_stride;
+    enum m2d_pixel_format src_format;
+    size_t width;
+    size_t height;
+    unsigned int flags;
+    size_t band_height;
+};
+
+static void convert_band(size_t band, void* data)
+{
+    const struct convert_job* job = data;
+    const struct m2d_convert_kernels* k = convert_kernels();
+    size_t row_size = job->width * m2d_byte_per_pixel(job->src_format);
+    size_t y = band * job->band_height;
+    size_t end = y + job->band_height < job->height ? y + job->band_height : job->height;
+    const uint8_t* s = job->src + y * job->src_stride;
+    uint8_t* d = job->dst + y * job->dst_stride;
+    m2d_row_func convert = m2d_pixel_row_func(job->dst_format, job->src_format);
+
+    for (; y < end; y++, s += job->src_stride, d += job->dst_stride)
+    {
+        if (job->dst_format == M2D_PF_RGB565 && job->src_format == M2D_PF_ARGB8888)
+            k->argb8888_to_rgb565(d, s, job->width,
+                                  job->flags & M2D_CONVERT_DITHER ? dither_bias[y & 3] : NULL);
+        else if (convert)
+            convert(d, s, job->width);
+        else
+            memmove(d, s, row_size);
+    }
+}
+
+int m2d_convert(void* dst, size_t dst_stride, enum m2d_pixel_format dst_format,
+                const void* src, size_t src_stride, enum m2d_pixel_format src_format,
+                size_t width, size_t height, unsigned int flags)
+{
+    size_t dst_bpp = m2d_byte_per_pixel(dst_format);
+    size_t src_bpp = m2d_byte_per_pixel(src_format);
+    uintptr_t dst_start = (uintptr_t)dst;
+    uintptr_t src_start = (uintptr_t)src;
+    struct convert_job job;
+    size_t row_size;
+
+    if (!dst_bpp || !src_bpp)
+        return -1;
+
+    if (!width || !height)
+        return 0;
+
+    /* Rows are converted in place from left to right, and top to bottom. */
+    if (dst_start < src_start + (height - 1) * src_stride + width * src_bpp &&
+        src_start < dst_start + (height - 1) * dst_stride + width * dst_bpp &&
+        (dst != src || dst_bpp > src_bpp || dst_stride > src_stride))
+    {
+        LIBM2D_ERROR("can't convert overlapping pixels from %s to %s\n",
+                     m2d_format_name(src_format), m2d_format_name(dst_format));
+        return -1;
+    }
+
+    job.dst = dst;
+    job.dst_stride = dst_stride;
+    job.dst_format = dst_format;
+    job.src = src;
+    job.src_stride = src_stride;
+    job.src_format = src_format;
+    job.width = width;
+    job.height = height;
+    job.flags = flags;
+    job.band_height = height;
+
+    /* In place, a row may overwrite the previous ones: these must be read first. */
+    row_size = width * dst_bpp;
+    if (width * height >= CONVERT_PARALLEL_MIN && (dst != src || dst_stride == src_stride))
+    {
+        job.band_height = CONVERT_BAND_SIZE / row_size;
+        if (!job.band_height)
+            job.band_height = 1;
+    }
+
+    m2d_pool_run((height + job.band_height - 1) / job.band_height, convert_band, &job);
+
+    return 0;
+}
+
+void m2d_premultiply(uint32_t* dst, const uint32_t* src, size_t count)
+{
+    convert_kernels()->premultiply(dst, (const uint8_t*)src, count);
+}
+
+void m2d_unpremultiply(uint32_t* dst, const uint32_t* src, size_t count)
+{
+    unpremultiply(dst, (const uint8_t*)src, count);
+}
+
+void m2d_swizzle_rgba(uint32_t* dst, const uint8_t* src, size_t count)
+{
+    convert_kernels()->rgba_swizzle(dst, src, count);
+}
+
+void m2d_premultiply_rgba(uint32_t* dst, const uint8_t* src, size_t count)
+{
+    convert_kernels()->rgba_premultiply(dst, src, count);
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d_priv.h"
+
+/*
+ * NEON pixel conversion kernels, see convert.c. The de-interleaving loads and
+ * stores give one channel per register: 8 pixels per iteration.
+ */
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+
+/* vraddhn(t, t >> 8) is the rounded division by 255. */
+static inline uint8x8_t neon_mul_div255(uint8x8_t x, uint8x8_t a)
+{
+    uint16x8_t t = vmull_u8(x, a);
+
+    return vraddhn_u16(t, vrshrq_n_u16(t, 8));
+}
+
+static void neon_rgba_premultiply(void* dst, const uint8_t* src, size_t width)
+{
+    uint8_t* d = dst;
+    size_t i;
+
+    for (i = 0; i + 8 <= width; i += 8, src += 32, d += 32)
+    {
+        uint8x8x4_t in = vld4_u8(src);
+        uint8x8x4_t out;
+
+        out.val[0] = neon_mul_div255(in.val[2], in.val[3]);
+        out.val[1] = neon_mul_div255(in.val[1], in.val[3]);
+        out.val[2] = neon_mul_div255(in.val[0], in.val[3]);
+        out.val[3] = in.val[3];
+        vst4_u8(d, out);
+    }
+
+    m2d_convert_c.rgba_premultiply(d, src, width - i);
+}
+
+static void neon_rgba_swizzle(void* dst, const uint8_t* src, size_t width)
+{
+    uint8_t* d = dst;
+    size_t i;
+
+    for (i = 0; i + 16 <= width; i += 16, src += 64, d += 64)
+    {
+        uint8x16x4_t in = vld4q_u8(src);
+        uint8x16_t r = in.val[0];
+
+        in.val[0] = in.val[2];
+        in.val[2] = r;
+        vst4q_u8(d, in);
+    }
+
+    m2d_convert_c.rgba_swizzle(d, src, width - i);
+}
+
+static void neon_premultiply(void* dst, const uint8_t* src, size_t width)
+{
+    uint8_t* d = dst;
+    size_t i;
+
+    for (i = 0; i + 8 <= width; i += 8, src += 32, d += 32)
+    {
+        uint8x8x4_t p = vld4_u8(src);
+
+        p.val[0] = neon_mul_div255(p.val[0], p.val[3]);
+        p.val[1] = neon_mul_div255(p.val[1], p.val[3]);
+        p.val[2] = neon_mul_div255(p.val[2], p.val[3]);
+        vst4_u8(d, p);
+    }
+
+    m2d_convert_c.premultiply(d, src, width - i);
+}
+
+static void neon_argb8888_to_a8(void* dst, const uint8_t* src, size_t width)
+{
+    uint8_t* d = dst;
+    size_t i;
+
+    for (i = 0; i + 16 <= width; i += 16, src += 64, d += 16)
+        vst1q_u8(d, vld4q_u8(src).val[3]);
+
+    m2d_convert_c.argb8888_to_a8(d, src, width - i);
+}
+
+static void neon_a8_to_argb8888(void* dst, const uint8_t* src, size_t width)
+{
+    uint8_t* d = dst;
+    size_t i;
+
+    for (i = 0; i + 16 <= width; i += 16, src += 16, d += 64)
+    {
+        uint8x16x4_t out;
+
+        out.val[0] = vld1q_u8(src);
+        out.val[1] = out.val[0];
+        out.val[2] = out.val[0];
+        out.val[3] = out.val[0];
+        vst4q_u8(d, out);
+    }
+
+    m2d_convert_c.a8_to_argb8888(d, src, width - i);
+}
+
+static void neon_rgb565_to_argb8888(void* dst, const uint8_t* src, size_t width)
+{
+    uint8_t* d = dst;
+    size_t i;
+
+    for (i = 0; i + 8 <= width; i += 8, src += 16, d += 32)
+    {
+        uint16x8_t p = vld1q_u16((const uint16_t*)src);
+        uint8x8x4_t out;
+        uint8x8_t r = vand_u8(vshrn_n_u16(p, 8), vdup_n_u8(0xf8));
+        uint8x8_t g = vand_u8(vshrn_n_u16(p, 3), vdup_n_u8(0xfc));
+        uint8x8_t b = vmovn_u16(vshlq_n_u16(p, 3));
+
+        /* Replicate the high bits, so that white stays white. */
+        out.val[0] = vorr_u8(b, vshr_n_u8(b, 5));
+        out.val[1] = vorr_u8(g, vshr_n_u8(g, 6));
+        out.val[2] = vorr_u8(r, vshr_n_u8(r, 5));
+        out.val[3] = vdup_n_u8(0xff);
+        vst4_u8(d, out);
+    }
+
+    m2d_convert_c.rgb565_to_argb8888(d, src, width - i);
+}
+
+static void neon_argb8888_to_rgb565(void* dst, const uint8_t* src, size_t width,
+                                    const uint32_t* bias)
+{
+    uint8x8x4_t b = { { vdup_n_u8(0), vdup_n_u8(0), vdup_n_u8(0), vdup_n_u8(0) } };
+    uint16_t* d = dst;
+    size_t i;
+
+    if (bias)
+    {
+        /* The 4 thresholds twice, one channel per register. */
+        uint32_t t[8] = { bias[0], bias[1], bias[2], bias[3],
+                          bias[0], bias[1], bias[2], bias[3] };
+
+        b = vld4_u8((const uint8_t*)t);
+    }
+
+    for (i = 0; i + 8 <= width; i += 8, src += 32, d += 8)
+    {
+        uint8x8x4_t p = vld4_u8(src);
+        uint16x8_t out;
+
+        out = vshll_n_u8(vqadd_u8(p.val[2], b.val[2]), 8);
+        out = vsriq_n_u16(out, vshll_n_u8(vqadd_u8(p.val[1], b.val[1]), 8), 5);
+        out = vsriq_n_u16(out, vshll_n_u8(vqadd_u8(p.val[0], b.val[0]), 8), 11);
+        vst1q_u16(d, out);
+    }
+
+    m2d_convert_c.argb8888_to_rgb565(d, src, width - i, bias);
+}
+
+const struct m2d_convert_kernels m2d_convert_neon =
+{
+    .isa = "neon",
+    .rgba_premultiply = neon_rgba_premultiply,
+    .rgba_swizzle = neon_rgba_swizzle,
+    .premultiply = neon_premultiply,
+    .argb8888_to_a8 = neon_argb8888_to_a8,
+    .a8_to_argb8888 = neon_a8_to_argb8888,
+    .rgb565_to_argb8888 = neon_rgb565_to_argb8888,
+    .argb8888_to_rgb565 = neon_argb8888_to_rgb565,
+};
+#endif /* __ARM_NEON */
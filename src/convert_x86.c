@@ -0,0 +1,403 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d_priv.h"
+
+/*
+ * SSE2 and AVX2 pixel conversion kernels, see convert.c. SSE2 is the x86-64
+ * baseline, AVX2 kernels are built for it whatever the compiler flags and only
+ * used if the CPU supports it.
+ */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+/* Multiply the R, G, B bytes of 4 pixels by their alpha byte. */
+static inline __m128i sse2_premultiply(__m128i in)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rgb_mask = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+    const __m128i alpha_one = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+    const __m128i bias = _mm_set1_epi16(128);
+    __m128i lo = _mm_unpacklo_epi8(in, zero);
+    __m128i hi = _mm_unpackhi_epi8(in, zero);
+    __m128i alo;
+    __m128i ahi;
+
+    /* Multiply by A and A by 255, so that it is kept. */
+    alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xff), 0xff);
+    ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xff), 0xff);
+    alo = _mm_or_si128(_mm_and_si128(alo, rgb_mask), alpha_one);
+    ahi = _mm_or_si128(_mm_and_si128(ahi, rgb_mask), alpha_one);
+    lo = _mm_add_epi16(_mm_mullo_epi16(lo, alo), bias);
+    hi = _mm_add_epi16(_mm_mullo_epi16(hi, ahi), bias);
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+    return _mm_packus_epi16(lo, hi);
+}
+
+/* R, G, B, A bytes -> B, G, R, A bytes */
+static inline __m128i sse2_swap_rb(__m128i in)
+{
+    const __m128i ag_mask = _mm_set1_epi32((int)0xff00ff00u);
+    __m128i rb = _mm_andnot_si128(ag_mask, in);
+
+    rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+
+    return _mm_or_si128(_mm_and_si128(in, ag_mask), rb);
+}
+
+static void sse2_rgba_premultiply(void* dst, const uint8_t* src, size_t width)
+{
+    uint32_t* d = dst;
+    size_t i;
+
+    for (i = 0; i + 4 <= width; i += 4, src += 16, d += 4)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i*)src);
+
+        _mm_storeu_si128((__m128i*)d, sse2_swap_rb(sse2_premultiply(in)));
+    }
+
+    m2d_convert_c.rgba_premultiply(d, src, width - i);
+}
+
+static void sse2_rgba_swizzle(void* dst, const uint8_t* src, size_t width)
+{
+    uint32_t* d = dst;
+    size_t i;
+
+    for (i = 0; i + 4 <= width; i += 4, src += 16, d += 4)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i*)src);
+
+        _mm_storeu_si128((__m128i*)d, sse2_swap_rb(in));
+    }
+
+    m2d_convert_c.rgba_swizzle(d, src, width - i);
+}
+
+static void sse2_premultiply_row(void* dst, const uint8_t* src, size_t width)
+{
+    uint32_t* d = dst;
+    size_t i;
+
+    for (i = 0; i + 4 <= width; i += 4, src += 16, d += 4)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i*)src);
+
+        _mm_storeu_si128((__m128i*)d, sse2_premultiply(in));
+    }
+
+    m2d_convert_c.premultiply(d, src, width - i);
+}
+
+static void sse2_argb8888_to_a8(void* dst, const uint8_t* src, size_t width)
+{
+    uint8_t* d = dst;
+    size_t i;
+
+    for (i = 0; i + 16 <= width; i += 16, src += 64, d += 16)
+    {
+        __m128i a0 = _mm_srli_epi32(_mm_loadu_si128((const __m128i*)src), 24);
+        __m128i a1 = _mm_srli_epi32(_mm_loadu_si128((const __m128i*)(src + 16)), 24);
+        __m128i a2 = _mm_srli_epi32(_mm_loadu_si128((const __m128i*)(src + 32)), 24);
+        __m128i a3 = _mm_srli_epi32(_mm_loadu_si128((const __m128i*)(src + 48)), 24);
+
+        _mm_storeu_si128((__m128i*)d, _mm_packus_epi16(_mm_packs_epi32(a0, a1),
+                                                       _mm_packs_epi32(a2, a3)));
+    }
+
+    m2d_convert_c.argb8888_to_a8(d, src, width - i);
+}
+
+static void sse2_a8_to_argb8888(void* dst, const uint8_t* src, size_t width)
+{
+    uint32_t* d = dst;
+    size_t i;
+
+    for (i = 0; i + 16 <= width; i += 16, src += 16, d += 16)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i*)src);
+        __m128i lo = _mm_unpacklo_epi8(in, in);
+        __m128i hi = _mm_unpackhi_epi8(in, in);
+
+        _mm_storeu_si128((__m128i*)d, _mm_unpacklo_epi16(lo, lo));
+        _mm_storeu_si128((__m128i*)(d + 4), _mm_unpackhi_epi16(lo, lo));
+        _mm_storeu_si128((__m128i*)(d + 8), _mm_unpacklo_epi16(hi, hi));
+        _mm_storeu_si128((__m128i*)(d + 12), _mm_unpackhi_epi16(hi, hi));
+    }
+
+    m2d_convert_c.a8_to_argb8888(d, src, width - i);
+}
+
+static void sse2_rgb565_to_argb8888(void* dst, const uint8_t* src, size_t width)
+{
+    const __m128i mask5 = _mm_set1_epi16(0x1f);
+    const __m128i mask6 = _mm_set1_epi16(0x3f);
+    const __m128i alpha = _mm_set1_epi16((short)0xff00);
+    uint32_t* d = dst;
+    size_t i;
+
+    for (i = 0; i + 8 <= width; i += 8, src += 16, d += 8)
+    {
+        __m128i p = _mm_loadu_si128((const __m128i*)src);
+        __m128i r = _mm_srli_epi16(p, 11);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(p, 5), mask6);
+        __m128i b = _mm_and_si128(p, mask5);
+        __m128i bg;
+        __m128i ra;
+
+        /* Replicate the high bits, so that white stays white. */
+        r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+        g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+        b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+
+        bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+        ra = _mm_or_si128(r, alpha);
+        _mm_storeu_si128((__m128i*)d, _mm_unpacklo_epi16(bg, ra));
+        _mm_storeu_si128((__m128i*)(d + 4), _mm_unpackhi_epi16(bg, ra));
+    }
+
+    m2d_convert_c.rgb565_to_argb8888(d, src, width - i);
+}
+
+/* Pack 4 pixels into RGB565, in the low 16 bits of each 32-bit lane. */
+static inline __m128i sse2_pack_rgb565(__m128i p)
+{
+    __m128i r = _mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xf800));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07e0));
+    __m128i b = _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001f));
+
+    p = _mm_or_si128(_mm_or_si128(r, g), b);
+
+    /* Sign extend, so that _mm_packs_epi32() doesn't saturate. */
+    return _mm_srai_epi32(_mm_slli_epi32(p, 16), 16);
+}
+
+static void sse2_argb8888_to_rgb565(void* dst, const uint8_t* src, size_t width,
+                                    const uint32_t* bias)
+{
+    __m128i b = bias ? _mm_loadu_si128((const __m128i*)bias) : _mm_setzero_si128();
+    uint16_t* d = dst;
+    size_t i;
+
+    for (i = 0; i + 8 <= width; i += 8, src += 32, d += 8)
+    {
+        __m128i p0 = _mm_adds_epu8(_mm_loadu_si128((const __m128i*)src), b);
+        __m128i p1 = _mm_adds_epu8(_mm_loadu_si128((const __m128i*)(src + 16)), b);
+
+        _mm_storeu_si128((__m128i*)d, _mm_packs_epi32(sse2_pack_rgb565(p0),
+                                                      sse2_pack_rgb565(p1)));
+    }
+
+    m2d_convert_c.argb8888_to_rgb565(d, src, width - i, bias);
+}
+
+const struct m2d_convert_kernels m2d_convert_sse2 =
+{
+    .isa = "sse2",
+    .rgba_premultiply = sse2_rgba_premultiply,
+    .rgba_swizzle = sse2_rgba_swizzle,
+    .premultiply = sse2_premultiply_row,
+    .argb8888_to_a8 = sse2_argb8888_to_a8,
+    .a8_to_argb8888 = sse2_a8_to_argb8888,
+    .rgb565_to_argb8888 = sse2_rgb565_to_argb8888,
+    .argb8888_to_rgb565 = sse2_argb8888_to_rgb565,
+};
+#endif /* __SSE2__ */
+
+#if defined(M2D_CONVERT_AVX2)
+#include <immintrin.h>
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i avx2_premultiply(__m256i in)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i rgb_mask = _mm256_set1_epi64x(0x0000ffffffffffffLL);
+    const __m256i alpha_one = _mm256_set1_epi64x(0x00ff000000000000LL);
+    const __m256i bias = _mm256_set1_epi16(128);
+    __m256i lo = _mm256_unpacklo_epi8(in, zero);
+    __m256i hi = _mm256_unpackhi_epi8(in, zero);
+    __m256i alo;
+    __m256i ahi;
+
+    alo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(lo, 0xff), 0xff);
+    ahi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(hi, 0xff), 0xff);
+    alo = _mm256_or_si256(_mm256_and_si256(alo, rgb_mask), alpha_one);
+    ahi = _mm256_or_si256(_mm256_and_si256(ahi, rgb_mask), alpha_one);
+    lo = _mm256_add_epi16(_mm256_mullo_epi16(lo, alo), bias);
+    hi = _mm256_add_epi16(_mm256_mullo_epi16(hi, ahi), bias);
+    lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+
+    /* Unpacking and packing within 128-bit lanes keeps the pixel order. */
+    return _mm256_packus_epi16(lo, hi);
+}
+
+AVX2 static inline __m256i avx2_swap_rb(__m256i in)
+{
+    const __m256i shuffle = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7,
+                                             10, 9, 8, 11, 14, 13, 12, 15,
+                                             2, 1, 0, 3, 6, 5, 4, 7,
+                                             10, 9, 8, 11, 14, 13, 12, 15);
+
+    return _mm256_shuffle_epi8(in, shuffle);
+}
+
+AVX2 static void avx2_rgba_premultiply(void* dst, const uint8_t* src, size_t width)
+{
+    uint32_t* d = dst;
+    size_t i;
+
+    for (i = 0; i + 8 <= width; i += 8, src += 32, d += 8)
+    {
+        __m256i in = _mm256_loadu_si256((const __m256i*)src);
+
+        _mm256_storeu_si256((__m256i*)d, avx2_swap_rb(avx2_premultiply(in)));
+    }
+
+    m2d_convert_c.rgba_premultiply(d, src, width - i);
+}
+
+AVX2 static void avx2_rgba_swizzle(void* dst, const uint8_t* src, size_t width)
+{
+    uint32_t* d = dst;
+    size_t i;
+
+    for (i = 0; i + 8 <= width; i += 8, src += 32, d += 8)
+    {
+        __m256i in = _mm256_loadu_si256((const __m256i*)src);
+
+        _mm256_storeu_si256((__m256i*)d, avx2_swap_rb(in));
+    }
+
+    m2d_convert_c.rgba_swizzle(d, src, width - i);
+}
+
+AVX2 static void avx2_premultiply_row(void* dst, const uint8_t* src, size_t width)
+{
+    uint32_t* d = dst;
+    size_t i;
+
+    for (i = 0; i + 8 <= width; i += 8, src += 32, d += 8)
+    {
+        __m256i in = _mm256_loadu_si256((const __m256i*)src);
+
+        _mm256_storeu_si256((__m256i*)d, avx2_premultiply(in));
+    }
+
+    m2d_convert_c.premultiply(d, src, width - i);
+}
+
+AVX2 static void avx2_argb8888_to_a8(void* dst, const uint8_t* src, size_t width)
+{
+    /* Packing works within 128-bit lanes: put the 4-pixel groups back in order. */
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    uint8_t* d = dst;
+    size_t i;
+
+    for (i = 0; i + 32 <= width; i += 32, src += 128, d += 32)
+    {
+        __m256i a0 = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i*)src), 24);
+        __m256i a1 = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i*)(src + 32)), 24);
+        __m256i a2 = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i*)(src + 64)), 24);
+        __m256i a3 = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i*)(src + 96)), 24);
+        __m256i a = _mm256_packus_epi16(_mm256_packs_epi32(a0, a1),
+                                        _mm256_packs_epi32(a2, a3));
+
+        _mm256_storeu_si256((__m256i*)d, _mm256_permutevar8x32_epi32(a, order));
+    }
+
+    m2d_convert_c.argb8888_to_a8(d, src, width - i);
+}
+
+AVX2 static void avx2_a8_to_argb8888(void* dst, const uint8_t* src, size_t width)
+{
+    const __m256i splat = _mm256_set1_epi32(0x01010101);
+    uint32_t* d = dst;
+    size_t i;
+
+    for (i = 0; i + 8 <= width; i += 8, src += 8, d += 8)
+    {
+        __m256i a = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)src));
+
+        _mm256_storeu_si256((__m256i*)d, _mm256_mullo_epi32(a, splat));
+    }
+
+    m2d_convert_c.a8_to_argb8888(d, src, width - i);
+}
+
+AVX2 static void avx2_rgb565_to_argb8888(void* dst, const uint8_t* src, size_t width)
+{
+    const __m256i mask5 = _mm256_set1_epi32(0x1f);
+    const __m256i mask6 = _mm256_set1_epi32(0x3f);
+    const __m256i alpha = _mm256_set1_epi32((int)0xff000000u);
+    uint32_t* d = dst;
+    size_t i;
+
+    for (i = 0; i + 8 <= width; i += 8, src += 16, d += 8)
+    {
+        __m256i p = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)src));
+        __m256i r = _mm256_srli_epi32(p, 11);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi32(p, 5), mask6);
+        __m256i b = _mm256_and_si256(p, mask5);
+
+        r = _mm256_or_si256(_mm256_slli_epi32(r, 3), _mm256_srli_epi32(r, 2));
+        g = _mm256_or_si256(_mm256_slli_epi32(g, 2), _mm256_srli_epi32(g, 4));
+        b = _mm256_or_si256(_mm256_slli_epi32(b, 3), _mm256_srli_epi32(b, 2));
+
+        p = _mm256_or_si256(_mm256_or_si256(alpha, _mm256_slli_epi32(r, 16)),
+                            _mm256_or_si256(_mm256_slli_epi32(g, 8), b));
+        _mm256_storeu_si256((__m256i*)d, p);
+    }
+
+    m2d_convert_c.rgb565_to_argb8888(d, src, width - i);
+}
+
+AVX2 static inline __m256i avx2_pack_rgb565(__m256i p)
+{
+    __m256i r = _mm256_and_si256(_mm256_srli_epi32(p, 8), _mm256_set1_epi32(0xf800));
+    __m256i g = _mm256_and_si256(_mm256_srli_epi32(p, 5), _mm256_set1_epi32(0x07e0));
+    __m256i b = _mm256_and_si256(_mm256_srli_epi32(p, 3), _mm256_set1_epi32(0x001f));
+
+    p = _mm256_or_si256(_mm256_or_si256(r, g), b);
+
+    return _mm256_srai_epi32(_mm256_slli_epi32(p, 16), 16);
+}
+
+AVX2 static void avx2_argb8888_to_rgb565(void* dst, const uint8_t* src, size_t width,
+                                         const uint32_t* bias)
+{
+    __m256i b = bias ? _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)bias)) :
+        _mm256_setzero_si256();
+    uint16_t* d = dst;
+    size_t i;
+
+    for (i = 0; i + 16 <= width; i += 16, src += 64, d += 16)
+    {
+        __m256i p0 = _mm256_adds_epu8(_mm256_loadu_si256((const __m256i*)src), b);
+        __m256i p1 = _mm256_adds_epu8(_mm256_loadu_si256((const __m256i*)(src + 32)), b);
+        __m256i p = _mm256_packs_epi32(avx2_pack_rgb565(p0), avx2_pack_rgb565(p1));
+
+        _mm256_storeu_si256((__m256i*)d, _mm256_permute4x64_epi64(p, 0xd8));
+    }
+
+    m2d_convert_c.argb8888_to_rgb565(d, src, width - i, bias);
+}
+
+const struct m2d_convert_kernels m2d_convert_avx2 =
+{
+    .isa = "avx2",
+    .rgba_premultiply = avx2_rgba_premultiply,
+    .rgba_swizzle = avx2_rgba_swizzle,
+    .premultiply = avx2_premultiply_row,
+    .argb8888_to_a8 = avx2_argb8888_to_a8,
+    .a8_to_argb8888 = avx2_a8_to_argb8888,
+    .rgb565_to_argb8888 = avx2_rgb565_to_argb8888,
+    .argb8888_to_rgb565 = avx2_argb8888_to_rgb565,
+};
+#endif /* M2D_CONVERT_AVX2 */
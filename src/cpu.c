@@ -0,0 +1,593 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/m2d.h"
+#include "m2d_priv.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Rows are blended by chunks, so that the modulated sources and converted
+ * destinations fit in buffers on the stack.
+ */
+#define CPU_CHUNK 256
+
+/*
+ * Batches are split into tiles of about this many target bytes, so that the
+ * target and source rows of a tile stay in the cache of the core drawing it.
+ */
+#define CPU_TILE_SIZE (64 * 1024)
+
+/* Smaller batches are drawn by the calling thread alone. */
+#define CPU_PARALLEL_MIN (128 * 1024)
+
+struct cpu_batch
+{
+    const struct m2d_cpu_state* state;
+    const struct m2d_rectangle* rects;
+    size_t num_rects;
+    struct m2d_rectangle bounds;
+    dim_t tile_height;
+    uint8_t* row_copy;
+};
+
+static inline uint8_t* cpu_pixel(const struct m2d_cpu_surface* surface, dim_t x, dim_t y)
+{
+    return surface->data + (size_t)(y - surface->y) * surface->stride +
+        (size_t)(x - surface->x) * m2d_byte_per_pixel(surface->format);
+}
+
+static bool cpu_clip(const struct m2d_cpu_surface* surface, struct m2d_rectangle* rect)
+{
+    struct m2d_rectangle bounds;
+
+    bounds.x = surface->x;
+    bounds.y = surface->y;
+    bounds.w = (dim_t)surface->width;
+    bounds.h = (dim_t)surface->height;
+
+    return m2d_intersect(rect, &bounds, rect);
+}
+
+/*
+ * Tell how to walk the rows when @src is read from the target while it is
+ * written: bottom-up when it is above, with a copy of each row when it is on
+ * the same rows.
+ */
+static bool cpu_overlaps(const struct m2d_cpu_state* state, const struct m2d_cpu_surface* src,
+                         const struct m2d_rectangle* rect, bool* bottom_up)
+{
+    *bottom_up = false;
+
+    if (src->data != state->target.data)
+        return false;
+
+    if (src->x >= rect->w || -src->x >= rect->w || src->y >= rect->h || -src->y >= rect->h)
+        return false;
+
+    *bottom_up = src->y > 0;
+
+    return src->y == 0 && src->x != 0;
+}
+
+static void cpu_fill(const struct m2d_cpu_state* state, const struct m2d_rectangle* rect)
+{
+    uint32_t color = state->blend.source_color;
+    size_t bpp = m2d_byte_per_pixel(state->target.format);
+    uint16_t color565;
+    dim_t x;
+    dim_t y;
+
+    color565 = (uint16_t)(((color >> 8) & 0xf800) | ((color >> 5) & 0x07e0) |
+                          ((color >> 3) & 0x001f));
+
+    for (y = rect->y; y < rect->y + rect->h; y++)
+    {
+        uint8_t* row = cpu_pixel(&state->target, rect->x, y);
+
+        switch (state->target.format)
+        {
+        case M2D_PF_ARGB8888:
+            for (x = 0; x < rect->w; x++)
+                ((uint32_t*)row)[x] = color;
+            break;
+        case M2D_PF_RGB565:
+            for (x = 0; x < rect->w; x++)
+                ((uint16_t*)row)[x] = color565;
+            break;
+        case M2D_PF_A8:
+            memset(row, color >> 24, (size_t)rect->w * bpp);
+            break;
+        }
+    }
+}
+
+static void cpu_copy(const struct m2d_cpu_state* state, const struct m2d_rectangle* rect)
+{
+    const struct m2d_cpu_surface* src = state->src;
+    size_t row_size = (size_t)rect->w * m2d_byte_per_pixel(src->format);
+    m2d_row_func convert = m2d_pixel_row_func(state->target.format, src->format);
+    bool bottom_up;
+    dim_t i;
+
+    /* memmove() takes care of the overlaps on the same rows. */
+    cpu_overlaps(state, src, rect, &bottom_up);
+
+    for (i = 0; i < rect->h; i++)
+    {
+        dim_t y = bottom_up ? rect->y + rect->h - 1 - i : rect->y + i;
+        uint8_t* d = cpu_pixel(&state->target, rect->x, y);
+        const uint8_t* s = cpu_pixel(src, rect->x, y);
+
+        if (convert)
+            convert(d, s, rect->w);
+        else
+            memmove(d, s, row_size);
+    }
+}
+
+static void cpu_blend(const struct m2d_cpu_state* state, const struct m2d_rectangle* rect,
+                      uint8_t* row_copy)
+{
+    const struct m2d_cpu_surface* src = state->src;
+    const struct m2d_cpu_surface* dst = state->dst;
+    const struct m2d_blend_args* args = &state->blend;
+    enum m2d_pixel_format target_format = state->target.format;
+    enum m2d_pixel_format src_format = src ? src->format : M2D_PF_ARGB8888;
+    size_t target_bpp = m2d_byte_per_pixel(target_format);
+    size_t src_bpp = m2d_byte_per_pixel(src_format);
+    uint32_t src_chunk[CPU_CHUNK];
+    uint32_t dst_chunk[CPU_CHUNK];
+    m2d_row_func convert_dst = NULL;
+    bool modulate = false;
+    m2d_blend_func blend;
+    bool bottom_up = false;
+    bool copy_rows = false;
+    dim_t i;
+    dim_t x;
+
+    if (dst->format != target_format)
+        convert_dst = m2d_pixel_row_func(target_format, dst->format);
+
+    if (!src)
+    {
+        /* The source color, as an ARGB8888 source. */
+        for (x = 0; x < CPU_CHUNK; x++)
+            src_chunk[x] = args->source_color;
+    }
+    else if (args->source_color != 0xffffffffu)
+    {
+        modulate = true;
+    }
+
+    blend = m2d_blend_select(&args->mode, target_format, src_format, modulate);
+    if (!blend)
+        blend = m2d_blend_select(&args->mode, target_format, M2D_PF_ARGB8888, false);
+    else
+        modulate = false;
+
+    if (src)
+        copy_rows = cpu_overlaps(state, src, rect, &bottom_up);
+
+    for (i = 0; i < rect->h; i++)
+    {
+        dim_t y = bottom_up ? rect->y + rect->h - 1 - i : rect->y + i;
+        uint8_t* out = cpu_pixel(&state->target, rect->x, y);
+        const uint8_t* d = cpu_pixel(dst, rect->x, y);
+        const uint8_t* s = (const uint8_t*)src_chunk;
+
+        if (src)
+        {
+            s = cpu_pixel(src, rect->x, y);
+            if (copy_rows)
+            {
+                memcpy(row_copy, s, (size_t)rect->w * src_bpp);
+                s = row_copy;
+            }
+        }
+
+        for (x = 0; x < rect->w; x += CPU_CHUNK)
+        {
+            size_t width = (size_t)min_int(CPU_CHUNK, rect->w - x);
+            const uint8_t* chunk_src = src ? s + x * src_bpp : s;
+            const uint8_t* chunk_dst = d + x * m2d_byte_per_pixel(dst->format);
+
+            if (modulate)
+            {
+                m2d_blend_modulate(src_chunk, chunk_src, src_format, width,
+                                   args->source_color);
+                chunk_src = (const uint8_t*)src_chunk;
+            }
+
+            if (convert_dst)
+            {
+                convert_dst(dst_chunk, chunk_dst, width);
+                chunk_dst = (const uint8_t*)dst_chunk;
+            }
+
+            blend(out + x * target_bpp, chunk_src, chunk_dst, width, args);
+        }
+    }
+}
+
+static void cpu_draw_rectangle(const struct m2d_cpu_state* state, struct m2d_rectangle* rect,
+                               uint8_t* row_copy)
+{
+    if (state->src && !cpu_clip(state->src, rect))
+        return;
+
+    if (!state->blend_enabled)
+    {
+        if (state->src)
+            cpu_copy(state, rect);
+        else
+            cpu_fill(state, rect);
+
+        return;
+    }
+
+    if (!cpu_clip(state->dst, rect))
+        return;
+
+    cpu_blend(state, rect, row_copy);
+}
+
+static void cpu_draw_tile(size_t job, void* data)
+{
+    const struct cpu_batch* batch = data;
+    struct m2d_rectangle tile = batch->bounds;
+    struct m2d_rectangle rect;
+    size_t i;
+
+    tile.y += (dim_t)(job * (size_t)batch->tile_height);
+    tile.h = (dim_t)min_int(batch->tile_height, batch->bounds.y + batch->bounds.h - tile.y);
+
+    /* All the rectangles in order: where they overlap, they blend as on the GPU. */
+    for (i = 0; i < batch->num_rects; i++)
+    {
+        if (m2d_intersect(&batch->rects[i], &tile, &rect))
+            cpu_draw_rectangle(batch->state, &rect, batch->row_copy);
+    }
+}
+
+void m2d_cpu_draw_rectangles(const struct m2d_cpu_state* state,
+                             const struct m2d_rectangle* rects, size_t num_rects)
+{
+    struct cpu_batch batch;
+    struct m2d_rectangle rect;
+    size_t row_size;
+    size_t num_pixels = 0;
+    dim_t max_x = 0;
+    dim_t max_y = 0;
+    size_t i;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.state = state;
+    batch.rects = rects;
+    batch.num_rects = num_rects;
+
+    for (i = 0; i < num_rects; i++)
+    {
+        rect = rects[i];
+        if (!cpu_clip(&state->target, &rect))
+            continue;
+
+        if (!num_pixels)
+        {
+            batch.bounds.x = rect.x;
+            batch.bounds.y = rect.y;
+            max_x = rect.x + rect.w;
+            max_y = rect.y + rect.h;
+        }
+
+        batch.bounds.x = (dim_t)min_int(batch.bounds.x, rect.x);
+        batch.bounds.y = (dim_t)min_int(batch.bounds.y, rect.y);
+        max_x = (dim_t)max_int(max_x, rect.x + rect.w);
+        max_y = (dim_t)max_int(max_y, rect.y + rect.h);
+        num_pixels += (size_t)rect.w * (size_t)rect.h;
+    }
+
+    if (!num_pixels)
+        return;
+
+    batch.bounds.w = max_x - batch.bounds.x;
+    batch.bounds.h = max_y - batch.bounds.y;
+    batch.tile_height = batch.bounds.h;
+
+    if (state->src && state->src->data == state->target.data)
+    {
+        /* Source rows overlapping their target rows are blended from a copy. */
+        if (state->blend_enabled)
+        {
+            batch.row_copy = malloc(state->target.stride);
+            if (!batch.row_copy)
+            {
+                LIBM2D_ERROR("could not allocate memory for CPU blending: %s\n",
+                             strerror(errno));
+                return;
+            }
+        }
+    }
+    else if (num_pixels >= CPU_PARALLEL_MIN)
+    {
+        /*
+         * Tiles are bands of rows: the kernels stream rows, and each tile
+         * reads and writes contiguous memory. Moving a surface over itself
+         * is left to a single thread, as tiles would read rows rewritten by
+         * others.
+         */
+        row_size = (size_t)batch.bounds.w * m2d_byte_per_pixel(state->target.format);
+        batch.tile_height = (dim_t)min_int(batch.bounds.h,
+                                           max_int(1, (int)(CPU_TILE_SIZE / row_size)));
+    }
+
+    m2d_pool_run(((size_t)batch.bounds.h + (size_t)batch.tile_height - 1) / (size_t)batch.tile_height,
+                 cpu_draw_tile, &batch);
+
+    free(batch.row_copy);
+}
+
+/*
+ * Deferred rendering: the draws on a target are recorded until
+ * m2d_cpu_flush(), then their rectangles are binned into tiles of
+ * CPU_BIN_SIZE pixels squared. Tiles are rendered one at a time, each with
+ * all its draws in order, while its target pixels stay in the cache: the
+ * target is read and written once per frame instead of once per layer.
+ */
+#define CPU_BIN_SIZE 64
+
+struct cpu_draw
+{
+    struct m2d_cpu_state state;
+    struct m2d_cpu_surface src;
+    struct m2d_cpu_surface dst;
+};
+
+struct cpu_rect
+{
+    struct m2d_rectangle rect;
+    size_t draw;
+};
+
+static struct
+{
+    struct cpu_draw* draws;
+    size_t num_draws;
+    size_t max_draws;
+
+    /* The rectangles of all draws, clipped to the target. */
+    struct cpu_rect* rects;
+    size_t num_rects;
+    size_t max_rects;
+
+    /* Per tile, the rectangles overlapping it, in draw order. */
+    size_t* bins;
+    size_t* bin_starts;
+    size_t max_bins;
+    size_t max_bin_starts;
+    size_t tiles_per_row;
+} frame;
+
+static bool cpu_grow(void** array, size_t* max, size_t count, size_t size)
+{
+    size_t new_max = *max ? *max : 16;
+    void* new_array;
+
+    if (count <= *max)
+        return true;
+
+    while (new_max < count)
+        new_max *= 2;
+
+    new_array = realloc(*array, new_max * size);
+    if (!new_array)
+    {
+        LIBM2D_ERROR("could not allocate memory for deferred CPU draws: %s\n", strerror(errno));
+        return false;
+    }
+
+    *array = new_array;
+    *max = new_max;
+
+    return true;
+}
+
+static bool cpu_reads_moved_target(const struct m2d_cpu_state* state,
+                                   const struct m2d_cpu_surface* src)
+{
+    return src && src->data == state->target.data && (src->x || src->y);
+}
+
+bool m2d_cpu_can_defer(const struct m2d_cpu_state* state)
+{
+    /* Tiles would read pixels of other tiles, already drawn or not. */
+    if (cpu_reads_moved_target(state, state->src))
+        return false;
+
+    if (state->blend_enabled && cpu_reads_moved_target(state, state->dst))
+        return false;
+
+    return !frame.num_draws || frame.draws[0].state.target.data == state->target.data;
+}
+
+bool m2d_cpu_defer(const struct m2d_cpu_state* state,
+                   const struct m2d_rectangle* rects, size_t num_rects)
+{
+    struct cpu_draw* draw;
+    size_t i;
+
+    if (!m2d_cpu_can_defer(state))
+        return false;
+
+    if (!cpu_grow((void**)&frame.draws, &frame.max_draws, frame.num_draws + 1,
+                  sizeof(*frame.draws)))
+        return false;
+
+    if (!cpu_grow((void**)&frame.rects, &frame.max_rects, frame.num_rects + num_rects,
+                  sizeof(*frame.rects)))
+        return false;
+
+    draw = &frame.draws[frame.num_draws];
+    draw->state = *state;
+    if (state->src)
+        draw->src = *state->src;
+    if (state->dst)
+        draw->dst = *state->dst;
+
+    for (i = 0; i < num_rects; i++)
+    {
+        struct cpu_rect* rect = &frame.rects[frame.num_rects];
+
+        rect->rect = rects[i];
+        rect->draw = frame.num_draws;
+        if (cpu_clip(&state->target, &rect->rect))
+            frame.num_rects++;
+    }
+
+    frame.num_draws++;
+
+    return true;
+}
+
+bool m2d_cpu_has_deferred(void)
+{
+    return frame.num_draws;
+}
+
+static void cpu_tile_range(const struct m2d_rectangle* rect, size_t* x0, size_t* y0,
+                           size_t* x1, size_t* y1)
+{
+    *x0 = (size_t)rect->x / CPU_BIN_SIZE;
+    *y0 = (size_t)rect->y / CPU_BIN_SIZE;
+    *x1 = ((size_t)(rect->x + rect->w) + CPU_BIN_SIZE - 1) / CPU_BIN_SIZE;
+    *y1 = ((size_t)(rect->y + rect->h) + CPU_BIN_SIZE - 1) / CPU_BIN_SIZE;
+}
+
+static void cpu_draw_bin(size_t tile, void* data)
+{
+    struct m2d_cpu_state state;
+    struct m2d_rectangle bounds;
+    struct m2d_rectangle rect;
+    const struct cpu_draw* draw;
+    size_t i;
+
+    (void)data;
+
+    bounds.x = (dim_t)(tile % frame.tiles_per_row * CPU_BIN_SIZE);
+    bounds.y = (dim_t)(tile / frame.tiles_per_row * CPU_BIN_SIZE);
+    bounds.w = CPU_BIN_SIZE;
+    bounds.h = CPU_BIN_SIZE;
+
+    for (i = frame.bin_starts[tile]; i < frame.bin_starts[tile + 1]; i++)
+    {
+        const struct cpu_rect* binned = &frame.rects[frame.bins[i]];
+
+        if (!m2d_intersect(&binned->rect, &bounds, &rect))
+            continue;
+
+        draw = &frame.draws[binned->draw];
+        state = draw->state;
+        if (state.src)
+            state.src = &draw->src;
+        if (state.dst)
+            state.dst = &draw->dst;
+
+        /* The target isn't read at another position: no row copy needed. */
+        cpu_draw_rectangle(&state, &rect, NULL);
+    }
+}
+
+/* Bin the rectangles, counting first to size the bins of each tile. */
+static bool cpu_bin(size_t num_tiles)
+{
+    size_t x0, y0, x1, y1;
+    size_t num_entries = 0;
+    size_t i, x, y;
+
+    if (!cpu_grow((void**)&frame.bin_starts, &frame.max_bin_starts, num_tiles + 1,
+                  sizeof(*frame.bin_starts)))
+        return false;
+
+    memset(frame.bin_starts, 0, (num_tiles + 1) * sizeof(*frame.bin_starts));
+
+    for (i = 0; i < frame.num_rects; i++)
+    {
+        cpu_tile_range(&frame.rects[i].rect, &x0, &y0, &x1, &y1);
+        for (y = y0; y < y1; y++)
+            for (x = x0; x < x1; x++)
+                frame.bin_starts[y * frame.tiles_per_row + x + 1]++;
+        num_entries += (x1 - x0) * (y1 - y0);
+    }
+
+    if (!cpu_grow((void**)&frame.bins, &frame.max_bins, num_entries, sizeof(*frame.bins)))
+        return false;
+
+    for (i = 0; i < num_tiles; i++)
+        frame.bin_starts[i + 1] += frame.bin_starts[i];
+
+    /* Each start ends up at the next one, hence the shift afterwards. */
+    for (i = 0; i < frame.num_rects; i++)
+    {
+        cpu_tile_range(&frame.rects[i].rect, &x0, &y0, &x1, &y1);
+        for (y = y0; y < y1; y++)
+            for (x = x0; x < x1; x++)
+                frame.bins[frame.bin_starts[y * frame.tiles_per_row + x]++] = i;
+    }
+
+    memmove(frame.bin_starts + 1, frame.bin_starts, num_tiles * sizeof(*frame.bin_starts));
+    frame.bin_starts[0] = 0;
+
+    return true;
+}
+
+void m2d_cpu_flush(void)
+{
+    const struct m2d_cpu_surface* target;
+    size_t num_tiles;
+    size_t i;
+
+    if (!frame.num_draws)
+        return;
+
+    target = &frame.draws[0].state.target;
+    frame.tiles_per_row = (target->width + CPU_BIN_SIZE - 1) / CPU_BIN_SIZE;
+    num_tiles = frame.tiles_per_row * ((target->height + CPU_BIN_SIZE - 1) / CPU_BIN_SIZE);
+
+    LIBM2D_DEBUG("drawing %zu deferred draw(s), %zu rectangle(s), on the CPU\n",
+                 frame.num_draws, frame.num_rects);
+
+    if (cpu_bin(num_tiles))
+    {
+        m2d_pool_run(num_tiles, cpu_draw_bin, NULL);
+    }
+    else
+    {
+        /* Out of memory for the bins: one draw at a time then. */
+        for (i = 0; i < frame.num_rects; i++)
+        {
+            struct cpu_draw* draw = &frame.draws[frame.rects[i].draw];
+
+            if (draw->state.src)
+                draw->state.src = &draw->src;
+            if (draw->state.dst)
+                draw->state.dst = &draw->dst;
+            m2d_cpu_draw_rectangles(&draw->state, &frame.rects[i].rect, 1);
+        }
+    }
+
+    frame.num_draws = 0;
+    frame.num_rects = 0;
+}
+
+void m2d_cpu_cleanup(void)
+{
+    free(frame.draws);
+    free(frame.rects);
+    free(frame.bins);
+    free(frame.bin_starts);
+    memset(&frame, 0, sizeof(frame));
+}
@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <time.h>
 #include <xf86drm.h>
 
 #define GFX2D_TIMEOUT_SECS 1
@@ -19,13 +20,25 @@
 
 #define GFX2D_DIM_MASK  0x1fffu
 
+#define GFX2D_STATE_STACK_DEPTH 4
+
+/*
+ * Every period, checked by the scratch requests and by @m2d_flush(), the
+ * scratch surface is released when the largest area requested during the
+ * period is less than half its size, hence when it was not requested at all.
+ */
+#define GFX2D_SCRATCH_IDLE_SECS 2
+
+/* Translated rectangles are kept on the stack up to this count. */
+#define GFX2D_LOCAL_RECTS 16
+
 struct gfx2d_buffer
 {
     struct m2d_buffer base;
     bool imported;
     enum drm_mchp_gfx2d_direction direction;
     uint32_t handle;
-    uint32_t tmp_handle;
+    uint64_t offset; /* fake offset for mmap() */
 };
 
 static inline struct gfx2d_buffer* to_gfx2d_buffer(const struct m2d_buffer* buf)
@@ -55,12 +68,42 @@ struct gfx2d_state
     enum drm_mchp_gfx2d_blend_factor dafactor;
     enum drm_mchp_gfx2d_blend_factor scfactor;
     enum drm_mchp_gfx2d_blend_factor dcfactor;
+
+    enum m2d_renderer renderer;
+    unsigned int transform;
+};
+
+/*
+ * ARGB32 surface shared by all targets for the intermediate results of
+ * multi-pass operations. It is sized after the bounding box of the
+ * rectangles being drawn, hence its origin is translated accordingly.
+ */
+struct gfx2d_scratch
+{
+    uint32_t handle;
+    size_t width;
+    size_t height;
+
+    /* Largest size requested since 'period_start'. */
+    size_t peak_width;
+    size_t peak_height;
+    struct timespec period_start;
 };
 
 struct gfx2d_device
 {
     struct m2d_device base;
     struct gfx2d_state state;
+    struct gfx2d_scratch scratch;
+    struct m2d_reclaimer scratch_reclaimer;
+
+    struct gfx2d_state saved_states[GFX2D_STATE_STACK_DEPTH];
+    size_t state_depth;
+
+    /* Buffers of the deferred CPU draws, synchronized for the CPU. */
+    struct gfx2d_buffer** cpu_bufs;
+    size_t num_cpu_bufs;
+    size_t max_cpu_bufs;
 };
 
 static const struct m2d_capabilities gfx2d_caps =
@@ -79,6 +122,11 @@ static struct m2d_buffer* gfx2d_create(size_t width, size_t height,
                                        size_t* stride);
 static struct m2d_buffer* gfx2d_import(const struct m2d_import_desc* desc);
 static void gfx2d_free(struct m2d_buffer* buf);
+static void gfx2d_release(struct m2d_buffer* buf);
+static int gfx2d_restore(struct m2d_buffer* buf);
+static int gfx2d_export(struct m2d_buffer* buf, int* fd);
+static void* gfx2d_map(struct m2d_buffer* buf);
+static void gfx2d_unmap(struct m2d_buffer* buf);
 static int gfx2d_sync_for_cpu(struct m2d_buffer* buf,
                               const struct timespec* timeout);
 static int gfx2d_sync_for_gpu(struct m2d_buffer* buf);
@@ -86,6 +134,7 @@ static int gfx2d_wait(const struct m2d_buffer* buf,
                       const struct timespec* timeout);
 static void gfx2d_draw_rectangles(const struct m2d_rectangle* rects,
                                   size_t num_rects);
+static void gfx2d_flush_cpu(void);
 
 static const struct m2d_device_funcs gfx2d_device_funcs =
 {
@@ -94,6 +143,11 @@ static const struct m2d_device_funcs gfx2d_device_funcs =
     .create = gfx2d_create,
     .import = gfx2d_import,
     .free = gfx2d_free,
+    .release = gfx2d_release,
+    .restore = gfx2d_restore,
+    .export = gfx2d_export,
+    .map = gfx2d_map,
+    .unmap = gfx2d_unmap,
     .sync_for_cpu = gfx2d_sync_for_cpu,
     .sync_for_gpu = gfx2d_sync_for_gpu,
     .wait = gfx2d_wait,
@@ -277,72 +331,90 @@ static bool gfx2d_surface_is_valid(size_t width, size_t height,
     return true;
 }
 
+static size_t gfx2d_reclaim_scratch(size_t bytes, void* data)
+{
+    size_t size = m2d_scratch_size();
+
+    (void)bytes;
+    (void)data;
+
+    m2d_scratch_trim();
+
+    return size;
+}
+
 static int gfx2d_init()
 {
+    dev.scratch_reclaimer.reclaim = gfx2d_reclaim_scratch;
+    m2d_register_reclaimer(&dev.scratch_reclaimer);
+
     return 0;
 }
 
 static void gfx2d_cleanup()
 {
+    gfx2d_flush_cpu();
+    free(dev.cpu_bufs);
+    dev.cpu_bufs = NULL;
+    dev.max_cpu_bufs = 0;
+    m2d_cpu_cleanup();
+
+    m2d_unregister_reclaimer(&dev.scratch_reclaimer);
+    m2d_scratch_trim();
+}
+
+static int gfx2d_alloc_handle(struct gfx2d_buffer* priv_buf, size_t width,
+                              size_t height, enum m2d_pixel_format format,
+                              size_t stride)
+{
+    struct drm_mchp_gfx2d_alloc_buffer args;
+
+    memset(&args, 0, sizeof(args));
+    args.size = height * stride;
+    args.width = (uint16_t)width;
+    args.height = (uint16_t)height;
+    args.stride = (uint16_t)stride;
+    args.format = to_gfx2d_format(format);
+    args.direction = priv_buf->direction;
+    if (drmIoctl(dev.base.fd, DRM_IOCTL_MCHP_GFX2D_ALLOC_BUFFER, &args) < 0)
+    {
+        LIBM2D_ERROR("could not create buffer: %s\n", strerror(errno));
+        return -1;
+    }
+
+    /* Mapped by gfx2d_map() when the CPU first needs it. */
+    priv_buf->handle = args.handle;
+    priv_buf->offset = args.offset;
+
+    return 0;
 }
 
 static struct m2d_buffer* gfx2d_create(size_t width, size_t height,
                                        enum m2d_pixel_format format,
                                        size_t* stride)
 {
-    struct drm_mchp_gfx2d_alloc_buffer args;
     struct gfx2d_buffer* priv_buf;
-    struct m2d_buffer* buf;
-    size_t size;
 
     if (!gfx2d_surface_is_valid(width, height, format, *stride))
         return NULL;
 
-    size = height * *stride;
-
     priv_buf = calloc(1, sizeof(*priv_buf));
     if (!priv_buf)
     {
         LIBM2D_ERROR("could not allocate memory for buffer: %s\n", strerror(errno));
-        goto out;
+        return NULL;
     }
-    buf = &priv_buf->base;
 
     priv_buf->imported = false;
     priv_buf->direction = DRM_MCHP_GFX2D_DIR_BIDIRECTIONAL;
 
-    memset(&args, 0, sizeof(args));
-    args.size = size;
-    args.width = (uint16_t)width;
-    args.height = (uint16_t)height;
-    args.stride = (uint16_t)*stride;
-    args.format = to_gfx2d_format(format);
-    args.direction = priv_buf->direction;
-    if (drmIoctl(dev.base.fd, DRM_IOCTL_MCHP_GFX2D_ALLOC_BUFFER, &args) < 0)
-    {
-        LIBM2D_ERROR("could not create buffer: %s\n", strerror(errno));
-        goto out_free;
-    }
-
-    priv_buf->handle = args.handle;
-    buf->cpu_addr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED,
-                         dev.base.fd, args.offset);
-    if (buf->cpu_addr == MAP_FAILED)
+    if (gfx2d_alloc_handle(priv_buf, width, height, format, *stride))
     {
-        LIBM2D_ERROR("could not map dumb buffer: %s\n", strerror(errno));
-        goto out_drm_close;
+        free(priv_buf);
+        return NULL;
     }
 
-    return buf;
-
-out_drm_close:
-    drmCloseBufferHandle(dev.base.fd, priv_buf->handle);
-
-out_free:
-    free(priv_buf);
-
-out:
-    return NULL;
+    return &priv_buf->base;
 }
 
 static struct m2d_buffer* gfx2d_import(const struct m2d_import_desc* desc)
@@ -387,26 +459,85 @@ static void gfx2d_free(struct m2d_buffer* buf)
 {
     struct gfx2d_buffer* priv_buf = to_gfx2d_buffer(buf);
 
-    if (!priv_buf->imported && buf->cpu_addr != MAP_FAILED)
-    {
-        size_t size = buf->height * buf->stride;
+    gfx2d_unmap(buf);
 
-        munmap(buf->cpu_addr, size);
+    if (priv_buf->handle)
+    {
+        if (drmCloseBufferHandle(dev.base.fd, priv_buf->handle))
+            LIBM2D_ERROR("could not free buffer: %s\n", strerror(errno));
     }
 
-    if (priv_buf->tmp_handle)
+    free(priv_buf);
+}
+
+/* Parking: drop the GEM object but keep the buffer, see park.c */
+static void gfx2d_release(struct m2d_buffer* buf)
+{
+    struct gfx2d_buffer* priv_buf = to_gfx2d_buffer(buf);
+
+    gfx2d_unmap(buf);
+
+    if (drmCloseBufferHandle(dev.base.fd, priv_buf->handle))
+        LIBM2D_ERROR("could not free buffer: %s\n", strerror(errno));
+
+    priv_buf->handle = 0;
+    priv_buf->offset = 0;
+}
+
+static int gfx2d_restore(struct m2d_buffer* buf)
+{
+    return gfx2d_alloc_handle(to_gfx2d_buffer(buf), buf->width, buf->height,
+                              buf->format, buf->stride);
+}
+
+static int gfx2d_export(struct m2d_buffer* buf, int* fd)
+{
+    struct gfx2d_buffer* priv_buf = to_gfx2d_buffer(buf);
+
+    if (drmPrimeHandleToFD(dev.base.fd, priv_buf->handle, DRM_CLOEXEC | DRM_RDWR, fd))
     {
-        if (drmCloseBufferHandle(dev.base.fd, priv_buf->tmp_handle))
-            LIBM2D_ERROR("could not free tmp buffer: %s\n", strerror(errno));
+        LIBM2D_ERROR("could not get a DRM PRIME file descriptor for buffer %u: %s\n",
+                     buf->id, strerror(errno));
+        return -1;
     }
 
-    if (priv_buf->handle)
+    return 0;
+}
+
+static void* gfx2d_map(struct m2d_buffer* buf)
+{
+    struct gfx2d_buffer* priv_buf = to_gfx2d_buffer(buf);
+    size_t size = buf->height * buf->stride;
+    void* addr;
+
+    /* The exporter didn't provide any mapping for this imported buffer. */
+    if (priv_buf->imported)
+        return NULL;
+
+    addr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                dev.base.fd, priv_buf->offset);
+    if (addr == MAP_FAILED)
     {
-        if (drmCloseBufferHandle(dev.base.fd, priv_buf->handle))
-            LIBM2D_ERROR("could not free buffer: %s\n", strerror(errno));
+        LIBM2D_ERROR("could not map buffer %u: %s\n", buf->id, strerror(errno));
+        return NULL;
     }
 
-    free(priv_buf);
+    buf->cpu_addr = addr;
+
+    return addr;
+}
+
+static void gfx2d_unmap(struct m2d_buffer* buf)
+{
+    struct gfx2d_buffer* priv_buf = to_gfx2d_buffer(buf);
+
+    if (priv_buf->imported || !buf->cpu_addr)
+        return;
+
+    if (munmap(buf->cpu_addr, buf->height * buf->stride))
+        LIBM2D_ERROR("could not unmap buffer %u: %s\n", buf->id, strerror(errno));
+
+    buf->cpu_addr = NULL;
 }
 
 static int gfx2d_sync_for_cpu(struct m2d_buffer* buf,
@@ -482,20 +613,39 @@ static int gfx2d_wait(const struct m2d_buffer* buf, const struct timespec* timeo
     return 0;
 }
 
-void m2d_set_target(struct m2d_buffer* buf)
+int m2d_set_target(struct m2d_buffer* buf)
 {
+    /* Don't draw into a GEM object that is gone. */
+    if (m2d_use_buffer(buf))
+        return -1;
+
     dev.state.target = to_gfx2d_buffer(buf);
+
+    return 0;
+}
+
+void m2d_set_target_transform(unsigned int transform)
+{
+    dev.state.transform = transform & (M2D_TRANSFORM_ROTATE_270 | M2D_TRANSFORM_FLIP_X |
+                                       M2D_TRANSFORM_FLIP_Y);
 }
 
-void m2d_set_source(enum m2d_source_id id, struct m2d_buffer* buf, dim_t x, dim_t y)
+int m2d_set_source(enum m2d_source_id id, struct m2d_buffer* buf, dim_t x, dim_t y)
 {
     if (id >= M2D_MAX_SOURCES)
-        return;
+        return -1;
+
+    if (m2d_use_buffer(buf))
+        return -1;
+
+    m2d_loader_unbind_source(id);
 
     struct gfx2d_source* source = &dev.state.sources[id];
     source->buf = to_gfx2d_buffer(buf);
     source->x = x;
     source->y = y;
+
+    return 0;
 }
 
 void m2d_source_enable(enum m2d_source_id id, bool enabled)
@@ -506,6 +656,79 @@ void m2d_source_enable(enum m2d_source_id id, bool enabled)
     dev.state.sources[id].enabled = enabled;
 }
 
+bool m2d_source_is_enabled(enum m2d_source_id id)
+{
+    return id < M2D_MAX_SOURCES && dev.state.sources[id].enabled;
+}
+
+struct m2d_buffer* m2d_get_source(enum m2d_source_id id)
+{
+    if (id >= M2D_MAX_SOURCES || !dev.state.sources[id].buf)
+        return NULL;
+
+    return &dev.state.sources[id].buf->base;
+}
+
+struct m2d_buffer* m2d_get_target(void)
+{
+    return dev.state.target ? &dev.state.target->base : NULL;
+}
+
+bool m2d_blend_is_enabled(void)
+{
+    return dev.state.blend_enabled;
+}
+
+uint32_t m2d_get_source_color(void)
+{
+    return dev.state.source_color;
+}
+
+enum m2d_renderer m2d_get_renderer(void)
+{
+    return dev.state.renderer;
+}
+
+unsigned int m2d_get_target_transform(void)
+{
+    return dev.state.transform;
+}
+
+static bool gfx2d_state_uses(const struct gfx2d_state* state,
+                             const struct gfx2d_buffer* buf)
+{
+    size_t i;
+
+    if (state->target == buf)
+        return true;
+
+    for (i = 0; i < M2D_MAX_SOURCES; i++)
+        if (state->sources[i].buf == buf)
+            return true;
+
+    return false;
+}
+
+bool m2d_buffer_is_bound(const struct m2d_buffer* buf)
+{
+    const struct gfx2d_buffer* priv_buf = to_gfx2d_buffer(buf);
+    size_t i;
+
+    if (gfx2d_state_uses(&dev.state, priv_buf))
+        return true;
+
+    for (i = 0; i < dev.state_depth && i < GFX2D_STATE_STACK_DEPTH; i++)
+        if (gfx2d_state_uses(&dev.saved_states[i], priv_buf))
+            return true;
+
+    /* Deferred CPU draws use it until flushed. */
+    for (i = 0; i < dev.num_cpu_bufs; i++)
+        if (dev.cpu_bufs[i] == priv_buf)
+            return true;
+
+    return false;
+}
+
 void m2d_source_color(uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha)
 {
     dev.state.source_color = gfx2d_color(red, green, blue, alpha);
@@ -529,6 +752,36 @@ void m2d_blend_functions(enum m2d_blend_function rgb_func,
     dev.state.function = to_gfx2d_blend_function(rgb_func);
 }
 
+void m2d_set_renderer(enum m2d_renderer renderer)
+{
+    dev.state.renderer = renderer;
+}
+
+void m2d_push_state(void)
+{
+    if (dev.state_depth < GFX2D_STATE_STACK_DEPTH)
+        dev.saved_states[dev.state_depth] = dev.state;
+    else
+        LIBM2D_ERROR("renderer state stack overflow\n");
+
+    dev.state_depth++;
+    m2d_loader_suspend();
+}
+
+void m2d_pop_state(void)
+{
+    if (!dev.state_depth)
+    {
+        LIBM2D_ERROR("renderer state stack underflow\n");
+        return;
+    }
+
+    dev.state_depth--;
+    if (dev.state_depth < GFX2D_STATE_STACK_DEPTH)
+        dev.state = dev.saved_states[dev.state_depth];
+    m2d_loader_resume();
+}
+
 static enum drm_mchp_gfx2d_blend_factor gfx2d_fix_afactor(enum drm_mchp_gfx2d_blend_factor afactor)
 {
     switch (afactor)
@@ -555,33 +808,165 @@ void m2d_blend_factors(enum m2d_blend_factor src_rgb_factor,
     dev.state.dafactor = gfx2d_fix_afactor(to_gfx2d_blend_factor(dst_alpha_factor));
 }
 
-static int gfx2d_get_tmp_handle(struct gfx2d_buffer* priv_buf)
+size_t m2d_scratch_size()
+{
+    struct gfx2d_scratch* scratch = &dev.scratch;
+
+    return scratch->handle ? scratch->height * scratch->width * sizeof(uint32_t) : 0;
+}
+
+void m2d_scratch_trim()
+{
+    struct gfx2d_scratch* scratch = &dev.scratch;
+
+    if (!scratch->handle)
+        return;
+
+    /* Pending commands hold their own reference on the GEM object. */
+    if (drmCloseBufferHandle(dev.base.fd, scratch->handle))
+        LIBM2D_ERROR("could not free scratch buffer: %s\n", strerror(errno));
+
+    LIBM2D_DEBUG("released scratch buffer [%zux%zu]\n", scratch->width, scratch->height);
+
+    scratch->handle = 0;
+    scratch->width = 0;
+    scratch->height = 0;
+}
+
+static void gfx2d_scratch_shrink_if_idle(struct gfx2d_scratch* scratch)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec - scratch->period_start.tv_sec < GFX2D_SCRATCH_IDLE_SECS)
+        return;
+
+    if (scratch->handle &&
+        2 * scratch->peak_width * scratch->peak_height < scratch->width * scratch->height)
+        m2d_scratch_trim();
+
+    scratch->peak_width = 0;
+    scratch->peak_height = 0;
+    scratch->period_start = now;
+}
+
+/*
+ * Get a scratch surface covering @bbox, that is the bounding box of the
+ * rectangles to draw, in the target surface space. The bounding box is
+ * clipped to @target, so it also tells the scratch origin to use.
+ */
+static uint32_t gfx2d_get_scratch(const struct gfx2d_buffer* target,
+                                  struct m2d_rectangle* bbox)
 {
-    if (unlikely(!priv_buf->tmp_handle))
+    struct gfx2d_scratch* scratch = &dev.scratch;
+    struct drm_mchp_gfx2d_alloc_buffer args;
+    struct m2d_rectangle bounds;
+    size_t width;
+    size_t height;
+
+    bounds.x = 0;
+    bounds.y = 0;
+    bounds.w = (dim_t)target->base.width;
+    bounds.h = (dim_t)target->base.height;
+    if (!m2d_intersect(bbox, &bounds, bbox))
+        return 0;
+
+    gfx2d_scratch_shrink_if_idle(scratch);
+
+    scratch->peak_width = max_int((int)scratch->peak_width, bbox->w);
+    scratch->peak_height = max_int((int)scratch->peak_height, bbox->h);
+
+    if (scratch->handle &&
+        scratch->width >= (size_t)bbox->w && scratch->height >= (size_t)bbox->h)
+        return scratch->handle;
+
+    /* Grow to the recent peak so that alternating sizes don't thrash. */
+    width = max_int((int)scratch->width, (int)scratch->peak_width);
+    height = max_int((int)scratch->height, (int)scratch->peak_height);
+    m2d_scratch_trim();
+
+    memset(&args, 0, sizeof(args));
+    args.size = height * width * sizeof(uint32_t);
+    args.width = (uint16_t)width;
+    args.height = (uint16_t)height;
+    args.stride = (uint16_t)(width * sizeof(uint32_t));
+    args.format = DRM_MCHP_GFX2D_PF_ARGB32;
+    args.direction = DRM_MCHP_GFX2D_DIR_BIDIRECTIONAL;
+    if (drmIoctl(dev.base.fd, DRM_IOCTL_MCHP_GFX2D_ALLOC_BUFFER, &args) < 0)
     {
-        size_t stride = priv_buf->base.width * sizeof(uint32_t);
-        size_t size = priv_buf->base.height * stride;
-        struct drm_mchp_gfx2d_alloc_buffer args;
+        LIBM2D_ERROR("could not create scratch buffer [%zux%zu]: %s\n",
+                     width, height, strerror(errno));
+        return 0;
+    }
 
-        memset(&args, 0, sizeof(args));
-        args.size = size;
-        args.width = (uint16_t)priv_buf->base.width;
-        args.height = (uint16_t)priv_buf->base.height;
-        args.stride = (uint16_t)stride;
-        args.format = DRM_MCHP_GFX2D_PF_ARGB32;
-        args.direction = DRM_MCHP_GFX2D_DIR_BIDIRECTIONAL;
-        if (drmIoctl(dev.base.fd, DRM_IOCTL_MCHP_GFX2D_ALLOC_BUFFER, &args) < 0)
-        {
-            LIBM2D_ERROR("could not create tmp bo for buffer %u: %s\n",
-                         priv_buf->base.id, strerror(errno));
-        }
-        else
+    scratch->handle = args.handle;
+    scratch->width = width;
+    scratch->height = height;
+
+    LIBM2D_DEBUG("allocated scratch buffer [%zux%zu]\n", width, height);
+
+    return scratch->handle;
+}
+
+static void gfx2d_bounding_box(const struct m2d_rectangle* rects, size_t num_rects,
+                               struct m2d_rectangle* bbox)
+{
+    dim_t x1;
+    dim_t y1;
+    size_t i;
+
+    *bbox = rects[0];
+    x1 = bbox->x + bbox->w;
+    y1 = bbox->y + bbox->h;
+    for (i = 1; i < num_rects; i++)
+    {
+        bbox->x = min_int(bbox->x, rects[i].x);
+        bbox->y = min_int(bbox->y, rects[i].y);
+        x1 = max_int(x1, rects[i].x + rects[i].w);
+        y1 = max_int(y1, rects[i].y + rects[i].h);
+    }
+    bbox->w = x1 - bbox->x;
+    bbox->h = y1 - bbox->y;
+}
+
+/*
+ * Translate @rects by (-@x, -@y), into @local when it is large enough,
+ * into a new allocated array otherwise, to be released with
+ * @gfx2d_put_translated().
+ */
+static struct m2d_rectangle* gfx2d_translate(const struct m2d_rectangle* rects,
+                                             size_t num_rects, dim_t x, dim_t y,
+                                             struct m2d_rectangle* local)
+{
+    struct m2d_rectangle* translated = local;
+    size_t i;
+
+    if (num_rects > GFX2D_LOCAL_RECTS)
+    {
+        translated = malloc(num_rects * sizeof(*translated));
+        if (!translated)
         {
-            priv_buf->tmp_handle = args.handle;
+            LIBM2D_ERROR("could not allocate memory for rectangles: %s\n", strerror(errno));
+            return NULL;
         }
     }
 
-    return priv_buf->tmp_handle;
+    for (i = 0; i < num_rects; i++)
+    {
+        translated[i].x = rects[i].x - x;
+        translated[i].y = rects[i].y - y;
+        translated[i].w = rects[i].w;
+        translated[i].h = rects[i].h;
+    }
+
+    return translated;
+}
+
+static void gfx2d_put_translated(struct m2d_rectangle* translated,
+                                 struct m2d_rectangle* local)
+{
+    if (translated != local)
+        free(translated);
 }
 
 static int gfx2d_submit_blend(struct drm_mchp_gfx2d_submit* args)
@@ -642,30 +1027,44 @@ static void gfx2d_blend(const struct m2d_rectangle* rects, size_t num_rects)
 
     if (unlikely(dev.state.source_color != 0xffffffffu))
     {
-        uint32_t handle = gfx2d_get_tmp_handle(target);
-
+        struct m2d_rectangle local[GFX2D_LOCAL_RECTS];
+        struct m2d_rectangle* translated;
+        struct m2d_rectangle bbox;
+        uint32_t handle;
+        int ret;
+
+        gfx2d_bounding_box(rects, num_rects, &bbox);
+        handle = gfx2d_get_scratch(target, &bbox);
         if (!handle)
             return;
 
+        translated = gfx2d_translate(rects, num_rects, bbox.x, bbox.y, local);
+        if (!translated)
+            return;
+
         LIBM2D_TRACE("source color: %08X\n", dev.state.source_color);
 
         /* Don't care about the DST (source 0) surface here. */
+        args.rectangles = (uint64_t)(intptr_t)translated;
         args.target_handle = handle;
         args.sources[0].handle = src->buf->handle;
-        args.sources[0].x = src->x;
-        args.sources[0].y = src->y;
+        args.sources[0].x = src->x - bbox.x;
+        args.sources[0].y = src->y - bbox.y;
         args.blend.src_color = dev.state.source_color;
         args.blend.function = DRM_MCHP_GFX2D_BFUNC_ADD;
         args.blend.safactor = DRM_MCHP_GFX2D_BFACTOR_CONSTANT_ALPHA;
         args.blend.dafactor = DRM_MCHP_GFX2D_BFACTOR_ZERO;
         args.blend.scfactor = DRM_MCHP_GFX2D_BFACTOR_CONSTANT_COLOR;
         args.blend.dcfactor = DRM_MCHP_GFX2D_BFACTOR_ZERO;
-        if (gfx2d_submit_blend(&args))
+        ret = gfx2d_submit_blend(&args);
+        gfx2d_put_translated(translated, local);
+        if (ret)
             return;
 
+        args.rectangles = (uint64_t)(intptr_t)rects;
         args.sources[1].handle = handle;
-        args.sources[1].x = 0;
-        args.sources[1].y = 0;
+        args.sources[1].x = bbox.x;
+        args.sources[1].y = bbox.y;
     }
 
     args.target_handle = target->handle;
@@ -756,16 +1155,30 @@ static void gfx2d_blend_with_source_color(const struct m2d_rectangle* rects, siz
     struct gfx2d_buffer* target = dev.state.target;
     struct gfx2d_source tmp;
     const struct gfx2d_source* dst = gfx2d_get_dst_or_target(&tmp);
+    struct m2d_rectangle local[GFX2D_LOCAL_RECTS];
+    struct m2d_rectangle* translated;
     struct drm_mchp_gfx2d_submit args;
+    struct m2d_rectangle bbox;
     uint32_t handle;
+    int ret;
 
     LIBM2D_DEBUG("reading %s surface pixels from buffer %u {origin: (%d,%d)}\n",
                  m2d_source_name(M2D_DST), dst->buf->base.id, dst->x, dst->y);
 
     LIBM2D_TRACE("source color: %08X\n", dev.state.source_color);
 
-    handle = gfx2d_get_tmp_handle(target);
-    if (!handle || gfx2d_fill_target(rects, num_rects, handle))
+    gfx2d_bounding_box(rects, num_rects, &bbox);
+    handle = gfx2d_get_scratch(target, &bbox);
+    if (!handle)
+        return;
+
+    translated = gfx2d_translate(rects, num_rects, bbox.x, bbox.y, local);
+    if (!translated)
+        return;
+
+    ret = gfx2d_fill_target(translated, num_rects, handle);
+    gfx2d_put_translated(translated, local);
+    if (ret)
         return;
 
     memset(&args, 0, sizeof(args));
@@ -779,8 +1192,8 @@ static void gfx2d_blend_with_source_color(const struct m2d_rectangle* rects, siz
     args.sources[0].x = dst->x;
     args.sources[0].y = dst->y;
     args.sources[1].handle = handle;
-    args.sources[1].x = 0;
-    args.sources[1].y = 0;
+    args.sources[1].x = bbox.x;
+    args.sources[1].y = bbox.y;
     args.blend.src_color = dev.state.blend_color;
     args.blend.dst_color = dev.state.blend_color;
     args.blend.function = dev.state.function;
@@ -795,6 +1208,273 @@ static void gfx2d_blend_with_source_color(const struct m2d_rectangle* rects, siz
     }
 }
 
+/* Map @buf for the CPU renderer. */
+static bool gfx2d_cpu_surface(struct gfx2d_buffer* buf, dim_t x, dim_t y,
+                              struct m2d_cpu_surface* surface)
+{
+    surface->data = m2d_get_data(&buf->base);
+    if (!surface->data)
+    {
+        LIBM2D_DEBUG("buffer %u can't be accessed by the CPU: using the GPU\n", buf->base.id);
+        return false;
+    }
+
+    surface->width = buf->base.width;
+    surface->height = buf->base.height;
+    surface->stride = buf->base.stride;
+    surface->format = buf->base.format;
+    surface->x = x;
+    surface->y = y;
+
+    return true;
+}
+
+/* Synchronize @buf for the CPU renderer, unless it is in @bufs already. */
+static bool gfx2d_cpu_acquire(struct gfx2d_buffer* buf, struct gfx2d_buffer** bufs,
+                              size_t* num_bufs)
+{
+    struct timespec timeout;
+    size_t i;
+
+    for (i = 0; i < *num_bufs; i++)
+        if (bufs[i] == buf)
+            return true;
+
+    clock_gettime(CLOCK_MONOTONIC, &timeout);
+    timeout.tv_sec += GFX2D_TIMEOUT_SECS;
+    if (gfx2d_sync_for_cpu(&buf->base, &timeout))
+        return false;
+
+    bufs[(*num_bufs)++] = buf;
+
+    return true;
+}
+
+static void gfx2d_cpu_release(struct gfx2d_buffer** bufs, size_t* num_bufs)
+{
+    size_t i;
+
+    for (i = 0; i < *num_bufs; i++)
+        gfx2d_sync_for_gpu(&bufs[i]->base);
+
+    *num_bufs = 0;
+}
+
+/* Draw the deferred CPU draws, and hand their buffers back to the GPU. */
+static void gfx2d_flush_cpu(void)
+{
+    if (!m2d_cpu_has_deferred())
+        return;
+
+    m2d_cpu_flush();
+    gfx2d_cpu_release(dev.cpu_bufs, &dev.num_cpu_bufs);
+}
+
+/* Return false if the draw must be executed right away. */
+static bool gfx2d_defer_cpu(const struct m2d_cpu_state* state,
+                            const struct m2d_rectangle* rects, size_t num_rects,
+                            struct gfx2d_buffer** bufs, size_t num_bufs)
+{
+    struct gfx2d_buffer** cpu_bufs;
+    size_t i;
+
+    if (!m2d_cpu_can_defer(state))
+        gfx2d_flush_cpu();
+
+    if (!m2d_cpu_can_defer(state))
+        return false;
+
+    if (dev.num_cpu_bufs + num_bufs > dev.max_cpu_bufs)
+    {
+        cpu_bufs = realloc(dev.cpu_bufs, (dev.max_cpu_bufs * 2 + num_bufs) * sizeof(*cpu_bufs));
+        if (!cpu_bufs)
+            return false;
+
+        dev.cpu_bufs = cpu_bufs;
+        dev.max_cpu_bufs = dev.max_cpu_bufs * 2 + num_bufs;
+    }
+
+    /* The buffers stay synchronized for the CPU until the flush. */
+    for (i = 0; i < num_bufs; i++)
+        if (!gfx2d_cpu_acquire(bufs[i], dev.cpu_bufs, &dev.num_cpu_bufs))
+            return false;
+
+    if (!m2d_cpu_defer(state, rects, num_rects))
+        return false;
+
+    LIBM2D_DEBUG("deferred %zu rectangle(s) on the CPU\n", num_rects);
+    m2d_print_rectangles(rects, num_rects);
+
+    return true;
+}
+
+/* Return false if the surfaces can't be accessed by the CPU. */
+static bool gfx2d_draw_cpu(const struct m2d_rectangle* rects, size_t num_rects)
+{
+    const struct gfx2d_source* src = &dev.state.sources[M2D_SRC];
+    struct gfx2d_buffer* bufs[1 + M2D_MAX_SOURCES];
+    struct gfx2d_buffer* synced[1 + M2D_MAX_SOURCES];
+    struct m2d_cpu_surface src_surface;
+    struct m2d_cpu_surface dst_surface;
+    struct m2d_cpu_state state;
+    struct gfx2d_source tmp;
+    const struct gfx2d_source* dst;
+    size_t num_bufs = 0;
+    size_t num_synced = 0;
+    size_t i;
+
+    memset(&state, 0, sizeof(state));
+    state.blend_enabled = dev.state.blend_enabled;
+    state.blend.source_color = dev.state.source_color;
+    state.blend.blend_color = dev.state.blend_color;
+    state.blend.mode.function = from_gfx2d_blend_function(dev.state.function);
+    state.blend.mode.scfactor = from_gfx2d_blend_factor(dev.state.scfactor);
+    state.blend.mode.dcfactor = from_gfx2d_blend_factor(dev.state.dcfactor);
+    state.blend.mode.safactor = from_gfx2d_blend_factor(dev.state.safactor);
+    state.blend.mode.dafactor = from_gfx2d_blend_factor(dev.state.dafactor);
+
+    if (!gfx2d_cpu_surface(dev.state.target, 0, 0, &state.target))
+        return false;
+    bufs[num_bufs++] = dev.state.target;
+
+    if (src->enabled && src->buf)
+    {
+        if (!gfx2d_cpu_surface(src->buf, src->x, src->y, &src_surface))
+            return false;
+        bufs[num_bufs++] = src->buf;
+        state.src = &src_surface;
+    }
+
+    if (state.blend_enabled)
+    {
+        dst = gfx2d_get_dst_or_target(&tmp);
+        if (!gfx2d_cpu_surface(dst->buf, dst->x, dst->y, &dst_surface))
+            return false;
+        bufs[num_bufs++] = dst->buf;
+        state.dst = &dst_surface;
+    }
+
+    if (dev.state.renderer == M2D_RENDERER_CPU_DEFERRED &&
+        gfx2d_defer_cpu(&state, rects, num_rects, bufs, num_bufs))
+        return true;
+
+    /* Executed after the deferred draws. */
+    gfx2d_flush_cpu();
+
+    for (i = 0; i < num_bufs; i++)
+    {
+        if (!gfx2d_cpu_acquire(bufs[i], synced, &num_synced))
+        {
+            gfx2d_cpu_release(synced, &num_synced);
+            return false;
+        }
+    }
+
+    m2d_cpu_draw_rectangles(&state, rects, num_rects);
+
+    LIBM2D_DEBUG("drew %zu rectangle(s) on the CPU\n", num_rects);
+    m2d_print_rectangles(rects, num_rects);
+
+    gfx2d_cpu_release(synced, &num_synced);
+
+    return true;
+}
+
+void m2d_flush()
+{
+    /* Background threads leave the deferred draws to the render thread. */
+    if (!m2d_is_render_thread())
+        return;
+
+    gfx2d_flush_cpu();
+
+    /* A scratch surface no longer requested is released here. */
+    gfx2d_scratch_shrink_if_idle(&dev.scratch);
+}
+
+/*
+ * Draw @rects given in the logical space of the transformed target: the
+ * rectangles are transformed, and the sources replaced by their transformed
+ * variants, positioned where their transformed area lands.
+ */
+static void gfx2d_draw_transformed(const struct m2d_rectangle* rects, size_t num_rects)
+{
+    struct gfx2d_source sources[M2D_MAX_SOURCES];
+    struct m2d_rectangle local[GFX2D_LOCAL_RECTS];
+    struct m2d_rectangle* transformed = local;
+    struct m2d_rectangle origin = { 0, 0, 1, 1 };
+    struct m2d_rectangle r;
+    struct m2d_buffer* variant;
+    struct m2d_buffer* target = &dev.state.target->base;
+    unsigned int transform = dev.state.transform;
+    bool transposed = transform & M2D_TRANSFORM_ROTATE_90;
+    size_t width = transposed ? target->height : target->width;
+    size_t height = transposed ? target->width : target->height;
+    size_t i;
+
+    if (num_rects > GFX2D_LOCAL_RECTS)
+    {
+        transformed = malloc(num_rects * sizeof(*transformed));
+        if (!transformed)
+        {
+            LIBM2D_ERROR("could not allocate memory for rectangles: %s\n", strerror(errno));
+            return;
+        }
+    }
+
+    for (i = 0; i < num_rects; i++)
+        m2d_transform_rect(transform, width, height, &rects[i], &transformed[i]);
+
+    m2d_transform_rect(transform, width, height, &origin, &origin);
+
+    memcpy(sources, dev.state.sources, sizeof(sources));
+    dev.state.transform = M2D_TRANSFORM_NONE;
+
+    for (i = 0; i < M2D_MAX_SOURCES; i++)
+    {
+        struct gfx2d_source* source = &dev.state.sources[i];
+
+        if (!source->enabled || !source->buf)
+            continue;
+
+        /* The target is read in its own space: only the offset turns. */
+        if (&source->buf->base == target)
+        {
+            r.x = source->x;
+            r.y = source->y;
+            r.w = 1;
+            r.h = 1;
+            m2d_transform_rect(transform, width, height, &r, &r);
+            source->x = r.x - origin.x;
+            source->y = r.y - origin.y;
+            continue;
+        }
+
+        /* Bound right away, so that the next variants don't evict it. */
+        variant = m2d_transformed_variant(&source->buf->base, transform);
+        if (!variant)
+            goto restore;
+
+        r.x = source->x;
+        r.y = source->y;
+        r.w = (dim_t)source->buf->base.width;
+        r.h = (dim_t)source->buf->base.height;
+        m2d_transform_rect(transform, width, height, &r, &r);
+        source->buf = to_gfx2d_buffer(variant);
+        source->x = r.x;
+        source->y = r.y;
+    }
+
+    gfx2d_draw_rectangles(transformed, num_rects);
+
+restore:
+    memcpy(dev.state.sources, sources, sizeof(sources));
+    dev.state.transform = transform;
+
+    if (transformed != local)
+        free(transformed);
+}
+
 static void gfx2d_draw_rectangles(const struct m2d_rectangle* rects,
                                   size_t num_rects)
 {
@@ -808,6 +1488,23 @@ static void gfx2d_draw_rectangles(const struct m2d_rectangle* rects,
         return;
     }
 
+    if (!num_rects)
+        return;
+
+    if (dev.state.transform)
+    {
+        gfx2d_draw_transformed(rects, num_rects);
+        return;
+    }
+
+    dev.state.target->base.generation++;
+
+    if (dev.state.renderer != M2D_RENDERER_GPU && gfx2d_draw_cpu(rects, num_rects))
+        return;
+
+    /* The GPU draws after the deferred CPU draws. */
+    gfx2d_flush_cpu();
+
     if (dev.state.blend_enabled)
         func = src_enabled ? gfx2d_blend : gfx2d_blend_with_source_color;
     else if (src_enabled)
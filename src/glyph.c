@@ -0,0 +1,690 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/atlas.h"
+#include "m2d/glyph.h"
+#include "m2d_priv.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define GLYPH_BUCKETS 256
+#define GLYPH_LAYOUT_BUCKETS 64
+#define GLYPH_PAGE_WIDTH 1024
+#define GLYPH_PAGE_HEIGHT 512
+#define GLYPH_MAX_PAGES 2
+#define GLYPH_BUDGET (GLYPH_MAX_PAGES * GLYPH_PAGE_WIDTH * GLYPH_PAGE_HEIGHT)
+#define GLYPH_TIMEOUT_SECS 1
+#define GLYPH_REPLACEMENT_CHARACTER 0xfffd
+
+/*
+ * Glyph cache and text.
+ *
+ * Drawing glyph by glyph from an atlas takes one command per glyph: each one
+ * has its own source origin. Rather, the glyphs are rasterized once and kept
+ * by the CPU, and each text is laid out once into an A8 atlas page, where its
+ * glyphs keep their relative positions. A run, however long, is then a single
+ * blend of its line boxes, modulated by the constant source color: a 200
+ * character paragraph takes one command, two for GFX2D which multiplies the
+ * source by the color in a pass of its own.
+ *
+ * Laying out a text costs a CPU composition of its few coverage bytes, right
+ * into the atlas rectangle reserved for it. Atlas images can't be released one
+ * by one: when the pages and the surfaces of the texts too large for them go
+ * over the budget, or memory is reclaimed, all the layouts are forgotten at
+ * once, and laid out again when drawn next.
+ */
+struct glyph
+{
+    uint32_t codepoint;
+
+    /* Tightly packed coverage, NULL for blank or missing glyphs. */
+    uint8_t* pixels;
+    dim_t width;
+    dim_t height;
+    dim_t left;
+    dim_t top;
+    dim_t advance;
+
+    struct glyph* next;
+};
+
+struct text_layout
+{
+    uint64_t hash;
+    char* text;
+
+    /* The box of the laid out pixels, relative to the run origin. */
+    struct m2d_rectangle bounds;
+    struct m2d_atlas_image image;
+
+    /* Set when the text is too large for the pages: it has its own surface. */
+    struct m2d_buffer* own;
+
+    /* The boxes of the non blank lines, relative to the run origin. */
+    struct m2d_rectangle* lines;
+    size_t num_lines;
+
+    struct text_layout* next;
+};
+
+struct m2d_glyph_cache
+{
+    dim_t ascent;
+    dim_t line_height;
+    m2d_glyph_render_func render;
+    void* data;
+
+    struct glyph* glyphs[GLYPH_BUCKETS];
+    struct text_layout* layouts[GLYPH_LAYOUT_BUCKETS];
+    struct m2d_atlas* atlas;
+
+    /* The bytes of the surfaces of the texts too large for the pages. */
+    size_t own_size;
+
+    struct m2d_reclaimer reclaimer;
+
+    /* Set while drawing: the atlas may be growing or in use, it can't be reclaimed. */
+    bool busy;
+};
+
+/* Decode the UTF-8 character at *@text, invalid sequences being replaced. */
+static uint32_t glyph_next_codepoint(const char** text)
+{
+    const uint8_t* s = (const uint8_t*)*text;
+    uint32_t codepoint;
+    size_t len;
+    size_t i;
+
+    if (s[0] < 0x80)
+    {
+        *text += 1;
+        return s[0];
+    }
+
+    if (s[0] >= 0xc2 && s[0] <= 0xdf)
+    {
+        codepoint = s[0] & 0x1f;
+        len = 2;
+    }
+    else if (s[0] >= 0xe0 && s[0] <= 0xef)
+    {
+        codepoint = s[0] & 0x0f;
+        len = 3;
+    }
+    else if (s[0] >= 0xf0 && s[0] <= 0xf4)
+    {
+        codepoint = s[0] & 0x07;
+        len = 4;
+    }
+    else
+    {
+        *text += 1;
+        return GLYPH_REPLACEMENT_CHARACTER;
+    }
+
+    for (i = 1; i < len; i++)
+    {
+        if ((s[i] & 0xc0) != 0x80)
+        {
+            *text += i;
+            return GLYPH_REPLACEMENT_CHARACTER;
+        }
+        codepoint = codepoint << 6 | (s[i] & 0x3f);
+    }
+
+    *text += len;
+
+    /* Overlong forms, surrogates and out of range characters. */
+    if ((len == 3 && codepoint < 0x800) || (len == 4 && codepoint < 0x10000) ||
+        (codepoint >= 0xd800 && codepoint <= 0xdfff) || codepoint > 0x10ffff)
+        return GLYPH_REPLACEMENT_CHARACTER;
+
+    return codepoint;
+}
+
+/* The glyph of @codepoint, rasterized on first use; NULL if out of memory. */
+static const struct glyph* glyph_get(struct m2d_glyph_cache* cache, uint32_t codepoint)
+{
+    struct glyph** bucket = &cache->glyphs[codepoint % GLYPH_BUCKETS];
+    struct m2d_glyph_bitmap bitmap;
+    struct glyph* glyph;
+    size_t y;
+
+    for (glyph = *bucket; glyph; glyph = glyph->next)
+    {
+        if (glyph->codepoint == codepoint)
+            return glyph;
+    }
+
+    glyph = calloc(1, sizeof(*glyph));
+    if (!glyph)
+    {
+        LIBM2D_ERROR("could not allocate memory for glyph: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    glyph->codepoint = codepoint;
+
+    /* Missing glyphs are cached as well, so that they are looked up once. */
+    memset(&bitmap, 0, sizeof(bitmap));
+    if (cache->render(codepoint, &bitmap, cache->data))
+    {
+        LIBM2D_DEBUG("no glyph for character U+%04X\n", codepoint);
+    }
+    else
+    {
+        glyph->left = bitmap.left;
+        glyph->top = bitmap.top;
+        glyph->advance = bitmap.advance;
+
+        if (bitmap.pixels && bitmap.width && bitmap.height)
+        {
+            glyph->pixels = malloc(bitmap.width * bitmap.height);
+            if (!glyph->pixels)
+            {
+                LIBM2D_ERROR("could not allocate memory for glyph: %s\n", strerror(errno));
+                free(glyph);
+                return NULL;
+            }
+
+            for (y = 0; y < bitmap.height; y++)
+                memcpy(glyph->pixels + y * bitmap.width, bitmap.pixels + y * bitmap.pitch,
+                       bitmap.width);
+
+            glyph->width = (dim_t)bitmap.width;
+            glyph->height = (dim_t)bitmap.height;
+        }
+    }
+
+    glyph->next = *bucket;
+    *bucket = glyph;
+
+    return glyph;
+}
+
+static void glyph_layout_free(struct text_layout* layout)
+{
+    m2d_free(layout->own);
+    free(layout->lines);
+    free(layout->text);
+    free(layout);
+}
+
+/* Forget every layout, and release the atlas pages holding them. */
+static size_t glyph_flush_layouts(struct m2d_glyph_cache* cache)
+{
+    struct text_layout* layout;
+    size_t size = 0;
+    size_t i;
+
+    for (i = 0; i < GLYPH_LAYOUT_BUCKETS; i++)
+    {
+        while ((layout = cache->layouts[i]))
+        {
+            cache->layouts[i] = layout->next;
+            glyph_layout_free(layout);
+        }
+    }
+
+    size += cache->own_size;
+    cache->own_size = 0;
+
+    if (cache->atlas)
+    {
+        for (i = 0; i < m2d_atlas_num_pages(cache->atlas); i++)
+            size += m2d_buffer_size(m2d_atlas_page(cache->atlas, i));
+
+        m2d_atlas_destroy(cache->atlas);
+        cache->atlas = NULL;
+    }
+
+    return size;
+}
+
+static size_t glyph_reclaim(size_t bytes, void* data)
+{
+    struct m2d_glyph_cache* cache = data;
+    size_t i;
+
+    (void)bytes;
+
+    if (cache->busy)
+        return 0;
+
+    if (cache->atlas)
+    {
+        for (i = 0; i < m2d_atlas_num_pages(cache->atlas); i++)
+        {
+            if (m2d_buffer_is_bound(m2d_atlas_page(cache->atlas, i)))
+                return 0;
+        }
+    }
+
+    return glyph_flush_layouts(cache);
+}
+
+/* Add the pixels with saturation, overlapping glyphs sharing columns. */
+static void glyph_add(uint8_t* dst, size_t stride, const struct glyph* glyph)
+{
+    const uint8_t* src = glyph->pixels;
+    size_t width = (size_t)glyph->width;
+    size_t x, y;
+
+    for (y = 0; y < (size_t)glyph->height; y++, dst += stride, src += width)
+    {
+        for (x = 0; x < width; x++)
+        {
+            unsigned int sum = dst[x] + src[x];
+
+            dst[x] = sum > 255 ? 255 : sum;
+        }
+    }
+}
+
+/*
+ * Walk the glyphs of @text, accumulating the box of each line into @lines when
+ * not NULL, and drawing the glyphs into @data, of origin @origin relative to
+ * the run, when not NULL. Return the number of lines, 0 if out of memory.
+ */
+static size_t glyph_walk(struct m2d_glyph_cache* cache, const char* text,
+                         struct m2d_rectangle* lines, uint8_t* data, size_t stride,
+                         const struct m2d_rectangle* origin)
+{
+    const struct glyph* glyph;
+    struct m2d_rectangle box;
+    size_t line = 0;
+    dim_t pen = 0;
+
+    if (lines)
+        memset(&lines[0], 0, sizeof(lines[0]));
+
+    while (*text)
+    {
+        if (*text == '\n')
+        {
+            text++;
+            line++;
+            pen = 0;
+            if (lines)
+                memset(&lines[line], 0, sizeof(lines[line]));
+            continue;
+        }
+
+        glyph = glyph_get(cache, glyph_next_codepoint(&text));
+        if (!glyph)
+            return 0;
+
+        box.x = pen + glyph->left;
+        box.y = (dim_t)line * cache->line_height + cache->ascent - glyph->top;
+        box.w = glyph->width;
+        box.h = glyph->height;
+        pen += glyph->advance;
+
+        if (!glyph->pixels)
+            continue;
+
+        if (lines && !lines[line].w)
+            lines[line] = box;
+        else if (lines)
+            m2d_rectangle_union(&lines[line], &box);
+
+        if (data)
+            glyph_add(data + (size_t)(box.y - origin->y) * stride + (size_t)(box.x - origin->x),
+                      stride, glyph);
+    }
+
+    return line + 1;
+}
+
+/* The bytes held by the pages and the surfaces of the texts too large for them. */
+static size_t glyph_cache_size(const struct m2d_glyph_cache* cache)
+{
+    size_t size = cache->own_size;
+    size_t i;
+
+    if (cache->atlas)
+    {
+        for (i = 0; i < m2d_atlas_num_pages(cache->atlas); i++)
+            size += m2d_buffer_size(m2d_atlas_page(cache->atlas, i));
+    }
+
+    return size;
+}
+
+/* Reserve room in the atlas, starting over with empty pages when over budget. */
+static int glyph_atlas_reserve(struct m2d_glyph_cache* cache, size_t width, size_t height,
+                               struct m2d_atlas_image* image)
+{
+    size_t num_pages;
+
+    if (!cache->atlas)
+    {
+        cache->atlas = m2d_atlas_create(GLYPH_PAGE_WIDTH, GLYPH_PAGE_HEIGHT, M2D_PF_A8);
+        if (!cache->atlas)
+            return -1;
+    }
+
+    num_pages = m2d_atlas_num_pages(cache->atlas);
+    if (m2d_atlas_reserve(cache->atlas, width, height, image))
+        return -1;
+
+    if (m2d_atlas_num_pages(cache->atlas) > num_pages && glyph_cache_size(cache) > GLYPH_BUDGET)
+    {
+        LIBM2D_DEBUG("glyph cache full, forgetting the text laid out\n");
+        glyph_flush_layouts(cache);
+        return glyph_atlas_reserve(cache, width, height, image);
+    }
+
+    m2d_set_tag(image->page, "glyphs");
+
+    return 0;
+}
+
+/* Compose the coverage of @text into the @image rectangle of its page. */
+static int glyph_compose(struct m2d_glyph_cache* cache, const char* text,
+                         const struct m2d_rectangle* bounds, const struct m2d_atlas_image* image)
+{
+    struct timespec timeout;
+    uint8_t* data;
+    size_t stride;
+    size_t y;
+
+    /* Waits for the runs already drawn from the page. */
+    clock_gettime(CLOCK_MONOTONIC, &timeout);
+    timeout.tv_sec += GLYPH_TIMEOUT_SECS;
+    if (m2d_sync_for_cpu(image->page, &timeout))
+        return -1;
+
+    data = m2d_get_data(image->page);
+    if (!data)
+    {
+        LIBM2D_ERROR("buffer %u can't be accessed by the CPU to lay text out\n",
+                     image->page->id);
+        m2d_sync_for_gpu(image->page);
+        return -1;
+    }
+
+    stride = m2d_get_stride(image->page);
+    data += (size_t)image->rect.y * stride + (size_t)image->rect.x;
+    for (y = 0; y < (size_t)image->rect.h; y++)
+        memset(data + y * stride, 0, (size_t)image->rect.w);
+    glyph_walk(cache, text, NULL, data, stride, bounds);
+    m2d_sync_for_gpu(image->page);
+
+    return 0;
+}
+
+/* Lay @text out into the atlas. */
+static struct text_layout* glyph_layout_create(struct m2d_glyph_cache* cache, const char* text,
+                                               uint64_t hash)
+{
+    struct text_layout* layout;
+    size_t width, height;
+    size_t stride;
+    const char* s;
+    size_t count;
+    size_t i;
+
+    layout = calloc(1, sizeof(*layout));
+    if (!layout)
+        goto enomem;
+
+    layout->hash = hash;
+    layout->text = strdup(text);
+    for (count = 1, s = text; *s; s++)
+        count += *s == '\n';
+    layout->lines = calloc(count, sizeof(*layout->lines));
+    if (!layout->text || !layout->lines)
+        goto enomem;
+
+    count = glyph_walk(cache, text, layout->lines, NULL, 0, NULL);
+    if (!count)
+        goto free_layout;
+
+    /* Keep the non blank lines only, and their bounds. */
+    for (i = 0; i < count; i++)
+    {
+        const struct m2d_rectangle* line = &layout->lines[i];
+
+        if (!line->w)
+            continue;
+
+        if (!layout->num_lines)
+            layout->bounds = *line;
+        else
+            m2d_rectangle_union(&layout->bounds, line);
+
+        layout->lines[layout->num_lines++] = *line;
+    }
+
+    if (!layout->num_lines)
+        return layout;
+
+    width = (size_t)layout->bounds.w;
+    height = (size_t)layout->bounds.h;
+
+    /* Too large for the pages: the text has its own surface, within the budget. */
+    if (width > GLYPH_PAGE_WIDTH || height > GLYPH_PAGE_HEIGHT)
+    {
+        stride = (width + 3) & ~(size_t)3;
+        if (glyph_cache_size(cache) + stride * height > GLYPH_BUDGET)
+        {
+            LIBM2D_DEBUG("glyph cache full, forgetting the text laid out\n");
+            glyph_flush_layouts(cache);
+        }
+
+        layout->own = m2d_alloc(width, height, M2D_PF_A8, stride);
+        if (!layout->own)
+            goto free_layout;
+
+        m2d_set_tag(layout->own, "glyphs");
+        layout->image.page = layout->own;
+        layout->image.rect.x = 0;
+        layout->image.rect.y = 0;
+        layout->image.rect.w = layout->bounds.w;
+        layout->image.rect.h = layout->bounds.h;
+    }
+    else if (glyph_atlas_reserve(cache, width, height, &layout->image))
+    {
+        goto free_layout;
+    }
+
+    if (glyph_compose(cache, text, &layout->bounds, &layout->image))
+        goto free_layout;
+
+    if (layout->own)
+        cache->own_size += m2d_buffer_size(layout->own);
+
+    LIBM2D_DEBUG("laid out %zu line(s) of text [%dx%d]\n", layout->num_lines,
+                 layout->bounds.w, layout->bounds.h);
+
+    return layout;
+
+enomem:
+    LIBM2D_ERROR("could not allocate memory for text layout: %s\n", strerror(errno));
+free_layout:
+    if (layout)
+        glyph_layout_free(layout);
+    return NULL;
+}
+
+/* The layout of @text, created on first use. */
+static const struct text_layout* glyph_layout_get(struct m2d_glyph_cache* cache, const char* text)
+{
+    uint64_t hash = m2d_hash(text, strlen(text));
+    struct text_layout** bucket = &cache->layouts[hash % GLYPH_LAYOUT_BUCKETS];
+    struct text_layout* layout;
+
+    for (layout = *bucket; layout; layout = layout->next)
+    {
+        if (layout->hash == hash && !strcmp(layout->text, text))
+            return layout;
+    }
+
+    layout = glyph_layout_create(cache, text, hash);
+    if (!layout)
+        return NULL;
+
+    /* Laying out may have flushed the layouts, hence the bucket is read again. */
+    layout->next = *bucket;
+    *bucket = layout;
+
+    return layout;
+}
+
+struct m2d_glyph_cache* m2d_glyph_cache_create(dim_t ascent, dim_t line_height,
+                                               m2d_glyph_render_func render, void* data)
+{
+    struct m2d_glyph_cache* cache;
+
+    if (!render || line_height <= 0)
+    {
+        LIBM2D_ERROR("invalid glyph cache: line height %d\n", line_height);
+        return NULL;
+    }
+
+    cache = calloc(1, sizeof(*cache));
+    if (!cache)
+    {
+        LIBM2D_ERROR("could not allocate memory for glyph cache: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    cache->ascent = ascent;
+    cache->line_height = line_height;
+    cache->render = render;
+    cache->data = data;
+
+    cache->reclaimer.reclaim = glyph_reclaim;
+    cache->reclaimer.data = cache;
+    m2d_register_reclaimer(&cache->reclaimer);
+
+    return cache;
+}
+
+void m2d_glyph_cache_destroy(struct m2d_glyph_cache* cache)
+{
+    struct glyph* glyph;
+    size_t i;
+
+    if (!cache)
+        return;
+
+    m2d_unregister_reclaimer(&cache->reclaimer);
+    glyph_flush_layouts(cache);
+
+    for (i = 0; i < GLYPH_BUCKETS; i++)
+    {
+        while ((glyph = cache->glyphs[i]))
+        {
+            cache->glyphs[i] = glyph->next;
+            free(glyph->pixels);
+            free(glyph);
+        }
+    }
+
+    free(cache);
+}
+
+void m2d_glyph_cache_trim(struct m2d_glyph_cache* cache)
+{
+    glyph_flush_layouts(cache);
+}
+
+void m2d_measure_text(struct m2d_glyph_cache* cache, const char* text,
+                      dim_t* width, dim_t* height)
+{
+    const struct glyph* glyph;
+    dim_t lines = 1;
+    dim_t pen = 0;
+
+    *width = 0;
+
+    while (*text)
+    {
+        if (*text == '\n')
+        {
+            text++;
+            lines++;
+            pen = 0;
+            continue;
+        }
+
+        glyph = glyph_get(cache, glyph_next_codepoint(&text));
+        if (glyph)
+            pen += glyph->advance;
+        *width = max_int(*width, pen);
+    }
+
+    *height = lines * cache->line_height;
+}
+
+void m2d_draw_text(struct m2d_glyph_cache* cache, const struct m2d_text_run* runs,
+                   size_t num_runs)
+{
+    const struct text_layout* layout;
+    struct m2d_rectangle rects[16];
+    struct m2d_rectangle* lines;
+    size_t i, j;
+
+    if (!m2d_get_target())
+        return;
+
+    cache->busy = true;
+    m2d_push_state();
+    m2d_source_enable(M2D_SRC, true);
+    m2d_source_enable(M2D_DST, false);
+    m2d_blend_enable(true);
+    m2d_blend_functions(M2D_FUNC_ADD, M2D_FUNC_ADD);
+    m2d_blend_factors(M2D_BLEND_ONE, M2D_BLEND_ONE_MINUS_SRC_ALPHA,
+                      M2D_BLEND_ONE, M2D_BLEND_ONE_MINUS_SRC_ALPHA);
+
+    for (i = 0; i < num_runs; i++)
+    {
+        const struct m2d_text_run* run = &runs[i];
+
+        if (!run->text || !run->alpha)
+            continue;
+
+        /* Laying the run out may release the page of the previous one. */
+        m2d_set_source(M2D_SRC, NULL, 0, 0);
+        layout = glyph_layout_get(cache, run->text);
+        if (!layout || !layout->num_lines)
+            continue;
+
+        /* The line boxes of the run share a single source origin. */
+        lines = layout->num_lines <= ARRAY_SIZE(rects) ? rects :
+                malloc(layout->num_lines * sizeof(*lines));
+        if (!lines)
+        {
+            LIBM2D_ERROR("could not allocate memory for text: %s\n", strerror(errno));
+            continue;
+        }
+
+        for (j = 0; j < layout->num_lines; j++)
+        {
+            lines[j] = layout->lines[j];
+            lines[j].x += run->x;
+            lines[j].y += run->y;
+        }
+
+        /* Blended as premultiplied colors. */
+        m2d_source_color(run->red * run->alpha / 255, run->green * run->alpha / 255,
+                         run->blue * run->alpha / 255, run->alpha);
+        m2d_set_source(M2D_SRC, layout->image.page,
+                       run->x + layout->bounds.x - layout->image.rect.x,
+                       run->y + layout->bounds.y - layout->image.rect.y);
+        m2d_draw_rectangles(lines, layout->num_lines);
+
+        if (lines != rects)
+            free(lines);
+    }
+
+    m2d_pop_state();
+    cache->busy = false;
+}
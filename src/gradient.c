@@ -0,0 +1,570 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/m2d.h"
+#include "m2d_priv.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define GRADIENT_TIMEOUT_SECS 1
+
+/* Gradient surfaces kept, in bytes. */
+#define GRADIENT_BUDGET (1024 * 1024)
+
+/* Colors of a gradient, from the first to the last stop. */
+#define GRADIENT_LUT_SIZE 256
+
+/* Rows (or columns) of the slabs expanded to fill axis aligned gradients. */
+#define GRADIENT_SLAB_SIZE 32
+
+/* Rows of the gradient surfaces rendered by each CPU thread at once. */
+#define GRADIENT_BAND_ROWS 32
+
+/*
+ * Gradient fills.
+ *
+ * The colors of the stops are interpolated into a table once; pixels look
+ * their color up from their position along the gradient.
+ *
+ * A horizontal or vertical linear gradient only changes along one axis: a
+ * slab of a few rows (or columns) is rendered by the CPU and cached, then
+ * expanded over the rectangle by the GPU. Copies double the filled area by
+ * copying it onto itself, so that a rectangle takes a few copies; blends
+ * blend the slab band after band.
+ *
+ * Other gradients are rendered by the CPU into a surface of the rectangle
+ * size, cached as well. Radial gradients compute 4 distances at once with
+ * SIMD.
+ *
+ * Gradient surfaces are keyed by the gradient relative to the rectangle, so
+ * that moving a filled rectangle with its gradient hits the cache.
+ */
+struct gradient_key
+{
+    enum m2d_gradient_type type;
+    dim_t x0;
+    dim_t y0;
+    dim_t x1;
+    dim_t y1;
+    dim_t radius;
+    dim_t width;
+    dim_t height;
+    size_t num_stops;
+    struct m2d_gradient_stop stops[M2D_GRADIENT_MAX_STOPS];
+};
+
+struct gradient_entry
+{
+    struct gradient_key key;
+    struct m2d_buffer* buf;
+
+    struct gradient_entry* prev;
+    struct gradient_entry* next;
+};
+
+static struct
+{
+    struct gradient_entry* first;
+    struct gradient_entry* last;
+
+    size_t bytes;
+    struct m2d_reclaimer reclaimer;
+    bool registered;
+} gradients;
+
+struct gradient_job
+{
+    const struct gradient_key* key;
+    uint32_t lut[GRADIENT_LUT_SIZE];
+    uint8_t* data;
+    size_t stride;
+};
+
+static inline uint32_t gradient_stop_color(const struct m2d_gradient_stop* stop)
+{
+    return (uint32_t)stop->alpha << 24 | (uint32_t)stop->red << 16 |
+           (uint32_t)stop->green << 8 | stop->blue;
+}
+
+/* (a * (256 - w) + b * w) / 256 for each channel. */
+static inline uint32_t gradient_lerp(uint32_t a, uint32_t b, uint32_t w)
+{
+    uint32_t rb = ((a & 0x00ff00ffu) * (256 - w) + (b & 0x00ff00ffu) * w) >> 8;
+    uint32_t ag = ((a >> 8) & 0x00ff00ffu) * (256 - w) + ((b >> 8) & 0x00ff00ffu) * w;
+
+    return (rb & 0x00ff00ffu) | (ag & 0xff00ff00u);
+}
+
+static void gradient_lut(const struct gradient_key* key, uint32_t* lut)
+{
+    const struct m2d_gradient_stop* stops = key->stops;
+    size_t k = 0;
+    size_t i;
+
+    for (i = 0; i < GRADIENT_LUT_SIZE; i++)
+    {
+        while (k < key->num_stops && stops[k].offset < i)
+            k++;
+
+        if (!k)
+            lut[i] = gradient_stop_color(&stops[0]);
+        else if (k == key->num_stops)
+            lut[i] = gradient_stop_color(&stops[k - 1]);
+        else
+            lut[i] = gradient_lerp(gradient_stop_color(&stops[k - 1]),
+                                   gradient_stop_color(&stops[k]),
+                                   (uint32_t)(i - stops[k - 1].offset) * 256 /
+                                   (uint32_t)(stops[k].offset - stops[k - 1].offset));
+    }
+}
+
+static void gradient_linear_row(const struct gradient_job* job, uint32_t* out, size_t y)
+{
+    const struct gradient_key* key = job->key;
+    int64_t dx = key->x1 - key->x0;
+    int64_t dy = key->y1 - key->y0;
+    int64_t length2 = dx * dx + dy * dy;
+    int64_t pos;
+    int64_t step;
+    int64_t index;
+    size_t x;
+
+    /* The position of the pixel centers, times 255, in 16.16 fixed point. */
+    pos = (((1 - 2 * (int64_t)key->x0) * dx + (2 * (int64_t)y + 1 - 2 * (int64_t)key->y0) * dy) *
+           255 * 65536) / (2 * length2);
+    step = dx * 255 * 65536 / length2;
+
+    for (x = 0; x < (size_t)key->width; x++, pos += step)
+    {
+        index = pos >> 16;
+        if (index < 0)
+            index = 0;
+        else if (index >= GRADIENT_LUT_SIZE)
+            index = GRADIENT_LUT_SIZE - 1;
+
+        out[x] = job->lut[index];
+    }
+}
+
+static void gradient_radial_row(const struct gradient_job* job, uint32_t* out, size_t y)
+{
+    const struct gradient_key* key = job->key;
+    size_t width = (size_t)key->width;
+    size_t x = 0;
+
+#if defined(__ARM_NEON) || defined(__SSE2__)
+    float scale = (float)(GRADIENT_LUT_SIZE - 1) / (float)key->radius;
+    float fy = (float)y + 0.5f - (float)key->y0;
+    float fx = 0.5f - (float)key->x0;
+    uint32_t index[4];
+    size_t i;
+#if defined(__ARM_NEON)
+    float32x4_t vx = { fx, fx + 1, fx + 2, fx + 3 };
+    float32x4_t vy2 = vdupq_n_f32(fy * fy);
+    float32x4_t vscale = vdupq_n_f32(scale);
+    float32x4_t vmax = vdupq_n_f32(GRADIENT_LUT_SIZE - 1);
+    float32x4_t vmin = vdupq_n_f32(1e-6f);
+    float32x4_t four = vdupq_n_f32(4);
+
+    for (; x + 4 <= width; x += 4)
+    {
+        float32x4_t d2 = vmaxq_f32(vmlaq_f32(vy2, vx, vx), vmin);
+        float32x4_t r = vrsqrteq_f32(d2);
+
+        /* Two Newton steps: sqrt(d2) = d2 / sqrt(d2). */
+        r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(d2, r), r));
+        r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(d2, r), r));
+        vst1q_u32(index, vcvtq_u32_f32(vminq_f32(vmulq_f32(vmulq_f32(d2, r), vscale), vmax)));
+
+        for (i = 0; i < 4; i++)
+            out[x + i] = job->lut[index[i]];
+
+        vx = vaddq_f32(vx, four);
+    }
+#else
+    __m128 vx = _mm_setr_ps(fx, fx + 1, fx + 2, fx + 3);
+    __m128 vy2 = _mm_set1_ps(fy * fy);
+    __m128 vscale = _mm_set1_ps(scale);
+    __m128 vmax = _mm_set1_ps(GRADIENT_LUT_SIZE - 1);
+    __m128 four = _mm_set1_ps(4);
+
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128 d = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(vx, vx), vy2));
+
+        _mm_storeu_si128((__m128i*)index,
+                         _mm_cvttps_epi32(_mm_min_ps(_mm_mul_ps(d, vscale), vmax)));
+
+        for (i = 0; i < 4; i++)
+            out[x + i] = job->lut[index[i]];
+
+        vx = _mm_add_ps(vx, four);
+    }
+#endif
+    /* The last pixels, by the same vector code. */
+    if (x < width)
+    {
+        uint32_t tail[4];
+        struct gradient_key last = *key;
+        struct gradient_job tail_job;
+
+        last.x0 = key->x0 - (dim_t)x;
+        last.width = 4;
+        tail_job = *job;
+        tail_job.key = &last;
+        gradient_radial_row(&tail_job, tail, y);
+        memcpy(out + x, tail, (width - x) * sizeof(*tail));
+    }
+#else
+    /* In half pixels, to get the pixel centers. */
+    int64_t dy = 2 * (int64_t)y + 1 - 2 * (int64_t)key->y0;
+    uint64_t scale = (uint64_t)(GRADIENT_LUT_SIZE - 1) * (GRADIENT_LUT_SIZE - 1);
+    uint64_t radius2 = 4 * (uint64_t)key->radius * (uint64_t)key->radius;
+
+    for (; x < width; x++)
+    {
+        int64_t dx = 2 * (int64_t)x + 1 - 2 * (int64_t)key->x0;
+        uint32_t index = m2d_isqrt((uint64_t)(dx * dx + dy * dy) * scale / radius2);
+
+        out[x] = job->lut[index < GRADIENT_LUT_SIZE ? index : GRADIENT_LUT_SIZE - 1];
+    }
+#endif
+}
+
+static void gradient_band(size_t band, void* data)
+{
+    const struct gradient_job* job = data;
+    size_t height = (size_t)job->key->height;
+    size_t first = band * GRADIENT_BAND_ROWS;
+    size_t last = first + GRADIENT_BAND_ROWS < height ? first + GRADIENT_BAND_ROWS : height;
+    size_t y;
+
+    for (y = first; y < last; y++)
+    {
+        uint32_t* out = (uint32_t*)(job->data + y * job->stride);
+
+        if (job->key->type == M2D_GRADIENT_RADIAL)
+            gradient_radial_row(job, out, y);
+        else
+            gradient_linear_row(job, out, y);
+    }
+}
+
+static struct m2d_buffer* gradient_create(const struct gradient_key* key)
+{
+    size_t width = (size_t)key->width;
+    size_t height = (size_t)key->height;
+    struct gradient_job* job;
+    struct timespec timeout;
+    struct m2d_buffer* buf;
+
+    job = malloc(sizeof(*job));
+    if (!job)
+    {
+        LIBM2D_ERROR("could not allocate memory for a gradient: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    buf = m2d_alloc(width, height, M2D_PF_ARGB8888, width * sizeof(uint32_t));
+    if (!buf)
+        goto free_job;
+
+    clock_gettime(CLOCK_MONOTONIC, &timeout);
+    timeout.tv_sec += GRADIENT_TIMEOUT_SECS;
+    if (m2d_sync_for_cpu(buf, &timeout))
+        goto free_buf;
+
+    job->data = m2d_get_data(buf);
+    if (!job->data)
+    {
+        LIBM2D_ERROR("buffer %u can't be accessed by the CPU\n", buf->id);
+        m2d_sync_for_gpu(buf);
+        goto free_buf;
+    }
+
+    job->key = key;
+    job->stride = buf->stride;
+    gradient_lut(key, job->lut);
+    m2d_pool_run((height + GRADIENT_BAND_ROWS - 1) / GRADIENT_BAND_ROWS, gradient_band, job);
+
+    m2d_sync_for_gpu(buf);
+    m2d_set_tag(buf, "gradient");
+    free(job);
+
+    LIBM2D_DEBUG("rendered a %zux%zu gradient\n", width, height);
+
+    return buf;
+
+free_buf:
+    m2d_free(buf);
+free_job:
+    free(job);
+    return NULL;
+}
+
+static void gradient_unlink(struct gradient_entry* entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        gradients.first = entry->next;
+
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        gradients.last = entry->prev;
+}
+
+static void gradient_link_first(struct gradient_entry* entry)
+{
+    entry->prev = NULL;
+    entry->next = gradients.first;
+    if (gradients.first)
+        gradients.first->prev = entry;
+    else
+        gradients.last = entry;
+    gradients.first = entry;
+}
+
+static size_t gradient_evict_bytes(size_t bytes, const struct gradient_entry* keep)
+{
+    struct gradient_entry* entry;
+    struct gradient_entry* prev;
+    size_t released = 0;
+    size_t size;
+
+    for (entry = gradients.last; entry && released < bytes; entry = prev)
+    {
+        prev = entry->prev;
+        if (entry == keep || m2d_buffer_is_bound(entry->buf))
+            continue;
+
+        size = m2d_buffer_size(entry->buf);
+        gradient_unlink(entry);
+        gradients.bytes -= size;
+        released += size;
+
+        m2d_free(entry->buf);
+        free(entry);
+    }
+
+    return released;
+}
+
+static size_t gradient_reclaim(size_t bytes, void* data)
+{
+    (void)data;
+
+    return gradient_evict_bytes(bytes, NULL);
+}
+
+static struct m2d_buffer* gradient_get(const struct gradient_key* key)
+{
+    struct gradient_entry* entry;
+    struct m2d_buffer* buf;
+
+    for (entry = gradients.first; entry; entry = entry->next)
+    {
+        if (!memcmp(&entry->key, key, sizeof(*key)))
+        {
+            gradient_unlink(entry);
+            gradient_link_first(entry);
+            return entry->buf;
+        }
+    }
+
+    buf = gradient_create(key);
+    if (!buf)
+        return NULL;
+
+    entry = calloc(1, sizeof(*entry));
+    if (!entry)
+    {
+        LIBM2D_ERROR("could not allocate memory to cache a gradient: %s\n", strerror(errno));
+        m2d_free(buf);
+        return NULL;
+    }
+
+    entry->key = *key;
+    entry->buf = buf;
+
+    if (!gradients.registered)
+    {
+        gradients.reclaimer.reclaim = gradient_reclaim;
+        m2d_register_reclaimer(&gradients.reclaimer);
+        gradients.registered = true;
+    }
+
+    gradient_link_first(entry);
+    gradients.bytes += m2d_buffer_size(buf);
+
+    /* The gradient being drawn stays, even above the budget. */
+    if (gradients.bytes > GRADIENT_BUDGET)
+        gradient_evict_bytes(gradients.bytes - GRADIENT_BUDGET, entry);
+
+    return buf;
+}
+
+/* The band of @rect from @offset, @length wide (@vertical) or high. */
+static void gradient_band_rect(struct m2d_rectangle* band, const struct m2d_rectangle* rect,
+                               bool vertical, dim_t offset, dim_t length)
+{
+    *band = *rect;
+    if (vertical)
+    {
+        band->x += offset;
+        band->w = length;
+    }
+    else
+    {
+        band->y += offset;
+        band->h = length;
+    }
+}
+
+/*
+ * Fill @rect from the @slab of an axis aligned gradient, @vertical if the
+ * colors change from top to bottom: the slab is then a few columns wide.
+ */
+static void gradient_expand(struct m2d_buffer* slab, const struct m2d_rectangle* rect,
+                            bool vertical)
+{
+    dim_t size = vertical ? rect->w : rect->h;
+    dim_t slab_size = (dim_t)(vertical ? slab->width : slab->height);
+    struct m2d_rectangle band;
+    dim_t done = 0;
+    dim_t n;
+
+    /* Blends read the target: each band is blended from the slab. */
+    if (m2d_blend_is_enabled())
+    {
+        for (; done < size; done += n)
+        {
+            n = min_int(slab_size, size - done);
+            gradient_band_rect(&band, rect, vertical, done, n);
+            m2d_set_source(M2D_SRC, slab, band.x, band.y);
+            m2d_draw_rectangles(&band, 1);
+        }
+        return;
+    }
+
+    /* Copies double the area filled, copying it onto itself. */
+    n = min_int(slab_size, size);
+    gradient_band_rect(&band, rect, vertical, 0, n);
+    m2d_set_source(M2D_SRC, slab, rect->x, rect->y);
+    m2d_draw_rectangles(&band, 1);
+    m2d_expand_target(rect, band.w, band.h);
+}
+
+void m2d_fill_gradient(const struct m2d_rectangle* rect, const struct m2d_gradient* gradient)
+{
+    struct gradient_key key;
+    struct m2d_buffer* buf;
+    bool horizontal;
+    bool vertical;
+    size_t i;
+
+    if (rect->w <= 0 || rect->h <= 0)
+        return;
+
+    if (!gradient->num_stops || gradient->num_stops > M2D_GRADIENT_MAX_STOPS)
+    {
+        LIBM2D_ERROR("gradients have 1 to %d stops\n", M2D_GRADIENT_MAX_STOPS);
+        return;
+    }
+
+    for (i = 1; i < gradient->num_stops; i++)
+    {
+        if (gradient->stops[i].offset < gradient->stops[i - 1].offset)
+        {
+            LIBM2D_ERROR("gradient stops out of order\n");
+            return;
+        }
+    }
+
+    if (!m2d_get_target())
+    {
+        LIBM2D_ERROR("no target surface\n");
+        return;
+    }
+
+    memset(&key, 0, sizeof(key));
+    key.type = gradient->type;
+    key.x0 = gradient->x0 - rect->x;
+    key.y0 = gradient->y0 - rect->y;
+    key.x1 = gradient->x1 - rect->x;
+    key.y1 = gradient->y1 - rect->y;
+    key.radius = gradient->radius;
+    key.width = rect->w;
+    key.height = rect->h;
+    key.num_stops = gradient->num_stops;
+    memcpy(key.stops, gradient->stops, gradient->num_stops * sizeof(*gradient->stops));
+
+    horizontal = key.type == M2D_GRADIENT_LINEAR && key.y0 == key.y1 && key.x0 != key.x1;
+    vertical = key.type == M2D_GRADIENT_LINEAR && key.x0 == key.x1 && key.y0 != key.y1;
+
+    if (key.type == M2D_GRADIENT_RADIAL ? key.radius <= 0 : key.x0 == key.x1 && key.y0 == key.y1)
+    {
+        /* Degenerate: the last stop everywhere. */
+        key.type = M2D_GRADIENT_LINEAR;
+        key.x0 = 0;
+        key.x1 = 0;
+        key.y0 = -1;
+        key.y1 = 0;
+        vertical = true;
+    }
+
+    if (horizontal)
+    {
+        key.y0 = 0;
+        key.y1 = 0;
+        key.height = min_int(key.height, GRADIENT_SLAB_SIZE);
+    }
+    else if (vertical)
+    {
+        key.x0 = 0;
+        key.x1 = 0;
+        key.width = min_int(key.width, GRADIENT_SLAB_SIZE);
+    }
+
+    buf = gradient_get(&key);
+    if (!buf)
+        return;
+
+    m2d_push_state();
+    m2d_source_enable(M2D_SRC, true);
+
+    if (horizontal || vertical)
+    {
+        gradient_expand(buf, rect, vertical);
+    }
+    else
+    {
+        m2d_set_source(M2D_SRC, buf, rect->x, rect->y);
+        m2d_draw_rectangles(rect, 1);
+    }
+
+    m2d_pop_state();
+}
+
+void m2d_gradient_cleanup(void)
+{
+    gradient_evict_bytes(SIZE_MAX, NULL);
+
+    if (gradients.registered)
+    {
+        m2d_unregister_reclaimer(&gradients.reclaimer);
+        gradients.registered = false;
+    }
+}
@@ -0,0 +1,580 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/image.h"
+#include "m2d_priv.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_PNG
+#include <png.h>
+#endif
+
+#ifdef HAVE_JPEG
+#include <setjmp.h>
+#include <jpeglib.h>
+#endif
+
+/* Encoded image: either a stream or a memory region. */
+struct image_input
+{
+    FILE* file;
+    const uint8_t* data;
+    size_t size;
+    size_t offset;
+};
+
+/*
+ * Decoded image: decoders call begin() once the image size is known, write
+ * row y at @data + y * @stride, then call end().
+ */
+struct image_output
+{
+    const struct m2d_image_options* options;
+
+    int (*begin)(struct image_output* output, size_t width, size_t height);
+    void (*end)(struct image_output* output, bool success);
+
+    uint8_t* data;
+    size_t stride;
+    struct m2d_buffer* buf;
+    struct m2d_image* image;
+};
+
+static const struct m2d_image_options default_options = {
+    .format = M2D_PF_ARGB8888,
+};
+
+static int buffer_begin(struct image_output* output, size_t width, size_t height)
+{
+    enum m2d_pixel_format format = output->options->format;
+    size_t stride = (width * m2d_byte_per_pixel(format) + 3) & ~(size_t)3;
+    struct timespec timeout;
+
+    output->buf = m2d_alloc(width, height, format, stride);
+    if (!output->buf)
+        return -1;
+
+    m2d_set_tag(output->buf, "image");
+
+    clock_gettime(CLOCK_MONOTONIC, &timeout);
+    timeout.tv_sec += 1;
+    if (m2d_sync_for_cpu(output->buf, &timeout))
+        goto free_buffer;
+
+    output->data = m2d_get_data(output->buf);
+    if (!output->data)
+        goto free_buffer;
+
+    output->stride = m2d_get_stride(output->buf);
+
+    return 0;
+
+free_buffer:
+    m2d_free(output->buf);
+    output->buf = NULL;
+
+    return -1;
+}
+
+static void buffer_end(struct image_output* output, bool success)
+{
+    if (success)
+    {
+        m2d_sync_for_gpu(output->buf);
+        return;
+    }
+
+    m2d_free(output->buf);
+    output->buf = NULL;
+}
+
+static int memory_begin(struct image_output* output, size_t width, size_t height)
+{
+    struct m2d_image* image = output->image;
+
+    image->format = output->options->format;
+    image->width = width;
+    image->height = height;
+    image->stride = (width * m2d_byte_per_pixel(image->format) + 3) & ~(size_t)3;
+    if (height && image->stride > SIZE_MAX / height)
+        return -1;
+
+    image->data = malloc(height * image->stride);
+    if (!image->data)
+    {
+        LIBM2D_ERROR("failed to allocate image: %s\n", strerror(errno));
+        return -1;
+    }
+
+    output->data = image->data;
+    output->stride = image->stride;
+
+    return 0;
+}
+
+static void memory_end(struct image_output* output, bool success)
+{
+    if (!success)
+        m2d_image_release(output->image);
+}
+
+#ifdef HAVE_PNG
+static void image_png_error(png_structp png, png_const_charp msg)
+{
+    LIBM2D_ERROR("PNG: %s\n", msg);
+    png_longjmp(png, 1);
+}
+
+static void image_png_warning(png_structp png, png_const_charp msg)
+{
+    (void)png;
+    LIBM2D_WARN("PNG: %s\n", msg);
+}
+
+static void image_png_read(png_structp png, png_bytep data, size_t length)
+{
+    struct image_input* input = png_get_io_ptr(png);
+
+    if (length > input->size - input->offset)
+        png_error(png, "unexpected end of data");
+
+    memcpy(data, input->data + input->offset, length);
+    input->offset += length;
+}
+
+static int decode_png(struct image_input* input, struct image_output* output)
+{
+    png_structp png;
+    png_infop info;
+    png_uint_32 width;
+    png_uint_32 height;
+    png_uint_32 y;
+    int depth;
+    int color_type;
+    int passes;
+    int pass;
+    size_t row_size;
+    volatile size_t channels = 4;
+    uint8_t* volatile rows = NULL;
+    volatile bool started = false;
+    volatile int ret = -1;
+    m2d_row_func convert;
+
+    if (!m2d_rgba_row_func(output->options->format))
+    {
+        LIBM2D_ERROR("unsupported pixel format: %s\n",
+                     m2d_format_name(output->options->format));
+        return -1;
+    }
+
+    png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL,
+                                 image_png_error, image_png_warning);
+    if (!png)
+        return -1;
+
+    info = png_create_info_struct(png);
+    if (!info)
+        goto destroy;
+
+    if (setjmp(png_jmpbuf(png)))
+        goto destroy;
+
+    if (input->file)
+        png_init_io(png, input->file);
+    else
+        png_set_read_fn(png, input, image_png_read);
+
+    png_read_info(png, info);
+    png_get_IHDR(png, info, &width, &height, &depth, &color_type,
+                 NULL, NULL, NULL);
+
+    /*
+     * Whatever the image, get rows of 8-bit R, G, B, A components, or R, G, B
+     * components for opaque images, which A8 surfaces get the luminance of.
+     */
+    if (color_type == PNG_COLOR_TYPE_PALETTE)
+        png_set_palette_to_rgb(png);
+    if (color_type == PNG_COLOR_TYPE_GRAY && depth < 8)
+        png_set_expand_gray_1_2_4_to_8(png);
+    if (png_get_valid(png, info, PNG_INFO_tRNS))
+        png_set_tRNS_to_alpha(png);
+    else if (!(color_type & PNG_COLOR_MASK_ALPHA))
+        channels = 3;
+    if (depth == 16)
+        png_set_strip_16(png);
+    if (!(color_type & PNG_COLOR_MASK_COLOR))
+        png_set_gray_to_rgb(png);
+    passes = png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+    convert = channels == 4 ? m2d_rgba_row_func(output->options->format) :
+                              m2d_rgb_row_func(output->options->format);
+
+    if (output->begin(output, width, height))
+        goto destroy;
+    started = true;
+
+    /*
+     * Non-interlaced images go through a single row, converted as soon as it
+     * is decoded. Interlaced ones are only complete after the last pass.
+     */
+    row_size = (size_t)width * channels;
+    if (passes > 1 && height > SIZE_MAX / row_size)
+        goto destroy;
+
+    rows = malloc(passes > 1 ? row_size * height : row_size);
+    if (!rows)
+    {
+        LIBM2D_ERROR("failed to allocate PNG rows: %s\n", strerror(errno));
+        goto destroy;
+    }
+
+    if (passes > 1)
+    {
+        for (pass = 0; pass < passes; pass++)
+            for (y = 0; y < height; y++)
+                png_read_row(png, rows + y * row_size, NULL);
+
+        for (y = 0; y < height; y++)
+            convert(output->data + y * output->stride, rows + y * row_size, width);
+    }
+    else
+    {
+        for (y = 0; y < height; y++)
+        {
+            png_read_row(png, rows, NULL);
+            convert(output->data + y * output->stride, rows, width);
+        }
+    }
+
+    png_read_end(png, NULL);
+    ret = 0;
+
+destroy:
+    if (started)
+        output->end(output, !ret);
+    free(rows);
+    png_destroy_read_struct(&png, info ? &info : NULL, NULL);
+
+    return ret;
+}
+#endif
+
+#ifdef HAVE_JPEG
+/* The number of rows decoded at once: libjpeg outputs up to 4 rows per call. */
+#define JPEG_MAX_ROWS 4
+
+struct image_jpeg_error
+{
+    struct jpeg_error_mgr mgr;
+    jmp_buf jmp;
+};
+
+static void image_jpeg_error_exit(j_common_ptr cinfo)
+{
+    struct image_jpeg_error* err = (struct image_jpeg_error*)cinfo->err;
+    char msg[JMSG_LENGTH_MAX];
+
+    cinfo->err->format_message(cinfo, msg);
+    LIBM2D_ERROR("JPEG: %s\n", msg);
+    longjmp(err->jmp, 1);
+}
+
+static void image_jpeg_output_message(j_common_ptr cinfo)
+{
+    char msg[JMSG_LENGTH_MAX];
+
+    cinfo->err->format_message(cinfo, msg);
+    LIBM2D_WARN("JPEG: %s\n", msg);
+}
+
+/*
+ * libjpeg-turbo writes some of the libm2d formats itself: rows are then
+ * decoded straight into the output without any conversion. Other formats are
+ * converted from JCS_RGB.
+ */
+static J_COLOR_SPACE image_jpeg_color_space(enum m2d_pixel_format format)
+{
+    switch (format)
+    {
+#if defined(JCS_ALPHA_EXTENSIONS) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    case M2D_PF_ARGB8888:
+        return JCS_EXT_BGRA;
+#endif
+
+#ifdef LIBJPEG_TURBO_VERSION_NUMBER
+    case M2D_PF_RGB565:
+        return JCS_RGB565;
+#endif
+
+    case M2D_PF_A8:
+        return JCS_GRAYSCALE;
+
+    default:
+        break;
+    }
+
+    return JCS_RGB;
+}
+
+/*
+ * Let the IDCT do the downscaling: pick the smallest scale whose output is
+ * still at least as large as the requested size.
+ */
+static void image_jpeg_set_scale(struct jpeg_decompress_struct* cinfo,
+                                 const struct m2d_image_options* options)
+{
+    unsigned int denom;
+
+    if (!options->width && !options->height)
+        return;
+
+    cinfo->scale_num = 1;
+    for (denom = 8; denom > 1; denom /= 2)
+    {
+        cinfo->scale_denom = denom;
+        jpeg_calc_output_dimensions(cinfo);
+        if (cinfo->output_width >= options->width &&
+            cinfo->output_height >= options->height)
+        {
+            LIBM2D_DEBUG("decoding JPEG at 1/%u scale\n", denom);
+            return;
+        }
+    }
+
+    cinfo->scale_denom = 1;
+}
+
+static int decode_jpeg(struct image_input* input, struct image_output* output)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct image_jpeg_error err;
+    JSAMPROW samples[JPEG_MAX_ROWS];
+    J_COLOR_SPACE space;
+    m2d_row_func convert;
+    uint8_t* volatile rows = NULL;
+    volatile bool started = false;
+    volatile int ret = -1;
+    size_t row_size;
+    bool direct;
+
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = image_jpeg_error_exit;
+    err.mgr.output_message = image_jpeg_output_message;
+    jpeg_create_decompress(&cinfo);
+
+    if (setjmp(err.jmp))
+        goto destroy;
+
+    space = image_jpeg_color_space(output->options->format);
+    direct = space != JCS_RGB;
+    convert = m2d_rgb_row_func(output->options->format);
+    if (!direct && !convert)
+    {
+        LIBM2D_ERROR("unsupported pixel format: %s\n",
+                     m2d_format_name(output->options->format));
+        goto destroy;
+    }
+
+    if (input->file)
+        jpeg_stdio_src(&cinfo, input->file);
+    else
+        jpeg_mem_src(&cinfo, (unsigned char*)input->data, input->size);
+
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = space;
+    image_jpeg_set_scale(&cinfo, output->options);
+    jpeg_start_decompress(&cinfo);
+
+    if (output->begin(output, cinfo.output_width, cinfo.output_height))
+        goto destroy;
+    started = true;
+
+    row_size = (size_t)cinfo.output_width * cinfo.output_components;
+    if (!direct)
+    {
+        rows = malloc(row_size * JPEG_MAX_ROWS);
+        if (!rows)
+        {
+            LIBM2D_ERROR("failed to allocate JPEG rows: %s\n", strerror(errno));
+            goto destroy;
+        }
+    }
+
+    while (cinfo.output_scanline < cinfo.output_height)
+    {
+        JDIMENSION first = cinfo.output_scanline;
+        JDIMENSION count;
+        JDIMENSION i;
+
+        count = cinfo.output_height - first;
+        if (count > JPEG_MAX_ROWS)
+            count = JPEG_MAX_ROWS;
+
+        for (i = 0; i < count; i++)
+            samples[i] = direct ? output->data + (first + i) * output->stride
+                                : rows + i * row_size;
+
+        count = jpeg_read_scanlines(&cinfo, samples, count);
+
+        if (!direct)
+            for (i = 0; i < count; i++)
+                convert(output->data + (first + i) * output->stride,
+                        samples[i], cinfo.output_width);
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    ret = 0;
+
+destroy:
+    if (started)
+        output->end(output, !ret);
+    free(rows);
+    jpeg_destroy_decompress(&cinfo);
+
+    return ret;
+}
+#endif
+
+static int decode(struct image_input* input, struct image_output* output)
+{
+    static const uint8_t png_signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    static const uint8_t jpeg_signature[] = { 0xff, 0xd8, 0xff };
+    uint8_t magic[8];
+    size_t size;
+
+    if (input->file)
+    {
+        size = fread(magic, 1, sizeof(magic), input->file);
+        if (fseek(input->file, 0, SEEK_SET))
+        {
+            LIBM2D_ERROR("failed to rewind image: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    else
+    {
+        size = input->size < sizeof(magic) ? input->size : sizeof(magic);
+        memcpy(magic, input->data, size);
+    }
+
+    if (size >= sizeof(png_signature) &&
+        !memcmp(magic, png_signature, sizeof(png_signature)))
+    {
+#ifdef HAVE_PNG
+        return decode_png(input, output);
+#else
+        LIBM2D_ERROR("libm2d built without PNG support\n");
+        return -1;
+#endif
+    }
+
+    if (size >= sizeof(jpeg_signature) &&
+        !memcmp(magic, jpeg_signature, sizeof(jpeg_signature)))
+    {
+#ifdef HAVE_JPEG
+        return decode_jpeg(input, output);
+#else
+        LIBM2D_ERROR("libm2d built without JPEG support\n");
+        return -1;
+#endif
+    }
+
+    LIBM2D_ERROR("unknown image format\n");
+
+    return -1;
+}
+
+static struct m2d_buffer* load_image(struct image_input* input,
+                                     const struct m2d_image_options* options)
+{
+    struct image_output output = {
+        .options = options ? options : &default_options,
+        .begin = buffer_begin,
+        .end = buffer_end,
+    };
+
+    if (decode(input, &output))
+        return NULL;
+
+    LIBM2D_DEBUG("loaded image in buffer %u (size: [%zux%zu], format: %s)\n",
+                 output.buf->id, output.buf->width, output.buf->height,
+                 m2d_format_name(output.buf->format));
+
+    return output.buf;
+}
+
+struct m2d_buffer* m2d_load_image(const char* filename,
+                                  const struct m2d_image_options* options)
+{
+    struct image_input input = { 0 };
+    struct m2d_buffer* buf;
+
+    input.file = fopen(filename, "rb");
+    if (!input.file)
+    {
+        LIBM2D_ERROR("failed to open %s: %s\n", filename, strerror(errno));
+        return NULL;
+    }
+
+    buf = load_image(&input, options);
+    if (!buf)
+        LIBM2D_ERROR("failed to load %s\n", filename);
+
+    fclose(input.file);
+
+    return buf;
+}
+
+struct m2d_buffer* m2d_load_image_from_memory(const void* data, size_t size,
+                                              const struct m2d_image_options* options)
+{
+    struct image_input input = {
+        .data = data,
+        .size = size,
+    };
+
+    return load_image(&input, options);
+}
+
+int m2d_decode_image(const char* filename, const struct m2d_image_options* options,
+                     struct m2d_image* image)
+{
+    struct image_output output = {
+        .options = options ? options : &default_options,
+        .begin = memory_begin,
+        .end = memory_end,
+        .image = image,
+    };
+    struct image_input input = { 0 };
+    int ret;
+
+    memset(image, 0, sizeof(*image));
+
+    input.file = fopen(filename, "rb");
+    if (!input.file)
+    {
+        LIBM2D_ERROR("failed to open %s: %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    ret = decode(&input, &output);
+    if (ret)
+        LIBM2D_ERROR("failed to decode %s\n", filename);
+
+    fclose(input.file);
+
+    return ret;
+}
+
+void m2d_image_release(struct m2d_image* image)
+{
+    free(image->data);
+    image->data = NULL;
+}
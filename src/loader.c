@@ -0,0 +1,612 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/loader.h"
+#include "m2d_priv.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* The nice value of the worker threads, relative to the rendering thread. */
+#define LOADER_NICE 5
+
+/*
+ * A load is referenced by the application, until m2d_load_release(), and by
+ * the loader while it is queued, loaded or waiting for m2d_loader_dispatch().
+ * Draw sources set by m2d_set_source_load() hold a reference as well.
+ */
+struct m2d_load
+{
+    char* filename;
+    struct m2d_image_options options;
+    int priority;
+    m2d_load_callback callback;
+    void* data;
+
+    enum m2d_load_state state;
+    struct m2d_buffer* buf;
+    bool canceled;
+    bool released;
+    unsigned int refs;
+
+    struct m2d_load* next; /* in the queue or the completed list */
+};
+
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+
+    struct m2d_load* queue; /* by decreasing priority */
+    struct m2d_load* completed;
+    struct m2d_load** completed_tail;
+
+    pthread_t* threads;
+    size_t num_threads;
+    bool stop;
+    int event_fd;
+} loader = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .completed_tail = &loader.completed,
+    .event_fd = -1,
+};
+
+/* Loads set as draw sources, only touched by the rendering thread. */
+static struct
+{
+    struct m2d_load* load;
+    dim_t x;
+    dim_t y;
+    enum m2d_load_policy policy;
+} bindings[M2D_MAX_SOURCES];
+static size_t num_bindings;
+static unsigned int suspended;
+
+static void loader_free(struct m2d_load* load)
+{
+    m2d_free(load->buf);
+    free(load->filename);
+    free(load);
+}
+
+/* Drop a reference, with the lock held: the load is freed by the caller. */
+static bool loader_put_locked(struct m2d_load* load)
+{
+    return !--load->refs;
+}
+
+static void loader_put(struct m2d_load* load)
+{
+    bool last;
+
+    pthread_mutex_lock(&loader.lock);
+    last = loader_put_locked(load);
+    pthread_mutex_unlock(&loader.lock);
+
+    if (last)
+        loader_free(load);
+}
+
+static void loader_enqueue(struct m2d_load* load)
+{
+    struct m2d_load** link = &loader.queue;
+
+    while (*link && (*link)->priority >= load->priority)
+        link = &(*link)->next;
+
+    load->next = *link;
+    *link = load;
+}
+
+static bool loader_dequeue(struct m2d_load* load)
+{
+    struct m2d_load** link;
+
+    for (link = &loader.queue; *link; link = &(*link)->next)
+    {
+        if (*link == load)
+        {
+            *link = load->next;
+            load->next = NULL;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Publish the result of a load, with the lock held. The loader reference
+ * moves to the completed list when there is a callback to call.
+ * Return the surface to release if the load has been canceled meanwhile.
+ */
+static struct m2d_buffer* loader_complete_locked(struct m2d_load* load,
+                                                 struct m2d_buffer* buf,
+                                                 bool* last)
+{
+    static const uint64_t one = 1;
+
+    *last = false;
+
+    if (load->canceled)
+    {
+        load->state = M2D_LOAD_CANCELED;
+        pthread_cond_broadcast(&loader.done);
+        *last = loader_put_locked(load);
+        return buf;
+    }
+
+    load->buf = buf;
+    load->state = buf ? M2D_LOAD_READY : M2D_LOAD_FAILED;
+    pthread_cond_broadcast(&loader.done);
+
+    if (!load->callback)
+    {
+        *last = loader_put_locked(load);
+        return NULL;
+    }
+
+    *loader.completed_tail = load;
+    loader.completed_tail = &load->next;
+    if (loader.event_fd >= 0 && write(loader.event_fd, &one, sizeof(one)) < 0)
+        LIBM2D_WARN("failed to signal the loader event: %s\n", strerror(errno));
+
+    return NULL;
+}
+
+static void loader_run(struct m2d_load* load)
+{
+    struct m2d_buffer* buf;
+    struct m2d_buffer* canceled;
+    bool last;
+
+    buf = m2d_load_image(load->filename, &load->options);
+
+    /* The CPU is done with it. */
+    if (buf)
+        m2d_unmap(buf);
+
+    pthread_mutex_lock(&loader.lock);
+    canceled = loader_complete_locked(load, buf, &last);
+    pthread_mutex_unlock(&loader.lock);
+
+    m2d_free(canceled);
+    if (last)
+        loader_free(load);
+}
+
+static void* loader_thread(void* arg)
+{
+    (void)arg;
+
+    /* Decoding must not steal the CPU from the rendering thread. */
+    if (setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), LOADER_NICE))
+        LIBM2D_DEBUG("failed to lower the loader thread priority: %s\n", strerror(errno));
+
+    pthread_mutex_lock(&loader.lock);
+    while (true)
+    {
+        struct m2d_load* load;
+
+        while (!loader.queue && !loader.stop)
+            pthread_cond_wait(&loader.work, &loader.lock);
+
+        if (loader.stop)
+            break;
+
+        load = loader.queue;
+        loader.queue = load->next;
+        load->next = NULL;
+        load->state = M2D_LOAD_LOADING;
+        pthread_mutex_unlock(&loader.lock);
+
+        loader_run(load);
+
+        pthread_mutex_lock(&loader.lock);
+    }
+    pthread_mutex_unlock(&loader.lock);
+
+    return NULL;
+}
+
+int m2d_loader_init(size_t num_threads)
+{
+    pthread_condattr_t attr;
+    size_t i;
+
+    if (loader.threads)
+        return 0;
+
+    if (!num_threads)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        num_threads = cpus > 0 ? (size_t)cpus : 1;
+    }
+
+    loader.threads = calloc(num_threads, sizeof(*loader.threads));
+    if (!loader.threads)
+    {
+        LIBM2D_ERROR("failed to allocate loader threads: %s\n", strerror(errno));
+        return -1;
+    }
+
+    /* m2d_load_wait() timeouts are CLOCK_MONOTONIC times. */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&loader.done, &attr);
+    pthread_condattr_destroy(&attr);
+
+    loader.event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (loader.event_fd < 0)
+        LIBM2D_WARN("failed to create the loader event: %s\n", strerror(errno));
+
+    loader.stop = false;
+    for (i = 0; i < num_threads; i++)
+    {
+        int ret = pthread_create(&loader.threads[i], NULL, loader_thread, NULL);
+
+        if (ret)
+        {
+            LIBM2D_ERROR("failed to create loader thread: %s\n", strerror(ret));
+            break;
+        }
+    }
+    loader.num_threads = i;
+
+    if (!loader.num_threads)
+    {
+        m2d_loader_cleanup();
+        return -1;
+    }
+
+    LIBM2D_DEBUG("started %zu loader thread(s)\n", loader.num_threads);
+
+    return 0;
+}
+
+void m2d_loader_cleanup(void)
+{
+    struct m2d_load* queue;
+    size_t i;
+
+    if (!loader.threads)
+        return;
+
+    for (i = 0; i < M2D_MAX_SOURCES; i++)
+        m2d_loader_unbind_source((enum m2d_source_id)i);
+
+    pthread_mutex_lock(&loader.lock);
+    loader.stop = true;
+    pthread_cond_broadcast(&loader.work);
+    pthread_mutex_unlock(&loader.lock);
+
+    for (i = 0; i < loader.num_threads; i++)
+        pthread_join(loader.threads[i], NULL);
+
+    /* Whatever was queued never gets loaded. */
+    pthread_mutex_lock(&loader.lock);
+    queue = loader.queue;
+    loader.queue = NULL;
+    pthread_mutex_unlock(&loader.lock);
+
+    while (queue)
+    {
+        struct m2d_load* load = queue;
+
+        queue = load->next;
+        load->next = NULL;
+
+        pthread_mutex_lock(&loader.lock);
+        load->state = M2D_LOAD_CANCELED;
+        pthread_cond_broadcast(&loader.done);
+        pthread_mutex_unlock(&loader.lock);
+
+        loader_put(load);
+    }
+
+    /* Drop the pending callbacks. */
+    while (m2d_loader_dispatch())
+        ;
+
+    if (loader.event_fd >= 0)
+        close(loader.event_fd);
+    loader.event_fd = -1;
+
+    pthread_cond_destroy(&loader.done);
+    free(loader.threads);
+    loader.threads = NULL;
+    loader.num_threads = 0;
+}
+
+struct m2d_load* m2d_load_async(const char* filename,
+                                const struct m2d_image_options* options,
+                                int priority, m2d_load_callback callback,
+                                void* data)
+{
+    struct m2d_load* load;
+
+    if (m2d_loader_init(0))
+        return NULL;
+
+    load = calloc(1, sizeof(*load));
+    if (!load)
+        goto error;
+
+    load->filename = strdup(filename);
+    if (!load->filename)
+    {
+        free(load);
+        goto error;
+    }
+
+    load->options.format = M2D_PF_ARGB8888;
+    if (options)
+        load->options = *options;
+    load->priority = priority;
+    load->callback = callback;
+    load->data = data;
+    load->state = M2D_LOAD_PENDING;
+    load->refs = 2;
+
+    pthread_mutex_lock(&loader.lock);
+    loader_enqueue(load);
+    pthread_cond_signal(&loader.work);
+    pthread_mutex_unlock(&loader.lock);
+
+    LIBM2D_DEBUG("queued %s (priority: %d)\n", filename, priority);
+
+    return load;
+
+error:
+    LIBM2D_ERROR("failed to allocate load: %s\n", strerror(errno));
+
+    return NULL;
+}
+
+enum m2d_load_state m2d_load_get_state(struct m2d_load* load)
+{
+    enum m2d_load_state state;
+
+    pthread_mutex_lock(&loader.lock);
+    state = load->state;
+    pthread_mutex_unlock(&loader.lock);
+
+    return state;
+}
+
+struct m2d_buffer* m2d_load_get_buffer(struct m2d_load* load)
+{
+    struct m2d_buffer* buf;
+
+    pthread_mutex_lock(&loader.lock);
+    buf = load->state == M2D_LOAD_READY ? load->buf : NULL;
+    pthread_mutex_unlock(&loader.lock);
+
+    return buf;
+}
+
+int m2d_load_wait(struct m2d_load* load, const struct timespec* timeout)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&loader.lock);
+
+    /* Don't wait behind the rest of the queue. */
+    if (load->state == M2D_LOAD_PENDING && loader_dequeue(load))
+    {
+        load->state = M2D_LOAD_LOADING;
+        pthread_mutex_unlock(&loader.lock);
+
+        loader_run(load);
+
+        pthread_mutex_lock(&loader.lock);
+    }
+
+    while (!ret && (load->state == M2D_LOAD_PENDING || load->state == M2D_LOAD_LOADING))
+    {
+        if (timeout)
+            ret = pthread_cond_timedwait(&loader.done, &loader.lock, timeout);
+        else
+            ret = pthread_cond_wait(&loader.done, &loader.lock);
+    }
+
+    if (ret == ETIMEDOUT)
+        LIBM2D_DEBUG("timeout while waiting for %s\n", load->filename);
+
+    ret = load->state == M2D_LOAD_READY ? 0 : -1;
+    pthread_mutex_unlock(&loader.lock);
+
+    return ret;
+}
+
+void m2d_load_set_priority(struct m2d_load* load, int priority)
+{
+    pthread_mutex_lock(&loader.lock);
+    load->priority = priority;
+    if (load->state == M2D_LOAD_PENDING && loader_dequeue(load))
+        loader_enqueue(load);
+    pthread_mutex_unlock(&loader.lock);
+}
+
+void m2d_load_cancel(struct m2d_load* load)
+{
+    bool last = false;
+
+    pthread_mutex_lock(&loader.lock);
+    switch (load->state)
+    {
+    case M2D_LOAD_PENDING:
+        if (loader_dequeue(load))
+        {
+            load->state = M2D_LOAD_CANCELED;
+            pthread_cond_broadcast(&loader.done);
+            last = loader_put_locked(load);
+        }
+        break;
+
+    case M2D_LOAD_LOADING:
+        load->canceled = true;
+        break;
+
+    default:
+        break;
+    }
+    pthread_mutex_unlock(&loader.lock);
+
+    if (last)
+        loader_free(load);
+}
+
+void m2d_load_release(struct m2d_load* load)
+{
+    if (!load)
+        return;
+
+    m2d_load_cancel(load);
+
+    pthread_mutex_lock(&loader.lock);
+    load->released = true;
+    pthread_mutex_unlock(&loader.lock);
+
+    loader_put(load);
+}
+
+size_t m2d_loader_dispatch()
+{
+    struct m2d_load* completed;
+    uint64_t count;
+    size_t num_loads = 0;
+
+    pthread_mutex_lock(&loader.lock);
+    completed = loader.completed;
+    loader.completed = NULL;
+    loader.completed_tail = &loader.completed;
+    if (loader.event_fd >= 0 && read(loader.event_fd, &count, sizeof(count)) < 0 &&
+        errno != EAGAIN)
+        LIBM2D_WARN("failed to clear the loader event: %s\n", strerror(errno));
+    pthread_mutex_unlock(&loader.lock);
+
+    while (completed)
+    {
+        struct m2d_load* load = completed;
+        bool released;
+
+        completed = load->next;
+        load->next = NULL;
+
+        pthread_mutex_lock(&loader.lock);
+        released = load->released;
+        pthread_mutex_unlock(&loader.lock);
+
+        if (!released && !loader.stop)
+            load->callback(load, load->data);
+
+        loader_put(load);
+        num_loads++;
+    }
+
+    return num_loads;
+}
+
+int m2d_loader_get_fd()
+{
+    return loader.event_fd;
+}
+
+void m2d_set_source_load(enum m2d_source_id id, struct m2d_load* load,
+                         dim_t x, dim_t y, enum m2d_load_policy policy)
+{
+    struct m2d_buffer* buf;
+
+    if (id >= M2D_MAX_SOURCES)
+        return;
+
+    buf = m2d_load_get_buffer(load);
+    m2d_set_source(id, buf, x, y);
+    if (buf)
+        return;
+
+    pthread_mutex_lock(&loader.lock);
+    load->refs++;
+    pthread_mutex_unlock(&loader.lock);
+
+    bindings[id].load = load;
+    bindings[id].x = x;
+    bindings[id].y = y;
+    bindings[id].policy = policy;
+    num_bindings++;
+}
+
+void m2d_loader_unbind_source(enum m2d_source_id id)
+{
+    struct m2d_load* load = bindings[id].load;
+
+    if (!load || suspended)
+        return;
+
+    bindings[id].load = NULL;
+    num_bindings--;
+    loader_put(load);
+}
+
+bool m2d_loader_resolve_sources(void)
+{
+    bool ready = true;
+    size_t i;
+
+    if (!num_bindings || suspended)
+        return true;
+
+    for (i = 0; i < M2D_MAX_SOURCES; i++)
+    {
+        struct m2d_load* load = bindings[i].load;
+        struct m2d_buffer* buf;
+        bool released;
+
+        /* Disabled sources aren't read. */
+        if (!load || !m2d_source_is_enabled((enum m2d_source_id)i))
+            continue;
+
+        if (bindings[i].policy == M2D_LOAD_WAIT)
+            m2d_load_wait(load, NULL);
+
+        pthread_mutex_lock(&loader.lock);
+        buf = load->state == M2D_LOAD_READY ? load->buf : NULL;
+        released = load->released;
+        pthread_mutex_unlock(&loader.lock);
+
+        /* The surface goes with the load once released. */
+        if (!buf || released)
+        {
+            ready = false;
+            continue;
+        }
+
+        /* This also forgets the load, unless the surface can't be restored. */
+        if (m2d_set_source((enum m2d_source_id)i, buf, bindings[i].x, bindings[i].y))
+            ready = false;
+    }
+
+    return ready;
+}
+
+void m2d_loader_suspend(void)
+{
+    suspended++;
+}
+
+void m2d_loader_resume(void)
+{
+    suspended--;
+}
@@ -8,12 +8,16 @@
 #include "gitversion.h"
 
 #include <errno.h>
+#include <linux/dma-buf.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <xf86drm.h>
 
 static struct m2d_device* dev;
+static pthread_t render_thread;
 
 int m2d_init()
 {
@@ -23,6 +27,7 @@ int m2d_init()
     LIBM2D_INFO("Git Version %s\n", GIT_VERSION);
 
     dev = m2d_get_device();
+    render_thread = pthread_self();
 
     dev->next_id = 0;
     dev->fd = drmOpenWithType(dev->name, NULL, DRM_NODE_RENDER);
@@ -48,12 +53,15 @@ int m2d_init()
     }
 #endif
 
+    m2d_park_init();
+
     if (dev->funcs->init())
-        goto drm_close;
+        goto park_cleanup;
 
     return 0;
 
-drm_close:
+park_cleanup:
+    m2d_park_cleanup();
     drmClose(dev->fd);
     dev->fd = -1;
 
@@ -72,7 +80,19 @@ void m2d_cleanup()
         return;
     }
 
+    m2d_loader_cleanup();
+    m2d_cache_cleanup();
+    m2d_scale_cleanup();
+    m2d_gradient_cleanup();
+    m2d_color_key_cleanup();
+    m2d_shape_cleanup();
+
+    if (m2d_memory_num_buffers())
+        LIBM2D_WARN("%zu buffer(s) not freed\n", m2d_memory_num_buffers());
+
     dev->funcs->cleanup();
+    m2d_park_cleanup();
+    m2d_pool_cleanup();
 
     if (drmClose(dev->fd))
         LIBM2D_ERROR("can't close DRM render node %s: %s\n", dev->name, strerror(errno));
@@ -94,18 +114,28 @@ struct m2d_buffer* m2d_alloc(size_t width, size_t height,
     if (dev->fd < 0)
         return NULL;
 
+    m2d_memory_reserve(height * stride);
+
     buf = dev->funcs->create(width, height, format, &stride);
     if (!buf)
     {
-        LIBM2D_ERROR("failed to create new buffer\n");
-        return NULL;
+        m2d_memory_alloc_failed(height * stride);
+
+        buf = dev->funcs->create(width, height, format, &stride);
+        if (!buf)
+        {
+            LIBM2D_ERROR("failed to create new buffer\n");
+            return NULL;
+        }
     }
 
-    buf->id = dev->next_id++;
+    /* Loader threads allocate buffers too. */
+    buf->id = __atomic_fetch_add(&dev->next_id, 1, __ATOMIC_RELAXED);
     buf->width = width;
     buf->height = height;
     buf->format = format;
     buf->stride = stride;
+    m2d_memory_add(buf);
 
     LIBM2D_DEBUG("allocated buffer %u (size: [%zux%zu], format: %s)\n",
                  buf->id, width, height, m2d_format_name(format));
@@ -127,12 +157,14 @@ struct m2d_buffer* m2d_import(const struct m2d_import_desc* desc)
         return NULL;
     }
 
-    buf->id = dev->next_id++;
+    buf->id = __atomic_fetch_add(&dev->next_id, 1, __ATOMIC_RELAXED);
     buf->width = desc->width;
     buf->height = desc->height;
     buf->format = desc->format;
     buf->stride = desc->stride;
     buf->cpu_addr = desc->cpu_addr;
+    buf->imported = true;
+    m2d_memory_add(buf);
 
     LIBM2D_DEBUG("imported buffer %u from file descriptor %d (size: [%zux%zu], format: %s)\n",
                  buf->id, desc->fd, desc->width, desc->height, m2d_format_name(desc->format));
@@ -140,6 +172,91 @@ struct m2d_buffer* m2d_import(const struct m2d_import_desc* desc)
     return buf;
 }
 
+int m2d_export(struct m2d_buffer* buf, int* fd)
+{
+    if (dev->fd < 0)
+        return -1;
+
+    if (!buf || !fd)
+        return -1;
+
+    /* The GEM object is shared from now on: it must stay. */
+    m2d_use_buffer(buf);
+    if (buf->parked)
+        return -1;
+
+    m2d_flush();
+
+    if (dev->funcs->export(buf, fd))
+    {
+        LIBM2D_ERROR("failed to export buffer %u\n", buf->id);
+        return -1;
+    }
+
+    buf->exported = true;
+
+    LIBM2D_DEBUG("exported buffer %u as file descriptor %d\n", buf->id, *fd);
+
+    return 0;
+}
+
+void* m2d_dmabuf_map(int fd, size_t size, unsigned int access)
+{
+    int prot = 0;
+    void* addr;
+
+    if (access & M2D_ACCESS_READ)
+        prot |= PROT_READ;
+    if (access & M2D_ACCESS_WRITE)
+        prot |= PROT_WRITE;
+
+    addr = mmap(0, size, prot, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+        LIBM2D_ERROR("could not map file descriptor %d: %s\n", fd, strerror(errno));
+        return NULL;
+    }
+
+    return addr;
+}
+
+void m2d_dmabuf_unmap(void* addr, size_t size)
+{
+    if (addr && munmap(addr, size))
+        LIBM2D_ERROR("could not unmap %p: %s\n", addr, strerror(errno));
+}
+
+static int m2d_dmabuf_sync(int fd, unsigned int access, uint64_t flags)
+{
+    struct dma_buf_sync args;
+
+    memset(&args, 0, sizeof(args));
+    args.flags = flags;
+    if (access & M2D_ACCESS_READ)
+        args.flags |= DMA_BUF_SYNC_READ;
+    if (access & M2D_ACCESS_WRITE)
+        args.flags |= DMA_BUF_SYNC_WRITE;
+
+    /* drmIoctl() restarts the ioctl when interrupted. */
+    if (drmIoctl(fd, DMA_BUF_IOCTL_SYNC, &args) < 0)
+    {
+        LIBM2D_ERROR("failed to synchronize file descriptor %d: %s\n", fd, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int m2d_dmabuf_begin_cpu_access(int fd, unsigned int access)
+{
+    return m2d_dmabuf_sync(fd, access, DMA_BUF_SYNC_START);
+}
+
+int m2d_dmabuf_end_cpu_access(int fd, unsigned int access)
+{
+    return m2d_dmabuf_sync(fd, access, DMA_BUF_SYNC_END);
+}
+
 void m2d_free(struct m2d_buffer* buf)
 {
     uint32_t id;
@@ -147,21 +264,33 @@ void m2d_free(struct m2d_buffer* buf)
     if (!buf)
         return;
 
+    m2d_flush();
+
+    if (buf->cache_entry)
+    {
+        m2d_cache_put(buf);
+        return;
+    }
+
     id = buf->id;
+    m2d_memory_remove(buf);
+    m2d_park_free(buf);
     dev->funcs->free(buf);
 
     (void)id;
     LIBM2D_DEBUG("freed buffer %u\n", id);
 }
 
-int m2d_sync_for_cpu(struct m2d_buffer* buf, const struct timespec* timeout)
+int m2d_sync_for_cpu_read(struct m2d_buffer* buf, const struct timespec* timeout)
 {
     if (dev->fd < 0)
         return -1;
 
-    if (!buf)
+    if (!buf || buf->parked)
         return 0;
 
+    m2d_flush();
+
     if (dev->funcs->sync_for_cpu(buf, timeout))
         return -1;
 
@@ -170,12 +299,24 @@ int m2d_sync_for_cpu(struct m2d_buffer* buf, const struct timespec* timeout)
     return 0;
 }
 
+int m2d_sync_for_cpu(struct m2d_buffer* buf, const struct timespec* timeout)
+{
+    if (m2d_sync_for_cpu_read(buf, timeout))
+        return -1;
+
+    /* The CPU may write from now on. */
+    if (buf && !buf->parked)
+        buf->generation++;
+
+    return 0;
+}
+
 void m2d_sync_for_gpu(struct m2d_buffer* buf)
 {
     if (dev->fd < 0)
         return;
 
-    if (!buf)
+    if (!buf || buf->parked)
         return;
 
     if (dev->funcs->sync_for_gpu(buf))
@@ -189,9 +330,11 @@ int m2d_wait(const struct m2d_buffer* buf, const struct timespec* timeout)
     if (dev->fd < 0)
         return -1;
 
-    if (!buf)
+    if (!buf || buf->parked)
         return 0;
 
+    m2d_flush();
+
     if (dev->funcs->wait(buf, timeout))
         return -1;
 
@@ -202,9 +345,32 @@ int m2d_wait(const struct m2d_buffer* buf, const struct timespec* timeout)
 
 void* m2d_get_data(struct m2d_buffer* buf)
 {
+    m2d_use_buffer(buf);
+    if (unlikely(buf->parked))
+        return NULL;
+
+    if (unlikely(!buf->cpu_addr) && dev->funcs->map)
+    {
+        if (!dev->funcs->map(buf))
+            return NULL;
+
+        LIBM2D_TRACE("mapped buffer %u at %p\n", buf->id, buf->cpu_addr);
+    }
+
     return buf->cpu_addr;
 }
 
+void m2d_unmap(struct m2d_buffer* buf)
+{
+    if (!buf || !buf->cpu_addr || !dev->funcs->unmap)
+        return;
+
+    m2d_flush();
+    dev->funcs->unmap(buf);
+
+    LIBM2D_TRACE("unmapped buffer %u\n", buf->id);
+}
+
 size_t m2d_get_stride(const struct m2d_buffer* buf)
 {
     return buf->stride;
@@ -218,9 +384,17 @@ void m2d_draw_rectangles(const struct m2d_rectangle* rects, size_t num_rects)
         return;
     }
 
+    if (!m2d_loader_resolve_sources())
+        return;
+
     dev->funcs->draw_rectangles(rects, num_rects);
 }
 
+bool m2d_is_render_thread(void)
+{
+    return pthread_equal(pthread_self(), render_thread);
+}
+
 const char* m2d_format_name(enum m2d_pixel_format format)
 {
 #define FORMAT_TO_STR(name) case M2D_PF_##name: return #name
@@ -321,6 +495,19 @@ bool m2d_intersect(const struct m2d_rectangle* a,
     return true;
 }
 
+void m2d_rectangle_union(struct m2d_rectangle* a, const struct m2d_rectangle* b)
+{
+    dim_t x0 = min_int(a->x, b->x);
+    dim_t y0 = min_int(a->y, b->y);
+    dim_t x1 = max_int(a->x + a->w, b->x + b->w);
+    dim_t y1 = max_int(a->y + a->h, b->y + b->h);
+
+    a->x = x0;
+    a->y = y0;
+    a->w = x1 - x0;
+    a->h = y1 - y0;
+}
+
 static int m2d_active_log_level()
 {
     static int level = -1;
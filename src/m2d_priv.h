@@ -35,6 +35,33 @@ static inline type max_##type(type a, type b)    \
 }
 
 DEFINE_MIN_MAX(int)
+DEFINE_MIN_MAX(size_t)
+
+/* The integer square root of @value, rounded down. */
+static inline uint32_t m2d_isqrt(uint64_t value)
+{
+    uint64_t bit = (uint64_t)1 << 62;
+    uint64_t root = 0;
+
+    while (bit > value)
+        bit >>= 2;
+
+    while (bit)
+    {
+        if (value >= root + bit)
+        {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (uint32_t)root;
+}
 
 #ifndef container_of
 #define container_of(ptr, type, member) ((type *)((unsigned char *)(ptr) - offsetof(type, member)))
@@ -47,7 +74,8 @@ struct m2d_buffer
     /*
      * A virtual address that can be used by the CPU from the userspace,
      * by libcairo for instance, to access the memory behind the GEM DRM
-     * object. Likely returned by mmap().
+     * object. Likely returned by mmap(), on the first call to
+     * m2d_get_data(): NULL until then.
      */
     void* cpu_addr;
 
@@ -55,6 +83,33 @@ struct m2d_buffer
     size_t height; /* Height in pixels of the image/texture/frame buffer ... */
     size_t stride; /* Size in bytes between two consecutive pixel rows in the memory area. */
     enum m2d_pixel_format format; /* describe the layout of the pixel components (red, green, blue, alpha) in memory. */
+
+    /* Memory accounting: see memory.c */
+    bool imported;
+    char tag[16];
+    struct m2d_buffer* prev;
+    struct m2d_buffer* next;
+
+    /*
+     * Bumped whenever the pixels may change: drawn to, or synchronized for
+     * the CPU by m2d_sync_for_cpu(), which lets it write. Scaled variants are
+     * keyed with it: see scale.c
+     */
+    uint32_t generation;
+
+    /* Image cache: see cache.c */
+    struct m2d_cache_entry* cache_entry;
+
+    /*
+     * Parking: see park.c. While parked, the buffer has no GEM object and
+     * its pixels are held by @parked, run-length encoded if @parked_rle.
+     */
+    bool exported;
+    bool parkable;
+    uint64_t last_use;
+    void* parked;
+    size_t parked_size;
+    bool parked_rle;
 };
 
 struct m2d_device_funcs
@@ -66,6 +121,12 @@ struct m2d_device_funcs
                                  enum m2d_pixel_format format, size_t* stride);
     struct m2d_buffer* (*import)(const struct m2d_import_desc* desc);
     void (*free)(struct m2d_buffer* buf);
+    /* Release the GEM object of a buffer being parked, and create a new one. */
+    void (*release)(struct m2d_buffer* buf);
+    int (*restore)(struct m2d_buffer* buf);
+    int (*export)(struct m2d_buffer* buf, int* fd);
+    void* (*map)(struct m2d_buffer* buf);
+    void (*unmap)(struct m2d_buffer* buf);
     int (*sync_for_cpu)(struct m2d_buffer* buf, const struct timespec* timeout);
     int (*sync_for_gpu)(struct m2d_buffer* buf);
     int (*wait)(const struct m2d_buffer* buf, const struct timespec* timeout);
@@ -94,10 +155,171 @@ struct m2d_device
 
 struct m2d_device* m2d_get_device();
 
+/* m2d_sync_for_cpu() for reading only: the buffer generation is kept. */
+int m2d_sync_for_cpu_read(struct m2d_buffer* buf, const struct timespec* timeout);
+
+/*
+ * Memory that libm2d can release and rebuild on demand: scratch surfaces,
+ * caches... Reclaimers are called, most recently registered first, when the
+ * memory budget is exceeded or when an allocation fails.
+ */
+struct m2d_reclaimer
+{
+    /* Try to release @bytes bytes, return the number of bytes released. */
+    size_t (*reclaim)(size_t bytes, void* data);
+    void* data;
+
+    struct m2d_reclaimer* next;
+};
+
+void m2d_register_reclaimer(struct m2d_reclaimer* reclaimer);
+void m2d_unregister_reclaimer(struct m2d_reclaimer* reclaimer);
+size_t m2d_reclaim(size_t bytes);
+
+static inline size_t m2d_buffer_size(const struct m2d_buffer* buf)
+{
+    return buf->height * buf->stride;
+}
+
+void m2d_memory_reserve(size_t bytes);
+void m2d_memory_alloc_failed(size_t bytes);
+void m2d_memory_add(struct m2d_buffer* buf);
+void m2d_memory_remove(struct m2d_buffer* buf);
+size_t m2d_memory_num_buffers(void);
+void m2d_memory_park(struct m2d_buffer* buf, bool parked);
+struct m2d_buffer* m2d_memory_park_candidate(void);
+
+/*
+ * Save/restore the current renderer state, so that helpers built on top of
+ * the public drawing API leave the application state untouched.
+ */
+void m2d_push_state(void);
+void m2d_pop_state(void);
+
+bool m2d_source_is_enabled(enum m2d_source_id id);
+struct m2d_buffer* m2d_get_source(enum m2d_source_id id);
+struct m2d_buffer* m2d_get_target(void);
+bool m2d_blend_is_enabled(void);
+enum m2d_renderer m2d_get_renderer(void);
+uint32_t m2d_get_source_color(void);
+unsigned int m2d_get_target_transform(void);
+bool m2d_buffer_is_bound(const struct m2d_buffer* buf);
+
+/*
+ * Parking: see park.c
+ *
+ * Buffers are restored when used again: set as a source or a target, mapped
+ * or exported.
+ */
+void m2d_park_init(void);
+void m2d_park_cleanup(void);
+int m2d_use_buffer(struct m2d_buffer* buf);
+void m2d_park_free(struct m2d_buffer* buf);
+
+/*
+ * Background loading: see loader.c
+ *
+ * Draws resolve the sources set by m2d_set_source_load() first, and skip if
+ * they aren't ready. Setting a source forgets its load. Both are suspended
+ * while the renderer state is pushed, so that helpers drawing with their own
+ * sources don't interfere.
+ */
+bool m2d_is_render_thread(void);
+void m2d_loader_cleanup(void);
+bool m2d_loader_resolve_sources(void);
+void m2d_loader_unbind_source(enum m2d_source_id id);
+void m2d_loader_suspend(void);
+void m2d_loader_resume(void);
+
+/*
+ * Image cache: see cache.c
+ *
+ * m2d_free() hands cached surfaces back to the cache, which keeps them until
+ * they are evicted.
+ */
+void m2d_cache_put(struct m2d_buffer* buf);
+void m2d_cache_cleanup(void);
+/* The FNV-1a hash of @size bytes at @data. */
+uint64_t m2d_hash(const void* data, size_t size);
+
+/*
+ * Scaled variants: see scale.c
+ *
+ * m2d_transformed_variant() returns @buf transformed, cached as a scaled
+ * variant, or NULL on error. So does m2d_blurred_variant() with @src_rect of
+ * @buf blurred, created by m2d_blur_create(): see blur.c, and
+ * m2d_nine_patch_variant() with a nine-patch composed by
+ * m2d_nine_patch_create(): see ninepatch.c, and m2d_color_key_variant() with
+ * the A8 mask of the pixels of @src_rect which aren't @key, created by
+ * m2d_color_key_mask_create(): see colorkey.c
+ *
+ * m2d_resample() scales pixels in CPU memory.
+ */
+void m2d_scale_cleanup(void);
+struct m2d_buffer* m2d_transformed_variant(struct m2d_buffer* buf, unsigned int transform);
+struct m2d_buffer* m2d_blurred_variant(struct m2d_buffer* buf, const struct m2d_rectangle* src_rect,
+                                       unsigned int radius, bool shadow, uint32_t color);
+struct m2d_buffer* m2d_blur_create(struct m2d_buffer* src, const struct m2d_rectangle* src_rect,
+                                   unsigned int radius, bool shadow, uint32_t color);
+struct m2d_buffer* m2d_nine_patch_variant(struct m2d_buffer* buf,
+                                          const struct m2d_rectangle* src_rect,
+                                          const struct m2d_insets* insets, dim_t width,
+                                          dim_t height, enum m2d_nine_patch_mode mode);
+struct m2d_buffer* m2d_nine_patch_create(struct m2d_buffer* src, const struct m2d_rectangle* src_rect,
+                                         const struct m2d_insets* insets, dim_t width, dim_t height,
+                                         enum m2d_nine_patch_mode mode);
+struct m2d_buffer* m2d_color_key_variant(struct m2d_buffer* buf,
+                                         const struct m2d_rectangle* src_rect, uint32_t key);
+struct m2d_buffer* m2d_color_key_mask_create(struct m2d_buffer* src,
+                                             const struct m2d_rectangle* src_rect, uint32_t key);
+bool m2d_source_rect_is_valid(const struct m2d_buffer* buf, const struct m2d_rectangle* rect);
+int m2d_resample(void* dst, size_t dst_stride, size_t dst_width, size_t dst_height,
+                 const void* src, size_t src_stride, size_t src_width, size_t src_height,
+                 enum m2d_pixel_format format, enum m2d_filter filter);
+
+/*
+ * Gradients: see gradient.c
+ */
+void m2d_gradient_cleanup(void);
+
+/*
+ * Color keys: see colorkey.c
+ */
+void m2d_color_key_cleanup(void);
+
+/*
+ * Shapes: see shape.c
+ *
+ * m2d_sin() returns the sine of @angle degrees, in 16.16 fixed point.
+ */
+void m2d_shape_cleanup(void);
+int32_t m2d_sin(int angle);
+
+/*
+ * Patterns: see pattern.c
+ *
+ * m2d_expand_target() fills @rect by repeating its top left @width x @height
+ * pixels, already drawn, with copies of the target onto itself: M2D_SRC must
+ * be enabled, and blending disabled.
+ */
+void m2d_expand_target(const struct m2d_rectangle* rect, dim_t width, dim_t height);
+
+/*
+ * Rotations: see rotate.c
+ *
+ * m2d_transform_rect() maps @rect in the logical space of a @width x
+ * @height surface to the surface transformed by @transform.
+ */
+void m2d_transform_rect(unsigned int transform, size_t width, size_t height,
+                        const struct m2d_rectangle* rect, struct m2d_rectangle* result);
+
 bool m2d_intersect(const struct m2d_rectangle* a,
                    const struct m2d_rectangle* b,
                    struct m2d_rectangle* result);
 
+/* Grow @a to the bounding box of @a and @b. */
+void m2d_rectangle_union(struct m2d_rectangle* a, const struct m2d_rectangle* b);
+
 #define LIBM2D_LEVEL_TRACE 0
 #define LIBM2D_LEVEL_DEBUG 1
 #define LIBM2D_LEVEL_INFO 2
@@ -182,6 +404,153 @@ m2d_print_rectangles(const struct m2d_rectangle* rects, size_t num_rects)
 }
 #endif
 
-size_t m2d_byte_per_pixel(enum m2d_pixel_format format);
+/*
+ * Convert a row of @width pixels, decoded as R, G, B(, A) bytes with straight
+ * alpha, into @format with premultiplied alpha: see convert.c
+ */
+typedef void (*m2d_row_func)(void* dst, const uint8_t* src, size_t width);
+
+m2d_row_func m2d_rgba_row_func(enum m2d_pixel_format format);
+m2d_row_func m2d_rgb_row_func(enum m2d_pixel_format format);
+
+/*
+ * Convert a row of @width pixels between two libm2d formats, NULL if the
+ * formats are the same.
+ */
+m2d_row_func m2d_pixel_row_func(enum m2d_pixel_format dst_format,
+                                enum m2d_pixel_format src_format);
+
+/*
+ * Pixel conversion kernels, one set per instruction set: see convert.c,
+ * convert_x86.c and convert_neon.c. Vector kernels leave the last pixels of
+ * a row to the scalar ones.
+ *
+ * argb8888_to_rgb565() adds @bias, 4 B, G, R words repeated along the row, to
+ * the pixels first, with saturation: the ordered dithering thresholds, or
+ * NULL.
+ */
+struct m2d_convert_kernels
+{
+    const char* isa;
+    m2d_row_func rgba_premultiply;
+    m2d_row_func rgba_swizzle;
+    m2d_row_func premultiply;
+    m2d_row_func argb8888_to_a8;
+    m2d_row_func a8_to_argb8888;
+    m2d_row_func rgb565_to_argb8888;
+    void (*argb8888_to_rgb565)(void* dst, const uint8_t* src, size_t width,
+                               const uint32_t* bias);
+};
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#define M2D_CONVERT_AVX2
+#endif
+
+extern const struct m2d_convert_kernels m2d_convert_c;
+extern const struct m2d_convert_kernels m2d_convert_sse2;
+extern const struct m2d_convert_kernels m2d_convert_avx2;
+extern const struct m2d_convert_kernels m2d_convert_neon;
+
+/* Copy @size bytes into write-combined memory, bypassing the CPU caches. */
+void m2d_stream_copy(void* dst, const void* src, size_t size);
+
+/*
+ * Run-length encoding of pixels of @unit bytes: see rle.c
+ */
+size_t m2d_rle_bound(size_t size, size_t unit);
+size_t m2d_rle_encode(void* dst, const void* src, size_t size, size_t unit);
+int m2d_rle_decode(void* dst, size_t size, const void* src, size_t src_size,
+                   size_t unit);
+
+/*
+ * CPU blend kernels: see blend.c
+ *
+ * A kernel blends @width pixels of @src, in the source format, with @dst, in
+ * the target format, into @out, in the target format too. @out may be @dst.
+ * Modulated kernels multiply @src by the source color first.
+ */
+struct m2d_blend_mode
+{
+    enum m2d_blend_function function;
+    enum m2d_blend_factor scfactor;
+    enum m2d_blend_factor dcfactor;
+    enum m2d_blend_factor safactor;
+    enum m2d_blend_factor dafactor;
+};
+
+struct m2d_blend_args
+{
+    uint32_t blend_color;
+    uint32_t source_color;
+    struct m2d_blend_mode mode;
+};
+
+typedef void (*m2d_blend_func)(uint8_t* out, const uint8_t* src, const uint8_t* dst,
+                               size_t width, const struct m2d_blend_args* args);
+
+/* NULL if there is no modulated kernel: see m2d_blend_modulate(). */
+m2d_blend_func m2d_blend_select(const struct m2d_blend_mode* mode,
+                                enum m2d_pixel_format target_format,
+                                enum m2d_pixel_format src_format,
+                                bool modulated);
+void m2d_blend_modulate(uint32_t* out, const uint8_t* src,
+                        enum m2d_pixel_format src_format, size_t width,
+                        uint32_t color);
+
+/*
+ * Thread pool: see pool.c
+ *
+ * m2d_pool_run() calls @func for each job in [0, @num_jobs) from the pool
+ * threads and the calling thread, and returns once they are all done.
+ */
+typedef void (*m2d_job_func)(size_t job, void* data);
+
+void m2d_pool_run(size_t num_jobs, m2d_job_func func, void* data);
+unsigned int m2d_pool_num_threads(void);
+void m2d_pool_cleanup(void);
+
+/*
+ * CPU renderer: see cpu.c
+ *
+ * It executes the draw operations of the GPU on surfaces mapped and
+ * synchronized for the CPU by the backend. Sources are positioned at (@x, @y)
+ * in the target surface space, the target at (0, 0). @src is NULL to blend
+ * the source color. @dst is the DST source, or the target.
+ */
+struct m2d_cpu_surface
+{
+    uint8_t* data;
+    size_t width;
+    size_t height;
+    size_t stride;
+    enum m2d_pixel_format format;
+    dim_t x;
+    dim_t y;
+};
+
+struct m2d_cpu_state
+{
+    struct m2d_cpu_surface target;
+    const struct m2d_cpu_surface* src;
+    const struct m2d_cpu_surface* dst;
+    bool blend_enabled;
+    struct m2d_blend_args blend;
+};
+
+void m2d_cpu_draw_rectangles(const struct m2d_cpu_state* state,
+                             const struct m2d_rectangle* rects, size_t num_rects);
+
+/*
+ * Deferred CPU rendering: m2d_cpu_defer() records a draw, with copies of the
+ * surfaces, to be drawn by m2d_cpu_flush(). The surfaces must stay synchronized
+ * for the CPU until then. Draws on another target than the recorded ones, or
+ * reading their target at another position, can't be deferred.
+ */
+bool m2d_cpu_can_defer(const struct m2d_cpu_state* state);
+bool m2d_cpu_defer(const struct m2d_cpu_state* state,
+                   const struct m2d_rectangle* rects, size_t num_rects);
+bool m2d_cpu_has_deferred(void);
+void m2d_cpu_flush(void);
+void m2d_cpu_cleanup(void);
 
 #endif /* M2D_PRIV_H */
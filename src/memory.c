@@ -0,0 +1,403 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/m2d.h"
+#include "m2d_priv.h"
+
+#include <pthread.h>
+#include <string.h>
+
+/* Tags reported one by one on allocation failures, the others are summed. */
+#define MEMORY_REPORT_TAGS 16
+
+/*
+ * Live buffers are linked from the oldest to the newest, so that dumps read
+ * in allocation order.
+ *
+ * Buffers can be allocated and freed by the loader threads: the registry is
+ * protected by @lock. Reclaimers and the budget callback only run on the
+ * rendering thread though, since they touch the renderer state.
+ */
+static struct
+{
+    pthread_mutex_t lock;
+
+    struct m2d_buffer* first;
+    struct m2d_buffer* last;
+    size_t num_buffers;
+
+    size_t allocated_bytes;
+    size_t peak_bytes;
+    size_t format_bytes[M2D_NUM_PIXEL_FORMATS];
+    size_t imported_bytes;
+
+    size_t budget;
+    m2d_budget_callback callback;
+    void* callback_data;
+
+    struct m2d_reclaimer* reclaimers;
+} memory = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+void m2d_register_reclaimer(struct m2d_reclaimer* reclaimer)
+{
+    reclaimer->next = memory.reclaimers;
+    memory.reclaimers = reclaimer;
+}
+
+void m2d_unregister_reclaimer(struct m2d_reclaimer* reclaimer)
+{
+    struct m2d_reclaimer** link;
+
+    for (link = &memory.reclaimers; *link; link = &(*link)->next)
+    {
+        if (*link == reclaimer)
+        {
+            *link = reclaimer->next;
+            reclaimer->next = NULL;
+            break;
+        }
+    }
+}
+
+size_t m2d_reclaim(size_t bytes)
+{
+    struct m2d_reclaimer* reclaimer;
+    size_t released = 0;
+
+    for (reclaimer = memory.reclaimers; reclaimer && released < bytes;
+         reclaimer = reclaimer->next)
+        released += reclaimer->reclaim(bytes - released, reclaimer->data);
+
+    LIBM2D_DEBUG("reclaimed %zu byte(s) out of %zu\n", released, bytes);
+
+    return released;
+}
+
+static size_t m2d_memory_used(void)
+{
+    return memory.allocated_bytes + m2d_scratch_size();
+}
+
+void m2d_memory_reserve(size_t bytes)
+{
+    size_t used;
+
+    if (!memory.budget || !m2d_is_render_thread())
+        return;
+
+    used = m2d_memory_used();
+    if (used + bytes <= memory.budget)
+        return;
+
+    LIBM2D_DEBUG("allocating %zu byte(s) exceeds the budget: %zu/%zu\n",
+                 bytes, used, memory.budget);
+
+    m2d_reclaim(used + bytes - memory.budget);
+
+    used = m2d_memory_used();
+    if (used + bytes > memory.budget && memory.callback)
+        memory.callback(bytes, used, memory.budget, memory.callback_data);
+}
+
+static size_t m2d_tag_usage_locked(const char* tag)
+{
+    const struct m2d_buffer* buf;
+    size_t bytes = 0;
+
+    for (buf = memory.first; buf; buf = buf->next)
+    {
+        if (!buf->imported && !buf->parked &&
+            !strncmp(buf->tag, tag, sizeof(buf->tag) - 1))
+            bytes += m2d_buffer_size(buf);
+    }
+
+    return bytes;
+}
+
+void m2d_memory_alloc_failed(size_t bytes)
+{
+    struct
+    {
+        const char* tag;
+        size_t bytes;
+    } tags[MEMORY_REPORT_TAGS];
+    const struct m2d_buffer* buf;
+    size_t num_tags = 0;
+    size_t others = 0;
+    size_t i;
+
+    /* Tell who owns the memory: the tags in order of first use, summed in one pass. */
+    pthread_mutex_lock(&memory.lock);
+    LIBM2D_ERROR("failed to allocate %zu byte(s), %zu byte(s) in use:\n",
+                 bytes, m2d_memory_used());
+    for (buf = memory.first; buf; buf = buf->next)
+    {
+        if (buf->imported || buf->parked)
+            continue;
+
+        for (i = 0; i < num_tags; i++)
+            if (!strncmp(tags[i].tag, buf->tag, sizeof(buf->tag) - 1))
+                break;
+
+        if (i == num_tags && num_tags < MEMORY_REPORT_TAGS)
+        {
+            tags[num_tags].tag = buf->tag;
+            tags[num_tags].bytes = 0;
+            num_tags++;
+        }
+
+        if (i < num_tags)
+            tags[i].bytes += m2d_buffer_size(buf);
+        else
+            others += m2d_buffer_size(buf);
+    }
+
+    for (i = 0; i < num_tags; i++)
+        LIBM2D_ERROR("  %-15s %zu byte(s)\n", tags[i].tag[0] ? tags[i].tag : "-",
+                     tags[i].bytes);
+    if (others)
+        LIBM2D_ERROR("  %-15s %zu byte(s)\n", "(others)", others);
+    pthread_mutex_unlock(&memory.lock);
+
+    if (!m2d_is_render_thread())
+        return;
+
+    m2d_reclaim(bytes);
+
+    if (memory.callback)
+        memory.callback(bytes, m2d_memory_used(), memory.budget, memory.callback_data);
+}
+
+void m2d_memory_add(struct m2d_buffer* buf)
+{
+    pthread_mutex_lock(&memory.lock);
+
+    buf->prev = memory.last;
+    buf->next = NULL;
+    if (memory.last)
+        memory.last->next = buf;
+    else
+        memory.first = buf;
+    memory.last = buf;
+    memory.num_buffers++;
+
+    if (buf->imported)
+    {
+        memory.imported_bytes += m2d_buffer_size(buf);
+    }
+    else
+    {
+        memory.allocated_bytes += m2d_buffer_size(buf);
+        if (buf->format < M2D_NUM_PIXEL_FORMATS)
+            memory.format_bytes[buf->format] += m2d_buffer_size(buf);
+
+        if (memory.allocated_bytes > memory.peak_bytes)
+            memory.peak_bytes = memory.allocated_bytes;
+    }
+
+    pthread_mutex_unlock(&memory.lock);
+}
+
+void m2d_memory_remove(struct m2d_buffer* buf)
+{
+    pthread_mutex_lock(&memory.lock);
+
+    if (buf->prev)
+        buf->prev->next = buf->next;
+    else
+        memory.first = buf->next;
+    if (buf->next)
+        buf->next->prev = buf->prev;
+    else
+        memory.last = buf->prev;
+    buf->prev = NULL;
+    buf->next = NULL;
+    memory.num_buffers--;
+
+    if (buf->imported)
+    {
+        memory.imported_bytes -= m2d_buffer_size(buf);
+    }
+    else if (!buf->parked)
+    {
+        memory.allocated_bytes -= m2d_buffer_size(buf);
+        if (buf->format < M2D_NUM_PIXEL_FORMATS)
+            memory.format_bytes[buf->format] -= m2d_buffer_size(buf);
+    }
+
+    pthread_mutex_unlock(&memory.lock);
+}
+
+/* Parked buffers don't hold any GPU memory. */
+void m2d_memory_park(struct m2d_buffer* buf, bool parked)
+{
+    size_t size = m2d_buffer_size(buf);
+
+    pthread_mutex_lock(&memory.lock);
+
+    if (parked)
+    {
+        memory.allocated_bytes -= size;
+        if (buf->format < M2D_NUM_PIXEL_FORMATS)
+            memory.format_bytes[buf->format] -= size;
+    }
+    else
+    {
+        memory.allocated_bytes += size;
+        if (buf->format < M2D_NUM_PIXEL_FORMATS)
+            memory.format_bytes[buf->format] += size;
+
+        if (memory.allocated_bytes > memory.peak_bytes)
+            memory.peak_bytes = memory.allocated_bytes;
+    }
+
+    pthread_mutex_unlock(&memory.lock);
+}
+
+/*
+ * Get the least recently used buffer that can be parked: parkable, neither
+ * imported nor exported, and not bound to the renderer state.
+ */
+struct m2d_buffer* m2d_memory_park_candidate(void)
+{
+    struct m2d_buffer* candidate = NULL;
+    struct m2d_buffer* buf;
+
+    pthread_mutex_lock(&memory.lock);
+    for (buf = memory.first; buf; buf = buf->next)
+    {
+        if (!buf->parkable || buf->parked || buf->imported || buf->exported)
+            continue;
+
+        if (candidate && candidate->last_use <= buf->last_use)
+            continue;
+
+        if (!m2d_buffer_is_bound(buf))
+            candidate = buf;
+    }
+    pthread_mutex_unlock(&memory.lock);
+
+    return candidate;
+}
+
+size_t m2d_memory_num_buffers(void)
+{
+    size_t num_buffers;
+
+    pthread_mutex_lock(&memory.lock);
+    num_buffers = memory.num_buffers;
+    pthread_mutex_unlock(&memory.lock);
+
+    return num_buffers;
+}
+
+void m2d_get_memory_stats(struct m2d_memory_stats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_lock(&memory.lock);
+    stats->allocated_bytes = memory.allocated_bytes;
+    stats->peak_bytes = memory.peak_bytes;
+    memcpy(stats->format_bytes, memory.format_bytes, sizeof(stats->format_bytes));
+    stats->scratch_bytes = m2d_scratch_size();
+    stats->imported_bytes = memory.imported_bytes;
+    stats->num_buffers = memory.num_buffers;
+    pthread_mutex_unlock(&memory.lock);
+}
+
+void m2d_set_tag(struct m2d_buffer* buf, const char* tag)
+{
+    if (!buf)
+        return;
+
+    pthread_mutex_lock(&memory.lock);
+    strncpy(buf->tag, tag ? tag : "", sizeof(buf->tag) - 1);
+    buf->tag[sizeof(buf->tag) - 1] = '\0';
+    pthread_mutex_unlock(&memory.lock);
+}
+
+size_t m2d_get_tag_usage(const char* tag)
+{
+    size_t bytes;
+
+    pthread_mutex_lock(&memory.lock);
+    bytes = m2d_tag_usage_locked(tag);
+    pthread_mutex_unlock(&memory.lock);
+
+    return bytes;
+}
+
+void m2d_foreach_buffer(void (*func)(const struct m2d_buffer_info* info, void* data),
+                        void* data)
+{
+    struct m2d_buffer* buf;
+
+    pthread_mutex_lock(&memory.lock);
+    for (buf = memory.first; buf; buf = buf->next)
+    {
+        struct m2d_buffer_info info = {
+            .buf = buf,
+            .id = buf->id,
+            .width = buf->width,
+            .height = buf->height,
+            .format = buf->format,
+            .stride = buf->stride,
+            .size = m2d_buffer_size(buf),
+            .imported = buf->imported,
+            .parked = buf->parked != NULL,
+            .tag = buf->tag,
+        };
+
+        func(&info, data);
+    }
+    pthread_mutex_unlock(&memory.lock);
+}
+
+static void m2d_dump_buffer(const struct m2d_buffer_info* info, void* data)
+{
+    FILE* stream = data;
+
+    fprintf(stream, "%6u %5zux%-5zu %-8s %6zu %9zu %-8s %s\n",
+            info->id, info->width, info->height, m2d_format_name(info->format),
+            info->stride, info->size,
+            info->imported ? "imported" : info->parked ? "parked" : "",
+            info->tag[0] ? info->tag : "-");
+}
+
+void m2d_dump_buffers(FILE* stream)
+{
+    struct m2d_memory_stats stats;
+    struct m2d_park_stats park_stats;
+    size_t i;
+
+    if (!stream)
+        stream = stderr;
+
+    fprintf(stream, "%6s %11s %-8s %6s %9s %-8s %s\n",
+            "id", "size", "format", "stride", "bytes", "", "tag");
+    m2d_foreach_buffer(m2d_dump_buffer, stream);
+
+    m2d_get_memory_stats(&stats);
+    fprintf(stream, "allocated: %zu byte(s) (peak: %zu), budget: %zu\n",
+            stats.allocated_bytes, stats.peak_bytes, memory.budget);
+    for (i = 0; i < M2D_NUM_PIXEL_FORMATS; i++)
+        fprintf(stream, "  %-8s %zu byte(s)\n",
+                m2d_format_name((enum m2d_pixel_format)i), stats.format_bytes[i]);
+    fprintf(stream, "scratch: %zu byte(s)\n", stats.scratch_bytes);
+    fprintf(stream, "imported: %zu byte(s)\n", stats.imported_bytes);
+
+    m2d_get_park_stats(&park_stats);
+    fprintf(stream, "parked: %zu buffer(s), %zu byte(s) compressed into %zu\n",
+            park_stats.num_parked, park_stats.parked_bytes,
+            park_stats.compressed_bytes);
+}
+
+void m2d_set_memory_budget(size_t budget, m2d_budget_callback callback, void* data)
+{
+    memory.budget = budget;
+    memory.callback = callback;
+    memory.callback_data = data;
+}
@@ -0,0 +1,376 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/m2d.h"
+#include "m2d_priv.h"
+
+#include <string.h>
+#include <time.h>
+
+#define NINE_PATCH_TIMEOUT_SECS 1
+
+/*
+ * Nine-patches.
+ *
+ * The insets split the source rectangle into 3x3 slices: the corners are
+ * drawn as they are, the edges are stretched or repeated along the frame,
+ * and the center both ways. Insets larger than the destination shrink the
+ * corners, keeping their outer part.
+ *
+ * Copies of a repeating nine-patch go straight to the target: each corner
+ * with the first tiles next to it, then the tiles are repeated by copying
+ * the area drawn so far onto itself, doubling it each time. A frame of any
+ * size takes a handful of draws.
+ *
+ * Blends can't be expanded that way, and the GPU can't stretch: the other
+ * nine-patches are composed by the CPU into a surface of the destination
+ * size, cached with the scaled variants, then drawn at once.
+ */
+struct nine_patch_axis
+{
+    /* Per slice: start and size in the source, then in the destination. */
+    dim_t src[3];
+    dim_t src_size[3];
+    dim_t dst[3];
+    dim_t dst_size[3];
+};
+
+static void nine_patch_axis(dim_t src_size, dim_t start, dim_t end, dim_t dst_size,
+                            struct nine_patch_axis* axis)
+{
+    dim_t dst_start = start;
+    dim_t dst_end = end;
+
+    if (start + end > dst_size)
+    {
+        dst_start = (dim_t)((int64_t)dst_size * start / (start + end));
+        dst_end = dst_size - dst_start;
+    }
+
+    axis->src[0] = 0;
+    axis->src[1] = start;
+    axis->src[2] = src_size - dst_end;
+    axis->src_size[0] = dst_start;
+    axis->src_size[1] = src_size - start - end;
+    axis->src_size[2] = dst_end;
+
+    axis->dst[0] = 0;
+    axis->dst[1] = dst_start;
+    axis->dst[2] = dst_size - dst_end;
+    axis->dst_size[0] = dst_start;
+    axis->dst_size[1] = dst_size - dst_start - dst_end;
+    axis->dst_size[2] = dst_end;
+}
+
+static void nine_patch_axes(const struct m2d_rectangle* src_rect, const struct m2d_insets* insets,
+                            dim_t width, dim_t height,
+                            struct nine_patch_axis* x_axis, struct nine_patch_axis* y_axis)
+{
+    nine_patch_axis(src_rect->w, insets->left, insets->right, width, x_axis);
+    nine_patch_axis(src_rect->h, insets->top, insets->bottom, height, y_axis);
+}
+
+/* Fill @width x @height pixels at @dst by repeating the @tile_width x @tile_height @src. */
+static void nine_patch_repeat(uint8_t* dst, size_t dst_stride, size_t width, size_t height,
+                              const uint8_t* src, size_t src_stride,
+                              size_t tile_width, size_t tile_height, size_t bpp)
+{
+    size_t row = width * bpp;
+    size_t tile_row = tile_width * bpp;
+    size_t done;
+    size_t y;
+
+    for (y = 0; y < height; y++, dst += dst_stride)
+    {
+        /* Further rows repeat the first tile rows already expanded. */
+        if (y >= tile_height)
+        {
+            memcpy(dst, dst - tile_height * dst_stride, row);
+            continue;
+        }
+
+        memcpy(dst, src + y * src_stride, min_size_t(tile_row, row));
+        for (done = tile_row; done < row; done *= 2)
+            memcpy(dst + done, dst, min_size_t(done, row - done));
+    }
+}
+
+struct m2d_buffer* m2d_nine_patch_create(struct m2d_buffer* src, const struct m2d_rectangle* src_rect,
+                                         const struct m2d_insets* insets, dim_t width, dim_t height,
+                                         enum m2d_nine_patch_mode mode)
+{
+    size_t bpp = m2d_byte_per_pixel(src->format);
+    size_t stride = ((size_t)width * bpp + 3) & ~(size_t)3;
+    struct nine_patch_axis x_axis;
+    struct nine_patch_axis y_axis;
+    struct timespec timeout;
+    struct m2d_buffer* buf;
+    const uint8_t* src_data;
+    const uint8_t* s;
+    uint8_t* data;
+    uint8_t* d;
+    size_t sw, sh, dw, dh;
+    size_t i, j, y;
+
+    buf = m2d_alloc((size_t)width, (size_t)height, src->format, stride);
+    if (!buf)
+        return NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &timeout);
+    timeout.tv_sec += NINE_PATCH_TIMEOUT_SECS;
+    if (m2d_sync_for_cpu_read(src, &timeout) || m2d_sync_for_cpu(buf, &timeout))
+        goto free_buf;
+
+    src_data = m2d_get_data(src);
+    data = m2d_get_data(buf);
+    if (!src_data || !data)
+    {
+        LIBM2D_ERROR("buffer %u can't be accessed by the CPU to compose a nine-patch\n", src->id);
+        goto sync;
+    }
+
+    nine_patch_axes(src_rect, insets, width, height, &x_axis, &y_axis);
+
+    for (j = 0; j < 3; j++)
+    {
+        for (i = 0; i < 3; i++)
+        {
+            sw = (size_t)x_axis.src_size[i];
+            sh = (size_t)y_axis.src_size[j];
+            dw = (size_t)x_axis.dst_size[i];
+            dh = (size_t)y_axis.dst_size[j];
+            if (!dw || !dh)
+                continue;
+
+            s = src_data + (size_t)(src_rect->y + y_axis.src[j]) * src->stride +
+                (size_t)(src_rect->x + x_axis.src[i]) * bpp;
+            d = data + (size_t)y_axis.dst[j] * stride + (size_t)x_axis.dst[i] * bpp;
+
+            /* An empty center or edge isn't drawn, see nine_patch_rects(). */
+            if (!sw || !sh)
+            {
+                for (y = 0; y < dh; y++)
+                    memset(d + y * stride, 0, dw * bpp);
+            }
+            else if (mode == M2D_NINE_PATCH_REPEAT || (sw == dw && sh == dh))
+            {
+                nine_patch_repeat(d, stride, dw, dh, s, src->stride, sw, sh, bpp);
+            }
+            else if (m2d_resample(d, stride, dw, dh, s, src->stride, sw, sh, src->format,
+                                  M2D_FILTER_BILINEAR))
+            {
+                goto sync;
+            }
+        }
+    }
+
+    m2d_sync_for_gpu(buf);
+    m2d_sync_for_gpu(src);
+    m2d_set_tag(buf, "nine-patch");
+
+    LIBM2D_DEBUG("composed a %dx%d nine-patch of buffer %u\n", width, height, src->id);
+
+    return buf;
+
+sync:
+    m2d_sync_for_gpu(buf);
+    m2d_sync_for_gpu(src);
+free_buf:
+    m2d_free(buf);
+    return NULL;
+}
+
+/* Draw the non empty of two @rects sharing the source origin at once. */
+static void nine_patch_draw(const struct m2d_rectangle* rects)
+{
+    bool first = rects[0].w > 0 && rects[0].h > 0;
+    bool second = rects[1].w > 0 && rects[1].h > 0;
+
+    if (first && second)
+        m2d_draw_rectangles(rects, 2);
+    else if (first || second)
+        m2d_draw_rectangles(first ? &rects[0] : &rects[1], 1);
+}
+
+/*
+ * Draw the corners of a repeating nine-patch with the first tiles next to
+ * them, then repeat the tiles by copies of the target onto itself.
+ */
+static void nine_patch_expand(struct m2d_buffer* src, const struct m2d_rectangle* src_rect,
+                              const struct m2d_rectangle* dst_rect,
+                              const struct nine_patch_axis* x_axis,
+                              const struct nine_patch_axis* y_axis)
+{
+    struct m2d_rectangle rects[2];
+    struct m2d_rectangle rect;
+    struct m2d_buffer* target = m2d_get_target();
+    dim_t first_w = x_axis->src_size[1] ? min_int(x_axis->src_size[1], x_axis->dst_size[1]) : 0;
+    dim_t first_h = y_axis->src_size[1] ? min_int(y_axis->src_size[1], y_axis->dst_size[1]) : 0;
+    dim_t done;
+    dim_t n;
+    size_t i, j;
+
+    /* Corners: the first two slices of each side, then the last one. */
+    for (j = 0; j < 2; j++)
+    {
+        for (i = 0; i < 2; i++)
+        {
+            rect.x = dst_rect->x + (i ? x_axis->dst[2] : 0);
+            rect.y = dst_rect->y + (j ? y_axis->dst[2] : 0);
+            rect.w = i ? x_axis->dst_size[2] : x_axis->dst_size[0] + first_w;
+            rect.h = j ? y_axis->dst_size[2] : y_axis->dst_size[0] + first_h;
+            if (rect.w <= 0 || rect.h <= 0)
+                continue;
+
+            m2d_set_source(M2D_SRC, src,
+                           rect.x - src_rect->x - (i ? x_axis->src[2] : 0),
+                           rect.y - src_rect->y - (j ? y_axis->src[2] : 0));
+            m2d_draw_rectangles(&rect, 1);
+        }
+    }
+
+    /* Rows of tiles, down the left and right columns drawn. */
+    rects[0].x = dst_rect->x;
+    rects[0].w = x_axis->dst_size[0] + first_w;
+    rects[1].x = dst_rect->x + x_axis->dst[2];
+    rects[1].w = x_axis->dst_size[2];
+    for (done = first_h; done && done < y_axis->dst_size[1]; done += n)
+    {
+        n = min_int(done, y_axis->dst_size[1] - done);
+        rects[0].y = dst_rect->y + y_axis->dst[1] + done;
+        rects[0].h = n;
+        rects[1].y = rects[0].y;
+        rects[1].h = n;
+
+        m2d_set_source(M2D_SRC, target, 0, done);
+        nine_patch_draw(rects);
+    }
+
+    /* Columns of tiles, across the rows drawn: all of them unless the center is empty. */
+    rects[0].y = dst_rect->y;
+    rects[0].h = first_h || !y_axis->dst_size[1] ? dst_rect->h : y_axis->dst_size[0];
+    rects[1].y = dst_rect->y + y_axis->dst[2];
+    rects[1].h = first_h || !y_axis->dst_size[1] ? 0 : y_axis->dst_size[2];
+    for (done = first_w; done && done < x_axis->dst_size[1]; done += n)
+    {
+        n = min_int(done, x_axis->dst_size[1] - done);
+        rects[0].x = dst_rect->x + x_axis->dst[1] + done;
+        rects[0].w = n;
+        rects[1].x = rects[0].x;
+        rects[1].w = n;
+
+        m2d_set_source(M2D_SRC, target, done, 0);
+        nine_patch_draw(rects);
+    }
+}
+
+/*
+ * The areas of @dst_rect showing source pixels, at most six: the centers and
+ * edges emptied by the insets aren't drawn, as when they are expanded.
+ */
+static size_t nine_patch_rects(const struct m2d_rectangle* dst_rect,
+                               const struct nine_patch_axis* x_axis,
+                               const struct nine_patch_axis* y_axis,
+                               struct m2d_rectangle* rects)
+{
+    struct m2d_rectangle* rect;
+    size_t num_rects = 0;
+    size_t start;
+    size_t i, j;
+
+    for (j = 0; j < 3; j++)
+    {
+        if (!y_axis->src_size[j] || !y_axis->dst_size[j])
+            continue;
+
+        start = num_rects;
+        for (i = 0; i < 3; i++)
+        {
+            if (!x_axis->src_size[i] || !x_axis->dst_size[i])
+                continue;
+
+            /* Slices next to each other make a single span. */
+            rect = &rects[num_rects - 1];
+            if (num_rects > start && rect->x + rect->w == dst_rect->x + x_axis->dst[i])
+            {
+                rect->w += x_axis->dst_size[i];
+                continue;
+            }
+
+            rect = &rects[num_rects++];
+            rect->x = dst_rect->x + x_axis->dst[i];
+            rect->y = dst_rect->y + y_axis->dst[j];
+            rect->w = x_axis->dst_size[i];
+            rect->h = y_axis->dst_size[j];
+        }
+
+        /* A row of a single span extends the same span right above. */
+        rect = &rects[start];
+        if (start && num_rects == start + 1 && rect[-1].x == rect->x && rect[-1].w == rect->w &&
+            rect[-1].y + rect[-1].h == rect->y)
+        {
+            rect[-1].h += rect->h;
+            num_rects--;
+        }
+    }
+
+    return num_rects;
+}
+
+void m2d_draw_nine_patch(const struct m2d_rectangle* src_rect, const struct m2d_insets* insets,
+                         const struct m2d_rectangle* dst_rect, enum m2d_nine_patch_mode mode)
+{
+    struct m2d_buffer* src = m2d_get_source(M2D_SRC);
+    struct m2d_rectangle rects[6];
+    struct nine_patch_axis x_axis;
+    struct nine_patch_axis y_axis;
+    struct m2d_buffer* variant;
+    size_t num_rects;
+
+    if (!src)
+    {
+        LIBM2D_ERROR("no source surface to draw a nine-patch from\n");
+        return;
+    }
+
+    if (!m2d_source_rect_is_valid(src, src_rect))
+        return;
+
+    if (insets->left < 0 || insets->top < 0 || insets->right < 0 || insets->bottom < 0 ||
+        insets->left + insets->right > src_rect->w || insets->top + insets->bottom > src_rect->h)
+    {
+        LIBM2D_ERROR("nine-patch insets out of the source rectangle\n");
+        return;
+    }
+
+    if (dst_rect->w <= 0 || dst_rect->h <= 0)
+        return;
+
+    if (mode == M2D_NINE_PATCH_REPEAT && !m2d_blend_is_enabled() && m2d_get_target())
+    {
+        nine_patch_axes(src_rect, insets, dst_rect->w, dst_rect->h, &x_axis, &y_axis);
+
+        m2d_push_state();
+        m2d_source_enable(M2D_SRC, true);
+        nine_patch_expand(src, src_rect, dst_rect, &x_axis, &y_axis);
+        m2d_pop_state();
+        return;
+    }
+
+    variant = m2d_nine_patch_variant(src, src_rect, insets, dst_rect->w, dst_rect->h, mode);
+    if (!variant)
+        return;
+
+    nine_patch_axes(src_rect, insets, dst_rect->w, dst_rect->h, &x_axis, &y_axis);
+    num_rects = nine_patch_rects(dst_rect, &x_axis, &y_axis, rects);
+    if (!num_rects)
+        return;
+
+    m2d_push_state();
+    m2d_source_enable(M2D_SRC, true);
+    m2d_set_source(M2D_SRC, variant, dst_rect->x, dst_rect->y);
+    m2d_draw_rectangles(rects, num_rects);
+    m2d_pop_state();
+}
@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/m2d.h"
+#include "m2d_priv.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PARK_TIMEOUT_SECS 1
+
+/*
+ * A parked buffer keeps its 'struct m2d_buffer', so that the application
+ * pointers and the buffer id stay valid, while its GEM object is released.
+ * The pixels are run-length encoded into the heap: offscreen UI layers are
+ * mostly flat colors and transparent areas, and decoding them back is mostly
+ * memset() and memcpy(). Buffers which don't compress are copied as is.
+ *
+ * Buffers are stamped each time they are used, so that the reclaimer parks
+ * the least recently used ones first. The stamps are also bumped by the
+ * loader threads mapping their new buffers, hence the atomic clock.
+ */
+static struct
+{
+    uint64_t clock;
+    struct m2d_reclaimer reclaimer;
+    struct m2d_park_stats stats;
+} park;
+
+static uint64_t park_elapsed_ns(const struct timespec* start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)(now.tv_sec - start->tv_sec) * 1000000000 +
+        now.tv_nsec - start->tv_nsec;
+}
+
+static size_t park_unit(const struct m2d_buffer* buf)
+{
+    size_t unit = m2d_byte_per_pixel(buf->format);
+
+    return unit && !(buf->stride % unit) ? unit : 1;
+}
+
+static void* park_map(struct m2d_device* dev, struct m2d_buffer* buf)
+{
+    struct timespec timeout;
+
+    clock_gettime(CLOCK_MONOTONIC, &timeout);
+    timeout.tv_sec += PARK_TIMEOUT_SECS;
+    if (dev->funcs->sync_for_cpu(buf, &timeout))
+        return NULL;
+
+    return buf->cpu_addr ? buf->cpu_addr : dev->funcs->map(buf);
+}
+
+int m2d_park(struct m2d_buffer* buf)
+{
+    struct m2d_device* dev = m2d_get_device();
+    size_t size;
+    struct timespec start;
+    uint8_t* packed;
+    size_t packed_size;
+    void* pixels;
+    uint64_t ns;
+
+    if (dev->fd < 0 || !buf)
+        return -1;
+
+    if (buf->parked)
+        return 0;
+
+    size = m2d_buffer_size(buf);
+
+    if (buf->imported || buf->exported || !dev->funcs->release)
+    {
+        LIBM2D_ERROR("buffer %u can't be parked\n", buf->id);
+        return -1;
+    }
+
+    if (m2d_buffer_is_bound(buf))
+    {
+        LIBM2D_ERROR("buffer %u is set in the renderer state\n", buf->id);
+        return -1;
+    }
+
+    /* Deferred CPU draws may still use the mapping released below. */
+    m2d_flush();
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pixels = park_map(dev, buf);
+    if (!pixels)
+        return -1;
+
+    packed = malloc(m2d_rle_bound(size, park_unit(buf)));
+    if (!packed)
+    {
+        LIBM2D_ERROR("could not allocate memory to park buffer %u: %s\n",
+                     buf->id, strerror(errno));
+        return -1;
+    }
+
+    packed_size = m2d_rle_encode(packed, pixels, size, park_unit(buf));
+    buf->parked_rle = packed_size < size;
+    if (!buf->parked_rle)
+    {
+        memcpy(packed, pixels, size);
+        packed_size = size;
+    }
+
+    /* Give the encoding slack back, the buffer may stay parked for long. */
+    buf->parked = realloc(packed, packed_size);
+    if (!buf->parked)
+        buf->parked = packed;
+    buf->parked_size = packed_size;
+
+    dev->funcs->release(buf);
+    m2d_memory_park(buf, true);
+
+    ns = park_elapsed_ns(&start);
+    park.stats.num_parked++;
+    park.stats.parked_bytes += size;
+    park.stats.compressed_bytes += packed_size;
+    park.stats.parks++;
+    park.stats.park_ns += ns;
+
+    LIBM2D_DEBUG("parked buffer %u: %zu byte(s) into %zu in %llu us\n",
+                 buf->id, size, packed_size, (unsigned long long)(ns / 1000));
+
+    return 0;
+}
+
+int m2d_unpark(struct m2d_buffer* buf)
+{
+    struct m2d_device* dev = m2d_get_device();
+    size_t size;
+    struct timespec start;
+    void* pixels;
+    uint64_t ns;
+
+    if (dev->fd < 0 || !buf)
+        return -1;
+
+    if (!buf->parked)
+        return 0;
+
+    size = m2d_buffer_size(buf);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    m2d_memory_reserve(size);
+
+    if (dev->funcs->restore(buf))
+    {
+        m2d_memory_alloc_failed(size);
+
+        if (dev->funcs->restore(buf))
+        {
+            LIBM2D_ERROR("failed to restore parked buffer %u\n", buf->id);
+            return -1;
+        }
+    }
+
+    pixels = park_map(dev, buf);
+    if (!pixels)
+        goto release;
+
+    if (!buf->parked_rle)
+        memcpy(pixels, buf->parked, size);
+    else if (m2d_rle_decode(pixels, size, buf->parked, buf->parked_size, park_unit(buf)))
+        goto release;
+
+    dev->funcs->sync_for_gpu(buf);
+    dev->funcs->unmap(buf);
+    m2d_memory_park(buf, false);
+
+    ns = park_elapsed_ns(&start);
+    park.stats.num_parked--;
+    park.stats.parked_bytes -= size;
+    park.stats.compressed_bytes -= buf->parked_size;
+    park.stats.unparks++;
+    park.stats.unpark_ns += ns;
+
+    free(buf->parked);
+    buf->parked = NULL;
+    buf->parked_size = 0;
+
+    LIBM2D_DEBUG("restored buffer %u in %llu us\n",
+                 buf->id, (unsigned long long)(ns / 1000));
+
+    return 0;
+
+release:
+    LIBM2D_ERROR("failed to restore parked buffer %u\n", buf->id);
+    dev->funcs->release(buf);
+
+    return -1;
+}
+
+bool m2d_is_parked(const struct m2d_buffer* buf)
+{
+    return buf && buf->parked;
+}
+
+void m2d_set_parkable(struct m2d_buffer* buf, bool parkable)
+{
+    if (buf)
+        buf->parkable = parkable;
+}
+
+void m2d_get_park_stats(struct m2d_park_stats* stats)
+{
+    *stats = park.stats;
+}
+
+int m2d_use_buffer(struct m2d_buffer* buf)
+{
+    if (!buf)
+        return 0;
+
+    buf->last_use = __atomic_add_fetch(&park.clock, 1, __ATOMIC_RELAXED);
+
+    if (unlikely(buf->parked))
+        return m2d_unpark(buf);
+
+    return 0;
+}
+
+void m2d_park_free(struct m2d_buffer* buf)
+{
+    if (!buf->parked)
+        return;
+
+    park.stats.num_parked--;
+    park.stats.parked_bytes -= m2d_buffer_size(buf);
+    park.stats.compressed_bytes -= buf->parked_size;
+
+    free(buf->parked);
+    buf->parked = NULL;
+    buf->parked_size = 0;
+}
+
+static size_t park_reclaim(size_t bytes, void* data)
+{
+    struct m2d_buffer* buf;
+    size_t released = 0;
+
+    (void)data;
+
+    while (released < bytes)
+    {
+        buf = m2d_memory_park_candidate();
+        if (!buf)
+            break;
+
+        /* Don't pick it again. */
+        if (m2d_park(buf))
+        {
+            buf->parkable = false;
+            continue;
+        }
+
+        released += m2d_buffer_size(buf);
+    }
+
+    return released;
+}
+
+void m2d_park_init(void)
+{
+    /* Registered first, hence tried last: parking costs a copy both ways. */
+    park.reclaimer.reclaim = park_reclaim;
+    m2d_register_reclaimer(&park.reclaimer);
+}
+
+void m2d_park_cleanup(void)
+{
+    m2d_unregister_reclaimer(&park.reclaimer);
+}
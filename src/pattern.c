@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/m2d.h"
+#include "m2d_priv.h"
+
+/* Patterns filling up to this many pixels are drawn by the CPU. */
+#define PATTERN_CPU_MAX_PIXELS (64 * 64)
+
+/*
+ * Pattern fills.
+ *
+ * A pattern drawn tile by tile takes one draw per tile, with its own source
+ * origin. Copies rather draw the tiles of the first pattern period, then
+ * double the area filled with copies of the target onto itself: down the
+ * first columns, then across. An 800x480 area takes a dozen draws whatever
+ * the tile size.
+ *
+ * Blends can't be doubled that way: the pattern is repeated by the CPU into
+ * a surface of the area size, cached with the scaled variants as a nine-patch
+ * without borders, and drawn at once.
+ *
+ * Tiny areas aren't worth a GPU submission: the CPU renderer draws their
+ * tiles instead. So does the CPU renderer selected by the caller.
+ */
+
+/* The start of the tile at or before @pos, tiles of @size starting at @origin. */
+static dim_t pattern_tile_start(dim_t pos, dim_t origin, dim_t size)
+{
+    dim_t phase = (pos - origin) % size;
+
+    return pos - (phase < 0 ? phase + size : phase);
+}
+
+/* Draw the tiles of the pattern at (@x, @y) overlapping @area, clipped to it. */
+static void pattern_draw_tiles(struct m2d_buffer* src, const struct m2d_rectangle* src_rect,
+                               const struct m2d_rectangle* area, dim_t x, dim_t y)
+{
+    struct m2d_rectangle tile;
+    struct m2d_rectangle rect;
+
+    tile.w = src_rect->w;
+    tile.h = src_rect->h;
+
+    for (tile.y = pattern_tile_start(area->y, y, tile.h); tile.y < area->y + area->h;
+         tile.y += tile.h)
+    {
+        for (tile.x = pattern_tile_start(area->x, x, tile.w); tile.x < area->x + area->w;
+             tile.x += tile.w)
+        {
+            if (!m2d_intersect(&tile, area, &rect))
+                continue;
+
+            m2d_set_source(M2D_SRC, src, tile.x - src_rect->x, tile.y - src_rect->y);
+            m2d_draw_rectangles(&rect, 1);
+        }
+    }
+}
+
+void m2d_expand_target(const struct m2d_rectangle* rect, dim_t width, dim_t height)
+{
+    struct m2d_buffer* target = m2d_get_target();
+    struct m2d_rectangle band;
+    dim_t done;
+    dim_t n;
+
+    if (!target || width <= 0 || height <= 0)
+        return;
+
+    band.x = rect->x;
+    band.w = width;
+    for (done = height; done < rect->h; done += n)
+    {
+        n = min_int(done, rect->h - done);
+        band.y = rect->y + done;
+        band.h = n;
+        m2d_set_source(M2D_SRC, target, 0, done);
+        m2d_draw_rectangles(&band, 1);
+    }
+
+    band.y = rect->y;
+    band.h = rect->h;
+    for (done = width; done < rect->w; done += n)
+    {
+        n = min_int(done, rect->w - done);
+        band.x = rect->x + done;
+        band.w = n;
+        m2d_set_source(M2D_SRC, target, done, 0);
+        m2d_draw_rectangles(&band, 1);
+    }
+}
+
+void m2d_fill_pattern(const struct m2d_rectangle* src_rect, const struct m2d_rectangle* dst_rect,
+                      dim_t x, dim_t y)
+{
+    static const struct m2d_insets no_insets;
+    struct m2d_buffer* src = m2d_get_source(M2D_SRC);
+    struct m2d_buffer* variant = NULL;
+    struct m2d_rectangle first;
+    bool tiny;
+    dim_t start_x;
+    dim_t start_y;
+
+    if (!src)
+    {
+        LIBM2D_ERROR("no source surface to fill a pattern from\n");
+        return;
+    }
+
+    if (!m2d_source_rect_is_valid(src, src_rect))
+        return;
+
+    if (src_rect->w <= 0 || src_rect->h <= 0 || dst_rect->w <= 0 || dst_rect->h <= 0)
+        return;
+
+    tiny = (size_t)dst_rect->w * (size_t)dst_rect->h <= PATTERN_CPU_MAX_PIXELS;
+    start_x = pattern_tile_start(dst_rect->x, x, src_rect->w);
+    start_y = pattern_tile_start(dst_rect->y, y, src_rect->h);
+
+    /* From the start of the first tile, so that the surface is a nine-patch. */
+    if (m2d_get_renderer() == M2D_RENDERER_GPU && !tiny && m2d_blend_is_enabled())
+    {
+        variant = m2d_nine_patch_variant(src, src_rect, &no_insets,
+                                         dst_rect->x + dst_rect->w - start_x,
+                                         dst_rect->y + dst_rect->h - start_y,
+                                         M2D_NINE_PATCH_REPEAT);
+        if (!variant)
+            return;
+    }
+
+    m2d_push_state();
+    m2d_source_enable(M2D_SRC, true);
+
+    if (variant)
+    {
+        m2d_set_source(M2D_SRC, variant, start_x, start_y);
+        m2d_draw_rectangles(dst_rect, 1);
+    }
+    else if (tiny || m2d_get_renderer() != M2D_RENDERER_GPU)
+    {
+        if (m2d_get_renderer() == M2D_RENDERER_GPU)
+            m2d_set_renderer(M2D_RENDERER_CPU);
+        pattern_draw_tiles(src, src_rect, dst_rect, x, y);
+    }
+    else
+    {
+        first = *dst_rect;
+        first.w = min_int(first.w, src_rect->w);
+        first.h = min_int(first.h, src_rect->h);
+        pattern_draw_tiles(src, src_rect, &first, x, y);
+        m2d_expand_target(dst_rect, first.w, first.h);
+    }
+
+    m2d_pop_state();
+}
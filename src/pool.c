@@ -0,0 +1,295 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/m2d.h"
+#include "m2d_priv.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Thread pool for the CPU renderer and conversions.
+ *
+ * The jobs of a run are split into one range per thread, the calling thread
+ * included. Each thread takes the jobs of its range in order: the tiles of a
+ * band of rows are next to each other. Once done, it steals the second half
+ * of the range of another thread, so that uneven jobs don't leave cores idle.
+ *
+ * Runs are serialized: the loader threads may convert images while the
+ * render thread draws. Jobs run from a worker run inline.
+ */
+struct pool_worker
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    size_t begin;
+    size_t end;
+    uint64_t generation;
+};
+
+static struct
+{
+    pthread_mutex_t run_lock;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+
+    /* The workers, the calling thread being the first one. */
+    struct pool_worker* workers;
+    unsigned int num_threads;
+    unsigned int requested_threads;
+
+    uint64_t generation;
+    unsigned int busy;
+    bool quit;
+
+    m2d_job_func func;
+    void* data;
+} pool =
+{
+    .run_lock = PTHREAD_MUTEX_INITIALIZER,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .start = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+static __thread bool pool_in_worker;
+
+/* Take the next job of @self, or steal some from another thread. */
+static bool pool_next(unsigned int self, size_t* job)
+{
+    struct pool_worker* worker = &pool.workers[self];
+    unsigned int i;
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->begin < worker->end)
+    {
+        *job = worker->begin++;
+        pthread_mutex_unlock(&worker->lock);
+        return true;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    for (i = 1; i < pool.num_threads; i++)
+    {
+        struct pool_worker* victim = &pool.workers[(self + i) % pool.num_threads];
+        size_t begin;
+        size_t end;
+
+        pthread_mutex_lock(&victim->lock);
+        end = victim->end;
+        begin = end;
+        if (victim->begin < end)
+        {
+            begin = end - (end - victim->begin + 1) / 2;
+            victim->end = begin;
+        }
+        pthread_mutex_unlock(&victim->lock);
+
+        if (begin == end)
+            continue;
+
+        pthread_mutex_lock(&worker->lock);
+        worker->begin = begin + 1;
+        worker->end = end;
+        pthread_mutex_unlock(&worker->lock);
+
+        *job = begin;
+        return true;
+    }
+
+    return false;
+}
+
+static void pool_work(unsigned int self)
+{
+    size_t job;
+
+    while (pool_next(self, &job))
+        pool.func(job, pool.data);
+}
+
+static void* pool_thread(void* arg)
+{
+    unsigned int self = (unsigned int)(uintptr_t)arg;
+    uint64_t generation = pool.workers[self].generation;
+
+    pool_in_worker = true;
+
+    pthread_mutex_lock(&pool.lock);
+    for (;;)
+    {
+        while (!pool.quit && pool.generation == generation)
+            pthread_cond_wait(&pool.start, &pool.lock);
+
+        if (pool.quit)
+            break;
+
+        generation = pool.generation;
+        pthread_mutex_unlock(&pool.lock);
+
+        pool_work(self);
+
+        pthread_mutex_lock(&pool.lock);
+        if (!--pool.busy)
+            pthread_cond_signal(&pool.done);
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    return NULL;
+}
+
+static void pool_stop(void)
+{
+    unsigned int i;
+
+    if (!pool.workers)
+        return;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.quit = true;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (i = 1; i < pool.num_threads; i++)
+        pthread_join(pool.workers[i].thread, NULL);
+
+    for (i = 0; i < pool.num_threads; i++)
+        pthread_mutex_destroy(&pool.workers[i].lock);
+
+    free(pool.workers);
+    pool.workers = NULL;
+    pool.num_threads = 0;
+    pool.quit = false;
+}
+
+static void pool_start(void)
+{
+    unsigned int num_threads = pool.requested_threads;
+    unsigned int i;
+    long cpus;
+    int ret;
+
+    if (!num_threads)
+    {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cpus > 0 ? (unsigned int)cpus : 1;
+    }
+
+    pool.workers = calloc(num_threads, sizeof(*pool.workers));
+    if (!pool.workers)
+    {
+        LIBM2D_ERROR("could not allocate memory for the thread pool: %s\n", strerror(errno));
+        return;
+    }
+
+    for (i = 0; i < num_threads; i++)
+    {
+        struct pool_worker* worker = &pool.workers[i];
+
+        pthread_mutex_init(&worker->lock, NULL);
+        if (!i)
+            continue;
+
+        /* The thread waits for the next run. */
+        worker->generation = pool.generation;
+        ret = pthread_create(&worker->thread, NULL, pool_thread, (void*)(uintptr_t)i);
+        if (ret)
+        {
+            /* Go on with the threads created so far. */
+            LIBM2D_ERROR("could not create CPU thread: %s\n", strerror(ret));
+            pthread_mutex_destroy(&worker->lock);
+            break;
+        }
+    }
+
+    /* Published to the threads by the start of the next run. */
+    pool.num_threads = i;
+
+    LIBM2D_DEBUG("CPU rendering on %u thread(s)\n", pool.num_threads);
+}
+
+void m2d_pool_run(size_t num_jobs, m2d_job_func func, void* data)
+{
+    size_t first;
+    size_t i;
+
+    if (num_jobs > 1 && !pool_in_worker)
+    {
+        pthread_mutex_lock(&pool.run_lock);
+
+        if (!pool.workers)
+            pool_start();
+
+        if (pool.num_threads > 1)
+        {
+            for (i = 0, first = 0; i < pool.num_threads; i++)
+            {
+                size_t count = num_jobs / pool.num_threads + (i < num_jobs % pool.num_threads);
+
+                pool.workers[i].begin = first;
+                pool.workers[i].end = first + count;
+                first += count;
+            }
+
+            pthread_mutex_lock(&pool.lock);
+            pool.func = func;
+            pool.data = data;
+            pool.busy = pool.num_threads - 1;
+            pool.generation++;
+            pthread_cond_broadcast(&pool.start);
+            pthread_mutex_unlock(&pool.lock);
+
+            pool_in_worker = true;
+            pool_work(0);
+            pool_in_worker = false;
+
+            /* Join: the caller hands the surfaces back to the GPU next. */
+            pthread_mutex_lock(&pool.lock);
+            while (pool.busy)
+                pthread_cond_wait(&pool.done, &pool.lock);
+            pthread_mutex_unlock(&pool.lock);
+
+            pthread_mutex_unlock(&pool.run_lock);
+            return;
+        }
+
+        pthread_mutex_unlock(&pool.run_lock);
+    }
+
+    for (i = 0; i < num_jobs; i++)
+        func(i, data);
+}
+
+unsigned int m2d_pool_num_threads(void)
+{
+    unsigned int num_threads;
+
+    pthread_mutex_lock(&pool.run_lock);
+    if (!pool.workers)
+        pool_start();
+    num_threads = pool.num_threads ? pool.num_threads : 1;
+    pthread_mutex_unlock(&pool.run_lock);
+
+    return num_threads;
+}
+
+void m2d_set_cpu_threads(unsigned int num_threads)
+{
+    pthread_mutex_lock(&pool.run_lock);
+    pool_stop();
+    pool.requested_threads = num_threads;
+    pthread_mutex_unlock(&pool.run_lock);
+}
+
+void m2d_pool_cleanup(void)
+{
+    pthread_mutex_lock(&pool.run_lock);
+    pool_stop();
+    pthread_mutex_unlock(&pool.run_lock);
+}
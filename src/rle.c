@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d_priv.h"
+
+#include <string.h>
+
+/*
+ * Run-length encoding of pixels: the unit is the pixel size (1, 2 or 4
+ * bytes). The stream is a sequence of packets starting with a header byte:
+ *
+ *   1nnnnnnn: a run, the next pixel repeated n + 1 times.
+ *   0nnnnnnn: n + 1 literal pixels follow.
+ *
+ * Flat UI graphics, transparent borders and atlas gutters shrink a lot while
+ * decoding is mostly memset() and memcpy().
+ *
+ * A run saves at least one byte over its pixels as literals, that is three
+ * pixels of one byte and two of more, so that it pays for the literal header
+ * it may add by splitting literals: the output is never larger than literals
+ * only, one header per 128 pixels.
+ */
+#define RLE_RUN 0x80
+#define RLE_MAX_COUNT 128
+
+static inline uint32_t rle_load(const uint8_t* p, size_t unit)
+{
+    uint32_t value = 0;
+
+    memcpy(&value, p, unit);
+
+    return value;
+}
+
+static inline bool rle_same(const uint8_t* src, size_t a, size_t b, size_t unit)
+{
+    return rle_load(src + a * unit, unit) == rle_load(src + b * unit, unit);
+}
+
+/* The number of times pixel @i is repeated, up to @max. */
+static size_t rle_run_length(const uint8_t* src, size_t i, size_t num_pixels, size_t max,
+                             size_t unit)
+{
+    size_t count = 1;
+
+    while (i + count < num_pixels && count < max && rle_same(src, i, i + count, unit))
+        count++;
+
+    return count;
+}
+
+size_t m2d_rle_bound(size_t size, size_t unit)
+{
+    return size + (size / unit + RLE_MAX_COUNT - 1) / RLE_MAX_COUNT;
+}
+
+size_t m2d_rle_encode(void* dst, const void* src, size_t size, size_t unit)
+{
+    const uint8_t* s = src;
+    uint8_t* d = dst;
+    size_t num_pixels = size / unit;
+    size_t min_run = unit == 1 ? 3 : 2;
+    size_t i = 0;
+
+    while (i < num_pixels)
+    {
+        size_t count = rle_run_length(s, i, num_pixels, RLE_MAX_COUNT, unit);
+
+        if (count >= min_run)
+        {
+            *d++ = RLE_RUN | (uint8_t)(count - 1);
+            memcpy(d, s + i * unit, unit);
+            d += unit;
+            i += count;
+            continue;
+        }
+
+        /* Literals stop where a run starts. */
+        count = 1;
+        while (i + count < num_pixels && count < RLE_MAX_COUNT &&
+               rle_run_length(s, i + count, num_pixels, min_run, unit) < min_run)
+            count++;
+
+        *d++ = (uint8_t)(count - 1);
+        memcpy(d, s + i * unit, count * unit);
+        d += count * unit;
+        i += count;
+    }
+
+    return (size_t)(d - (uint8_t*)dst);
+}
+
+static void rle_fill(uint8_t* dst, const uint8_t* pixel, size_t count, size_t unit)
+{
+    uint16_t value16;
+    uint32_t value32;
+    size_t i;
+
+    switch (unit)
+    {
+    case 1:
+        memset(dst, *pixel, count);
+        break;
+
+    case 2:
+        memcpy(&value16, pixel, sizeof(value16));
+        for (i = 0; i < count; i++)
+            ((uint16_t*)dst)[i] = value16;
+        break;
+
+    default:
+        memcpy(&value32, pixel, sizeof(value32));
+        for (i = 0; i < count; i++)
+            ((uint32_t*)dst)[i] = value32;
+        break;
+    }
+}
+
+int m2d_rle_decode(void* dst, size_t size, const void* src, size_t src_size,
+                   size_t unit)
+{
+    const uint8_t* s = src;
+    const uint8_t* s_end = s + src_size;
+    uint8_t* d = dst;
+    uint8_t* d_end = d + size;
+
+    while (d < d_end)
+    {
+        size_t count;
+        size_t bytes;
+        uint8_t header;
+
+        if (s == s_end)
+            return -1;
+
+        header = *s++;
+        count = (header & ~RLE_RUN) + 1;
+        bytes = count * unit;
+        if (bytes > (size_t)(d_end - d))
+            return -1;
+
+        if (header & RLE_RUN)
+        {
+            if ((size_t)(s_end - s) < unit)
+                return -1;
+
+            rle_fill(d, s, count, unit);
+            s += unit;
+        }
+        else
+        {
+            if ((size_t)(s_end - s) < bytes)
+                return -1;
+
+            memcpy(d, s, bytes);
+            s += bytes;
+        }
+
+        d += bytes;
+    }
+
+    return s == s_end ? 0 : -1;
+}
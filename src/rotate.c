@@ -0,0 +1,462 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/convert.h"
+#include "m2d_priv.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define ROTATE_TIMEOUT_SECS 1
+
+/*
+ * Blocks are split in halves until they fit in the L1 cache, whatever its
+ * size: a block of the source and its transposed block in the destination.
+ */
+#define ROTATE_BLOCK_BYTES 4096
+
+/* Rows of the source rotated by each CPU thread at once. */
+#define ROTATE_BAND_ROWS 64
+
+/* Side of the 16-bit transposes in registers. */
+#if defined(__ARM_NEON)
+#define ROTATE_TILE16 4
+#else
+#define ROTATE_TILE16 8
+#endif
+
+/*
+ * Rotations and flips.
+ *
+ * Transforms flip first, then rotate clockwise. A transform is normalized to
+ * an optional FLIP_X and a rotation: FLIP_Y is FLIP_X rotated by 180 degrees.
+ *
+ * Source pixel (x, y) lands at @origin + x * @x_step + y * @y_step in the
+ * destination. For 90 and 270 degrees, source rows become destination
+ * columns: the pixels are transposed by tiles in SIMD registers, in blocks
+ * small enough for the cache, so that both sides are accessed by lines.
+ */
+struct rotate_job
+{
+    uint8_t* origin;
+    ptrdiff_t x_step;
+    ptrdiff_t y_step;
+    const uint8_t* src;
+    size_t src_stride;
+    size_t width;
+    size_t height;
+    size_t bpp;
+    bool transposed;
+};
+
+static unsigned int rotate_normalize(unsigned int transform)
+{
+    unsigned int rotation = transform & 3;
+    unsigned int flip = transform & M2D_TRANSFORM_FLIP_X;
+
+    if (transform & M2D_TRANSFORM_FLIP_Y)
+    {
+        rotation = (rotation + 2) & 3;
+        flip ^= M2D_TRANSFORM_FLIP_X;
+    }
+
+    return rotation | flip;
+}
+
+void m2d_transform_rect(unsigned int transform, size_t width, size_t height,
+                        const struct m2d_rectangle* rect, struct m2d_rectangle* result)
+{
+    dim_t w = (dim_t)width;
+    dim_t h = (dim_t)height;
+    struct m2d_rectangle r = *rect;
+
+    transform = rotate_normalize(transform);
+
+    if (transform & M2D_TRANSFORM_FLIP_X)
+        r.x = w - r.x - r.w;
+
+    switch (transform & 3)
+    {
+    case M2D_TRANSFORM_ROTATE_90:
+        result->x = h - r.y - r.h;
+        result->y = r.x;
+        result->w = r.h;
+        result->h = r.w;
+        break;
+    case M2D_TRANSFORM_ROTATE_180:
+        result->x = w - r.x - r.w;
+        result->y = h - r.y - r.h;
+        result->w = r.w;
+        result->h = r.h;
+        break;
+    case M2D_TRANSFORM_ROTATE_270:
+        result->x = r.y;
+        result->y = w - r.x - r.w;
+        result->w = r.h;
+        result->h = r.w;
+        break;
+    default:
+        *result = r;
+        break;
+    }
+}
+
+/* The destination address of the source pixel (@x, @y). */
+static inline uint8_t* rotate_dst(const struct rotate_job* job, size_t x, size_t y)
+{
+    return job->origin + (ptrdiff_t)x * job->x_step + (ptrdiff_t)y * job->y_step;
+}
+
+static inline const uint8_t* rotate_src(const struct rotate_job* job, size_t x, size_t y)
+{
+    return job->src + y * job->src_stride + x * job->bpp;
+}
+
+static void rotate_pixel(const struct rotate_job* job, size_t x, size_t y)
+{
+    uint8_t* d = rotate_dst(job, x, y);
+    const uint8_t* s = rotate_src(job, x, y);
+
+    switch (job->bpp)
+    {
+    case 4:
+        *(uint32_t*)d = *(const uint32_t*)s;
+        break;
+    case 2:
+        *(uint16_t*)d = *(const uint16_t*)s;
+        break;
+    default:
+        *d = *s;
+        break;
+    }
+}
+
+/*
+ * Transpose the 4x4 32-bit tile at (@x, @y): source column @x + i is stored
+ * along a destination row, reversed if the source rows go right to left.
+ */
+static void rotate_tile32(const struct rotate_job* job, size_t x, size_t y)
+{
+    bool reverse = job->y_step < 0;
+    size_t i;
+#if defined(__ARM_NEON)
+    uint32x4_t r0 = vld1q_u32((const uint32_t*)rotate_src(job, x, y));
+    uint32x4_t r1 = vld1q_u32((const uint32_t*)rotate_src(job, x, y + 1));
+    uint32x4_t r2 = vld1q_u32((const uint32_t*)rotate_src(job, x, y + 2));
+    uint32x4_t r3 = vld1q_u32((const uint32_t*)rotate_src(job, x, y + 3));
+    uint32x4x2_t t01 = vtrnq_u32(r0, r1);
+    uint32x4x2_t t23 = vtrnq_u32(r2, r3);
+    uint32x4_t c[4];
+
+    c[0] = vcombine_u32(vget_low_u32(t01.val[0]), vget_low_u32(t23.val[0]));
+    c[1] = vcombine_u32(vget_low_u32(t01.val[1]), vget_low_u32(t23.val[1]));
+    c[2] = vcombine_u32(vget_high_u32(t01.val[0]), vget_high_u32(t23.val[0]));
+    c[3] = vcombine_u32(vget_high_u32(t01.val[1]), vget_high_u32(t23.val[1]));
+
+    for (i = 0; i < 4; i++)
+    {
+        if (reverse)
+        {
+            c[i] = vrev64q_u32(c[i]);
+            c[i] = vextq_u32(c[i], c[i], 2);
+        }
+        vst1q_u32((uint32_t*)rotate_dst(job, x + i, reverse ? y + 3 : y), c[i]);
+    }
+#elif defined(__SSE2__)
+    __m128i r0 = _mm_loadu_si128((const __m128i*)rotate_src(job, x, y));
+    __m128i r1 = _mm_loadu_si128((const __m128i*)rotate_src(job, x, y + 1));
+    __m128i r2 = _mm_loadu_si128((const __m128i*)rotate_src(job, x, y + 2));
+    __m128i r3 = _mm_loadu_si128((const __m128i*)rotate_src(job, x, y + 3));
+    __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+    __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+    __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+    __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+    __m128i c[4];
+
+    c[0] = _mm_unpacklo_epi64(t0, t1);
+    c[1] = _mm_unpackhi_epi64(t0, t1);
+    c[2] = _mm_unpacklo_epi64(t2, t3);
+    c[3] = _mm_unpackhi_epi64(t2, t3);
+
+    for (i = 0; i < 4; i++)
+    {
+        if (reverse)
+            c[i] = _mm_shuffle_epi32(c[i], 0x1b);
+        _mm_storeu_si128((__m128i*)rotate_dst(job, x + i, reverse ? y + 3 : y), c[i]);
+    }
+#else
+    size_t j;
+
+    (void)reverse;
+    for (j = 0; j < 4; j++)
+        for (i = 0; i < 4; i++)
+            rotate_pixel(job, x + i, y + j);
+#endif
+}
+
+/* Transpose the ROTATE_TILE16 squared 16-bit tile at (@x, @y). */
+static void rotate_tile16(const struct rotate_job* job, size_t x, size_t y)
+{
+    bool reverse = job->y_step < 0;
+    size_t i;
+#if defined(__ARM_NEON)
+    uint16x4_t r0 = vld1_u16((const uint16_t*)rotate_src(job, x, y));
+    uint16x4_t r1 = vld1_u16((const uint16_t*)rotate_src(job, x, y + 1));
+    uint16x4_t r2 = vld1_u16((const uint16_t*)rotate_src(job, x, y + 2));
+    uint16x4_t r3 = vld1_u16((const uint16_t*)rotate_src(job, x, y + 3));
+    uint16x4x2_t t01 = vtrn_u16(r0, r1);
+    uint16x4x2_t t23 = vtrn_u16(r2, r3);
+    uint32x2x2_t c02 = vtrn_u32(vreinterpret_u32_u16(t01.val[0]), vreinterpret_u32_u16(t23.val[0]));
+    uint32x2x2_t c13 = vtrn_u32(vreinterpret_u32_u16(t01.val[1]), vreinterpret_u32_u16(t23.val[1]));
+    uint16x4_t c[4];
+
+    c[0] = vreinterpret_u16_u32(c02.val[0]);
+    c[1] = vreinterpret_u16_u32(c13.val[0]);
+    c[2] = vreinterpret_u16_u32(c02.val[1]);
+    c[3] = vreinterpret_u16_u32(c13.val[1]);
+
+    for (i = 0; i < 4; i++)
+    {
+        if (reverse)
+            c[i] = vrev64_u16(c[i]);
+        vst1_u16((uint16_t*)rotate_dst(job, x + i, reverse ? y + 3 : y), c[i]);
+    }
+#elif defined(__SSE2__)
+    __m128i a[8];
+    __m128i b[8];
+    __m128i c[8];
+
+    for (i = 0; i < 8; i += 2)
+    {
+        __m128i r0 = _mm_loadu_si128((const __m128i*)rotate_src(job, x, y + i));
+        __m128i r1 = _mm_loadu_si128((const __m128i*)rotate_src(job, x, y + i + 1));
+
+        a[i] = _mm_unpacklo_epi16(r0, r1);
+        a[i + 1] = _mm_unpackhi_epi16(r0, r1);
+    }
+
+    b[0] = _mm_unpacklo_epi32(a[0], a[2]);
+    b[1] = _mm_unpackhi_epi32(a[0], a[2]);
+    b[2] = _mm_unpacklo_epi32(a[1], a[3]);
+    b[3] = _mm_unpackhi_epi32(a[1], a[3]);
+    b[4] = _mm_unpacklo_epi32(a[4], a[6]);
+    b[5] = _mm_unpackhi_epi32(a[4], a[6]);
+    b[6] = _mm_unpacklo_epi32(a[5], a[7]);
+    b[7] = _mm_unpackhi_epi32(a[5], a[7]);
+
+    for (i = 0; i < 4; i++)
+    {
+        c[2 * i] = _mm_unpacklo_epi64(b[i], b[i + 4]);
+        c[2 * i + 1] = _mm_unpackhi_epi64(b[i], b[i + 4]);
+    }
+
+    for (i = 0; i < 8; i++)
+    {
+        if (reverse)
+        {
+            c[i] = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c[i], 0x1b), 0x1b);
+            c[i] = _mm_shuffle_epi32(c[i], 0x4e);
+        }
+        _mm_storeu_si128((__m128i*)rotate_dst(job, x + i, reverse ? y + 7 : y), c[i]);
+    }
+#else
+    size_t j;
+
+    (void)reverse;
+    for (j = 0; j < ROTATE_TILE16; j++)
+        for (i = 0; i < ROTATE_TILE16; i++)
+            rotate_pixel(job, x + i, y + j);
+#endif
+}
+
+static void rotate_tiles(const struct rotate_job* job, size_t x0, size_t y0, size_t w, size_t h)
+{
+    size_t tile = job->bpp == 4 ? 4 : job->bpp == 2 ? ROTATE_TILE16 : 1;
+    size_t tw = w - w % tile;
+    size_t th = h - h % tile;
+    size_t x;
+    size_t y;
+
+    /* Down the source columns: the stores go along the destination rows. */
+    if (tile > 1)
+    {
+        for (x = x0; x < x0 + tw; x += tile)
+        {
+            for (y = y0; y < y0 + th; y += tile)
+            {
+                if (tile == 4 && job->bpp == 4)
+                    rotate_tile32(job, x, y);
+                else
+                    rotate_tile16(job, x, y);
+            }
+        }
+    }
+    else
+    {
+        tw = 0;
+        th = 0;
+    }
+
+    /* The right and bottom edges. */
+    for (y = y0; y < y0 + h; y++)
+        for (x = y < y0 + th ? x0 + tw : x0; x < x0 + w; x++)
+            rotate_pixel(job, x, y);
+}
+
+static void rotate_block(const struct rotate_job* job, size_t x, size_t y, size_t w, size_t h)
+{
+    size_t half;
+
+    if (w * h * job->bpp <= ROTATE_BLOCK_BYTES)
+    {
+        rotate_tiles(job, x, y, w, h);
+        return;
+    }
+
+    /* Halves on a tile boundary. */
+    if (w >= h)
+    {
+        half = (w / 2 + 7) & ~(size_t)7;
+        rotate_block(job, x, y, half, h);
+        rotate_block(job, x + half, y, w - half, h);
+    }
+    else
+    {
+        half = (h / 2 + 7) & ~(size_t)7;
+        rotate_block(job, x, y, w, half);
+        rotate_block(job, x, y + half, w, h - half);
+    }
+}
+
+static void rotate_rows(const struct rotate_job* job, size_t first, size_t last)
+{
+    size_t row_size = job->width * job->bpp;
+    size_t x;
+    size_t y;
+
+    for (y = first; y < last; y++)
+    {
+        const uint8_t* s = rotate_src(job, 0, y);
+        uint8_t* d = rotate_dst(job, 0, y);
+
+        if (job->x_step > 0)
+        {
+            memcpy(d, s, row_size);
+            continue;
+        }
+
+        /* Mirrored: @d is the address of the last pixel of the row. */
+        switch (job->bpp)
+        {
+        case 4:
+            for (x = 0; x < job->width; x++)
+                ((uint32_t*)d)[-(ptrdiff_t)x] = ((const uint32_t*)s)[x];
+            break;
+        case 2:
+            for (x = 0; x < job->width; x++)
+                ((uint16_t*)d)[-(ptrdiff_t)x] = ((const uint16_t*)s)[x];
+            break;
+        default:
+            for (x = 0; x < job->width; x++)
+                d[-(ptrdiff_t)x] = s[x];
+            break;
+        }
+    }
+}
+
+static void rotate_band(size_t band, void* data)
+{
+    const struct rotate_job* job = data;
+    size_t first = band * ROTATE_BAND_ROWS;
+    size_t last = first + ROTATE_BAND_ROWS < job->height ? first + ROTATE_BAND_ROWS : job->height;
+
+    if (job->transposed)
+        rotate_block(job, 0, first, job->width, last - first);
+    else
+        rotate_rows(job, first, last);
+}
+
+int m2d_rotate(void* dst, size_t dst_stride, const void* src, size_t src_stride,
+               enum m2d_pixel_format format, size_t width, size_t height,
+               unsigned int transform)
+{
+    struct m2d_rectangle origin = { 0, 0, 1, 1 };
+    struct m2d_rectangle right = { 1, 0, 1, 1 };
+    struct m2d_rectangle below = { 0, 1, 1, 1 };
+    struct rotate_job job;
+
+    job.bpp = m2d_byte_per_pixel(format);
+    if (!job.bpp)
+        return -1;
+
+    if (!width || !height)
+        return 0;
+
+    /* Where the pixels (0, 0), (1, 0) and (0, 1) of the source land. */
+    m2d_transform_rect(transform, width, height, &origin, &origin);
+    m2d_transform_rect(transform, width, height, &right, &right);
+    m2d_transform_rect(transform, width, height, &below, &below);
+
+    job.origin = (uint8_t*)dst + (size_t)origin.y * dst_stride + (size_t)origin.x * job.bpp;
+    job.x_step = (right.y - origin.y) * (ptrdiff_t)dst_stride +
+                 (right.x - origin.x) * (ptrdiff_t)job.bpp;
+    job.y_step = (below.y - origin.y) * (ptrdiff_t)dst_stride +
+                 (below.x - origin.x) * (ptrdiff_t)job.bpp;
+    job.transposed = right.y != origin.y;
+    job.src = src;
+    job.src_stride = src_stride;
+    job.width = width;
+    job.height = height;
+
+    m2d_pool_run((height + ROTATE_BAND_ROWS - 1) / ROTATE_BAND_ROWS, rotate_band, &job);
+
+    return 0;
+}
+
+int m2d_blit_transformed(struct m2d_buffer* dst, struct m2d_buffer* src, unsigned int transform)
+{
+    bool transposed = rotate_normalize(transform) & 1;
+    struct timespec timeout;
+    void* dst_data;
+    void* src_data;
+    int ret = -1;
+
+    if (dst->format != src->format ||
+        dst->width != (transposed ? src->height : src->width) ||
+        dst->height != (transposed ? src->width : src->height))
+    {
+        LIBM2D_ERROR("buffer %u doesn't fit buffer %u transformed\n", dst->id, src->id);
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &timeout);
+    timeout.tv_sec += ROTATE_TIMEOUT_SECS;
+    if (m2d_sync_for_cpu_read(src, &timeout) || m2d_sync_for_cpu(dst, &timeout))
+        goto sync;
+
+    src_data = m2d_get_data(src);
+    dst_data = m2d_get_data(dst);
+    if (!src_data || !dst_data)
+    {
+        LIBM2D_ERROR("buffers %u and %u can't be accessed by the CPU\n", dst->id, src->id);
+        goto sync;
+    }
+
+    ret = m2d_rotate(dst_data, dst->stride, src_data, src->stride, src->format,
+                     src->width, src->height, transform);
+
+sync:
+    m2d_sync_for_gpu(dst);
+    m2d_sync_for_gpu(src);
+
+    return ret;
+}
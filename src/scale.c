@@ -0,0 +1,761 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/convert.h"
+#include "m2d_priv.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define SCALE_TIMEOUT_SECS 1
+
+/* Scaled variants kept by default, in bytes. */
+#define SCALE_DEFAULT_BUDGET (4 * 1024 * 1024)
+
+/* Rows of the scaled surface resampled by each CPU thread at once. */
+#define SCALE_BAND_ROWS 32
+
+/*
+ * Stretched blits.
+ *
+ * The GPU can't scale: the source is resampled by the CPU into a surface of
+ * the destination size, drawn by a plain copy or blend. Such scaled variants
+ * are cached, least recently used first, so that the icons of a layout are
+ * resampled once.
+ *
+ * A variant is keyed by the source buffer id and content generation, the
+ * source rectangle, the destination size and the filter: it goes stale as
+ * soon as the source is drawn to or synchronized for the CPU to write.
+ *
+ * The sources of a transformed target are cached the same way, rotated or
+ * flipped instead of resampled, and so are blurred surfaces, composed
+ * nine-patches and color key masks: see blur.c, ninepatch.c and colorkey.c
+ *
+ * The resampler works in 16.16 fixed point, on ARGB8888 rows: other formats
+ * are converted on the fly. Bilinear filtering keeps the last two source rows
+ * resampled horizontally, which upscaling reuses for several rows.
+ */
+struct scale_key
+{
+    struct m2d_rectangle src_rect;
+    dim_t width;
+    dim_t height;
+    enum m2d_filter filter;
+    unsigned int transform;
+    unsigned int blur_radius;
+    bool shadow;
+    uint32_t shadow_color;
+    bool nine_patch;
+    struct m2d_insets insets;
+    enum m2d_nine_patch_mode nine_patch_mode;
+    bool color_key;
+    uint32_t key_color;
+};
+
+struct scale_variant
+{
+    uint32_t src_id;
+    uint32_t src_generation;
+    struct scale_key key;
+
+    struct m2d_buffer* buf;
+
+    struct scale_variant* prev;
+    struct scale_variant* next;
+};
+
+static struct
+{
+    struct scale_variant* first;
+    struct scale_variant* last;
+
+    size_t bytes;
+    size_t budget;
+    struct m2d_reclaimer reclaimer;
+    bool registered;
+} scale =
+{
+    .budget = SCALE_DEFAULT_BUDGET,
+};
+
+struct scale_job
+{
+    uint8_t* dst;
+    size_t dst_stride;
+    size_t dst_width;
+    size_t dst_height;
+    const uint8_t* src;
+    size_t src_stride;
+    size_t src_width;
+    size_t src_height;
+    enum m2d_pixel_format format;
+    enum m2d_filter filter;
+
+    /* Per destination column: the source columns, and the bilinear weight. */
+    uint32_t* x0;
+    uint32_t* x1;
+    uint8_t* wx;
+
+    /* Set by the jobs which could not allocate their rows. */
+    bool failed;
+};
+
+/* Map the destination @i to its source coordinate, in 16.16 fixed point. */
+static inline int64_t scale_position(size_t i, size_t src_size, size_t dst_size, bool centered)
+{
+    int64_t pos = (int64_t)(((2 * (uint64_t)i + 1) * src_size << 16) / (2 * dst_size));
+
+    /* Bilinear samples between the centers of the source pixels. */
+    return centered ? pos - 0x8000 : pos;
+}
+
+static inline void scale_coords(size_t i, size_t src_size, size_t dst_size,
+                                enum m2d_filter filter, uint32_t* i0, uint32_t* i1,
+                                uint8_t* w)
+{
+    int64_t pos = scale_position(i, src_size, dst_size, filter == M2D_FILTER_BILINEAR);
+
+    if (pos < 0)
+        pos = 0;
+
+    *i0 = (uint32_t)(pos >> 16);
+    *i1 = *i0 + 1 < src_size ? *i0 + 1 : *i0;
+    *w = filter == M2D_FILTER_BILINEAR ? (uint8_t)(pos >> 8) : 0;
+}
+
+/* (a * (256 - w) + b * w) / 256 for each channel, two at a time. */
+static inline uint32_t scale_lerp(uint32_t a, uint32_t b, uint32_t w)
+{
+    uint32_t rb = ((a & 0x00ff00ffu) * (256 - w) + (b & 0x00ff00ffu) * w) >> 8;
+    uint32_t ag = ((a >> 8) & 0x00ff00ffu) * (256 - w) + ((b >> 8) & 0x00ff00ffu) * w;
+
+    return (rb & 0x00ff00ffu) | (ag & 0xff00ff00u);
+}
+
+/* Vertical pass: @w isn't 0, so that 256 - @w fits in a byte. */
+static void scale_lerp_rows(uint32_t* out, const uint32_t* a, const uint32_t* b,
+                            size_t width, uint32_t w)
+{
+    size_t x = 0;
+
+#if defined(__ARM_NEON)
+    uint8x8_t w0 = vdup_n_u8((uint8_t)(256 - w));
+    uint8x8_t w1 = vdup_n_u8((uint8_t)w);
+
+    for (; x + 4 <= width; x += 4)
+    {
+        uint8x16_t va = vreinterpretq_u8_u32(vld1q_u32(a + x));
+        uint8x16_t vb = vreinterpretq_u8_u32(vld1q_u32(b + x));
+        uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(va), w0), vget_low_u8(vb), w1);
+        uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(va), w0), vget_high_u8(vb), w1);
+
+        vst1q_u32(out + x, vreinterpretq_u32_u8(vcombine_u8(vshrn_n_u16(lo, 8),
+                                                            vshrn_n_u16(hi, 8))));
+    }
+#elif defined(__SSE2__)
+    __m128i w0 = _mm_set1_epi16((short)(256 - w));
+    __m128i w1 = _mm_set1_epi16((short)w);
+    __m128i zero = _mm_setzero_si128();
+
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + x));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + x));
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), w0),
+                                   _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), w1));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), w0),
+                                   _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), w1));
+
+        _mm_storeu_si128((__m128i*)(out + x),
+                         _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+    }
+#endif
+
+    for (; x < width; x++)
+        out[x] = scale_lerp(a[x], b[x], w);
+}
+
+/*
+ * The rows of a band: @rows[] hold the source rows @ys[] resampled
+ * horizontally, @line a source row converted to ARGB8888.
+ */
+struct scale_rows
+{
+    uint32_t* rows[2];
+    size_t ys[2];
+    uint32_t* line;
+    uint32_t* out;
+};
+
+static const uint32_t* scale_row(const struct scale_job* job, struct scale_rows* rows,
+                                 size_t y, size_t keep)
+{
+    const uint8_t* s = job->src + y * job->src_stride;
+    const uint32_t* line = (const uint32_t*)s;
+    m2d_row_func convert;
+    uint32_t* row;
+    size_t x;
+    int i;
+
+    for (i = 0; i < 2; i++)
+        if (rows->ys[i] == y)
+            return rows->rows[i];
+
+    i = rows->ys[0] == keep ? 1 : 0;
+    row = rows->rows[i];
+    rows->ys[i] = y;
+
+    if (job->format != M2D_PF_ARGB8888)
+    {
+        convert = m2d_pixel_row_func(M2D_PF_ARGB8888, job->format);
+        convert(rows->line, s, job->src_width);
+        line = rows->line;
+    }
+
+    for (x = 0; x < job->dst_width; x++)
+        row[x] = job->wx[x] ? scale_lerp(line[job->x0[x]], line[job->x1[x]], job->wx[x])
+                            : line[job->x0[x]];
+
+    return row;
+}
+
+static void scale_bilinear_band(struct scale_job* job, size_t first, size_t last)
+{
+    struct scale_rows rows;
+    m2d_row_func convert = NULL;
+    size_t y;
+
+    memset(&rows, 0, sizeof(rows));
+    rows.ys[0] = rows.ys[1] = SIZE_MAX;
+    rows.rows[0] = malloc(job->dst_width * sizeof(uint32_t));
+    rows.rows[1] = malloc(job->dst_width * sizeof(uint32_t));
+    rows.out = malloc(job->dst_width * sizeof(uint32_t));
+    rows.line = malloc(job->src_width * sizeof(uint32_t));
+    if (!rows.rows[0] || !rows.rows[1] || !rows.out || !rows.line)
+    {
+        /* Reported by the caller. */
+        __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+        goto out;
+    }
+
+    if (job->format != M2D_PF_ARGB8888)
+        convert = m2d_pixel_row_func(job->format, M2D_PF_ARGB8888);
+
+    for (y = first; y < last; y++)
+    {
+        uint8_t* d = job->dst + y * job->dst_stride;
+        uint32_t* out = convert ? rows.out : (uint32_t*)d;
+        const uint32_t* r0;
+        const uint32_t* r1;
+        uint32_t y0;
+        uint32_t y1;
+        uint8_t wy;
+
+        scale_coords(y, job->src_height, job->dst_height, job->filter, &y0, &y1, &wy);
+
+        r0 = scale_row(job, &rows, y0, SIZE_MAX);
+        if (wy)
+        {
+            r1 = scale_row(job, &rows, y1, y0);
+            scale_lerp_rows(out, r0, r1, job->dst_width, wy);
+        }
+        else
+        {
+            memcpy(out, r0, job->dst_width * sizeof(uint32_t));
+        }
+
+        if (convert)
+            convert(d, (const uint8_t*)out, job->dst_width);
+    }
+
+out:
+    free(rows.line);
+    free(rows.out);
+    free(rows.rows[1]);
+    free(rows.rows[0]);
+}
+
+static void scale_nearest_band(const struct scale_job* job, size_t first, size_t last)
+{
+    size_t bpp = m2d_byte_per_pixel(job->format);
+    size_t prev_y0 = SIZE_MAX;
+    size_t y;
+    size_t x;
+
+    for (y = first; y < last; y++)
+    {
+        uint8_t* d = job->dst + y * job->dst_stride;
+        const uint8_t* s;
+        uint32_t y0;
+        uint32_t y1;
+        uint8_t wy;
+
+        scale_coords(y, job->src_height, job->dst_height, job->filter, &y0, &y1, &wy);
+
+        /* Upscaled rows repeat the previous one. */
+        if (y0 == prev_y0)
+        {
+            memcpy(d, d - job->dst_stride, job->dst_width * bpp);
+            continue;
+        }
+        prev_y0 = y0;
+
+        s = job->src + y0 * job->src_stride;
+        switch (bpp)
+        {
+        case 4:
+            for (x = 0; x < job->dst_width; x++)
+                ((uint32_t*)d)[x] = ((const uint32_t*)s)[job->x0[x]];
+            break;
+        case 2:
+            for (x = 0; x < job->dst_width; x++)
+                ((uint16_t*)d)[x] = ((const uint16_t*)s)[job->x0[x]];
+            break;
+        default:
+            for (x = 0; x < job->dst_width; x++)
+                d[x] = s[job->x0[x]];
+            break;
+        }
+    }
+}
+
+static void scale_band(size_t band, void* data)
+{
+    struct scale_job* job = data;
+    size_t first = band * SCALE_BAND_ROWS;
+    size_t last = first + SCALE_BAND_ROWS < job->dst_height ? first + SCALE_BAND_ROWS
+                                                              : job->dst_height;
+
+    if (job->filter == M2D_FILTER_BILINEAR)
+        scale_bilinear_band(job, first, last);
+    else
+        scale_nearest_band(job, first, last);
+}
+
+static int scale_resample(struct scale_job* job)
+{
+    size_t x;
+    int ret = -1;
+
+    job->x0 = malloc(job->dst_width * sizeof(*job->x0));
+    job->x1 = malloc(job->dst_width * sizeof(*job->x1));
+    job->wx = malloc(job->dst_width * sizeof(*job->wx));
+    if (!job->x0 || !job->x1 || !job->wx)
+        goto out;
+
+    for (x = 0; x < job->dst_width; x++)
+        scale_coords(x, job->src_width, job->dst_width, job->filter,
+                     &job->x0[x], &job->x1[x], &job->wx[x]);
+
+    job->failed = false;
+    m2d_pool_run((job->dst_height + SCALE_BAND_ROWS - 1) / SCALE_BAND_ROWS, scale_band, job);
+    if (!job->failed)
+        ret = 0;
+
+out:
+    if (ret)
+        LIBM2D_ERROR("could not allocate memory to scale to %zux%zu pixels\n",
+                     job->dst_width, job->dst_height);
+
+    free(job->wx);
+    free(job->x1);
+    free(job->x0);
+
+    return ret;
+}
+
+static void scale_unlink(struct scale_variant* variant)
+{
+    if (variant->prev)
+        variant->prev->next = variant->next;
+    else
+        scale.first = variant->next;
+
+    if (variant->next)
+        variant->next->prev = variant->prev;
+    else
+        scale.last = variant->prev;
+}
+
+static void scale_link_first(struct scale_variant* variant)
+{
+    variant->prev = NULL;
+    variant->next = scale.first;
+    if (scale.first)
+        scale.first->prev = variant;
+    else
+        scale.last = variant;
+    scale.first = variant;
+}
+
+static size_t scale_evict(struct scale_variant* variant)
+{
+    size_t size = m2d_buffer_size(variant->buf);
+
+    scale_unlink(variant);
+    scale.bytes -= size;
+
+    /* Deferred CPU draws are flushed first: see m2d_free(). */
+    m2d_free(variant->buf);
+    free(variant);
+
+    return size;
+}
+
+static size_t scale_evict_bytes(size_t bytes, const struct scale_variant* keep)
+{
+    struct scale_variant* variant;
+    struct scale_variant* prev;
+    size_t released = 0;
+
+    for (variant = scale.last; variant && released < bytes; variant = prev)
+    {
+        prev = variant->prev;
+        if (variant != keep && !m2d_buffer_is_bound(variant->buf))
+            released += scale_evict(variant);
+    }
+
+    return released;
+}
+
+static size_t scale_reclaim(size_t bytes, void* data)
+{
+    (void)data;
+
+    return scale_evict_bytes(bytes, NULL);
+}
+
+/* Keys are cleared before being set: they are compared as a whole. */
+static void scale_init_key(struct scale_key* key, const struct m2d_rectangle* src_rect,
+                           dim_t width, dim_t height)
+{
+    memset(key, 0, sizeof(*key));
+    key->src_rect = *src_rect;
+    key->width = width;
+    key->height = height;
+}
+
+static struct scale_variant* scale_find(const struct m2d_buffer* src, const struct scale_key* key)
+{
+    struct scale_variant* variant;
+
+    for (variant = scale.first; variant; variant = variant->next)
+    {
+        if (variant->src_id == src->id && variant->src_generation == src->generation &&
+            !memcmp(&variant->key, key, sizeof(*key)))
+            return variant;
+    }
+
+    return NULL;
+}
+
+/*
+ * Resample the @key source rectangle of @src into a new buffer of the @key
+ * size, or transform it if the @key transform isn't M2D_TRANSFORM_NONE.
+ */
+static struct m2d_buffer* scale_create(struct m2d_buffer* src, const struct scale_key* key)
+{
+    const struct m2d_rectangle* src_rect = &key->src_rect;
+    unsigned int transform = key->transform;
+    dim_t width = key->width;
+    dim_t height = key->height;
+    size_t bpp = m2d_byte_per_pixel(src->format);
+    size_t stride = ((size_t)width * bpp + 3) & ~(size_t)3;
+    struct timespec timeout;
+    struct scale_job job;
+    struct m2d_buffer* buf;
+    uint8_t* src_data;
+
+    buf = m2d_alloc((size_t)width, (size_t)height, src->format, stride);
+    if (!buf)
+        return NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &timeout);
+    timeout.tv_sec += SCALE_TIMEOUT_SECS;
+    if (m2d_sync_for_cpu_read(src, &timeout) || m2d_sync_for_cpu(buf, &timeout))
+        goto free_buf;
+
+    src_data = m2d_get_data(src);
+    memset(&job, 0, sizeof(job));
+    job.dst = m2d_get_data(buf);
+    if (!src_data || !job.dst)
+    {
+        LIBM2D_ERROR("buffer %u can't be accessed by the CPU to be scaled\n", src->id);
+        goto sync;
+    }
+
+    job.dst_stride = buf->stride;
+    job.dst_width = (size_t)width;
+    job.dst_height = (size_t)height;
+    job.src = src_data + (size_t)src_rect->y * src->stride + (size_t)src_rect->x * bpp;
+    job.src_stride = src->stride;
+    job.src_width = (size_t)src_rect->w;
+    job.src_height = (size_t)src_rect->h;
+    job.format = src->format;
+    job.filter = key->filter;
+
+    if (transform)
+    {
+        if (m2d_rotate(job.dst, job.dst_stride, job.src, job.src_stride, job.format,
+                       job.src_width, job.src_height, transform))
+            goto sync;
+    }
+    else if (scale_resample(&job))
+    {
+        goto sync;
+    }
+
+    m2d_sync_for_gpu(buf);
+    m2d_sync_for_gpu(src);
+    m2d_set_tag(buf, transform ? "rotated" : "scaled");
+
+    if (transform)
+        LIBM2D_DEBUG("transformed buffer %u by %#x\n", src->id, transform);
+    else
+        LIBM2D_DEBUG("scaled %dx%d pixels of buffer %u to %dx%d\n",
+                     src_rect->w, src_rect->h, src->id, width, height);
+
+    return buf;
+
+sync:
+    m2d_sync_for_gpu(buf);
+    m2d_sync_for_gpu(src);
+free_buf:
+    m2d_free(buf);
+    return NULL;
+}
+
+static struct scale_variant* scale_get(struct m2d_buffer* src, const struct scale_key* key)
+{
+    struct scale_variant* variant;
+    struct m2d_buffer* buf;
+
+    variant = scale_find(src, key);
+    if (variant)
+    {
+        scale_unlink(variant);
+        scale_link_first(variant);
+        return variant;
+    }
+
+    if (key->blur_radius || key->shadow)
+        buf = m2d_blur_create(src, &key->src_rect, key->blur_radius, key->shadow,
+                              key->shadow_color);
+    else if (key->nine_patch)
+        buf = m2d_nine_patch_create(src, &key->src_rect, &key->insets, key->width, key->height,
+                                    key->nine_patch_mode);
+    else if (key->color_key)
+        buf = m2d_color_key_mask_create(src, &key->src_rect, key->key_color);
+    else
+        buf = scale_create(src, key);
+    if (!buf)
+        return NULL;
+
+    variant = calloc(1, sizeof(*variant));
+    if (!variant)
+    {
+        LIBM2D_ERROR("could not allocate memory to cache a scaled surface: %s\n",
+                     strerror(errno));
+        m2d_free(buf);
+        return NULL;
+    }
+
+    variant->src_id = src->id;
+    variant->src_generation = src->generation;
+    /* memcpy(), unlike an assignment, keeps the cleared padding bytes. */
+    memcpy(&variant->key, key, sizeof(*key));
+    variant->buf = buf;
+
+    if (!scale.registered)
+    {
+        scale.reclaimer.reclaim = scale_reclaim;
+        m2d_register_reclaimer(&scale.reclaimer);
+        scale.registered = true;
+    }
+
+    scale_link_first(variant);
+    scale.bytes += m2d_buffer_size(buf);
+
+    /* The variant being drawn stays, even above the budget. */
+    if (scale.bytes > scale.budget)
+        scale_evict_bytes(scale.bytes - scale.budget, variant);
+
+    return variant;
+}
+
+void m2d_stretch_blit(const struct m2d_rectangle* src_rect, const struct m2d_rectangle* dst_rect,
+                      enum m2d_filter filter)
+{
+    struct m2d_buffer* src = m2d_get_source(M2D_SRC);
+    struct scale_variant* variant;
+    struct scale_key key;
+
+    if (!src)
+    {
+        LIBM2D_ERROR("no source surface to stretch\n");
+        return;
+    }
+
+    if (!m2d_source_rect_is_valid(src, src_rect))
+        return;
+
+    if (dst_rect->w <= 0 || dst_rect->h <= 0)
+        return;
+
+    m2d_push_state();
+    m2d_source_enable(M2D_SRC, true);
+
+    if (dst_rect->w == src_rect->w && dst_rect->h == src_rect->h)
+    {
+        m2d_set_source(M2D_SRC, src, dst_rect->x - src_rect->x, dst_rect->y - src_rect->y);
+        m2d_draw_rectangles(dst_rect, 1);
+    }
+    else
+    {
+        scale_init_key(&key, src_rect, dst_rect->w, dst_rect->h);
+        key.filter = filter;
+        variant = scale_get(src, &key);
+        if (variant)
+        {
+            m2d_set_source(M2D_SRC, variant->buf, dst_rect->x, dst_rect->y);
+            m2d_draw_rectangles(dst_rect, 1);
+        }
+    }
+
+    m2d_pop_state();
+}
+
+struct m2d_buffer* m2d_transformed_variant(struct m2d_buffer* buf, unsigned int transform)
+{
+    struct m2d_rectangle rect;
+    struct m2d_rectangle size;
+    struct scale_variant* variant;
+    struct scale_key key;
+
+    rect.x = 0;
+    rect.y = 0;
+    rect.w = (dim_t)buf->width;
+    rect.h = (dim_t)buf->height;
+    m2d_transform_rect(transform, buf->width, buf->height, &rect, &size);
+
+    scale_init_key(&key, &rect, size.w, size.h);
+    key.transform = transform;
+    variant = scale_get(buf, &key);
+
+    return variant ? variant->buf : NULL;
+}
+
+struct m2d_buffer* m2d_blurred_variant(struct m2d_buffer* buf, const struct m2d_rectangle* src_rect,
+                                       unsigned int radius, bool shadow, uint32_t color)
+{
+    struct scale_variant* variant;
+    struct scale_key key;
+
+    scale_init_key(&key, src_rect, src_rect->w + 2 * (dim_t)radius,
+                   src_rect->h + 2 * (dim_t)radius);
+    key.blur_radius = radius;
+    key.shadow = shadow;
+    key.shadow_color = shadow ? color : 0;
+    variant = scale_get(buf, &key);
+
+    return variant ? variant->buf : NULL;
+}
+
+struct m2d_buffer* m2d_nine_patch_variant(struct m2d_buffer* buf,
+                                          const struct m2d_rectangle* src_rect,
+                                          const struct m2d_insets* insets, dim_t width,
+                                          dim_t height, enum m2d_nine_patch_mode mode)
+{
+    struct scale_variant* variant;
+    struct scale_key key;
+
+    scale_init_key(&key, src_rect, width, height);
+    key.nine_patch = true;
+    key.insets = *insets;
+    key.nine_patch_mode = mode;
+    variant = scale_get(buf, &key);
+
+    return variant ? variant->buf : NULL;
+}
+
+struct m2d_buffer* m2d_color_key_variant(struct m2d_buffer* buf,
+                                         const struct m2d_rectangle* src_rect, uint32_t key)
+{
+    struct scale_variant* variant;
+    struct scale_key scale_key;
+
+    scale_init_key(&scale_key, src_rect, src_rect->w, src_rect->h);
+    scale_key.color_key = true;
+    scale_key.key_color = key;
+    variant = scale_get(buf, &scale_key);
+
+    return variant ? variant->buf : NULL;
+}
+
+bool m2d_source_rect_is_valid(const struct m2d_buffer* buf, const struct m2d_rectangle* rect)
+{
+    struct m2d_rectangle bounds;
+    struct m2d_rectangle clipped;
+
+    bounds.x = 0;
+    bounds.y = 0;
+    bounds.w = (dim_t)buf->width;
+    bounds.h = (dim_t)buf->height;
+    if (!m2d_intersect(rect, &bounds, &clipped) || memcmp(&clipped, rect, sizeof(clipped)))
+    {
+        LIBM2D_ERROR("the source rectangle is out of buffer %u\n", buf->id);
+        return false;
+    }
+
+    return true;
+}
+
+int m2d_resample(void* dst, size_t dst_stride, size_t dst_width, size_t dst_height,
+                 const void* src, size_t src_stride, size_t src_width, size_t src_height,
+                 enum m2d_pixel_format format, enum m2d_filter filter)
+{
+    struct scale_job job;
+
+    memset(&job, 0, sizeof(job));
+    job.dst = dst;
+    job.dst_stride = dst_stride;
+    job.dst_width = dst_width;
+    job.dst_height = dst_height;
+    job.src = src;
+    job.src_stride = src_stride;
+    job.src_width = src_width;
+    job.src_height = src_height;
+    job.format = format;
+    job.filter = filter;
+
+    return scale_resample(&job);
+}
+
+void m2d_set_scale_cache_budget(size_t budget)
+{
+    scale.budget = budget;
+
+    if (scale.bytes > budget)
+        scale_evict_bytes(scale.bytes - budget, NULL);
+}
+
+void m2d_scale_cleanup(void)
+{
+    scale_evict_bytes(SIZE_MAX, NULL);
+
+    if (scale.registered)
+    {
+        m2d_unregister_reclaimer(&scale.reclaimer);
+        scale.registered = false;
+    }
+}
@@ -0,0 +1,412 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/m2d.h"
+#include "m2d_priv.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCANLINE_ONE ((int64_t)1 << 16)
+#define SCANLINE_HALF ((int64_t)1 << 15)
+
+/*
+ * Scanline conversion.
+ *
+ * Shapes are sampled at the pixel centers, row by row, into horizontal
+ * spans. A span with the same extents as one of the previous row extends the
+ * rectangle of that one by a row, so that the straight parts of polygons and
+ * the middle of ellipses are a few tall rectangles rather than one per row.
+ * The rectangles don't overlap: they are all filled with a single command.
+ *
+ * Coordinates are in 16.16 fixed point, so that the vertices of pie slices
+ * don't need to be rounded to pixels.
+ */
+struct scanline_point
+{
+    int64_t x;
+    int64_t y;
+};
+
+struct scanline_edge
+{
+    /* From top to bottom: @x at @top, moving by @slope per row. */
+    int64_t top;
+    int64_t bottom;
+    int64_t x;
+    int64_t slope;
+    int winding;
+};
+
+struct scanline
+{
+    /* The clip: the target in its logical space. */
+    dim_t width;
+    dim_t height;
+
+    struct m2d_rectangle* rects;
+    size_t num_rects;
+    size_t max_rects;
+
+    /* The rectangles reaching the last row added, from left to right. */
+    size_t* open;
+    size_t* next_open;
+    size_t num_open;
+
+    bool failed;
+};
+
+/* The first pixel whose center is at @pos or after. */
+static inline dim_t scanline_pixel(int64_t pos)
+{
+    return (dim_t)((pos - SCANLINE_HALF + SCANLINE_ONE - 1) >> 16);
+}
+
+static bool scanline_init(struct scanline* sl, size_t max_spans)
+{
+    struct m2d_buffer* target = m2d_get_target();
+
+    memset(sl, 0, sizeof(*sl));
+
+    if (!target)
+    {
+        LIBM2D_ERROR("no target surface\n");
+        return false;
+    }
+
+    sl->width = (dim_t)target->width;
+    sl->height = (dim_t)target->height;
+    if (m2d_get_target_transform() & M2D_TRANSFORM_ROTATE_90)
+    {
+        sl->width = (dim_t)target->height;
+        sl->height = (dim_t)target->width;
+    }
+
+    sl->open = malloc(max_spans * sizeof(*sl->open));
+    sl->next_open = malloc(max_spans * sizeof(*sl->next_open));
+    if (!sl->open || !sl->next_open)
+    {
+        LIBM2D_ERROR("could not allocate memory for spans: %s\n", strerror(errno));
+        free(sl->next_open);
+        free(sl->open);
+        return false;
+    }
+
+    return true;
+}
+
+static struct m2d_rectangle* scanline_new_rect(struct scanline* sl)
+{
+    struct m2d_rectangle* rects;
+    size_t max;
+
+    if (sl->num_rects == sl->max_rects)
+    {
+        max = sl->max_rects ? 2 * sl->max_rects : 64;
+        rects = realloc(sl->rects, max * sizeof(*rects));
+        if (!rects)
+        {
+            LIBM2D_ERROR("could not allocate memory for spans: %s\n", strerror(errno));
+            sl->failed = true;
+            return NULL;
+        }
+
+        sl->rects = rects;
+        sl->max_rects = max;
+    }
+
+    return &sl->rects[sl->num_rects++];
+}
+
+/*
+ * Add the @num_spans spans of row @y, pairs of start and end columns from
+ * left to right, merging them with the rectangles of the previous row.
+ */
+static void scanline_add_row(struct scanline* sl, dim_t y, const dim_t* spans, size_t num_spans)
+{
+    struct m2d_rectangle* rect = NULL;
+    size_t num_next = 0;
+    size_t* open;
+    size_t i = 0;
+    size_t k;
+
+    if (sl->failed || y < 0 || y >= sl->height)
+        return;
+
+    for (k = 0; k < num_spans; k++)
+    {
+        dim_t x0 = max_int(spans[2 * k], 0);
+        dim_t x1 = min_int(spans[2 * k + 1], sl->width);
+
+        if (x0 >= x1)
+            continue;
+
+        /* The rectangles left of the span, or narrower, end above it. */
+        while (i < sl->num_open)
+        {
+            rect = &sl->rects[sl->open[i]];
+            if (rect->x > x0 || (rect->x == x0 && rect->w == x1 - x0))
+                break;
+            i++;
+        }
+
+        if (i < sl->num_open && rect->x == x0 && rect->w == x1 - x0 && rect->y + rect->h == y)
+        {
+            rect->h++;
+            sl->next_open[num_next++] = sl->open[i++];
+            continue;
+        }
+
+        rect = scanline_new_rect(sl);
+        if (!rect)
+            return;
+
+        rect->x = x0;
+        rect->y = y;
+        rect->w = x1 - x0;
+        rect->h = 1;
+        sl->next_open[num_next++] = sl->num_rects - 1;
+    }
+
+    open = sl->open;
+    sl->open = sl->next_open;
+    sl->next_open = open;
+    sl->num_open = num_next;
+}
+
+static void scanline_finish(struct scanline* sl)
+{
+    if (!sl->failed && sl->num_rects)
+    {
+        LIBM2D_DEBUG("filling a shape with %zu span rectangle(s)\n", sl->num_rects);
+
+        m2d_push_state();
+        m2d_source_enable(M2D_SRC, false);
+        m2d_draw_rectangles(sl->rects, sl->num_rects);
+        m2d_pop_state();
+    }
+
+    free(sl->rects);
+    free(sl->next_open);
+    free(sl->open);
+}
+
+static int scanline_compare_edges(const void* a, const void* b)
+{
+    const struct scanline_edge* ea = a;
+    const struct scanline_edge* eb = b;
+
+    return ea->top < eb->top ? -1 : ea->top > eb->top;
+}
+
+/* Fill the polygon of @num_points @points, nonzero winding. */
+static void scanline_fill(const struct scanline_point* points, size_t num_points)
+{
+    struct scanline_edge* edges;
+    struct scanline_edge** active;
+    struct scanline sl;
+    int64_t* crossings;
+    int* windings;
+    dim_t* spans;
+    size_t num_edges = 0;
+    size_t num_active = 0;
+    size_t next = 0;
+    size_t i, j, n;
+    int64_t top = INT64_MAX;
+    int64_t bottom = INT64_MIN;
+    dim_t y, end;
+
+    if (num_points < 3)
+        return;
+
+    edges = malloc(num_points * sizeof(*edges));
+    active = malloc(num_points * sizeof(*active));
+    crossings = malloc(num_points * sizeof(*crossings));
+    windings = malloc(num_points * sizeof(*windings));
+    spans = malloc(num_points * sizeof(*spans));
+    if (!edges || !active || !crossings || !windings || !spans)
+    {
+        LIBM2D_ERROR("could not allocate memory for polygon: %s\n", strerror(errno));
+        goto out;
+    }
+
+    for (i = 0; i < num_points; i++)
+    {
+        const struct scanline_point* p = &points[i];
+        const struct scanline_point* q = &points[(i + 1) % num_points];
+        struct scanline_edge* edge = &edges[num_edges];
+
+        if (p->y == q->y)
+            continue;
+
+        if (p->y > q->y)
+        {
+            const struct scanline_point* tmp = p;
+
+            p = q;
+            q = tmp;
+            edge->winding = -1;
+        }
+        else
+        {
+            edge->winding = 1;
+        }
+
+        edge->top = p->y;
+        edge->bottom = q->y;
+        edge->x = p->x;
+        edge->slope = (q->x - p->x) * SCANLINE_ONE / (q->y - p->y);
+        top = p->y < top ? p->y : top;
+        bottom = q->y > bottom ? q->y : bottom;
+        num_edges++;
+    }
+
+    if (!num_edges || !scanline_init(&sl, num_points))
+        goto out;
+
+    qsort(edges, num_edges, sizeof(*edges), scanline_compare_edges);
+
+    y = max_int(scanline_pixel(top), 0);
+    end = min_int(scanline_pixel(bottom), sl.height);
+    for (; y < end && !sl.failed; y++)
+    {
+        int64_t center = (int64_t)y * SCANLINE_ONE + SCANLINE_HALF;
+        int winding = 0;
+
+        /* Edges crossing the row at its pixel centers, top included, bottom excluded. */
+        while (next < num_edges && edges[next].top <= center)
+            active[num_active++] = &edges[next++];
+
+        for (i = 0, n = 0; i < num_active; i++)
+        {
+            const struct scanline_edge* edge = active[i];
+            int64_t x;
+
+            if (edge->bottom <= center)
+                continue;
+
+            active[n] = active[i];
+            x = edge->x + (center - edge->top) * edge->slope / SCANLINE_ONE;
+
+            /* Insertion sort: few crossings, mostly in order already. */
+            for (j = n; j > 0 && crossings[j - 1] > x; j--)
+            {
+                crossings[j] = crossings[j - 1];
+                windings[j] = windings[j - 1];
+            }
+            crossings[j] = x;
+            windings[j] = edge->winding;
+            n++;
+        }
+        num_active = n;
+
+        for (i = 0, n = 0; i < num_active; i++)
+        {
+            int before = winding;
+
+            winding += windings[i];
+            if (!before && winding)
+                spans[2 * n] = scanline_pixel(crossings[i]);
+            else if (before && !winding)
+                spans[2 * n++ + 1] = scanline_pixel(crossings[i]);
+        }
+
+        scanline_add_row(&sl, y, spans, n);
+    }
+
+    scanline_finish(&sl);
+
+out:
+    free(spans);
+    free(windings);
+    free(crossings);
+    free(active);
+    free(edges);
+}
+
+void m2d_fill_polygon(const struct m2d_point* points, size_t num_points)
+{
+    struct scanline_point* fixed;
+    size_t i;
+
+    if (num_points < 3)
+        return;
+
+    fixed = malloc(num_points * sizeof(*fixed));
+    if (!fixed)
+    {
+        LIBM2D_ERROR("could not allocate memory for polygon: %s\n", strerror(errno));
+        return;
+    }
+
+    for (i = 0; i < num_points; i++)
+    {
+        fixed[i].x = (int64_t)points[i].x * SCANLINE_ONE;
+        fixed[i].y = (int64_t)points[i].y * SCANLINE_ONE;
+    }
+
+    scanline_fill(fixed, num_points);
+    free(fixed);
+}
+
+void m2d_fill_ellipse(dim_t x, dim_t y, dim_t radius_x, dim_t radius_y)
+{
+    int64_t height = 4 * (int64_t)radius_y * radius_y;
+    struct scanline sl;
+    dim_t span[2];
+    dim_t j;
+
+    if (radius_x <= 0 || radius_y <= 0 || !scanline_init(&sl, 1))
+        return;
+
+    for (j = max_int(0, radius_y - y); j < 2 * radius_y && y - radius_y + j < sl.height; j++)
+    {
+        /* In half pixels from the center: the half width is in 1/256 of a pixel. */
+        int64_t dy = 2 * (int64_t)j + 1 - 2 * (int64_t)radius_y;
+        int64_t half = (int64_t)m2d_isqrt((uint64_t)(height - dy * dy) << 14) * radius_x / radius_y;
+        dim_t n = (dim_t)((half + 128) >> 8);
+
+        span[0] = x - n;
+        span[1] = x + n;
+        scanline_add_row(&sl, y - radius_y + j, span, n > 0);
+    }
+
+    scanline_finish(&sl);
+}
+
+void m2d_fill_pie(dim_t x, dim_t y, dim_t radius, int start_angle, int end_angle)
+{
+    struct scanline_point points[2 + 360];
+    int64_t sweep = (int64_t)end_angle - start_angle;
+    int64_t i;
+    int start = start_angle;
+
+    if (radius <= 0 || !sweep)
+        return;
+
+    if (sweep <= -360 || sweep >= 360)
+    {
+        m2d_fill_ellipse(x, y, radius, radius);
+        return;
+    }
+
+    if (sweep < 0)
+    {
+        start = end_angle;
+        sweep = -sweep;
+    }
+
+    /* The center, then a vertex every degree along the arc. */
+    points[0].x = (int64_t)x * SCANLINE_ONE;
+    points[0].y = (int64_t)y * SCANLINE_ONE;
+    for (i = 0; i <= sweep; i++)
+    {
+        points[i + 1].x = points[0].x + (int64_t)radius * m2d_sin(start + (int)i + 90);
+        points[i + 1].y = points[0].y + (int64_t)radius * m2d_sin(start + (int)i);
+    }
+
+    scanline_fill(points, (size_t)sweep + 2);
+}
@@ -0,0 +1,526 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/m2d.h"
+#include "m2d_priv.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SHAPE_TIMEOUT_SECS 1
+
+/* Coverage masks kept, in bytes. */
+#define SHAPE_BUDGET (512 * 1024)
+
+/*
+ * Antialiased shapes.
+ *
+ * Only the curved parts need coverage: the CPU renders it once into a small
+ * A8 mask, cached, which the GPU blends modulated by the source color. The
+ * rest of a shape is filled with plain rectangles, all in one command.
+ *
+ * A mask holds a whole ring of the radius, width and angles of the shape, as
+ * a disc for rounded corners: its quadrants are the four corners. A quadrant
+ * drawn at the same source origin as another one goes in the same command,
+ * hence a circle or an arc is a single blend, and a rounded rectangle a fill
+ * and up to four blends.
+ *
+ * The coverage of a pixel is the distance from its center to the edges, plus
+ * half a pixel, clamped: a close enough approximation of the area inside for
+ * radii larger than a pixel.
+ */
+struct shape_key
+{
+    dim_t radius;
+    dim_t width;
+    int start;
+    int sweep;
+};
+
+/* The offset of a quadrant source origin from the mask origin. */
+struct shape_offset
+{
+    dim_t x;
+    dim_t y;
+};
+
+struct shape_entry
+{
+    struct shape_key key;
+    struct m2d_buffer* buf;
+
+    struct shape_entry* prev;
+    struct shape_entry* next;
+};
+
+static struct
+{
+    struct shape_entry* first;
+    struct shape_entry* last;
+
+    size_t bytes;
+    struct m2d_reclaimer reclaimer;
+    bool registered;
+} shapes;
+
+/* sin() of 0 to 90 degrees, in 16.16 fixed point. */
+static const int32_t shape_sin_table[91] = {
+    0, 1144, 2287, 3430, 4572, 5712, 6850, 7987,
+    9121, 10252, 11380, 12505, 13626, 14742, 15855, 16962,
+    18064, 19161, 20252, 21336, 22415, 23486, 24550, 25607,
+    26656, 27697, 28729, 29753, 30767, 31772, 32768, 33754,
+    34729, 35693, 36647, 37590, 38521, 39441, 40348, 41243,
+    42126, 42995, 43852, 44695, 45525, 46341, 47143, 47930,
+    48703, 49461, 50203, 50931, 51643, 52339, 53020, 53684,
+    54332, 54963, 55578, 56175, 56756, 57319, 57865, 58393,
+    58903, 59396, 59870, 60326, 60764, 61183, 61584, 61966,
+    62328, 62672, 62997, 63303, 63589, 63856, 64104, 64332,
+    64540, 64729, 64898, 65048, 65177, 65287, 65376, 65446,
+    65496, 65526, 65536,
+};
+
+int32_t m2d_sin(int angle)
+{
+    angle %= 360;
+    if (angle < 0)
+        angle += 360;
+
+    if (angle <= 90)
+        return shape_sin_table[angle];
+    if (angle <= 180)
+        return shape_sin_table[180 - angle];
+    if (angle <= 270)
+        return -shape_sin_table[angle - 180];
+    return -shape_sin_table[360 - angle];
+}
+
+/* Coverage in 1/256 of a pixel @distance (in 1/256 of a pixel) inside an edge. */
+static inline int32_t shape_coverage(int64_t distance)
+{
+    distance += 128;
+
+    return distance <= 0 ? 0 : distance >= 256 ? 256 : (int32_t)distance;
+}
+
+/* Coverage in 1/256 of a pixel of the side of the edge along @dir, rotated clockwise. */
+static inline int32_t shape_side(int32_t dir_x, int32_t dir_y, int64_t x, int64_t y)
+{
+    /* x and y in half pixels, the direction in 16.16: 1/512 of a pixel apart. */
+    return shape_coverage((dir_x * y - dir_y * x) / 512);
+}
+
+static struct m2d_buffer* shape_create(const struct shape_key* key)
+{
+    size_t size = 2 * (size_t)key->radius;
+    size_t stride = (size_t)(size + 3) & ~(size_t)3;
+    int64_t outer = (int64_t)key->radius * 256 + 128;
+    int64_t inner = ((int64_t)key->radius - key->width) * 256 - 128;
+    int32_t start_x = m2d_sin(key->start + 90);
+    int32_t start_y = m2d_sin(key->start);
+    int32_t end_x = m2d_sin(key->start + key->sweep + 90);
+    int32_t end_y = m2d_sin(key->start + key->sweep);
+    struct timespec timeout;
+    struct m2d_buffer* buf;
+    uint8_t* data;
+    size_t i, j;
+
+    buf = m2d_alloc(size, size, M2D_PF_A8, stride);
+    if (!buf)
+        return NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &timeout);
+    timeout.tv_sec += SHAPE_TIMEOUT_SECS;
+    if (m2d_sync_for_cpu(buf, &timeout))
+        goto free_buf;
+
+    data = m2d_get_data(buf);
+    if (!data)
+    {
+        LIBM2D_ERROR("buffer %u can't be accessed by the CPU\n", buf->id);
+        m2d_sync_for_gpu(buf);
+        goto free_buf;
+    }
+
+    for (j = 0; j < size; j++)
+    {
+        int64_t y = 2 * (int64_t)j + 1 - (int64_t)size;
+
+        for (i = 0; i < size; i++)
+        {
+            int64_t x = 2 * (int64_t)i + 1 - (int64_t)size;
+            int64_t distance = m2d_isqrt((uint64_t)(x * x + y * y) << 14);
+            int32_t coverage = shape_coverage(outer - 128 - distance);
+
+            if (coverage && key->width < key->radius)
+                coverage = min_int(coverage, shape_coverage(distance - inner - 128));
+
+            /* Within the angles: both sides of a narrow arc, either side of a wide one. */
+            if (coverage && key->sweep < 360)
+            {
+                int32_t after_start = shape_side(start_x, start_y, x, y);
+                int32_t before_end = 256 - shape_side(end_x, end_y, x, y);
+
+                coverage = min_int(coverage, key->sweep <= 180 ?
+                                   min_int(after_start, before_end) :
+                                   max_int(after_start, before_end));
+            }
+
+            data[j * stride + i] = (uint8_t)(coverage - (coverage >> 8));
+        }
+    }
+
+    m2d_sync_for_gpu(buf);
+    m2d_set_tag(buf, "shape");
+
+    LIBM2D_DEBUG("rendered the coverage of a %dx%d ring, angles %d+%d\n",
+                 key->radius, key->width, key->start, key->sweep);
+
+    return buf;
+
+free_buf:
+    m2d_free(buf);
+    return NULL;
+}
+
+static void shape_unlink(struct shape_entry* entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        shapes.first = entry->next;
+
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        shapes.last = entry->prev;
+}
+
+static void shape_link_first(struct shape_entry* entry)
+{
+    entry->prev = NULL;
+    entry->next = shapes.first;
+    if (shapes.first)
+        shapes.first->prev = entry;
+    else
+        shapes.last = entry;
+    shapes.first = entry;
+}
+
+static size_t shape_evict_bytes(size_t bytes, const struct shape_entry* keep)
+{
+    struct shape_entry* entry;
+    struct shape_entry* prev;
+    size_t released = 0;
+    size_t size;
+
+    for (entry = shapes.last; entry && released < bytes; entry = prev)
+    {
+        prev = entry->prev;
+        if (entry == keep || m2d_buffer_is_bound(entry->buf))
+            continue;
+
+        size = m2d_buffer_size(entry->buf);
+        shape_unlink(entry);
+        shapes.bytes -= size;
+        released += size;
+
+        m2d_free(entry->buf);
+        free(entry);
+    }
+
+    return released;
+}
+
+static size_t shape_reclaim(size_t bytes, void* data)
+{
+    (void)data;
+
+    return shape_evict_bytes(bytes, NULL);
+}
+
+static struct m2d_buffer* shape_get(dim_t radius, dim_t width, int start, int sweep)
+{
+    struct shape_entry* entry;
+    struct m2d_buffer* buf;
+    struct shape_key key;
+
+    memset(&key, 0, sizeof(key));
+    key.radius = radius;
+    key.width = min_int(width, radius);
+    key.start = sweep < 360 ? start : 0;
+    key.sweep = min_int(sweep, 360);
+
+    for (entry = shapes.first; entry; entry = entry->next)
+    {
+        if (!memcmp(&entry->key, &key, sizeof(key)))
+        {
+            shape_unlink(entry);
+            shape_link_first(entry);
+            return entry->buf;
+        }
+    }
+
+    buf = shape_create(&key);
+    if (!buf)
+        return NULL;
+
+    entry = calloc(1, sizeof(*entry));
+    if (!entry)
+    {
+        LIBM2D_ERROR("could not allocate memory to cache a shape: %s\n", strerror(errno));
+        m2d_free(buf);
+        return NULL;
+    }
+
+    entry->key = key;
+    entry->buf = buf;
+
+    if (!shapes.registered)
+    {
+        shapes.reclaimer.reclaim = shape_reclaim;
+        m2d_register_reclaimer(&shapes.reclaimer);
+        shapes.registered = true;
+    }
+
+    shape_link_first(entry);
+    shapes.bytes += m2d_buffer_size(buf);
+
+    /* The mask being drawn stays, even above the budget. */
+    if (shapes.bytes > SHAPE_BUDGET)
+        shape_evict_bytes(shapes.bytes - SHAPE_BUDGET, entry);
+
+    return buf;
+}
+
+/* Fill @rects in the source color, blended unless opaque, at once. */
+static void shape_fill(const struct m2d_rectangle* rects, size_t num_rects, uint32_t color)
+{
+    struct m2d_rectangle kept[3];
+    size_t i, n;
+
+    for (i = 0, n = 0; i < num_rects && n < ARRAY_SIZE(kept); i++)
+    {
+        if (rects[i].w > 0 && rects[i].h > 0)
+            kept[n++] = rects[i];
+    }
+
+    if (!n)
+        return;
+
+    m2d_source_enable(M2D_SRC, false);
+    m2d_blend_enable(color >> 24 != 255);
+    m2d_blend_factors(M2D_BLEND_SRC_ALPHA, M2D_BLEND_ONE_MINUS_SRC_ALPHA,
+                      M2D_BLEND_ONE, M2D_BLEND_ONE_MINUS_SRC_ALPHA);
+    m2d_draw_rectangles(kept, n);
+}
+
+/* Set the state to blend masks modulated by the source @color. */
+static void shape_mask_state(uint32_t color)
+{
+    uint32_t alpha = color >> 24;
+
+    m2d_source_enable(M2D_SRC, true);
+    m2d_blend_enable(true);
+    m2d_blend_factors(M2D_BLEND_ONE, M2D_BLEND_ONE_MINUS_SRC_ALPHA,
+                      M2D_BLEND_ONE, M2D_BLEND_ONE_MINUS_SRC_ALPHA);
+
+    /* Blended as a premultiplied color. */
+    m2d_source_color(((color >> 16) & 0xff) * alpha / 255, ((color >> 8) & 0xff) * alpha / 255,
+                     (color & 0xff) * alpha / 255, alpha);
+}
+
+/*
+ * Draw the @quadrants (a bit per quadrant, clockwise from the bottom right
+ * one) of @mask centered at (@x, @y), each at the source origin given by its
+ * @offsets from the mask origin, grouping the quadrants sharing an origin.
+ */
+static void shape_draw_quadrants(struct m2d_buffer* mask, dim_t x, dim_t y, unsigned int quadrants,
+                                 const struct m2d_rectangle* rects,
+                                 const struct shape_offset* offsets)
+{
+    struct m2d_rectangle group[4];
+    unsigned int done = 0;
+    size_t i, j, n;
+
+    for (i = 0; i < 4; i++)
+    {
+        if (!(quadrants & (1u << i)) || (done & (1u << i)))
+            continue;
+
+        for (j = i, n = 0; j < 4; j++)
+        {
+            if (!(quadrants & (1u << j)) || offsets[j].x != offsets[i].x ||
+                offsets[j].y != offsets[i].y)
+                continue;
+
+            group[n++] = rects[j];
+            done |= 1u << j;
+        }
+
+        m2d_set_source(M2D_SRC, mask, x + offsets[i].x, y + offsets[i].y);
+        m2d_draw_rectangles(group, n);
+    }
+}
+
+/* Check the target and the source color; its alpha is 0 if nothing is to be drawn. */
+static uint32_t shape_color(void)
+{
+    if (!m2d_get_target())
+    {
+        LIBM2D_ERROR("no target surface\n");
+        return 0;
+    }
+
+    return m2d_get_source_color();
+}
+
+void m2d_fill_rounded_rectangle(const struct m2d_rectangle* rect, dim_t radius)
+{
+    uint32_t color = shape_color();
+    struct m2d_rectangle fills[3];
+    struct m2d_rectangle corners[4];
+    struct shape_offset offsets[4];
+    struct m2d_buffer* mask = NULL;
+    size_t i;
+    dim_t r;
+
+    if (!(color >> 24) || rect->w <= 0 || rect->h <= 0)
+        return;
+
+    r = max_int(0, min_int(radius, min_int(rect->w, rect->h) / 2));
+    if (r)
+    {
+        mask = shape_get(r, r, 0, 360);
+        if (!mask)
+            return;
+    }
+
+    /* The bands between the corners, and the middle. */
+    fills[0].x = rect->x + r;
+    fills[0].y = rect->y;
+    fills[0].w = rect->w - 2 * r;
+    fills[0].h = r;
+    fills[1].x = rect->x;
+    fills[1].y = rect->y + r;
+    fills[1].w = rect->w;
+    fills[1].h = rect->h - 2 * r;
+    fills[2] = fills[0];
+    fills[2].y = rect->y + rect->h - r;
+
+    m2d_push_state();
+    m2d_source_enable(M2D_DST, false);
+    m2d_blend_functions(M2D_FUNC_ADD, M2D_FUNC_ADD);
+    shape_fill(fills, ARRAY_SIZE(fills), color);
+
+    if (mask)
+    {
+        /* Bottom right, bottom left, top left, top right. */
+        corners[0].x = rect->x + rect->w - r;
+        corners[0].y = rect->y + rect->h - r;
+        corners[1].x = rect->x;
+        corners[1].y = corners[0].y;
+        corners[2].x = rect->x;
+        corners[2].y = rect->y;
+        corners[3].x = corners[0].x;
+        corners[3].y = rect->y;
+
+        offsets[0].x = rect->w - 2 * r;
+        offsets[0].y = rect->h - 2 * r;
+        offsets[1].x = 0;
+        offsets[1].y = offsets[0].y;
+        offsets[2].x = 0;
+        offsets[2].y = 0;
+        offsets[3].x = offsets[0].x;
+        offsets[3].y = 0;
+
+        for (i = 0; i < 4; i++)
+        {
+            corners[i].w = r;
+            corners[i].h = r;
+        }
+
+        shape_mask_state(color);
+        shape_draw_quadrants(mask, rect->x, rect->y, 0xf, corners, offsets);
+    }
+
+    m2d_pop_state();
+}
+
+void m2d_fill_circle(dim_t x, dim_t y, dim_t radius)
+{
+    struct m2d_rectangle rect;
+
+    rect.x = x - radius;
+    rect.y = y - radius;
+    rect.w = 2 * radius;
+    rect.h = 2 * radius;
+    m2d_fill_rounded_rectangle(&rect, radius);
+}
+
+void m2d_draw_arc(dim_t x, dim_t y, dim_t radius, dim_t width,
+                  int start_angle, int end_angle)
+{
+    static const struct shape_offset offsets[4];
+    uint32_t color = shape_color();
+    struct m2d_rectangle quadrants[4];
+    struct m2d_buffer* mask;
+    unsigned int drawn = 0;
+    int64_t sweep = (int64_t)end_angle - start_angle;
+    int start = start_angle;
+    int q;
+
+    if (!(color >> 24) || radius <= 0 || width <= 0 || !sweep)
+        return;
+
+    if (sweep < 0)
+    {
+        start = end_angle;
+        sweep = -sweep;
+    }
+
+    start %= 360;
+    if (start < 0)
+        start += 360;
+    sweep = sweep < 360 ? sweep : 360;
+
+    /* The quadrants the arc goes through, edges included for their antialiasing. */
+    for (q = 0; q < 4; q++)
+    {
+        int first = q * 90;
+
+        if ((start <= first + 90 && start + sweep >= first) ||
+            (start <= first + 450 && start + sweep >= first + 360))
+            drawn |= 1u << q;
+
+        quadrants[q].x = x - (q == 1 || q == 2 ? radius : 0);
+        quadrants[q].y = y - (q >= 2 ? radius : 0);
+        quadrants[q].w = radius;
+        quadrants[q].h = radius;
+    }
+
+    mask = shape_get(radius, width, start, (int)sweep);
+    if (!mask)
+        return;
+
+    m2d_push_state();
+    m2d_source_enable(M2D_DST, false);
+    m2d_blend_functions(M2D_FUNC_ADD, M2D_FUNC_ADD);
+    shape_mask_state(color);
+    shape_draw_quadrants(mask, x - radius, y - radius, drawn, quadrants, offsets);
+    m2d_pop_state();
+}
+
+void m2d_shape_cleanup(void)
+{
+    shape_evict_bytes(SIZE_MAX, NULL);
+
+    if (shapes.registered)
+    {
+        m2d_unregister_reclaimer(&shapes.reclaimer);
+        shapes.registered = false;
+    }
+}
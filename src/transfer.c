@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "m2d/m2d.h"
+#include "m2d_priv.h"
+
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define TRANSFER_TIMEOUT_SECS 1
+
+/*
+ * Uploads write whole 64-byte blocks, so that the write-combining buffers of
+ * the GEM mappings are flushed in full bursts, without pulling the
+ * destination lines into the CPU caches. Downloads use memcpy(): the
+ * destination is application memory, about to be read again.
+ */
+#if defined(__SSE2__)
+void m2d_stream_copy(void* dst, const void* src, size_t size)
+{
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+    size_t head = -(uintptr_t)d & 15;
+
+    if (size < 64 + head)
+    {
+        memcpy(d, s, size);
+        return;
+    }
+
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    size -= head;
+
+    for (; size >= 64; size -= 64, d += 64, s += 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)s);
+        __m128i b = _mm_loadu_si128((const __m128i*)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i*)(s + 48));
+
+        _mm_stream_si128((__m128i*)d, a);
+        _mm_stream_si128((__m128i*)(d + 16), b);
+        _mm_stream_si128((__m128i*)(d + 32), c);
+        _mm_stream_si128((__m128i*)(d + 48), e);
+    }
+
+    /* Streaming stores are weakly ordered. */
+    _mm_sfence();
+
+    memcpy(d, s, size);
+}
+#elif defined(__ARM_NEON)
+/* ARMv7 has no non-temporal stores: NEON at least stores 64-byte bursts. */
+void m2d_stream_copy(void* dst, const void* src, size_t size)
+{
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+
+    for (; size >= 64; size -= 64, d += 64, s += 64)
+    {
+        uint8x16_t a = vld1q_u8(s);
+        uint8x16_t b = vld1q_u8(s + 16);
+        uint8x16_t c = vld1q_u8(s + 32);
+        uint8x16_t e = vld1q_u8(s + 48);
+
+        __builtin_prefetch(s + 256);
+        vst1q_u8(d, a);
+        vst1q_u8(d + 16, b);
+        vst1q_u8(d + 32, c);
+        vst1q_u8(d + 48, e);
+    }
+
+    memcpy(d, s, size);
+}
+#else
+void m2d_stream_copy(void* dst, const void* src, size_t size)
+{
+    memcpy(dst, src, size);
+}
+#endif
+
+/*
+ * Clip @rect to @buf into @area, and tell the offset of the clipped area in
+ * the application pixels.
+ */
+static bool transfer_clip(const struct m2d_buffer* buf,
+                          const struct m2d_rectangle* rect,
+                          size_t stride, enum m2d_pixel_format format,
+                          struct m2d_rectangle* area, size_t* offset)
+{
+    struct m2d_rectangle bounds;
+
+    bounds.x = 0;
+    bounds.y = 0;
+    bounds.w = (dim_t)buf->width;
+    bounds.h = (dim_t)buf->height;
+    if (!rect)
+        rect = &bounds;
+
+    if (!m2d_intersect(rect, &bounds, area))
+        return false;
+
+    *offset = (size_t)(area->y - rect->y) * stride +
+        (size_t)(area->x - rect->x) * m2d_byte_per_pixel(format);
+
+    return true;
+}
+
+/* Map @buf for the CPU, which only reads it unless @write. */
+static uint8_t* transfer_begin(struct m2d_buffer* buf, bool write)
+{
+    struct timespec timeout;
+    uint8_t* data;
+
+    /* Restores parked buffers: do it before waiting for the GPU. */
+    data = m2d_get_data(buf);
+    if (!data)
+        return NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &timeout);
+    timeout.tv_sec += TRANSFER_TIMEOUT_SECS;
+    if (write ? m2d_sync_for_cpu(buf, &timeout) : m2d_sync_for_cpu_read(buf, &timeout))
+        return NULL;
+
+    return data;
+}
+
+int m2d_upload(struct m2d_buffer* buf, const struct m2d_rectangle* rect,
+               const void* src, size_t src_stride,
+               enum m2d_pixel_format src_format)
+{
+    size_t bpp;
+    struct m2d_rectangle area;
+    const uint8_t* s = src;
+    m2d_row_func convert;
+    size_t offset;
+    uint8_t* d;
+    dim_t y;
+
+    if (!buf || !src)
+        return -1;
+
+    bpp = m2d_byte_per_pixel(buf->format);
+    if (!bpp || !m2d_byte_per_pixel(src_format))
+        return -1;
+
+    if (!transfer_clip(buf, rect, src_stride, src_format, &area, &offset))
+        return 0;
+
+    convert = m2d_pixel_row_func(buf->format, src_format);
+
+    d = transfer_begin(buf, true);
+    if (!d)
+        return -1;
+
+    s += offset;
+    d += (size_t)area.y * buf->stride + (size_t)area.x * bpp;
+
+    if (!convert && src_stride == buf->stride && area.w == (dim_t)buf->width)
+    {
+        /* Contiguous rows: a single copy. */
+        m2d_stream_copy(d, s, (size_t)(area.h - 1) * buf->stride +
+                        (size_t)area.w * bpp);
+    }
+    else
+    {
+        for (y = 0; y < area.h; y++, s += src_stride, d += buf->stride)
+        {
+            if (convert)
+                convert(d, s, area.w);
+            else
+                m2d_stream_copy(d, s, (size_t)area.w * bpp);
+        }
+    }
+
+    m2d_sync_for_gpu(buf);
+
+    return 0;
+}
+
+int m2d_download(struct m2d_buffer* buf, const struct m2d_rectangle* rect,
+                 void* dst, size_t dst_stride,
+                 enum m2d_pixel_format dst_format)
+{
+    size_t bpp;
+    struct m2d_rectangle area;
+    m2d_row_func convert;
+    uint8_t* d = dst;
+    const uint8_t* s;
+    size_t offset;
+    dim_t y;
+
+    if (!buf || !dst)
+        return -1;
+
+    bpp = m2d_byte_per_pixel(buf->format);
+    if (!bpp || !m2d_byte_per_pixel(dst_format))
+        return -1;
+
+    if (!transfer_clip(buf, rect, dst_stride, dst_format, &area, &offset))
+        return 0;
+
+    convert = m2d_pixel_row_func(dst_format, buf->format);
+
+    s = transfer_begin(buf, false);
+    if (!s)
+        return -1;
+
+    d += offset;
+    s += (size_t)area.y * buf->stride + (size_t)area.x * bpp;
+
+    for (y = 0; y < area.h; y++, s += buf->stride, d += dst_stride)
+    {
+        if (convert)
+            convert(d, s, area.w);
+        else
+            memcpy(d, s, (size_t)area.w * bpp);
+    }
+
+    /* Hand the buffer back to the GPU: the kernel tracks the ownership. */
+    m2d_sync_for_gpu(buf);
+
+    return 0;
+}
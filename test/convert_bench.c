@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Measure the throughput of the pixel conversion kernels, see m2d/convert.h,
+ * for each instruction set supported by the build and the CPU.
+ */
+#include <getopt.h>
+#include <m2d/convert.h>
+#include <m2d/m2d.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#endif
+
+enum bench_kernel
+{
+    BENCH_CONVERT,
+    BENCH_PREMULTIPLY,
+    BENCH_UNPREMULTIPLY,
+    BENCH_SWIZZLE_RGBA,
+    BENCH_PREMULTIPLY_RGBA,
+};
+
+struct bench
+{
+    const char* name;
+    enum bench_kernel kernel;
+    enum m2d_pixel_format dst_format;
+    enum m2d_pixel_format src_format;
+    unsigned int flags;
+};
+
+static const struct bench benches[] =
+{
+    { "argb8888 -> rgb565", BENCH_CONVERT, M2D_PF_RGB565, M2D_PF_ARGB8888, 0 },
+    { "argb8888 -> rgb565 dither", BENCH_CONVERT, M2D_PF_RGB565, M2D_PF_ARGB8888, M2D_CONVERT_DITHER },
+    { "argb8888 -> a8", BENCH_CONVERT, M2D_PF_A8, M2D_PF_ARGB8888, 0 },
+    { "rgb565 -> argb8888", BENCH_CONVERT, M2D_PF_ARGB8888, M2D_PF_RGB565, 0 },
+    { "rgb565 -> a8", BENCH_CONVERT, M2D_PF_A8, M2D_PF_RGB565, 0 },
+    { "a8 -> argb8888", BENCH_CONVERT, M2D_PF_ARGB8888, M2D_PF_A8, 0 },
+    { "a8 -> rgb565", BENCH_CONVERT, M2D_PF_RGB565, M2D_PF_A8, 0 },
+    { "premultiply", BENCH_PREMULTIPLY, 0, 0, 0 },
+    { "unpremultiply", BENCH_UNPREMULTIPLY, 0, 0, 0 },
+    { "swizzle rgba", BENCH_SWIZZLE_RGBA, 0, 0, 0 },
+    { "premultiply rgba", BENCH_PREMULTIPLY_RGBA, 0, 0, 0 },
+};
+
+static const char* const isas[] = { "c", "sse2", "avx2", "neon" };
+
+static size_t width = 1920;
+static size_t height = 1080;
+static unsigned int iterations = 20;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(const struct bench* bench, void* dst, const void* src)
+{
+    size_t count = width * height;
+
+    switch (bench->kernel)
+    {
+    case BENCH_CONVERT:
+        m2d_convert(dst, width * m2d_byte_per_pixel(bench->dst_format), bench->dst_format,
+                    src, width * m2d_byte_per_pixel(bench->src_format), bench->src_format,
+                    width, height, bench->flags);
+        break;
+    case BENCH_PREMULTIPLY:
+        m2d_premultiply(dst, src, count);
+        break;
+    case BENCH_UNPREMULTIPLY:
+        m2d_unpremultiply(dst, src, count);
+        break;
+    case BENCH_SWIZZLE_RGBA:
+        m2d_swizzle_rgba(dst, src, count);
+        break;
+    case BENCH_PREMULTIPLY_RGBA:
+        m2d_premultiply_rgba(dst, src, count);
+        break;
+    }
+}
+
+static void help(const char* program)
+{
+    printf("Usage: %s [OPTION]...\n"
+           "Measure the libm2d pixel conversion kernels, in megapixels per second.\n"
+           "\n"
+           "  -h, --help               display this help and exit\n"
+           "  -W, --width=WIDTH        the image width (default: 1920)\n"
+           "  -H, --height=HEIGHT      the image height (default: 1080)\n"
+           "  -n, --iterations=COUNT   the number of conversions per kernel (default: 20)\n"
+           "  -t, --threads=COUNT      the number of threads (default: one per CPU core)\n",
+           program);
+}
+
+int main(int argc, char* argv[])
+{
+    static const struct option long_options[] =
+    {
+        { "help", no_argument, 0, 'h' },
+        { "width", required_argument, 0, 'W' },
+        { "height", required_argument, 0, 'H' },
+        { "iterations", required_argument, 0, 'n' },
+        { "threads", required_argument, 0, 't' },
+        { 0, 0, 0, 0 }
+    };
+    uint8_t* src;
+    uint8_t* dst;
+    size_t size;
+    size_t i;
+    size_t j;
+    unsigned int n;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "hW:H:n:t:", long_options, NULL)) != -1)
+    {
+        switch (c)
+        {
+        case 'W':
+            width = strtoul(optarg, NULL, 0);
+            break;
+        case 'H':
+            height = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            iterations = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            m2d_set_cpu_threads(strtoul(optarg, NULL, 0));
+            break;
+        case 'h':
+            help(argv[0]);
+            return EXIT_SUCCESS;
+        default:
+            help(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!width || !height || !iterations)
+    {
+        help(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    size = width * height * 4;
+    src = malloc(size);
+    dst = malloc(size);
+    if (!src || !dst)
+    {
+        fprintf(stderr, "error: can't allocate %zu byte(s)\n", size);
+        return EXIT_FAILURE;
+    }
+
+    /* Pixels with all kinds of alpha, premultiplied or not, it doesn't matter. */
+    srand(1);
+    for (i = 0; i < size; i++)
+        src[i] = rand();
+
+    printf("%ux %zux%zu\n", iterations, width, height);
+
+    for (i = 0; i < ARRAY_SIZE(isas); i++)
+    {
+        if (m2d_convert_set_isa(isas[i]))
+            continue;
+
+        printf("\n%s:\n", isas[i]);
+
+        for (j = 0; j < ARRAY_SIZE(benches); j++)
+        {
+            double start;
+            double elapsed;
+
+            /* Warm the caches and the page tables. */
+            run(&benches[j], dst, src);
+
+            start = now();
+            for (n = 0; n < iterations; n++)
+                run(&benches[j], dst, src);
+            elapsed = now() - start;
+
+            printf("  %-28s %8.1f Mpix/s\n", benches[j].name,
+                   (double)width * height * iterations / elapsed / 1e6);
+        }
+    }
+
+    free(dst);
+    free(src);
+
+    return EXIT_SUCCESS;
+}
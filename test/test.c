@@ -6,6 +6,12 @@
 #include "utils.h"
 #include <drm_fourcc.h>
 #include <getopt.h>
+#include <m2d/asset.h>
+#include <m2d/atlas.h>
+#include <m2d/cache.h>
+#include <m2d/glyph.h>
+#include <m2d/image.h>
+#include <m2d/loader.h>
 #include <m2d/m2d.h>
 #include <planes/kms.h>
 #include <planes/plane.h>
@@ -311,24 +317,1199 @@ free_bg:
     m2d_free(bg);
 }
 
+static void atlas_images(void)
+{
+    static const char* const names[] = { "up", "down", "on", "off" };
+    struct m2d_atlas_image images[ARRAY_SIZE(names)];
+    struct m2d_sprite sprites[ARRAY_SIZE(names)];
+    struct m2d_atlas* atlas;
+    struct m2d_buffer* bg;
+    char filename[256];
+    uint32_t i;
+
+    snprintf(filename, sizeof(filename), "%s/background2_%ux%u.png",
+             TESTDATA, screen_width, screen_height);
+    bg = load_png(filename);
+    if (!bg)
+        return;
+
+    atlas = m2d_atlas_create(256, 256, M2D_PF_ARGB8888);
+    if (!atlas)
+        goto free_bg;
+
+    for (i = 0; i < ARRAY_SIZE(names); i++)
+    {
+        struct m2d_buffer* icon;
+
+        snprintf(filename, sizeof(filename), "%s/%s.png", TESTDATA, names[i]);
+        icon = load_png(filename);
+        if (!icon)
+            goto destroy_atlas;
+
+        if (m2d_atlas_add(atlas, icon, &images[i]))
+        {
+            m2d_free(icon);
+            goto destroy_atlas;
+        }
+
+        m2d_free(icon);
+        sprites[i].image = &images[i];
+    }
+
+    printf("%zu icon(s) packed into %zu page(s)\n",
+           ARRAY_SIZE(names), m2d_atlas_num_pages(atlas));
+
+    sprites[0].x = 10;
+    sprites[0].y = 10;
+    sprites[1].x = screen_width - 10 - images[1].rect.w;
+    sprites[1].y = 10;
+    sprites[2].x = 10;
+    sprites[2].y = screen_height - 10 - images[2].rect.h;
+    sprites[3].x = screen_width - 10 - images[3].rect.w;
+    sprites[3].y = screen_height - 10 - images[3].rect.h;
+
+    draw_background(bg);
+
+    sleep(3);
+
+    m2d_set_source(M2D_DST, framebuffer, 0, 0);
+    m2d_source_enable(M2D_DST, true);
+
+    m2d_blend_enable(true);
+    m2d_blend_functions(M2D_FUNC_ADD, M2D_FUNC_ADD);
+    m2d_blend_factors(M2D_BLEND_SRC_ALPHA, M2D_BLEND_ONE_MINUS_SRC_ALPHA,
+                      M2D_BLEND_ONE, M2D_BLEND_ONE_MINUS_SRC_ALPHA);
+
+    m2d_draw_sprites(sprites, ARRAY_SIZE(sprites));
+
+    sleep(1);
+
+destroy_atlas:
+    m2d_atlas_destroy(atlas);
+free_bg:
+    m2d_free(bg);
+}
+
 static void mask_images(void)
 {
-    const enum m2d_pixel_format src_format = M2D_PF_ARGB8888;
-    const enum m2d_pixel_format msk_format = M2D_PF_A8;
-    const size_t sizes[] = {50, 100, 150};
+    const enum m2d_pixel_format src_format = M2D_PF_ARGB8888;
+    const enum m2d_pixel_format msk_format = M2D_PF_A8;
+    const size_t sizes[] = {50, 100, 150};
+    struct m2d_buffer* msk;
+    struct m2d_buffer* src;
+    struct m2d_buffer* bg;
+    struct m2d_buffer* fg;
+    struct m2d_rectangle rect;
+    char filename[256];
+    uint32_t i;
+
+    snprintf(filename, sizeof(filename), "%s/background_%ux%u.png",
+             TESTDATA, screen_width, screen_height);
+    bg = load_png(filename);
+    if (!bg)
+        return;
+
+    snprintf(filename, sizeof(filename), "%s/background2_%ux%u.png",
+             TESTDATA, screen_width, screen_height);
+    fg = load_png(filename);
+    if (!fg)
+        goto free_bg;
+
+    msk = m2d_alloc(screen_width, screen_height, msk_format,
+                    stride(msk_format, screen_width));
+    if (!msk)
+        goto free_fg;
+
+    src = m2d_alloc(screen_width, screen_height, src_format,
+                    stride(src_format, screen_width));
+    if (!src)
+        goto free_msk;
+
+    /* Draw the background. */
+    draw_background(bg);
+
+    m2d_source_color(255, 255, 255, 255);
+
+    for (i = 0; i < 100; i++)
+    {
+        rect.w = sizes[rand() % ARRAY_SIZE(sizes)];
+        rect.h = sizes[rand() % ARRAY_SIZE(sizes)];
+        rect.x = rand() % (screen_width - rect.w);
+        rect.y = rand() % (screen_height - rect.h);
+
+        /* Fill the mask. */
+        m2d_source_enable(M2D_SRC, false);
+        m2d_source_enable(M2D_DST, false);
+        m2d_blend_enable(false);
+        m2d_set_target(msk);
+        m2d_draw_rectangles(&rect, 1);
+
+        /* Combine the foreground and dynamic mask into the source. */
+        m2d_set_source(M2D_SRC, fg, 0, 0);
+        m2d_set_source(M2D_DST, msk, 0, 0);
+        m2d_source_enable(M2D_SRC, true);
+        m2d_source_enable(M2D_DST, true);
+        m2d_blend_enable(true);
+        m2d_blend_factors(M2D_BLEND_ONE, M2D_BLEND_ZERO,
+                          M2D_BLEND_DST_ALPHA, M2D_BLEND_ZERO);
+        m2d_set_target(src);
+        m2d_draw_rectangles(&rect, 1);
+
+        /* Blend the source into the framebuffer. */
+        m2d_set_source(M2D_SRC, src, 0, 0);
+        m2d_set_source(M2D_DST, framebuffer, 0, 0);
+        m2d_blend_factors(M2D_BLEND_SRC_ALPHA, M2D_BLEND_ONE_MINUS_SRC_ALPHA,
+                          M2D_BLEND_ONE, M2D_BLEND_ONE_MINUS_SRC_ALPHA);
+        m2d_set_target(framebuffer);
+        m2d_draw_rectangles(&rect, 1);
+
+        usleep(100000);
+    }
+
+    sleep(1);
+
+    m2d_free(src);
+free_msk:
+    m2d_free(msk);
+free_fg:
+    m2d_free(fg);
+free_bg:
+    m2d_free(bg);
+}
+
+static void blend_premult_images(void)
+{
+    static const struct m2d_test_color
+    {
+        uint8_t r;
+        uint8_t g;
+        uint8_t b;
+        uint8_t a;
+    } colors[] =
+    {
+        { .r = 0xffu, .g = 0xffu, .b = 0xffu, .a = 0xffu },
+        { .r = 0xc0u, .g = 0xffu, .b = 0xffu, .a = 0xffu },
+        { .r = 0x80u, .g = 0xffu, .b = 0xffu, .a = 0xffu },
+        { .r = 0x40u, .g = 0xffu, .b = 0xffu, .a = 0xffu },
+        { .r = 0x00u, .g = 0xffu, .b = 0xffu, .a = 0xffu },
+        { .r = 0xffu, .g = 0xc0u, .b = 0xffu, .a = 0xffu },
+        { .r = 0xffu, .g = 0x80u, .b = 0xffu, .a = 0xffu },
+        { .r = 0xffu, .g = 0x40u, .b = 0xffu, .a = 0xffu },
+        { .r = 0xffu, .g = 0x00u, .b = 0xffu, .a = 0xffu },
+        { .r = 0xffu, .g = 0xffu, .b = 0xc0u, .a = 0xffu },
+        { .r = 0xffu, .g = 0xffu, .b = 0x80u, .a = 0xffu },
+        { .r = 0xffu, .g = 0xffu, .b = 0x40u, .a = 0xffu },
+        { .r = 0xffu, .g = 0xffu, .b = 0x00u, .a = 0xffu },
+        { .r = 0xffu, .g = 0xffu, .b = 0xffu, .a = 0xc0u },
+        { .r = 0xffu, .g = 0xffu, .b = 0xffu, .a = 0x80u },
+        { .r = 0xffu, .g = 0xffu, .b = 0xffu, .a = 0x40u },
+        { .r = 0xffu, .g = 0xffu, .b = 0xffu, .a = 0x00u },
+        { .r = 0x00u, .g = 0x00u, .b = 0x00u, .a = 0xffu },
+        { .r = 0x00u, .g = 0x00u, .b = 0x00u, .a = 0xc0u },
+        { .r = 0x00u, .g = 0x00u, .b = 0x00u, .a = 0x80u },
+        { .r = 0x00u, .g = 0x00u, .b = 0x00u, .a = 0x40u },
+        { .r = 0x00u, .g = 0x00u, .b = 0x00u, .a = 0x00u },
+    };
+    struct m2d_buffer* bg;
+    struct m2d_buffer* bg2;
+    struct m2d_rectangle rect;
+    char filename[256];
+    uint32_t i;
+
+    snprintf(filename, sizeof(filename), "%s/background_%ux%u.png",
+             TESTDATA, screen_width, screen_height);
+    bg = load_png(filename);
+    if (!bg)
+        return;
+
+    snprintf(filename, sizeof(filename), "%s/test_pattern_%ux%u.png",
+             TESTDATA, screen_width, screen_height);
+    bg2 = load_png(filename);
+    if (!bg2)
+        goto free_bg;
+
+    rect.x = 0;
+    rect.y = 0;
+    rect.w = screen_width;
+    rect.h = screen_height;
+    for (i = 0; i < ARRAY_SIZE(colors); i++)
+    {
+        const struct m2d_test_color* color = &colors[i];
+
+        draw_background(bg);
+
+        m2d_source_color(color->r, color->g, color->b, color->a);
+        m2d_source_enable(M2D_SRC, true);
+        m2d_source_enable(M2D_DST, true);
+        m2d_set_source(M2D_SRC, bg2, 0, 0);
+        m2d_set_source(M2D_DST, framebuffer, 0, 0);
+        m2d_blend_enable(true);
+        m2d_draw_rectangles(&rect, 1);
+        sleep(1);
+    }
+    m2d_source_color(255, 255, 255, 255);
+
+    sleep(1);
+
+    m2d_free(bg2);
+free_bg:
+    m2d_free(bg);
+}
+
+static void async_images(void)
+{
+    struct m2d_load* bg;
+    struct m2d_load* bg2;
+    struct m2d_rectangle rect;
+    char filename[256];
+    int frames = 0;
+
+    snprintf(filename, sizeof(filename), "%s/background_%ux%u.png",
+             TESTDATA, screen_width, screen_height);
+    bg = m2d_load_async(filename, NULL, 0, NULL, NULL);
+    if (!bg)
+        return;
+
+    snprintf(filename, sizeof(filename), "%s/background2_%ux%u.png",
+             TESTDATA, screen_width, screen_height);
+    bg2 = m2d_load_async(filename, NULL, 1, NULL, NULL);
+    if (!bg2)
+        goto release_bg;
+
+    m2d_source_enable(M2D_SRC, true);
+    m2d_source_enable(M2D_DST, false);
+    m2d_blend_enable(false);
+
+    rect.x = 0;
+    rect.y = 0;
+    rect.w = screen_width;
+    rect.h = screen_height;
+
+    /* The UI keeps running: draws are skipped until the image is ready. */
+    m2d_set_source_load(M2D_SRC, bg2, 0, 0, M2D_LOAD_SKIP);
+    while (m2d_load_get_state(bg2) < M2D_LOAD_READY)
+    {
+        fill_background(frames & 1 ? 64 : 0, 0, 0);
+        m2d_source_enable(M2D_SRC, true);
+        m2d_draw_rectangles(&rect, 1);
+        frames++;
+        usleep(20000);
+    }
+    m2d_draw_rectangles(&rect, 1);
+    printf("%d frame(s) while loading\n", frames);
+
+    sleep(2);
+
+    /* This one blocks until the image is ready. */
+    m2d_set_source_load(M2D_SRC, bg, 0, 0, M2D_LOAD_WAIT);
+    m2d_draw_rectangles(&rect, 1);
+
+    sleep(1);
+
+    m2d_load_release(bg2);
+release_bg:
+    m2d_load_release(bg);
+}
+
+static void park_pages(void)
+{
+    struct m2d_buffer* pages[2] = { NULL, NULL };
+    struct m2d_park_stats stats;
+    struct m2d_rectangle rect;
+    int i;
+
+    for (i = 0; i < 2; i++)
+    {
+        pages[i] = m2d_alloc(screen_width, screen_height, M2D_PF_ARGB8888,
+                             stride(M2D_PF_ARGB8888, screen_width));
+        if (!pages[i])
+            goto free_pages;
+
+        m2d_set_tag(pages[i], "page");
+        m2d_set_parkable(pages[i], true);
+
+        /* A flat page with a few widgets, like most UI layers. */
+        m2d_set_target(pages[i]);
+        fill_background(i ? 0 : 32, 32, i ? 64 : 0);
+        m2d_source_enable(M2D_SRC, false);
+        m2d_source_enable(M2D_DST, false);
+        m2d_source_color(255, 255, 255, 255);
+        rect.w = screen_width / 4;
+        rect.h = screen_height / 6;
+        for (rect.y = 20; rect.y + rect.h < (dim_t)screen_height; rect.y += rect.h + 20)
+        {
+            rect.x = i ? screen_width - rect.w - 20 : 20;
+            m2d_draw_rectangles(&rect, 1);
+        }
+    }
+    m2d_set_target(framebuffer);
+
+    /* Only one page is visible at a time: the other one is parked. */
+    for (i = 0; i < 4; i++)
+    {
+        draw_background(pages[i & 1]);
+        m2d_set_source(M2D_SRC, NULL, 0, 0);
+        m2d_park(pages[(i + 1) & 1]);
+        sleep(1);
+    }
+
+    m2d_get_park_stats(&stats);
+    if (stats.parks && stats.unparks)
+        printf("parked %zu time(s) in %llu us, restored %zu time(s) in %llu us on average\n",
+               stats.parks, (unsigned long long)(stats.park_ns / 1000 / stats.parks),
+               stats.unparks, (unsigned long long)(stats.unpark_ns / 1000 / stats.unparks));
+    if (stats.compressed_bytes)
+        printf("%zu byte(s) parked into %zu, ratio %.1f\n", stats.parked_bytes,
+               stats.compressed_bytes, (double)stats.parked_bytes / stats.compressed_bytes);
+
+free_pages:
+    m2d_free(pages[1]);
+    m2d_free(pages[0]);
+}
+
+/* The same rectangles on both halves: the GPU on the left, the CPU on the right. */
+static void cpu_renderer(void)
+{
+    uint32_t i;
+
+    fill_background(0, 0, 0);
+
+    m2d_source_enable(M2D_SRC, false);
+    m2d_source_enable(M2D_DST, false);
+    m2d_blend_enable(true);
+    m2d_blend_functions(M2D_FUNC_ADD, M2D_FUNC_ADD);
+    m2d_blend_factors(M2D_BLEND_ONE, M2D_BLEND_ONE_MINUS_SRC_ALPHA,
+                      M2D_BLEND_ONE, M2D_BLEND_ONE_MINUS_SRC_ALPHA);
+
+    for (i = 0; i < 100; i++)
+    {
+        struct m2d_rectangle rect;
+        size_t sizes[] = {50, 100, 150};
+        uint8_t alpha = 128;
+
+        /* Premultiplied color. */
+        m2d_source_color((rand() & 255) * alpha / 255, (rand() & 255) * alpha / 255,
+                         (rand() & 255) * alpha / 255, alpha);
+        rect.w = sizes[rand() % ARRAY_SIZE(sizes)];
+        rect.h = sizes[rand() % ARRAY_SIZE(sizes)];
+        rect.x = rand() % (screen_width / 2 - rect.w);
+        rect.y = rand() % (screen_height - rect.h);
+
+        m2d_set_renderer(M2D_RENDERER_GPU);
+        m2d_draw_rectangles(&rect, 1);
+
+        rect.x += screen_width / 2;
+        m2d_set_renderer(M2D_RENDERER_CPU);
+        m2d_draw_rectangles(&rect, 1);
+        usleep(100000);
+    }
+
+    m2d_set_renderer(M2D_RENDERER_GPU);
+    m2d_blend_factors(M2D_BLEND_SRC_ALPHA, M2D_BLEND_ONE_MINUS_SRC_ALPHA,
+                      M2D_BLEND_ONE, M2D_BLEND_ONE_MINUS_SRC_ALPHA);
+    m2d_source_color(255, 255, 255, 255);
+
+    sleep(1);
+}
+
+/*
+ * Frames of translucent full-width layers, rendered by the CPU into a page
+ * copied to the screen by the GPU: draw by draw, then deferred by tiles.
+ */
+static void cpu_deferred(void)
+{
+    struct m2d_buffer* page;
+    struct m2d_rectangle rect;
+    struct timespec start;
+    struct timespec end;
+    int deferred;
+    int frame;
+    int layer;
+
+    page = m2d_alloc(screen_width, screen_height, M2D_PF_ARGB8888,
+                     stride(M2D_PF_ARGB8888, screen_width));
+    if (!page)
+        return;
+
+    for (deferred = 0; deferred < 2; deferred++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (frame = 0; frame < 30; frame++)
+        {
+            m2d_set_target(page);
+            m2d_set_renderer(deferred ? M2D_RENDERER_CPU_DEFERRED : M2D_RENDERER_CPU);
+            fill_background(0, 0, deferred ? 64 : 0);
+
+            m2d_blend_enable(true);
+            m2d_blend_functions(M2D_FUNC_ADD, M2D_FUNC_ADD);
+            m2d_blend_factors(M2D_BLEND_ONE, M2D_BLEND_ONE_MINUS_SRC_ALPHA,
+                              M2D_BLEND_ONE, M2D_BLEND_ONE_MINUS_SRC_ALPHA);
+
+            for (layer = 0; layer < 8; layer++)
+            {
+                /* Premultiplied color. */
+                m2d_source_color(layer & 1 ? 64 : 0, layer & 2 ? 64 : 0, layer & 4 ? 64 : 0, 64);
+                rect.x = 0;
+                rect.y = (layer * screen_height / 8 + frame * 8) % screen_height / 2;
+                rect.w = screen_width;
+                rect.h = screen_height / 2;
+                m2d_draw_rectangles(&rect, 1);
+            }
+
+            m2d_flush();
+
+            m2d_set_renderer(M2D_RENDERER_GPU);
+            m2d_set_target(framebuffer);
+            draw_background(page);
+        }
+
+        /* Until the last copy is done. */
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        end.tv_sec += 1;
+        m2d_wait(framebuffer, &end);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("%s: %.1f ms per frame\n", deferred ? "deferred" : "draw by draw",
+               ((end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6) / 30);
+    }
+
+    m2d_blend_factors(M2D_BLEND_SRC_ALPHA, M2D_BLEND_ONE_MINUS_SRC_ALPHA,
+                      M2D_BLEND_ONE, M2D_BLEND_ONE_MINUS_SRC_ALPHA);
+    m2d_source_color(255, 255, 255, 255);
+    m2d_set_source(M2D_SRC, NULL, 0, 0);
+    m2d_free(page);
+
+    sleep(1);
+}
+
+/* A zoom on the center of the background: nearest on the left, bilinear on the right. */
+static void stretch_blit(void)
+{
+    struct m2d_buffer* bg;
+    struct m2d_rectangle src_rect;
+    struct m2d_rectangle dst_rect;
+    char filename[256];
+    int pass;
+    int i;
+
+    snprintf(filename, sizeof(filename), "%s/background_%ux%u.png",
+             TESTDATA, screen_width, screen_height);
+    bg = load_png(filename);
+    if (!bg)
+        return;
+
+    src_rect.w = screen_width / 8;
+    src_rect.h = screen_height / 4;
+    src_rect.x = (screen_width - src_rect.w) / 2;
+    src_rect.y = (screen_height - src_rect.h) / 2;
+
+    m2d_source_enable(M2D_SRC, true);
+    m2d_source_enable(M2D_DST, false);
+    m2d_blend_enable(false);
+    m2d_set_source(M2D_SRC, bg, 0, 0);
+
+    /* The second pass draws the scaled variants cached by the first one. */
+    for (pass = 0; pass < 2; pass++)
+    {
+        for (i = 1; i <= 16; i++)
+        {
+            fill_background(0, 0, 0);
+            m2d_source_enable(M2D_SRC, true);
+
+            dst_rect.w = src_rect.w * i / 4;
+            dst_rect.h = src_rect.h * i / 4;
+            dst_rect.y = (screen_height - dst_rect.h) / 2;
+
+            dst_rect.x = screen_width / 4 - dst_rect.w / 2;
+            m2d_stretch_blit(&src_rect, &dst_rect, M2D_FILTER_NEAREST);
+
+            dst_rect.x = screen_width * 3 / 4 - dst_rect.w / 2;
+            m2d_stretch_blit(&src_rect, &dst_rect, M2D_FILTER_BILINEAR);
+
+            usleep(100000);
+        }
+    }
+
+    sleep(1);
+
+    m2d_set_source(M2D_SRC, NULL, 0, 0);
+    m2d_free(bg);
+}
+
+/*
+ * The background and a banner flipped and rotated by 180 degrees, then drawn
+ * into a portrait page as if the panel were mounted rotated, and rotated back
+ * to the screen by the CPU.
+ */
+static void rotate(void)
+{
+    unsigned int transforms[] =
+    {
+        M2D_TRANSFORM_NONE,
+        M2D_TRANSFORM_FLIP_X,
+        M2D_TRANSFORM_FLIP_Y,
+        M2D_TRANSFORM_ROTATE_180,
+    };
+    struct m2d_buffer* bg;
+    struct m2d_buffer* page;
+    struct m2d_rectangle rect;
+    struct timespec start;
+    struct timespec end;
+    char filename[256];
+    size_t i;
+
+    snprintf(filename, sizeof(filename), "%s/background_%ux%u.png",
+             TESTDATA, screen_width, screen_height);
+    bg = load_png(filename);
+    if (!bg)
+        return;
+
+    page = m2d_alloc(screen_height, screen_width, M2D_PF_ARGB8888,
+                     stride(M2D_PF_ARGB8888, screen_height));
+    if (!page)
+        goto free_bg;
+
+    rect.x = 0;
+    rect.y = 0;
+    rect.w = screen_width / 2;
+    rect.h = screen_height / 8;
+
+    for (i = 0; i < ARRAY_SIZE(transforms); i++)
+    {
+        m2d_set_target_transform(transforms[i]);
+        draw_background(bg);
+
+        /* The banner shows where the top left corner went. */
+        m2d_source_enable(M2D_SRC, false);
+        m2d_source_color(255, 0, 0, 255);
+        m2d_draw_rectangles(&rect, 1);
+        m2d_source_color(255, 255, 255, 255);
+        sleep(1);
+    }
+
+    m2d_set_target(page);
+    m2d_set_target_transform(M2D_TRANSFORM_ROTATE_90);
+    draw_background(bg);
+    m2d_source_enable(M2D_SRC, false);
+    m2d_source_color(0, 0, 255, 255);
+    m2d_draw_rectangles(&rect, 1);
+    m2d_source_color(255, 255, 255, 255);
+
+    m2d_set_target_transform(M2D_TRANSFORM_NONE);
+    m2d_set_target(framebuffer);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    m2d_blit_transformed(framebuffer, page, M2D_TRANSFORM_ROTATE_270);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("rotated %zux%zu pixels in %.1f ms\n", screen_height, screen_width,
+           (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+
+    sleep(1);
+
+    m2d_set_source(M2D_SRC, NULL, 0, 0);
+    m2d_free(page);
+free_bg:
+    m2d_free(bg);
+}
+
+/*
+ * Icons casting shadows blurred more and more, over a frosted panel: the
+ * small radii are blurred by the GPU, the larger ones by the CPU.
+ */
+static void shadows(void)
+{
+    const unsigned int radii[] = {0, 2, 4, 8, 16, 32};
+    struct m2d_buffer* bg;
+    struct m2d_buffer* icon;
+    struct m2d_rectangle panel;
+    struct m2d_rectangle rect;
+    char filename[256];
+    size_t i;
+
+    snprintf(filename, sizeof(filename), "%s/background_%ux%u.png",
+             TESTDATA, screen_width, screen_height);
+    bg = load_png(filename);
+    if (!bg)
+        return;
+
+    snprintf(filename, sizeof(filename), "%s/on.png", TESTDATA);
+    icon = load_png(filename);
+    if (!icon)
+        goto free_bg;
+
+    panel.x = screen_width / 8;
+    panel.y = screen_height / 4;
+    panel.w = screen_width * 3 / 4;
+    panel.h = screen_height / 2;
+
+    rect.x = 0;
+    rect.y = 0;
+    rect.w = 100;
+    rect.h = 100;
+
+    for (i = 0; i < ARRAY_SIZE(radii); i++)
+    {
+        draw_background(bg);
+
+        /* The panel blurs what is behind it. */
+        m2d_blur_blit(&panel, panel.x, panel.y, radii[i]);
+
+        m2d_set_source(M2D_SRC, icon, 0, 0);
+        m2d_draw_shadow(&rect, panel.x + 40 + radii[i] / 2, panel.y + 40 + radii[i] / 2,
+                        radii[i], 0, 0, 0, 160);
+
+        m2d_blend_enable(true);
+        m2d_blend_functions(M2D_FUNC_ADD, M2D_FUNC_ADD);
+        m2d_blend_factors(M2D_BLEND_SRC_ALPHA, M2D_BLEND_ONE_MINUS_SRC_ALPHA,
+                          M2D_BLEND_ONE, M2D_BLEND_ONE_MINUS_SRC_ALPHA);
+        m2d_set_source(M2D_SRC, icon, panel.x + 40, panel.y + 40);
+        rect.x = panel.x + 40;
+        rect.y = panel.y + 40;
+        m2d_draw_rectangles(&rect, 1);
+        rect.x = 0;
+        rect.y = 0;
+        m2d_blend_enable(false);
+
+        sleep(1);
+    }
+
+    m2d_set_source(M2D_SRC, NULL, 0, 0);
+    m2d_free(icon);
+free_bg:
+    m2d_free(bg);
+}
+
+/*
+ * A vertical sky gradient expanded by copies, a radial glow moving across it
+ * (the cached glow is reused) and a diagonal panel, both blended.
+ */
+static void gradients(void)
+{
+    const struct m2d_gradient_stop sky[] = {
+        { 0, 20, 40, 120, 255 },
+        { 160, 120, 160, 220, 255 },
+        { 255, 240, 200, 160, 255 },
+    };
+    const struct m2d_gradient_stop glow[] = {
+        { 0, 255, 240, 200, 255 },
+        { 64, 128, 100, 40, 128 },
+        { 255, 0, 0, 0, 0 },
+    };
+    const struct m2d_gradient_stop glass[] = {
+        { 0, 64, 64, 64, 64 },
+        { 255, 16, 16, 16, 16 },
+    };
+    struct m2d_gradient gradient;
+    struct m2d_rectangle screen;
+    struct m2d_rectangle rect;
+    int i;
+
+    screen.x = 0;
+    screen.y = 0;
+    screen.w = screen_width;
+    screen.h = screen_height;
+
+    for (i = 0; i < 32; i++)
+    {
+        memset(&gradient, 0, sizeof(gradient));
+        gradient.type = M2D_GRADIENT_LINEAR;
+        gradient.y1 = screen_height;
+        gradient.stops = sky;
+        gradient.num_stops = ARRAY_SIZE(sky);
+        m2d_fill_gradient(&screen, &gradient);
+
+        m2d_blend_enable(true);
+        m2d_blend_functions(M2D_FUNC_ADD, M2D_FUNC_ADD);
+        m2d_blend_factors(M2D_BLEND_ONE, M2D_BLEND_ONE_MINUS_SRC_ALPHA,
+                          M2D_BLEND_ONE, M2D_BLEND_ONE_MINUS_SRC_ALPHA);
+
+        gradient.type = M2D_GRADIENT_RADIAL;
+        gradient.radius = screen_height / 3;
+        gradient.x0 = gradient.radius + (screen_width - 2 * gradient.radius) * i / 31;
+        gradient.y0 = screen_height / 3;
+        gradient.stops = glow;
+        gradient.num_stops = ARRAY_SIZE(glow);
+        rect.x = gradient.x0 - gradient.radius;
+        rect.y = gradient.y0 - gradient.radius;
+        rect.w = 2 * gradient.radius;
+        rect.h = 2 * gradient.radius;
+        m2d_fill_gradient(&rect, &gradient);
+
+        rect.x = screen_width / 8;
+        rect.y = screen_height * 5 / 8;
+        rect.w = screen_width * 3 / 4;
+        rect.h = screen_height / 4;
+        gradient.type = M2D_GRADIENT_LINEAR;
+        gradient.x0 = rect.x;
+        gradient.y0 = rect.y;
+        gradient.x1 = rect.x + rect.w;
+        gradient.y1 = rect.y + rect.h;
+        gradient.stops = glass;
+        gradient.num_stops = ARRAY_SIZE(glass);
+        m2d_fill_gradient(&rect, &gradient);
+
+        m2d_blend_enable(false);
+
+        usleep(100000);
+    }
+}
+
+/*
+ * Frames growing from an icon used as a nine-patch: repeated by copies on
+ * the left, stretched and blended on the right.
+ */
+static void nine_patches(void)
+{
+    const struct m2d_insets insets = { 32, 32, 32, 32 };
+    struct m2d_buffer* bg;
+    struct m2d_buffer* icon;
+    struct m2d_rectangle src_rect;
+    struct m2d_rectangle rect;
+    char filename[256];
+    int i;
+
+    snprintf(filename, sizeof(filename), "%s/background_%ux%u.png",
+             TESTDATA, screen_width, screen_height);
+    bg = load_png(filename);
+    if (!bg)
+        return;
+
+    snprintf(filename, sizeof(filename), "%s/on.png", TESTDATA);
+    icon = load_png(filename);
+    if (!icon)
+        goto free_bg;
+
+    src_rect.x = 0;
+    src_rect.y = 0;
+    src_rect.w = 100;
+    src_rect.h = 100;
+
+    for (i = 0; i < 32; i++)
+    {
+        draw_background(bg);
+
+        m2d_set_source(M2D_SRC, icon, 0, 0);
+
+        rect.x = 16;
+        rect.y = 16;
+        rect.w = 48 + (screen_width / 2 - 80) * i / 31;
+        rect.h = 48 + (screen_height - 80) * i / 31;
+        m2d_draw_nine_patch(&src_rect, &insets, &rect, M2D_NINE_PATCH_REPEAT);
+
+        m2d_blend_enable(true);
+        m2d_blend_functions(M2D_FUNC_ADD, M2D_FUNC_ADD);
+        m2d_blend_factors(M2D_BLEND_SRC_ALPHA, M2D_BLEND_ONE_MINUS_SRC_ALPHA,
+                          M2D_BLEND_ONE, M2D_BLEND_ONE_MINUS_SRC_ALPHA);
+        rect.x = screen_width / 2 + 16;
+        m2d_draw_nine_patch(&src_rect, &insets, &rect, M2D_NINE_PATCH_STRETCH);
+        m2d_blend_enable(false);
+
+        usleep(100000);
+    }
+
+    m2d_set_source(M2D_SRC, NULL, 0, 0);
+    m2d_free(icon);
+free_bg:
+    m2d_free(bg);
+}
+
+/*
+ * A 16x16 checkerboard filling the screen by self-copies, timed, then
+ * scrolled under a translucent band of the same pattern, blended.
+ */
+static void patterns(void)
+{
+    struct m2d_buffer* checker;
+    struct m2d_rectangle screen;
+    struct m2d_rectangle rect;
+    struct timespec start;
+    struct timespec end;
+    int i;
+
+    checker = m2d_alloc(16, 16, M2D_PF_ARGB8888, stride(M2D_PF_ARGB8888, 16));
+    if (!checker)
+        return;
+
+    m2d_set_target(checker);
+    m2d_source_enable(M2D_SRC, false);
+    rect.x = 0;
+    rect.y = 0;
+    rect.w = 16;
+    rect.h = 16;
+    m2d_source_color(40, 40, 40, 255);
+    m2d_draw_rectangles(&rect, 1);
+    rect.w = 8;
+    rect.h = 8;
+    m2d_source_color(200, 200, 200, 255);
+    m2d_draw_rectangles(&rect, 1);
+    rect.x = 8;
+    rect.y = 8;
+    m2d_draw_rectangles(&rect, 1);
+    m2d_source_color(255, 255, 255, 255);
+    m2d_set_target(framebuffer);
+
+    screen.x = 0;
+    screen.y = 0;
+    screen.w = screen_width;
+    screen.h = screen_height;
+
+    rect.x = 0;
+    rect.y = 0;
+    rect.w = 16;
+    rect.h = 16;
+
+    m2d_set_source(M2D_SRC, checker, 0, 0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    m2d_fill_pattern(&rect, &screen, 0, 0);
+    m2d_wait(framebuffer, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("filled %zux%zu pixels with a pattern in %.1f ms\n", screen_width, screen_height,
+           (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+
+    for (i = 0; i < 32; i++)
+    {
+        m2d_fill_pattern(&rect, &screen, i, i);
+
+        m2d_blend_enable(true);
+        m2d_blend_functions(M2D_FUNC_ADD, M2D_FUNC_ADD);
+        m2d_blend_factors(M2D_BLEND_CONSTANT_ALPHA, M2D_BLEND_ONE_MINUS_CONSTANT_ALPHA,
+                          M2D_BLEND_CONSTANT_ALPHA, M2D_BLEND_ONE_MINUS_CONSTANT_ALPHA);
+        m2d_blend_color(0, 0, 0, 128);
+        screen.y = screen_height / 3;
+        screen.h = screen_height / 3;
+        m2d_fill_pattern(&rect, &screen, 0, 0);
+        screen.y = 0;
+        screen.h = screen_height;
+        m2d_blend_enable(false);
+
+        usleep(50000);
+    }
+
+    m2d_set_source(M2D_SRC, NULL, 0, 0);
+    m2d_free(checker);
+}
+
+/*
+ * An RGB565 sprite on a magenta key, blitted over the background by the GPU,
+ * then by the CPU renderer.
+ */
+static void color_keys(void)
+{
+    struct m2d_buffer* bg;
+    struct m2d_buffer* sprite;
+    struct m2d_rectangle rect;
+    char filename[256];
+    int i;
+
+    snprintf(filename, sizeof(filename), "%s/background_%ux%u.png",
+             TESTDATA, screen_width, screen_height);
+    bg = load_png(filename);
+    if (!bg)
+        return;
+
+    sprite = m2d_alloc(96, 96, M2D_PF_RGB565, stride(M2D_PF_RGB565, 96));
+    if (!sprite)
+        goto free_bg;
+
+    m2d_set_target(sprite);
+    m2d_source_enable(M2D_SRC, false);
+    rect.x = 0;
+    rect.y = 0;
+    rect.w = 96;
+    rect.h = 96;
+    m2d_source_color(255, 0, 255, 255);
+    m2d_draw_rectangles(&rect, 1);
+    rect.x = 16;
+    rect.y = 40;
+    rect.w = 64;
+    rect.h = 16;
+    m2d_source_color(0, 160, 0, 255);
+    m2d_draw_rectangles(&rect, 1);
+    rect.x = 40;
+    rect.y = 16;
+    rect.w = 16;
+    rect.h = 64;
+    m2d_draw_rectangles(&rect, 1);
+    m2d_source_color(255, 255, 255, 255);
+    m2d_set_target(framebuffer);
+
+    rect.x = 0;
+    rect.y = 0;
+    rect.w = 96;
+    rect.h = 96;
+
+    for (i = 0; i < 64; i++)
+    {
+        m2d_set_renderer(i < 32 ? M2D_RENDERER_GPU : M2D_RENDERER_CPU);
+        draw_background(bg);
+
+        m2d_set_source(M2D_SRC, sprite, 0, 0);
+        m2d_color_key_blit(&rect, (screen_width - 96) * (i % 32) / 31,
+                           (screen_height - 96) / 2, 255, 0, 255);
+
+        usleep(50000);
+    }
+
+    m2d_set_renderer(M2D_RENDERER_GPU);
+    m2d_set_source(M2D_SRC, NULL, 0, 0);
+    m2d_free(sprite);
+free_bg:
+    m2d_free(bg);
+}
+
+/*
+ * Stand-in for a FreeType rasterizer: each printable character is a 6x12
+ * pattern of 3x3 cells picked from its code.
+ */
+static int text_glyph(uint32_t codepoint, struct m2d_glyph_bitmap* glyph, void* data)
+{
+    static uint8_t pixels[12 * 6];
+    uint32_t bits = codepoint * 2654435761u;
+    size_t x, y;
+
+    (void)data;
+
+    memset(glyph, 0, sizeof(*glyph));
+    glyph->advance = 8;
+
+    if (codepoint == ' ')
+        return 0;
+
+    if (codepoint < 0x21 || codepoint > 0x7e)
+        return -1;
+
+    for (y = 0; y < 12; y++)
+        for (x = 0; x < 6; x++)
+            pixels[y * 6 + x] = (bits >> (16 + (y / 3) * 2 + x / 3)) & 1 ? 255 : 0;
+
+    glyph->pixels = pixels;
+    glyph->width = 6;
+    glyph->height = 12;
+    glyph->pitch = 6;
+    glyph->left = 1;
+    glyph->top = 10;
+
+    return 0;
+}
+
+static void text(void)
+{
+    static const char paragraph[] =
+        "Text is laid out once into an A8 atlas page,\n"
+        "then each run is a single blend of its lines,\n"
+        "modulated by the constant source color: this\n"
+        "paragraph of about two hundred characters\n"
+        "takes as many commands as a single glyph.";
+    struct m2d_glyph_cache* cache;
+    struct m2d_text_run runs[3];
+    struct m2d_buffer* bg;
+    char counter[32];
+    char filename[256];
+    dim_t width;
+    dim_t height;
+    int i;
+
+    snprintf(filename, sizeof(filename), "%s/background_%ux%u.png",
+             TESTDATA, screen_width, screen_height);
+    bg = load_png(filename);
+    if (!bg)
+        return;
+
+    cache = m2d_glyph_cache_create(10, 16, text_glyph, NULL);
+    if (!cache)
+        goto free_bg;
+
+    m2d_measure_text(cache, paragraph, &width, &height);
+
+    runs[0].text = "Glyph cache";
+    runs[0].x = 20;
+    runs[0].y = 20;
+    runs[0].red = 255;
+    runs[0].green = 220;
+    runs[0].blue = 0;
+    runs[0].alpha = 255;
+
+    runs[1].text = paragraph;
+    runs[1].x = ((dim_t)screen_width - width) / 2;
+    runs[1].y = ((dim_t)screen_height - height) / 2;
+    runs[1].red = 255;
+    runs[1].green = 255;
+    runs[1].blue = 255;
+    runs[1].alpha = 255;
+
+    runs[2].text = counter;
+    runs[2].x = 20;
+    runs[2].y = (dim_t)screen_height - 36;
+    runs[2].red = 0;
+    runs[2].green = 255;
+    runs[2].blue = 0;
+    runs[2].alpha = 160;
+
+    for (i = 0; i < 64; i++)
+    {
+        m2d_set_renderer(i < 32 ? M2D_RENDERER_GPU : M2D_RENDERER_CPU);
+        draw_background(bg);
+
+        snprintf(counter, sizeof(counter), "Frame %d (%s)", i, i < 32 ? "GPU" : "CPU");
+        m2d_draw_text(cache, runs, ARRAY_SIZE(runs));
+
+        usleep(50000);
+    }
+
+    m2d_set_renderer(M2D_RENDERER_GPU);
+    m2d_glyph_cache_destroy(cache);
+free_bg:
+    m2d_free(bg);
+}
+
+/*
+ * A translucent rounded panel and a pill with a knob sliding across it, over a
+ * faint ring filled by an arc growing with the frames: by the GPU, then the CPU.
+ */
+static void shapes(void)
+{
+    struct m2d_buffer* bg;
+    struct m2d_rectangle rect;
+    char filename[256];
+    int i;
+
+    snprintf(filename, sizeof(filename), "%s/background_%ux%u.png",
+             TESTDATA, screen_width, screen_height);
+    bg = load_png(filename);
+    if (!bg)
+        return;
+
+    for (i = 0; i < 64; i++)
+    {
+        m2d_set_renderer(i < 32 ? M2D_RENDERER_GPU : M2D_RENDERER_CPU);
+        draw_background(bg);
+
+        rect.x = 40;
+        rect.y = 40;
+        rect.w = (dim_t)screen_width - 80;
+        rect.h = (dim_t)screen_height - 80;
+        m2d_source_color(0, 0, 0, 128);
+        m2d_fill_rounded_rectangle(&rect, 24);
+
+        rect.x = 80;
+        rect.y = 80;
+        rect.w = 200;
+        rect.h = 48;
+        m2d_source_color(0, 120, 215, 255);
+        m2d_fill_rounded_rectangle(&rect, 24);
+
+        m2d_source_color(255, 255, 255, 255);
+        m2d_fill_circle(80 + 24 + (200 - 48) * (i % 32) / 31, 104, 18);
+
+        m2d_source_color(255, 255, 255, 64);
+        m2d_draw_arc((dim_t)screen_width / 2, (dim_t)screen_height / 2 + 40, 100, 16, 0, 360);
+        m2d_source_color(0, 200, 80, 255);
+        m2d_draw_arc((dim_t)screen_width / 2, (dim_t)screen_height / 2 + 40, 100, 16,
+                     -90, -90 + 360 * (i % 32) / 31);
+
+        usleep(50000);
+    }
+
+    m2d_source_color(255, 255, 255, 255);
+    m2d_set_renderer(M2D_RENDERER_GPU);
+    m2d_free(bg);
+}
+
+static void polygons(void)
+{
+    /* A pentagram: its center is filled too, with the nonzero winding rule. */
+    static const struct m2d_point star[5] =
+    {
+        { 0, -60 }, { 35, 48 }, { -57, -19 }, { 57, -19 }, { -35, 48 },
+    };
+    struct m2d_point points[5];
+    struct m2d_buffer* bg;
+    char filename[256];
+    dim_t cx, cy;
+    size_t j;
+    int i;
+
+    snprintf(filename, sizeof(filename), "%s/background_%ux%u.png",
+             TESTDATA, screen_width, screen_height);
+    bg = load_png(filename);
+    if (!bg)
+        return;
+
+    cx = (dim_t)screen_width / 2;
+    cy = (dim_t)screen_height / 2;
+
+    for (i = 0; i < 64; i++)
+    {
+        m2d_set_renderer(i < 32 ? M2D_RENDERER_GPU : M2D_RENDERER_CPU);
+        draw_background(bg);
+
+        m2d_source_color(0, 0, 0, 128);
+        m2d_fill_ellipse(cx, cy, 200, 120);
+
+        m2d_source_color(0, 120, 215, 255);
+        m2d_fill_pie(cx, cy, 100, -90, -90 + 360 * (i % 32) / 31);
+
+        for (j = 0; j < 5; j++)
+        {
+            points[j].x = star[j].x + cx - 140 + 280 * (i % 32) / 31;
+            points[j].y = star[j].y + cy;
+        }
+        m2d_source_color(255, 200, 0, 192);
+        m2d_fill_polygon(points, 5);
+
+        usleep(50000);
+    }
+
+    m2d_source_color(255, 255, 255, 255);
+    m2d_set_renderer(M2D_RENDERER_GPU);
+    m2d_free(bg);
+}
+
+/*
+ * Opaque images loaded as A8 masks get their luminance: a gray PNG is decoded
+ * into a soft mask, not into a solid one, then used to blend the foreground.
+ */
+static void gray_masks(void)
+{
+    const struct m2d_image_options options = { .format = M2D_PF_A8 };
     struct m2d_buffer* msk;
     struct m2d_buffer* src;
     struct m2d_buffer* bg;
     struct m2d_buffer* fg;
     struct m2d_rectangle rect;
+    struct m2d_image image;
+    const uint8_t* row;
     char filename[256];
-    uint32_t i;
+    size_t opaque = 0;
+    size_t x, y;
+    int i;
+
+    snprintf(filename, sizeof(filename), "%s/gray_mask.png", TESTDATA);
+    if (m2d_decode_image(filename, &options, &image))
+        return;
+
+    for (y = 0; y < image.height; y++)
+    {
+        row = (const uint8_t*)image.data + y * image.stride;
+        for (x = 0; x < image.width; x++)
+            opaque += row[x] == 0xff;
+    }
+    printf("%s: %zu of %zu mask pixel(s) opaque\n",
+           opaque < image.width * image.height ? "OK" : "FAILED",
+           opaque, image.width * image.height);
+    rect.w = (dim_t)image.width;
+    rect.h = (dim_t)image.height;
+    m2d_image_release(&image);
+
+    msk = m2d_load_image(filename, &options);
+    if (!msk)
+        return;
 
     snprintf(filename, sizeof(filename), "%s/background_%ux%u.png",
              TESTDATA, screen_width, screen_height);
     bg = load_png(filename);
     if (!bg)
-        return;
+        goto free_msk;
 
     snprintf(filename, sizeof(filename), "%s/background2_%ux%u.png",
              TESTDATA, screen_width, screen_height);
@@ -336,38 +1517,21 @@ static void mask_images(void)
     if (!fg)
         goto free_bg;
 
-    msk = m2d_alloc(screen_width, screen_height, msk_format,
-                    stride(msk_format, screen_width));
-    if (!msk)
-        goto free_fg;
-
-    src = m2d_alloc(screen_width, screen_height, src_format,
-                    stride(src_format, screen_width));
+    src = m2d_alloc(screen_width, screen_height, M2D_PF_ARGB8888,
+                    stride(M2D_PF_ARGB8888, screen_width));
     if (!src)
-        goto free_msk;
+        goto free_fg;
 
-    /* Draw the background. */
     draw_background(bg);
 
-    m2d_source_color(255, 255, 255, 255);
-
-    for (i = 0; i < 100; i++)
+    for (i = 0; i < 32; i++)
     {
-        rect.w = sizes[rand() % ARRAY_SIZE(sizes)];
-        rect.h = sizes[rand() % ARRAY_SIZE(sizes)];
         rect.x = rand() % (screen_width - rect.w);
         rect.y = rand() % (screen_height - rect.h);
 
-        /* Fill the mask. */
-        m2d_source_enable(M2D_SRC, false);
-        m2d_source_enable(M2D_DST, false);
-        m2d_blend_enable(false);
-        m2d_set_target(msk);
-        m2d_draw_rectangles(&rect, 1);
-
-        /* Combine the foreground and dynamic mask into the source. */
+        /* Combine the foreground and the mask into the source. */
         m2d_set_source(M2D_SRC, fg, 0, 0);
-        m2d_set_source(M2D_DST, msk, 0, 0);
+        m2d_set_source(M2D_DST, msk, rect.x, rect.y);
         m2d_source_enable(M2D_SRC, true);
         m2d_source_enable(M2D_DST, true);
         m2d_blend_enable(true);
@@ -390,91 +1554,259 @@ static void mask_images(void)
     sleep(1);
 
     m2d_free(src);
-free_msk:
-    m2d_free(msk);
 free_fg:
     m2d_free(fg);
 free_bg:
     m2d_free(bg);
+free_msk:
+    m2d_free(msk);
 }
 
-static void blend_premult_images(void)
+/*
+ * Pixels uploaded into a buffer are downloaded back unchanged, whole or
+ * through a rectangle, then the buffer is drawn.
+ */
+static void transfers(void)
 {
-    static const struct m2d_test_color
-    {
-        uint8_t r;
-        uint8_t g;
-        uint8_t b;
-        uint8_t a;
-    } colors[] =
+    const size_t width = 256;
+    const size_t height = 128;
+    struct m2d_rectangle rect;
+    struct m2d_buffer* buf;
+    uint32_t* pixels;
+    uint32_t* copy;
+    size_t mismatches = 0;
+    size_t x, y;
+
+    pixels = malloc(width * height * sizeof(*pixels));
+    copy = calloc(width * height, sizeof(*copy));
+    buf = m2d_alloc(width, height, M2D_PF_ARGB8888, stride(M2D_PF_ARGB8888, width));
+    if (!pixels || !copy || !buf)
+        goto out;
+
+    for (y = 0; y < height; y++)
+        for (x = 0; x < width; x++)
+            pixels[y * width + x] = 0xff000000 | (uint32_t)(x << 16) | (uint32_t)(y << 9) |
+                (uint32_t)((x ^ y) & 0xff);
+
+    if (m2d_upload(buf, NULL, pixels, width * sizeof(*pixels), M2D_PF_ARGB8888) ||
+        m2d_download(buf, NULL, copy, width * sizeof(*copy), M2D_PF_ARGB8888))
+        goto out;
+
+    for (x = 0; x < width * height; x++)
+        mismatches += copy[x] != pixels[x];
+
+    /* A rectangle reaching out of the buffer is clipped. */
+    rect.x = (dim_t)width / 2;
+    rect.y = (dim_t)height / 2;
+    rect.w = (dim_t)width;
+    rect.h = (dim_t)height;
+    memset(copy, 0, width * height * sizeof(*copy));
+    if (m2d_download(buf, &rect, copy, width * sizeof(*copy), M2D_PF_ARGB8888))
+        goto out;
+
+    for (y = 0; y < height / 2; y++)
+        for (x = 0; x < width / 2; x++)
+            mismatches += copy[y * width + x] != pixels[(y + height / 2) * width + x + width / 2];
+
+    printf("%s: %zu pixel(s) changed by the round trip, NULL buffer %s\n",
+           mismatches ? "FAILED" : "OK", mismatches,
+           m2d_upload(NULL, NULL, pixels, width * sizeof(*pixels), M2D_PF_ARGB8888) ?
+           "rejected" : "accepted");
+
+    fill_background(0, 0, 0);
+
+    rect.x = (dim_t)(screen_width - width) / 2;
+    rect.y = (dim_t)(screen_height - height) / 2;
+    rect.w = (dim_t)width;
+    rect.h = (dim_t)height;
+    m2d_source_enable(M2D_SRC, true);
+    m2d_source_enable(M2D_DST, false);
+    m2d_blend_enable(false);
+    m2d_set_source(M2D_SRC, buf, rect.x, rect.y);
+    m2d_draw_rectangles(&rect, 1);
+
+    sleep(1);
+
+out:
+    m2d_free(buf);
+    free(copy);
+    free(pixels);
+}
+
+/*
+ * Buffers of each format filled with patterns adverse to the run-length
+ * encoding, short runs between single pixels, parked and restored unchanged.
+ */
+static void park_patterns(void)
+{
+    static const enum m2d_pixel_format formats[] =
     {
-        { .r = 0xffu, .g = 0xffu, .b = 0xffu, .a = 0xffu },
-        { .r = 0xc0u, .g = 0xffu, .b = 0xffu, .a = 0xffu },
-        { .r = 0x80u, .g = 0xffu, .b = 0xffu, .a = 0xffu },
-        { .r = 0x40u, .g = 0xffu, .b = 0xffu, .a = 0xffu },
-        { .r = 0x00u, .g = 0xffu, .b = 0xffu, .a = 0xffu },
-        { .r = 0xffu, .g = 0xc0u, .b = 0xffu, .a = 0xffu },
-        { .r = 0xffu, .g = 0x80u, .b = 0xffu, .a = 0xffu },
-        { .r = 0xffu, .g = 0x40u, .b = 0xffu, .a = 0xffu },
-        { .r = 0xffu, .g = 0x00u, .b = 0xffu, .a = 0xffu },
-        { .r = 0xffu, .g = 0xffu, .b = 0xc0u, .a = 0xffu },
-        { .r = 0xffu, .g = 0xffu, .b = 0x80u, .a = 0xffu },
-        { .r = 0xffu, .g = 0xffu, .b = 0x40u, .a = 0xffu },
-        { .r = 0xffu, .g = 0xffu, .b = 0x00u, .a = 0xffu },
-        { .r = 0xffu, .g = 0xffu, .b = 0xffu, .a = 0xc0u },
-        { .r = 0xffu, .g = 0xffu, .b = 0xffu, .a = 0x80u },
-        { .r = 0xffu, .g = 0xffu, .b = 0xffu, .a = 0x40u },
-        { .r = 0xffu, .g = 0xffu, .b = 0xffu, .a = 0x00u },
-        { .r = 0x00u, .g = 0x00u, .b = 0x00u, .a = 0xffu },
-        { .r = 0x00u, .g = 0x00u, .b = 0x00u, .a = 0xc0u },
-        { .r = 0x00u, .g = 0x00u, .b = 0x00u, .a = 0x80u },
-        { .r = 0x00u, .g = 0x00u, .b = 0x00u, .a = 0x40u },
-        { .r = 0x00u, .g = 0x00u, .b = 0x00u, .a = 0x00u },
+        M2D_PF_A8, M2D_PF_RGB565, M2D_PF_ARGB8888,
     };
-    struct m2d_buffer* bg;
-    struct m2d_buffer* bg2;
-    struct m2d_rectangle rect;
-    char filename[256];
-    uint32_t i;
+    static const char* const patterns[] = { "x,y,y", "x,x,y,y", "random" };
+    const size_t width = 600;
+    const size_t height = 5;
+    struct m2d_buffer* buf;
+    uint8_t* pixels;
+    uint8_t* copy;
+    size_t mismatches;
+    size_t pitch;
+    size_t bpp;
+    size_t i, j, k;
+    uint8_t value;
+
+    pixels = malloc(width * height * sizeof(uint32_t));
+    copy = malloc(width * height * sizeof(uint32_t));
+    if (!pixels || !copy)
+        goto out;
+
+    for (i = 0; i < ARRAY_SIZE(formats); i++)
+    {
+        bpp = m2d_byte_per_pixel(formats[i]);
+        pitch = width * bpp;
 
-    snprintf(filename, sizeof(filename), "%s/background_%ux%u.png",
-             TESTDATA, screen_width, screen_height);
-    bg = load_png(filename);
-    if (!bg)
-        return;
+        for (j = 0; j < ARRAY_SIZE(patterns); j++)
+        {
+            for (k = 0; k < width * height; k++)
+            {
+                if (j == 0)
+                    value = k % 3 ? 0xaa : (uint8_t)k;
+                else if (j == 1)
+                    value = (uint8_t)(k / 2);
+                else
+                    value = (uint8_t)(rand() % 3);
+                memset(pixels + k * bpp, value, bpp);
+            }
 
-    snprintf(filename, sizeof(filename), "%s/test_pattern_%ux%u.png",
-             TESTDATA, screen_width, screen_height);
-    bg2 = load_png(filename);
-    if (!bg2)
-        goto free_bg;
+            buf = m2d_alloc(width, height, formats[i], stride(formats[i], width));
+            if (!buf)
+                goto out;
 
-    rect.x = 0;
-    rect.y = 0;
-    rect.w = screen_width;
-    rect.h = screen_height;
-    for (i = 0; i < ARRAY_SIZE(colors); i++)
+            memset(copy, 0, pitch * height);
+            if (m2d_upload(buf, NULL, pixels, pitch, formats[i]) || m2d_park(buf) ||
+                m2d_unpark(buf) || m2d_download(buf, NULL, copy, pitch, formats[i]))
+            {
+                mismatches = width * height;
+            }
+            else
+            {
+                mismatches = 0;
+                for (k = 0; k < width * height; k++)
+                    mismatches += memcmp(copy + k * bpp, pixels + k * bpp, bpp) != 0;
+            }
+
+            printf("%s: %s %s pattern, %zu pixel(s) changed by parking\n",
+                   mismatches ? "FAILED" : "OK", m2d_format_name(formats[i]), patterns[j],
+                   mismatches);
+
+            m2d_free(buf);
+        }
+    }
+
+out:
+    free(copy);
+    free(pixels);
+}
+
+/*
+ * Images of each format, packed into atlas pages and standalone, run-length
+ * encoded into a pack, saved, opened and read back unchanged.
+ */
+static void asset_packs(void)
+{
+    static const enum m2d_pixel_format formats[] =
     {
-        const struct m2d_test_color* color = &colors[i];
+        M2D_PF_A8, M2D_PF_RGB565, M2D_PF_ARGB8888,
+    };
+    const size_t width = 120;
+    const size_t height = 20;
+    const size_t size = width * height * sizeof(uint32_t);
+    struct m2d_asset_writer* writer;
+    struct m2d_asset_pack* pack = NULL;
+    struct m2d_atlas_image image;
+    struct m2d_image src;
+    char filename[64];
+    char name[32];
+    uint8_t* pixels;
+    uint8_t* copy;
+    size_t mismatches;
+    size_t pitch;
+    size_t bpp;
+    size_t i, j, k;
+
+    snprintf(filename, sizeof(filename), "/tmp/m2d-test-%d.m2da", (int)getpid());
+
+    pixels = malloc(ARRAY_SIZE(formats) * size);
+    copy = malloc(size);
+    writer = m2d_asset_writer_create(256, 256, M2D_ASSET_RLE);
+    if (!pixels || !copy || !writer)
+        goto out;
+
+    /* Flat rows between x,y,y rows, adverse to the run-length encoding. */
+    for (i = 0; i < ARRAY_SIZE(formats); i++)
+    {
+        bpp = m2d_byte_per_pixel(formats[i]);
 
-        draw_background(bg);
+        for (k = 0; k < width * height; k++)
+            memset(pixels + i * size + k * bpp,
+                   (k / width) % 2 ? 0x55 : k % 3 ? 0xaa : (uint8_t)k, bpp);
 
-        m2d_source_color(color->r, color->g, color->b, color->a);
-        m2d_source_enable(M2D_SRC, true);
-        m2d_source_enable(M2D_DST, true);
-        m2d_set_source(M2D_SRC, bg2, 0, 0);
-        m2d_set_source(M2D_DST, framebuffer, 0, 0);
-        m2d_blend_enable(true);
-        m2d_draw_rectangles(&rect, 1);
-        sleep(1);
+        src.data = pixels + i * size;
+        src.width = width;
+        src.height = height;
+        src.stride = width * bpp;
+        src.format = formats[i];
+
+        for (j = 0; j < 2; j++)
+        {
+            snprintf(name, sizeof(name), "%s-%s", m2d_format_name(formats[i]),
+                     j ? "standalone" : "packed");
+            if (m2d_asset_writer_add(writer, name, &src, j ? M2D_ASSET_STANDALONE : 0))
+                goto out;
+        }
     }
-    m2d_source_color(255, 255, 255, 255);
 
-    sleep(1);
+    if (m2d_asset_writer_save(writer, filename))
+        goto out;
 
-    m2d_free(bg2);
-free_bg:
-    m2d_free(bg);
+    pack = m2d_asset_pack_open(filename);
+    if (!pack)
+        goto out;
+
+    for (i = 0; i < ARRAY_SIZE(formats); i++)
+    {
+        bpp = m2d_byte_per_pixel(formats[i]);
+        pitch = width * bpp;
+
+        for (j = 0; j < 2; j++)
+        {
+            snprintf(name, sizeof(name), "%s-%s", m2d_format_name(formats[i]),
+                     j ? "standalone" : "packed");
+
+            memset(copy, 0, size);
+            if (m2d_asset_pack_get(pack, name, &image) ||
+                m2d_download(image.page, &image.rect, copy, pitch, formats[i]))
+            {
+                mismatches = width * height;
+            }
+            else
+            {
+                mismatches = 0;
+                for (k = 0; k < width * height; k++)
+                    mismatches += memcmp(copy + k * bpp, pixels + i * size + k * bpp, bpp) != 0;
+            }
+
+            printf("%s: %s, %zu pixel(s) changed by the pack round trip\n",
+                   mismatches ? "FAILED" : "OK", name, mismatches);
+        }
+    }
+
+out:
+    m2d_asset_pack_close(pack);
+    unlink(filename);
+    m2d_asset_writer_destroy(writer);
+    free(copy);
+    free(pixels);
 }
 
 static const struct m2d_test tests[] =
@@ -486,6 +1818,25 @@ static const struct m2d_test tests[] =
     { "BlendImages", blend_images },
     { "BlendPremultImages", blend_premult_images },
     { "MaskImages", mask_images },
+    { "AtlasImages", atlas_images },
+    { "AsyncImages", async_images },
+    { "ParkPages", park_pages },
+    { "CpuRenderer", cpu_renderer },
+    { "CpuDeferred", cpu_deferred },
+    { "StretchBlit", stretch_blit },
+    { "Rotate", rotate },
+    { "Shadows", shadows },
+    { "Gradients", gradients },
+    { "NinePatches", nine_patches },
+    { "Patterns", patterns },
+    { "ColorKeys", color_keys },
+    { "Text", text },
+    { "Shapes", shapes },
+    { "Polygons", polygons },
+    { "GrayMasks", gray_masks },
+    { "Transfers", transfers },
+    { "ParkPatterns", park_patterns },
+    { "AssetPacks", asset_packs },
     { NULL, NULL}
 };
 
@@ -660,6 +2011,7 @@ int main(int argc, char* argv[])
     struct kms_device* device = NULL;
     struct plane_data* plane = NULL;
     struct m2d_import_desc desc;
+    struct m2d_cache_stats cache_stats;
     int ret = EXIT_FAILURE;
     int fd;
 
@@ -727,6 +2079,11 @@ int main(int argc, char* argv[])
         }
     }
 
+    m2d_cache_get_stats(&cache_stats);
+    printf("image cache: %zu hit(s), %zu miss(es), %zu eviction(s)\n",
+           cache_stats.hits + cache_stats.content_hits, cache_stats.misses,
+           cache_stats.evictions);
+
     ret = EXIT_SUCCESS;
 
 //free_framebuffer:
@@ -5,71 +5,14 @@
  */
 #include "utils.h"
 #include <assert.h>
-#include <cairo.h>
+#include <m2d/cache.h>
 #include <stdio.h>
 #include <time.h>
 
+/* Tests load the same backgrounds over and over: go through the cache. */
 struct m2d_buffer* load_png(const char* filename)
 {
-	struct m2d_buffer* buf = NULL;
-	struct timespec timeout;
-	cairo_t* cr;
-	cairo_surface_t* target;
-	cairo_surface_t* source;
-	size_t width;
-	size_t height;
-	size_t stride;
-
-	source = cairo_image_surface_create_from_png(filename);
-	if (cairo_surface_status(source) != CAIRO_STATUS_SUCCESS)
-		goto end;
-
-	width = cairo_image_surface_get_width(source);
-	height = cairo_image_surface_get_height(source);
-	stride = cairo_image_surface_get_stride(source);
-
-	buf = m2d_alloc(width, height, M2D_PF_ARGB8888, stride);
-	if (!buf)
-		goto destroy_source;
-
-	clock_gettime(CLOCK_MONOTONIC, &timeout);
-	timeout.tv_sec += 1;
-	if (m2d_sync_for_cpu(buf, &timeout))
-		goto free_buffer;
-
-	target = cairo_image_surface_create_for_data(m2d_get_data(buf),
-						     CAIRO_FORMAT_ARGB32,
-						     width, height,
-						     m2d_get_stride(buf));
-	if (cairo_surface_status(target) != CAIRO_STATUS_SUCCESS)
-		goto free_buffer;
-
-	cr = cairo_create(target);
-	cairo_surface_destroy(target);
-	if (!cr)
-		goto free_buffer;
-
-	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
-	cairo_set_source_surface(cr, source, 0, 0);
-
-	cairo_paint(cr);
-
-	cairo_surface_destroy(source);
-	cairo_destroy(cr);
-
-	m2d_sync_for_gpu(buf);
-
-	return buf;
-
-free_buffer:
-	m2d_free(buf);
-	buf = NULL;
-
-destroy_source:
-	cairo_surface_destroy(source);
-
-end:
-	return buf;
+	return m2d_cache_load(filename, NULL);
 }
 
 static void timespec_diff(struct timespec *start, struct timespec *stop,
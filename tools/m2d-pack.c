@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) 2024 Microchip Technology Inc.  All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Build an asset pack from PNG/JPEG images, see m2d/asset.h.
+ */
+#include <getopt.h>
+#include <libgen.h>
+#include <m2d/asset.h>
+#include <m2d/image.h>
+#include <m2d/m2d.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static void help(const char* program)
+{
+    printf("Usage: %s [OPTION]... -o PACK [NAME=]IMAGE...\n"
+           "Build a libm2d asset pack from PNG/JPEG images.\n"
+           "\n"
+           "  -h, --help               display this help and exit\n"
+           "  -o, --output=PACK        the asset pack to create\n"
+           "  -W, --page-width=WIDTH   the width of the atlas pages (default: 1024)\n"
+           "  -H, --page-height=HEIGHT the height of the atlas pages (default: 1024)\n"
+           "  -z, --rle                run-length encode the surfaces\n"
+           "\n"
+           "The following options apply to the images after them:\n"
+           "  -f, --format=FORMAT      argb8888 (default), rgb565 or a8\n"
+           "  -s, --standalone         store images in their own surface\n"
+           "  -p, --packed             pack images into atlas pages (default)\n"
+           "\n"
+           "Images are named after their file name without extension, unless\n"
+           "NAME is given.\n",
+           program);
+}
+
+static size_t parse_size(const char* name, const char* arg)
+{
+    unsigned long value;
+    char* end = NULL;
+
+    value = strtoul(arg, &end, 0);
+    if (!end || *end != '\0' || !value)
+    {
+        fprintf(stderr, "invalid value for %s: %s\n", name, arg);
+        exit(EXIT_FAILURE);
+    }
+
+    return value;
+}
+
+static enum m2d_pixel_format parse_format(const char* arg)
+{
+    if (!strcasecmp(arg, "argb8888"))
+        return M2D_PF_ARGB8888;
+    if (!strcasecmp(arg, "rgb565"))
+        return M2D_PF_RGB565;
+    if (!strcasecmp(arg, "a8"))
+        return M2D_PF_A8;
+
+    fprintf(stderr, "invalid format: %s\n", arg);
+    exit(EXIT_FAILURE);
+}
+
+struct input
+{
+    char* name;
+    const char* filename;
+    enum m2d_pixel_format format;
+    unsigned int flags;
+};
+
+static char* image_name(const char* arg, const char** filename)
+{
+    const char* equal = strchr(arg, '=');
+    char* path;
+    char* name;
+    char* dot;
+
+    if (equal)
+    {
+        *filename = equal + 1;
+        return strndup(arg, (size_t)(equal - arg));
+    }
+
+    *filename = arg;
+
+    path = strdup(arg);
+    if (!path)
+        return NULL;
+
+    name = strdup(basename(path));
+    free(path);
+    if (!name)
+        return NULL;
+
+    dot = strrchr(name, '.');
+    if (dot && dot != name)
+        *dot = '\0';
+
+    return name;
+}
+
+int main(int argc, char* argv[])
+{
+    static const struct option long_options[] =
+    {
+        {"help", no_argument, NULL, 'h'},
+        {"output", required_argument, NULL, 'o'},
+        {"page-width", required_argument, NULL, 'W'},
+        {"page-height", required_argument, NULL, 'H'},
+        {"rle", no_argument, NULL, 'z'},
+        {"format", required_argument, NULL, 'f'},
+        {"standalone", no_argument, NULL, 's'},
+        {"packed", no_argument, NULL, 'p'},
+        {NULL, 0, NULL, 0}
+    };
+    enum m2d_pixel_format format = M2D_PF_ARGB8888;
+    struct m2d_asset_writer* writer;
+    struct input* inputs = NULL;
+    const char* output = NULL;
+    size_t page_width = 1024;
+    size_t page_height = 1024;
+    unsigned int pack_flags = 0;
+    unsigned int flags = 0;
+    size_t num_inputs = 0;
+    int ret = EXIT_FAILURE;
+    size_t i;
+
+    while (1)
+    {
+        int option_index = 0;
+        struct input* input;
+        int c;
+
+        /* Options and images are parsed in order: see help(). */
+        c = getopt_long(argc, argv, "-ho:W:H:zf:sp", long_options, &option_index);
+
+        if (c == -1)
+            break;
+
+        switch (c)
+        {
+        case 'h':
+            help(argv[0]);
+            exit(EXIT_SUCCESS);
+
+        case 'o':
+            output = optarg;
+            break;
+
+        case 'W':
+            page_width = parse_size("page width", optarg);
+            break;
+
+        case 'H':
+            page_height = parse_size("page height", optarg);
+            break;
+
+        case 'z':
+            pack_flags |= M2D_ASSET_RLE;
+            break;
+
+        case 'f':
+            format = parse_format(optarg);
+            break;
+
+        case 's':
+            flags |= M2D_ASSET_STANDALONE;
+            break;
+
+        case 'p':
+            flags &= ~M2D_ASSET_STANDALONE;
+            break;
+
+        case 1:
+            input = realloc(inputs, (num_inputs + 1) * sizeof(*inputs));
+            if (!input)
+                goto free_inputs;
+            inputs = input;
+
+            input = &inputs[num_inputs];
+            input->name = image_name(optarg, &input->filename);
+            if (!input->name)
+                goto free_inputs;
+            input->format = format;
+            input->flags = flags;
+            num_inputs++;
+            break;
+
+        default:
+            help(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!output || !num_inputs)
+    {
+        help(argv[0]);
+        goto free_inputs;
+    }
+
+    writer = m2d_asset_writer_create(page_width, page_height, pack_flags);
+    if (!writer)
+        goto free_inputs;
+
+    for (i = 0; i < num_inputs; i++)
+    {
+        struct m2d_image_options options = {
+            .format = inputs[i].format,
+        };
+        struct m2d_image image;
+
+        if (m2d_decode_image(inputs[i].filename, &options, &image))
+            goto destroy_writer;
+
+        if (m2d_asset_writer_add(writer, inputs[i].name, &image, inputs[i].flags))
+        {
+            m2d_image_release(&image);
+            goto destroy_writer;
+        }
+
+        printf("%s: %s [%zux%zu] %s\n", inputs[i].name, inputs[i].filename,
+               image.width, image.height, m2d_format_name(image.format));
+        m2d_image_release(&image);
+    }
+
+    if (m2d_asset_writer_save(writer, output))
+        goto destroy_writer;
+
+    ret = EXIT_SUCCESS;
+
+destroy_writer:
+    m2d_asset_writer_destroy(writer);
+
+free_inputs:
+    for (i = 0; i < num_inputs; i++)
+        free(inputs[i].name);
+    free(inputs);
+
+    return ret;
+}